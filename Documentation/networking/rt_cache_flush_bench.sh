@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# Forwarding throughput across IPv4 route cache flushes.
+#
+# Two machines: a generator running pktgen, and the router under test
+# (DUT) forwarding its traffic from IN to OUT.  The generator sends
+# small UDP packets to random destinations of a range, so that the DUT
+# route cache holds one entry per destination.  The DUT script flushes
+# the route cache every few seconds and prints forwarded packets per
+# 100ms, marking the intervals right after a flush, then compares
+# their rate with the rest and prints the route cache counters.
+#
+# On the generator:
+#	rt_cache_flush_bench.sh gen eth1 00:04:23:ac:fd:82 10.1.0.0 10.1.255.255
+# On the DUT:
+#	rt_cache_flush_bench.sh dut eth0 eth1 60 5
+#
+
+pgset() {
+	echo "$1" > "$PGDEV"
+	if ! grep -q "Result: OK" "$PGDEV"; then
+		grep "Result:" "$PGDEV"
+		exit 1
+	fi
+}
+
+gen() {
+	dev=$1 dst_mac=$2 dst_min=$3 dst_max=$4
+
+	modprobe pktgen
+
+	PGDEV=/proc/net/pktgen/kpktgend_0
+	pgset "rem_device_all"
+	pgset "add_device $dev"
+
+	PGDEV=/proc/net/pktgen/$dev
+	pgset "count 0"
+	pgset "clone_skb 0"
+	pgset "pkt_size 60"
+	pgset "delay 0"
+	pgset "dst_mac $dst_mac"
+	pgset "dst_min $dst_min"
+	pgset "dst_max $dst_max"
+	pgset "flag IPDST_RND"
+	pgset "flows 65536"
+	pgset "flowlen 8"
+
+	PGDEV=/proc/net/pktgen/pgctrl
+	echo "Sending, interrupt to stop"
+	pgset "start"
+}
+
+# Sum of one column of /proc/net/stat/rt_cache over all CPUs
+rt_stat() {
+	awk -v col="$1" '
+	function hex(s,  i, n) {
+		n = 0
+		for (i = 1; i <= length(s); i++)
+			n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+		return n
+	}
+	NR == 1 { for (i = 1; i <= NF; i++) if ($i == col) c = i; next }
+	c { sum += hex($c) }
+	END { print sum + 0 }' /proc/net/stat/rt_cache
+}
+
+dut() {
+	indev=$1 out=$2 secs=${3:-60} every=${4:-5}
+	tx=/sys/class/net/$out/statistics/tx_packets
+	ticks=$((secs * 10))
+	flush_ticks=$((every * 10))
+
+	echo 1 > /proc/sys/net/ipv4/ip_forward
+	echo "forwarding $indev -> $out for ${secs}s, flush every ${every}s"
+	for c in gc_lazy gc_budget_hit flush_deferred flush_swept gc_total; do
+		eval "start_$c=$(rt_stat $c)"
+	done
+
+	t=0 last=$(cat $tx) since=$flush_ticks
+	sum_flush=0 n_flush=0 sum_steady=0 n_steady=0 min_flush=
+	while [ $t -lt $ticks ]; do
+		if [ $since -ge $flush_ticks ]; then
+			echo 0 > /proc/sys/net/ipv4/route/flush
+			since=0
+		fi
+		sleep 0.1
+		now=$(cat $tx)
+		pps=$(((now - last) * 10))
+		last=$now
+		# the first second after a flush is where a dip would show
+		if [ $since -lt 10 ]; then
+			echo "$t $pps flush"
+			sum_flush=$((sum_flush + pps))
+			n_flush=$((n_flush + 1))
+			if [ -z "$min_flush" ] || [ $pps -lt $min_flush ]; then
+				min_flush=$pps
+			fi
+		else
+			echo "$t $pps"
+			sum_steady=$((sum_steady + pps))
+			n_steady=$((n_steady + 1))
+		fi
+		t=$((t + 1))
+		since=$((since + 1))
+	done
+
+	echo "steady:      $((sum_steady / (n_steady ? n_steady : 1))) pps"
+	echo "after flush: $((sum_flush / (n_flush ? n_flush : 1))) pps," \
+	     "min $min_flush pps"
+	for c in gc_lazy gc_budget_hit flush_deferred flush_swept gc_total; do
+		eval "echo \"$c: \$(( \$(rt_stat $c) - start_$c ))\""
+	done
+}
+
+case "$1" in
+gen)
+	shift
+	[ $# -eq 4 ] || { echo "usage: $0 gen DEV DST_MAC DST_MIN DST_MAX"; exit 1; }
+	gen "$@"
+	;;
+dut)
+	shift
+	[ $# -ge 2 ] || { echo "usage: $0 dut IN OUT [SECONDS] [FLUSH_EVERY]"; exit 1; }
+	dut "$@"
+	;;
+*)
+	echo "usage: $0 gen|dut ..."
+	exit 1
+	;;
+esac
@@ -0,0 +1,183 @@
+/*
+ * tdm_bench.c - measure the TDM interleave/de-interleave cost
+ *
+ * Runs the per port strided loops the TDM core used to do and the one
+ * pass helpers from drivers/tdm/tdm-interleave.h over the same buffers,
+ * for 8 and 16 bit slots and a range of open channel counts, and reports
+ * how many channels one millisecond of tasklet time can serve.
+ *
+ * Build in the kernel tree with the Makefile in this directory, or alone:
+ *	gcc -O2 -I../../drivers/tdm -o tdm_bench tdm_bench.c -lrt
+ *
+ * Usage: tdm_bench [cycles]
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+
+#define TDM_ACTIVE_CHANNELS	256	/* widest frame benchmarked */
+#define NUM_OF_FRAMES		80	/* one 10 ms processing cycle */
+
+#include "tdm-interleave.h"
+
+static u8 tdm_buf[TDM_MAX_STRIDE * NUM_OF_FRAMES * 2];
+static u8 pcm[TDM_ACTIVE_CHANNELS][NUM_OF_FRAMES * 2];
+static u16 silence[NUM_OF_FRAMES];
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static unsigned int stride_of(unsigned int ch, unsigned int width)
+{
+	return ((ch * width + 7) & ~7) / width;
+}
+
+/* what tdm_data_rx_deinterleave()/tdm_data_tx_interleave() used to do */
+static void old_rx_16(unsigned int ch, unsigned int stride)
+{
+	const u16 *in = (const u16 *)tdm_buf;
+	unsigned int p, i;
+
+	for (p = 0; p < ch; p++) {
+		u16 *out = (u16 *)pcm[p];
+		for (i = 0; i < NUM_OF_FRAMES; i++)
+			out[i] = in[i * stride + p];
+	}
+}
+
+static void old_tx_16(unsigned int ch, unsigned int stride)
+{
+	u16 *out = (u16 *)tdm_buf;
+	unsigned int p, i;
+
+	for (p = 0; p < ch; p++) {
+		const u16 *src = (const u16 *)pcm[p];
+		for (i = 0; i < NUM_OF_FRAMES; i++)
+			out[p + stride * i] = src[i];
+	}
+}
+
+static void old_rx_8(unsigned int ch, unsigned int stride)
+{
+	const u8 *in = tdm_buf;
+	unsigned int p, i;
+
+	for (p = 0; p < ch; p++)
+		for (i = 0; i < NUM_OF_FRAMES; i++)
+			pcm[p][i] = in[i * stride + p];
+}
+
+static void old_tx_8(unsigned int ch, unsigned int stride)
+{
+	u8 *out = tdm_buf;
+	unsigned int p, i;
+
+	for (p = 0; p < ch; p++)
+		for (i = 0; i < NUM_OF_FRAMES; i++)
+			out[p + stride * i] = pcm[p][i];
+}
+
+static struct tdm_xfer xfer[TDM_ACTIVE_CHANNELS];
+static const void *src[TDM_MAX_STRIDE];
+
+static void setup(unsigned int ch, unsigned int stride)
+{
+	unsigned int s;
+
+	for (s = 0; s < stride; s++)
+		src[s] = s < ch ? (const void *)pcm[s] : (const void *)silence;
+	for (s = 0; s < ch; s++) {
+		xfer[s].slot = s;
+		xfer[s].pcm = pcm[s];
+	}
+}
+
+static void new_rx_16(unsigned int ch, unsigned int stride)
+{
+	tdm_deinterleave_16((const u16 *)tdm_buf, stride, NUM_OF_FRAMES,
+			    xfer, ch);
+}
+
+static void new_tx_16(unsigned int ch, unsigned int stride)
+{
+	tdm_interleave_16((u16 *)tdm_buf, stride, NUM_OF_FRAMES,
+			  (const u16 * const *)src);
+}
+
+static void new_rx_8(unsigned int ch, unsigned int stride)
+{
+	tdm_deinterleave_8(tdm_buf, stride, NUM_OF_FRAMES, xfer, ch);
+}
+
+static void new_tx_8(unsigned int ch, unsigned int stride)
+{
+	tdm_interleave_8(tdm_buf, stride, NUM_OF_FRAMES,
+			 (const u8 * const *)src);
+}
+
+/* channels served per millisecond of processing for one direction */
+static double run(void (*fn)(unsigned int, unsigned int), unsigned int ch,
+		  unsigned int stride, unsigned int cycles)
+{
+	unsigned int c;
+	double t;
+
+	fn(ch, stride);		/* warm the caches */
+	t = now_ms();
+	for (c = 0; c < cycles; c++)
+		fn(ch, stride);
+	t = now_ms() - t;
+
+	return t > 0 ? (double)ch * cycles / t : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int chans[] = { 8, 16, 32, 64, 128, 256 };
+	unsigned int cycles = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000;
+	unsigned int w, i, ch, stride;
+
+	memset(tdm_buf, 0x5a, sizeof(tdm_buf));
+	memset(pcm, 0xa5, sizeof(pcm));
+
+	printf("%u cycles of %u frames, channels per ms of processing\n",
+	       cycles, NUM_OF_FRAMES);
+	printf("%5s %4s %12s %12s %12s %12s\n", "width", "ch",
+	       "rx old", "rx 1-pass", "tx old", "tx 1-pass");
+
+	for (w = 1; w <= 2; w++) {
+		for (i = 0; i < sizeof(chans) / sizeof(chans[0]); i++) {
+			ch = chans[i];
+			stride = stride_of(ch, w);
+			setup(ch, stride);
+			printf("%5u %4u %12.0f %12.0f %12.0f %12.0f\n",
+			       w * 8, ch,
+			       run(w == 2 ? old_rx_16 : old_rx_8, ch, stride,
+				   cycles),
+			       run(w == 2 ? new_rx_16 : new_rx_8, ch, stride,
+				   cycles),
+			       run(w == 2 ? old_tx_16 : old_tx_8, ch, stride,
+				   cycles),
+			       run(w == 2 ? new_tx_16 : new_tx_8, ch, stride,
+				   cycles));
+		}
+	}
+
+	return 0;
+}
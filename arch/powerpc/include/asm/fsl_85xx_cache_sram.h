@@ -28,6 +28,7 @@
 
 #include <asm/rheap.h>
 #include <linux/spinlock.h>
+#include <linux/dma-mapping.h>
 
 /*
  * Cache-SRAM
@@ -45,4 +46,47 @@ extern void mpc85xx_cache_sram_free(void *ptr);
 extern void *mpc85xx_cache_sram_alloc(unsigned int size,
 				  phys_addr_t *phys, unsigned int align);
 
+/*
+ * Placement service: drivers with hot DMA data ask for Cache-SRAM as one
+ * of the clients below and are held to that client's budget
+ * ("cache-sram-budget=" on the command line, or the cache_sram_budget
+ * attribute of the L2 controller).  When the budget or the SRAM itself
+ * is used up the memory comes from dma_alloc_coherent() instead, so the
+ * caller never has to care where it landed.
+ */
+enum cache_sram_client {
+	CACHE_SRAM_GIANFAR,		/* eTSEC buffer descriptor rings */
+	CACHE_SRAM_TALITOS,		/* SEC descriptors and link tables */
+	CACHE_SRAM_FSLDMA,		/* DMA engine link descriptors */
+	CACHE_SRAM_TDM,			/* TDM frame buffers */
+	CACHE_SRAM_STEERING,		/* per-cpu packet steering rings */
+	CACHE_SRAM_NR_CLIENTS,
+};
+
+#ifdef CONFIG_FSL_85XX_CACHE_SRAM
+extern void *cache_sram_client_alloc(enum cache_sram_client client,
+				     struct device *dev, unsigned int size,
+				     dma_addr_t *dma, unsigned int align);
+extern void cache_sram_client_free(enum cache_sram_client client,
+				   struct device *dev, unsigned int size,
+				   void *vaddr, dma_addr_t dma);
+#else
+static inline void *cache_sram_client_alloc(enum cache_sram_client client,
+					    struct device *dev,
+					    unsigned int size,
+					    dma_addr_t *dma,
+					    unsigned int align)
+{
+	return dma_alloc_coherent(dev, size, dma, GFP_KERNEL);
+}
+
+static inline void cache_sram_client_free(enum cache_sram_client client,
+					  struct device *dev,
+					  unsigned int size,
+					  void *vaddr, dma_addr_t dma)
+{
+	dma_free_coherent(dev, size, vaddr, dma);
+}
+#endif
+
 #endif /* __AMS_POWERPC_FSL_85XX_CACHE_SRAM_H__ */
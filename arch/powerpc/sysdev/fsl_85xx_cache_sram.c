@@ -28,7 +28,10 @@
 #include <linux/slab.h>
 #include <linux/err.h>
 #include <linux/of_platform.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <asm/pgtable.h>
+#include <asm/system.h>
 #include <asm/fsl_85xx_cache_sram.h>
 
 #include "fsl_85xx_cache_ctlr.h"
@@ -80,6 +83,259 @@ void mpc85xx_cache_sram_free(void *ptr)
 }
 EXPORT_SYMBOL(mpc85xx_cache_sram_free);
 
+/*
+ * Per-client budgets.  Without a "cache-sram-budget=" entry a client may
+ * use its default share (in sixteenths) of the SRAM window, so that the
+ * first driver to probe can no longer take all of it.
+ */
+#define CACHE_SRAM_BUDGET_AUTO	(~0U)
+
+struct cache_sram_client_info {
+	const char *name;
+	unsigned int share;		/* default budget, in 1/16 of SRAM */
+	unsigned int budget;		/* bytes */
+	unsigned int used;
+	unsigned int peak;
+	unsigned long allocs;		/* served from SRAM */
+	unsigned long fallbacks;	/* served from DDR */
+};
+
+static struct cache_sram_client_info cache_sram_clients[] = {
+	[CACHE_SRAM_GIANFAR]	= { "gianfar",	8, CACHE_SRAM_BUDGET_AUTO },
+	[CACHE_SRAM_TALITOS]	= { "talitos",	2, CACHE_SRAM_BUDGET_AUTO },
+	[CACHE_SRAM_FSLDMA]	= { "fsldma",	2, CACHE_SRAM_BUDGET_AUTO },
+	[CACHE_SRAM_TDM]	= { "tdm",	2, CACHE_SRAM_BUDGET_AUTO },
+	[CACHE_SRAM_STEERING]	= { "steering",	2, CACHE_SRAM_BUDGET_AUTO },
+};
+
+/*
+ * parse "<client>:<bytes>[,<client>:<bytes>...]", bytes as for memparse;
+ * the budgets only change when the whole string is valid
+ */
+static int cache_sram_parse_budget(const char *str)
+{
+	unsigned int budget[CACHE_SRAM_NR_CLIENTS];
+	struct cache_sram_client_info *ci;
+	unsigned long long val;
+	char *end;
+	int i, len;
+
+	for (i = 0; i < CACHE_SRAM_NR_CLIENTS; i++)
+		budget[i] = cache_sram_clients[i].budget;
+
+	while (*str) {
+		for (i = 0; i < CACHE_SRAM_NR_CLIENTS; i++) {
+			ci = &cache_sram_clients[i];
+			len = strlen(ci->name);
+			if (!strncmp(str, ci->name, len) &&
+			    (str[len] == ':' || str[len] == ' '))
+				break;
+		}
+		if (i == CACHE_SRAM_NR_CLIENTS)
+			return -EINVAL;
+
+		val = memparse(str + len + 1, &end);
+		if (end == str + len + 1 || val >= CACHE_SRAM_BUDGET_AUTO)
+			return -EINVAL;
+		budget[i] = val;
+
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str == '\n')
+			break;
+		else if (*str)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < CACHE_SRAM_NR_CLIENTS; i++)
+		cache_sram_clients[i].budget = budget[i];
+
+	return 0;
+}
+
+static int __init cache_sram_budget_setup(char *str)
+{
+	if (cache_sram_parse_budget(str))
+		pr_err("cache-sram-budget: invalid \"%s\"\n", str);
+
+	return 1;
+}
+__setup("cache-sram-budget=", cache_sram_budget_setup);
+
+static unsigned int cache_sram_budget(struct cache_sram_client_info *ci)
+{
+	if (ci->budget == CACHE_SRAM_BUDGET_AUTO)
+		return cache_sram->size / 16 * ci->share;
+
+	return ci->budget;
+}
+
+/**
+ * cache_sram_client_alloc - place hot DMA data in Cache-SRAM if possible
+ * @client:	who is asking, selects the budget
+ * @dev:	device used for the dma_alloc_coherent() fallback
+ * @size:	bytes
+ * @dma:	returns the bus address
+ * @align:	power of two > 1
+ *
+ * Returns the virtual address, in SRAM while the client stays within its
+ * budget and SRAM is left, in coherent DDR otherwise; NULL only when both
+ * fail.  Must be released with cache_sram_client_free().
+ */
+void *cache_sram_client_alloc(enum cache_sram_client client,
+			      struct device *dev, unsigned int size,
+			      dma_addr_t *dma, unsigned int align)
+{
+	struct cache_sram_client_info *ci = &cache_sram_clients[client];
+	unsigned long offset = -ENOMEM;
+	unsigned long flags;
+
+	if (cache_sram && size) {
+		spin_lock_irqsave(&cache_sram->lock, flags);
+		if (ci->used + size <= cache_sram_budget(ci))
+			offset = rh_alloc_align(cache_sram->rh, size,
+						max(align, 2U), NULL);
+		if (!IS_ERR_VALUE(offset)) {
+			ci->used += size;
+			ci->peak = max(ci->peak, ci->used);
+			ci->allocs++;
+		} else {
+			ci->fallbacks++;
+		}
+		spin_unlock_irqrestore(&cache_sram->lock, flags);
+
+		if (!IS_ERR_VALUE(offset)) {
+			*dma = cache_sram->base_phys + offset;
+			return (unsigned char *)cache_sram->base_virt + offset;
+		}
+	}
+
+	/* coherent memory is page aligned, which covers align */
+	return dma_alloc_coherent(dev, size, dma, GFP_KERNEL);
+}
+EXPORT_SYMBOL(cache_sram_client_alloc);
+
+static inline int cache_sram_contains(void *vaddr)
+{
+	return cache_sram && vaddr >= cache_sram->base_virt &&
+	       vaddr < cache_sram->base_virt + cache_sram->size;
+}
+
+void cache_sram_client_free(enum cache_sram_client client,
+			    struct device *dev, unsigned int size,
+			    void *vaddr, dma_addr_t dma)
+{
+	struct cache_sram_client_info *ci = &cache_sram_clients[client];
+	unsigned long flags;
+
+	if (!cache_sram_contains(vaddr)) {
+		dma_free_coherent(dev, size, vaddr, dma);
+		return;
+	}
+
+	spin_lock_irqsave(&cache_sram->lock, flags);
+	rh_free(cache_sram->rh, vaddr - cache_sram->base_virt);
+	ci->used -= size;
+	spin_unlock_irqrestore(&cache_sram->lock, flags);
+}
+EXPORT_SYMBOL(cache_sram_client_free);
+
+/*
+ * Budgets may be changed at run time; the new value applies to later
+ * allocations, what a client already holds is not taken back.
+ */
+static ssize_t cache_sram_show_budget(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct cache_sram_client_info *ci;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < CACHE_SRAM_NR_CLIENTS; i++) {
+		ci = &cache_sram_clients[i];
+		len += sprintf(buf + len, "%s:%u%s\n", ci->name,
+			       cache_sram_budget(ci),
+			       ci->budget == CACHE_SRAM_BUDGET_AUTO ?
+			       " (default)" : "");
+	}
+
+	return len;
+}
+
+static ssize_t cache_sram_set_budget(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t count)
+{
+	unsigned long flags;
+	int err;
+
+	spin_lock_irqsave(&cache_sram->lock, flags);
+	err = cache_sram_parse_budget(buf);
+	spin_unlock_irqrestore(&cache_sram->lock, flags);
+
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(cache_sram_budget, 0644, cache_sram_show_budget,
+		   cache_sram_set_budget);
+
+#ifdef CONFIG_DEBUG_FS
+static int cache_sram_usage_show(struct seq_file *m, void *v)
+{
+	struct cache_sram_client_info *ci;
+	unsigned long flags;
+	int i;
+
+	seq_printf(m, "base 0x%llx size 0x%x\n",
+		   (unsigned long long)cache_sram->base_phys, cache_sram->size);
+	seq_printf(m, "%-10s %10s %10s %10s %10s %10s\n", "client",
+		   "budget", "used", "peak", "allocs", "fallbacks");
+
+	spin_lock_irqsave(&cache_sram->lock, flags);
+	for (i = 0; i < CACHE_SRAM_NR_CLIENTS; i++) {
+		ci = &cache_sram_clients[i];
+		seq_printf(m, "%-10s %10u %10u %10u %10lu %10lu\n", ci->name,
+			   cache_sram_budget(ci), ci->used, ci->peak,
+			   ci->allocs, ci->fallbacks);
+	}
+	spin_unlock_irqrestore(&cache_sram->lock, flags);
+
+	return 0;
+}
+
+static int cache_sram_usage_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cache_sram_usage_show, NULL);
+}
+
+static const struct file_operations cache_sram_usage_fops = {
+	.owner		= THIS_MODULE,
+	.open		= cache_sram_usage_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct dentry *cache_sram_dentry;
+
+static void cache_sram_debugfs_init(void)
+{
+	cache_sram_dentry = debugfs_create_file("cache_sram", 0444,
+						powerpc_debugfs_root, NULL,
+						&cache_sram_usage_fops);
+}
+
+static void cache_sram_debugfs_exit(void)
+{
+	debugfs_remove(cache_sram_dentry);
+	cache_sram_dentry = NULL;
+}
+#else
+static inline void cache_sram_debugfs_init(void) { }
+static inline void cache_sram_debugfs_exit(void) { }
+#endif
+
 int __init instantiate_cache_sram(struct of_device *dev,
 		struct sram_parameters sram_params)
 {
@@ -127,6 +383,10 @@ int __init instantiate_cache_sram(struct of_device *dev,
 	rh_attach_region(cache_sram->rh, 0, cache_sram->size);
 	spin_lock_init(&cache_sram->lock);
 
+	if (device_create_file(&dev->dev, &dev_attr_cache_sram_budget))
+		dev_warn(&dev->dev, "can't create cache_sram_budget\n");
+	cache_sram_debugfs_init();
+
 	dev_info(&dev->dev, "[base:0x%llx, size:0x%x] configured and loaded\n",
 		(unsigned long long)cache_sram->base_phys, cache_sram->size);
 
@@ -147,6 +407,9 @@ void remove_cache_sram(struct of_device *dev)
 {
 	BUG_ON(!cache_sram);
 
+	cache_sram_debugfs_exit();
+	device_remove_file(&dev->dev, &dev_attr_cache_sram_budget);
+
 	rh_detach_region(cache_sram->rh, 0, cache_sram->size);
 	rh_destroy(cache_sram->rh);
 
@@ -29,6 +29,14 @@
 #include <linux/dma-mapping.h>
 #include <linux/async_tx.h>
 
+/*
+ * Below this many bytes setting up a dma descriptor and taking its
+ * completion costs more than copying with the cpu.
+ */
+static unsigned int copybreak = 256;
+module_param(copybreak, uint, 0644);
+MODULE_PARM_DESC(copybreak, "smallest copy (bytes) offloaded to a dma engine");
+
 /**
  * async_memcpy - attempt to copy memory with a dma engine.
  * @dest: destination page
@@ -50,7 +58,8 @@ async_memcpy(struct page *dest, struct page *src, unsigned int dest_offset,
 	struct dma_device *device = chan ? chan->device : NULL;
 	struct dma_async_tx_descriptor *tx = NULL;
 
-	if (device && is_dma_copy_aligned(device, src_offset, dest_offset, len)) {
+	if (device && len >= copybreak &&
+	    is_dma_copy_aligned(device, src_offset, dest_offset, len)) {
 		dma_addr_t dma_dest, dma_src;
 		unsigned long dma_prep_flags = 0;
 
@@ -110,6 +110,38 @@ struct talitos_request {
 	void *context;
 };
 
+/**
+ * talitos_batch_req - one request of a talitos_submit_batch() call
+ * @desc: descriptor pointer (kernel virtual)
+ * @callback: whom to call when descriptor processing is done
+ * @context: caller context (optional)
+ */
+struct talitos_batch_req {
+	struct talitos_desc *desc;
+	void (*callback) (struct device *dev, struct talitos_desc *desc,
+			  void *context, int error);
+	void *context;
+};
+
+/* a stack of cached extended descriptors */
+struct talitos_mag {
+	struct list_head node;		/* depot list */
+	unsigned int rounds;		/* objects held */
+	struct talitos_edesc *obj[0];
+};
+
+/* per-cpu extended descriptor cache */
+struct talitos_edesc_cpu {
+	struct talitos_mag *loaded;
+	struct talitos_mag *prev;
+	unsigned long hits;		/* served from a magazine */
+	unsigned long misses;		/* served from the slab */
+	unsigned long remote_frees;	/* freed on another cpu */
+	unsigned long depot_gets;	/* full magazines taken */
+	unsigned long depot_puts;	/* full magazines given back */
+	unsigned long overflows;	/* freed to the slab */
+};
+
 /* per-channel fifo management */
 struct talitos_channel {
 	/* request fifo */
@@ -163,10 +195,14 @@ struct talitos_private {
 	u8 core_chan_no[MAX_GROUPS][MAX_CHAN] ____cacheline_aligned;
 	/* pointer to the cache pool */
 	struct kmem_cache *netcrypto_cache;
-	/* pointer to edescriptor recycle queue */
-	struct talitos_edesc *edesc_rec_queue[NR_CPUS][MAX_IPSEC_RECYCLE_DESC];
-	/* index in edesc recycle queue */
-	u8 curr_edesc[MAX_GROUPS];
+	/* extended descriptor magazines, see crypto_edesc_alloc() */
+	struct talitos_edesc_cpu *edesc_cpu;
+	unsigned int mag_depth;
+	spinlock_t depot_lock;
+	struct list_head depot_full;
+	struct list_head depot_empty;
+	unsigned int depot_nr_full;
+	unsigned int depot_max;
 
 	/* request callback napi */
 	struct napi_struct *done_task;
@@ -190,6 +226,9 @@ struct talitos_private {
  * @dst_nents: number of segments in output scatterlist
  * @dma_len: length of dma mapped link_tbl space
  * @dma_link_tbl: bus physical address of link_tbl
+ * @cpu: cpu that allocated it, or TALITOS_EDESC_UNCACHED
+ * @tbl_len: length of the link_tbl space mapped for the object's life
+ * @tbl_dma: bus physical address of that mapping
  * @desc: h/w descriptor
  * @link_tbl: input and output h/w link tables (if {src,dst}_nents > 1)
  *
@@ -204,6 +243,9 @@ struct talitos_edesc {
 	int dst_is_chained;
 	int dma_len;
 	dma_addr_t dma_link_tbl;
+	int cpu;
+	int tbl_len;
+	dma_addr_t tbl_dma;
 	struct talitos_desc desc;
 	struct talitos_ptr link_tbl[0];
 };
@@ -213,53 +255,288 @@ struct talitos_edesc {
 #define TALITOS_FTR_HW_AUTH_CHECK 0x00000002
 #define TALITOS_FTR_SHA224_HWINIT 0x00000004
 
+/*
+ * Extended descriptor allocator.
+ *
+ * Every cache object has its link table area dma mapped once, when it is
+ * taken from the slab, and stays mapped while it is recycled; the data
+ * path only syncs the part it uses.  Objects are recycled through per-cpu
+ * magazines (Bonwick): a cpu allocates from and frees to its loaded
+ * magazine, falls back to its previous one, and only then exchanges a
+ * whole magazine with the depot under depot_lock.  Completions running on
+ * another core than the submitter thus fill magazines there which reach
+ * the submitting core through the depot, one lock round trip per
+ * edesc_mag_depth descriptors.
+ *
+ * Requests larger than a cache object get a private buffer mapped for
+ * that request alone.
+ */
+static unsigned int edesc_mag_depth = MAX_IPSEC_RECYCLE_DESC;
+module_param(edesc_mag_depth, uint, 0444);
+MODULE_PARM_DESC(edesc_mag_depth, "extended descriptors per per-cpu magazine");
+
+#define TALITOS_EDESC_UNCACHED	(-1)
+#define TALITOS_EDESC_TBL_OFF	offsetof(struct talitos_edesc, link_tbl)
+
+static struct talitos_edesc *talitos_edesc_new(struct talitos_private *priv,
+					       int len, gfp_t flags)
+{
+	struct talitos_edesc *edesc;
+	int cached = len <= MAX_DESC_LEN;
+
+	if (cached)
+		edesc = kmem_cache_alloc(priv->netcrypto_cache, flags);
+	else
+		edesc = kmalloc(len, flags);
+	if (!edesc)
+		return NULL;
+
+	edesc->cpu = cached ? raw_smp_processor_id() : TALITOS_EDESC_UNCACHED;
+	edesc->tbl_len = (cached ? MAX_DESC_LEN : len) - TALITOS_EDESC_TBL_OFF;
+	edesc->tbl_dma = dma_map_single(priv->dev, &edesc->link_tbl[0],
+					edesc->tbl_len, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(priv->dev, edesc->tbl_dma)) {
+		if (cached)
+			kmem_cache_free(priv->netcrypto_cache, edesc);
+		else
+			kfree(edesc);
+		return NULL;
+	}
+
+	return edesc;
+}
+
+static void talitos_edesc_destroy(struct talitos_private *priv,
+				  struct talitos_edesc *edesc)
+{
+	dma_unmap_single(priv->dev, edesc->tbl_dma, edesc->tbl_len,
+			 DMA_BIDIRECTIONAL);
+	if (edesc->cpu == TALITOS_EDESC_UNCACHED)
+		kfree(edesc);
+	else
+		kmem_cache_free(priv->netcrypto_cache, edesc);
+}
+
 struct talitos_edesc *crypto_edesc_alloc(int len, int flags,
 					struct talitos_private *priv)
 {
-	int check;
-	struct talitos_edesc *ret;
-	u32 smp_processor_id = smp_processor_id();
-	check = in_softirq();
+	struct talitos_edesc_cpu *cc;
+	struct talitos_mag *mag;
+	struct talitos_edesc *edesc;
+	unsigned long irqflags;
+	int cpu;
 
-	if (!check)
-		local_bh_disable();
+	if (unlikely(len > MAX_DESC_LEN))
+		return talitos_edesc_new(priv, len, flags);
 
-	u32 current_edesc = priv->curr_edesc[smp_processor_id];
-	if (unlikely(current_edesc == 0)) {
-		ret = kmem_cache_alloc(priv->netcrypto_cache,
-					GFP_KERNEL | flags);
-	} else {
-		 priv->curr_edesc[smp_processor_id] = current_edesc - 1;
-		ret = priv->edesc_rec_queue[smp_processor_id]
-					[current_edesc - 1];
+	local_irq_save(irqflags);
+	cpu = smp_processor_id();
+	cc = per_cpu_ptr(priv->edesc_cpu, cpu);
+
+	if (likely(cc->loaded->rounds))
+		goto hit;
+
+	if (cc->prev->rounds) {
+		swap(cc->loaded, cc->prev);
+		goto hit;
 	}
 
-	if (!check)
-		local_bh_enable();
+	/* both empty: trade the previous one for a full magazine */
+	spin_lock(&priv->depot_lock);
+	if (!list_empty(&priv->depot_full)) {
+		mag = list_first_entry(&priv->depot_full, struct talitos_mag,
+				       node);
+		list_del(&mag->node);
+		priv->depot_nr_full--;
+		list_add(&cc->prev->node, &priv->depot_empty);
+		cc->prev = cc->loaded;
+		cc->loaded = mag;
+		cc->depot_gets++;
+		spin_unlock(&priv->depot_lock);
+		goto hit;
+	}
+	spin_unlock(&priv->depot_lock);
 
-	return ret;
+	cc->misses++;
+	local_irq_restore(irqflags);
+
+	return talitos_edesc_new(priv, len, flags);
+
+hit:
+	edesc = cc->loaded->obj[--cc->loaded->rounds];
+	cc->hits++;
+	local_irq_restore(irqflags);
+
+	edesc->cpu = cpu;
+
+	return edesc;
 }
+
 void crypto_edesc_free(struct talitos_edesc *edesc,
 			struct talitos_private *priv)
 {
-	int check;
-	u32 smp_processor_id = smp_processor_id();
-	check = in_softirq();
+	struct talitos_edesc_cpu *cc;
+	struct talitos_mag *mag;
+	unsigned long irqflags;
+	int cpu;
 
-	if (!check)
-		local_bh_disable();
+	if (unlikely(edesc->cpu == TALITOS_EDESC_UNCACHED)) {
+		talitos_edesc_destroy(priv, edesc);
+		return;
+	}
 
-	u32 current_edesc = priv->curr_edesc[smp_processor_id];
-	if (unlikely(current_edesc == (MAX_IPSEC_RECYCLE_DESC - 1))) {
-		kmem_cache_free(priv->netcrypto_cache, edesc);
-	} else {
-		priv->edesc_rec_queue[smp_processor_id][current_edesc] =
-								edesc;
-		priv->curr_edesc[smp_processor_id] = current_edesc + 1;
+	local_irq_save(irqflags);
+	cpu = smp_processor_id();
+	cc = per_cpu_ptr(priv->edesc_cpu, cpu);
+
+	if (edesc->cpu != cpu)
+		cc->remote_frees++;
+
+	if (likely(cc->loaded->rounds < priv->mag_depth))
+		goto put;
+
+	if (!cc->prev->rounds) {
+		swap(cc->loaded, cc->prev);
+		goto put;
+	}
+
+	/* both full: trade the previous one for an empty magazine */
+	spin_lock(&priv->depot_lock);
+	if (!list_empty(&priv->depot_empty) &&
+	    priv->depot_nr_full < priv->depot_max) {
+		mag = list_first_entry(&priv->depot_empty, struct talitos_mag,
+				       node);
+		list_del(&mag->node);
+		list_add(&cc->prev->node, &priv->depot_full);
+		priv->depot_nr_full++;
+		cc->prev = cc->loaded;
+		cc->loaded = mag;
+		cc->depot_puts++;
+		spin_unlock(&priv->depot_lock);
+		goto put;
 	}
+	spin_unlock(&priv->depot_lock);
+
+	cc->overflows++;
+	local_irq_restore(irqflags);
+
+	talitos_edesc_destroy(priv, edesc);
+	return;
+
+put:
+	cc->loaded->obj[cc->loaded->rounds++] = edesc;
+	local_irq_restore(irqflags);
+}
+
+static struct talitos_mag *talitos_mag_alloc(struct talitos_private *priv)
+{
+	struct talitos_mag *mag;
+
+	mag = kzalloc(sizeof(*mag) + priv->mag_depth * sizeof(mag->obj[0]),
+		      GFP_KERNEL);
+	if (mag)
+		INIT_LIST_HEAD(&mag->node);
+
+	return mag;
+}
+
+static void talitos_mag_drain(struct talitos_private *priv,
+			      struct talitos_mag *mag)
+{
+	if (!mag)
+		return;
+
+	while (mag->rounds)
+		talitos_edesc_destroy(priv, mag->obj[--mag->rounds]);
+	kfree(mag);
+}
+
+static void talitos_edesc_cache_exit(struct talitos_private *priv)
+{
+	struct talitos_edesc_cpu *cc;
+	struct talitos_mag *mag, *n;
+	int cpu;
 
-	if (!check)
-		local_bh_enable();
+	if (!priv->edesc_cpu)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		cc = per_cpu_ptr(priv->edesc_cpu, cpu);
+		talitos_mag_drain(priv, cc->loaded);
+		talitos_mag_drain(priv, cc->prev);
+	}
+	list_for_each_entry_safe(mag, n, &priv->depot_full, node)
+		talitos_mag_drain(priv, mag);
+	list_for_each_entry_safe(mag, n, &priv->depot_empty, node)
+		talitos_mag_drain(priv, mag);
+
+	free_percpu(priv->edesc_cpu);
+	priv->edesc_cpu = NULL;
+}
+
+/*
+ * Give every cpu a loaded and a previous magazine, the loaded one filled
+ * up front, and put empty magazines in the depot so that a cpu that only
+ * frees can hand over as many full ones as the depot may hold.
+ */
+static int talitos_edesc_cache_init(struct talitos_private *priv)
+{
+	struct talitos_edesc_cpu *cc;
+	struct talitos_edesc *edesc;
+	struct talitos_mag *mag;
+	int cpu, i;
+
+	priv->mag_depth = clamp_t(unsigned int, edesc_mag_depth, 1, 1024);
+	priv->depot_max = 2 * num_possible_cpus();
+	spin_lock_init(&priv->depot_lock);
+	INIT_LIST_HEAD(&priv->depot_full);
+	INIT_LIST_HEAD(&priv->depot_empty);
+
+	priv->edesc_cpu = alloc_percpu(struct talitos_edesc_cpu);
+	if (!priv->edesc_cpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		cc = per_cpu_ptr(priv->edesc_cpu, cpu);
+		cc->loaded = talitos_mag_alloc(priv);
+		cc->prev = talitos_mag_alloc(priv);
+		if (!cc->loaded || !cc->prev)
+			goto err;
+
+		for (i = 0; i < priv->mag_depth; i++) {
+			edesc = talitos_edesc_new(priv, MAX_DESC_LEN,
+						  GFP_KERNEL | GFP_DMA);
+			if (!edesc)
+				goto err;
+			edesc->cpu = cpu;
+			cc->loaded->obj[cc->loaded->rounds++] = edesc;
+		}
+	}
+
+	for (i = 0; i < priv->depot_max; i++) {
+		mag = talitos_mag_alloc(priv);
+		if (!mag)
+			goto err;
+		list_add(&mag->node, &priv->depot_empty);
+	}
+
+	return 0;
+
+err:
+	talitos_edesc_cache_exit(priv);
+	return -ENOMEM;
+}
+
+/*
+ * The link table stays mapped for the life of the cache object: hand it
+ * back to the cpu instead of unmapping it.
+ */
+static inline void talitos_edesc_unmap_tbl(struct device *dev,
+					   struct talitos_edesc *edesc)
+{
+	if (edesc->dma_len)
+		dma_sync_single_for_cpu(dev, edesc->dma_link_tbl,
+					edesc->dma_len, DMA_BIDIRECTIONAL);
 }
 
 static inline unsigned int get_chan_remap(struct talitos_private *priv)
@@ -423,6 +700,125 @@ static int init_device(struct device *dev)
 	return 0;
 }
 
+/*
+ * Pick the least loaded channel of the group; submit_count runs from
+ * -(chfifo_len - 1) when idle up to 0 when the h/w fifo is full.  The scan
+ * starts one channel further each time so that ties still rotate.
+ */
+static int talitos_pick_chan(struct talitos_private *priv, int grp_id)
+{
+	u8 total_chan = priv->core_num_chan[grp_id];
+	u8 start = priv->last_chan[grp_id];
+	int i, ch, best = -1, best_count = 0;
+
+	if (start >= total_chan)
+		start = 0;
+	priv->last_chan[grp_id] = start + 1;
+
+	for (i = 0; i < total_chan; i++) {
+		ch = priv->core_chan_no[grp_id][(start + i) % total_chan];
+		if (priv->chan[ch].submit_count < best_count) {
+			best_count = priv->chan[ch].submit_count;
+			best = ch;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Queue one request on a channel known to have room.  The fetch fifo is
+ * written by talitos_ring_chan() once the whole batch is queued.
+ */
+static void talitos_queue_request(struct device *dev,
+				  struct talitos_private *priv,
+				  struct talitos_channel *chan,
+				  struct talitos_batch_req *req)
+{
+	struct talitos_request *request;
+
+	/* select done notification */
+	req->desc->hdr |= DESC_HDR_DONE_NOTIFY;
+
+	++chan->submit_count;
+	request = &chan->fifo[chan->head];
+
+	/* map descriptor and save caller data */
+	request->dma_desc = dma_map_single(dev, req->desc,
+					   sizeof(*req->desc),
+					   DMA_BIDIRECTIONAL);
+	request->callback = req->callback;
+	request->context = req->context;
+
+	/* increment fifo head */
+	chan->head = (chan->head + 1) & (priv->fifo_len - 1);
+
+	smp_wmb();
+	request->desc = req->desc;
+}
+
+/*
+ * Hand 'count' requests starting at fifo index 'first' to the channel.
+ * One barrier covers the batch; the write of the low address word is
+ * what pushes a descriptor into the fetch fifo.
+ */
+static void talitos_ring_chan(struct talitos_private *priv,
+			      struct talitos_channel *chan, u8 first,
+			      int count)
+{
+	struct talitos_request *request;
+
+	/* GO! */
+	wmb();
+	while (count--) {
+		request = &chan->fifo[first];
+		out_be32(priv->reg + TALITOS_FF(chan->id, priv),
+			 cpu_to_be32(upper_32_bits(request->dma_desc)));
+		out_be32(priv->reg + TALITOS_FF_LO(chan->id, priv),
+			 cpu_to_be32(lower_32_bits(request->dma_desc)));
+		first = (first + 1) & (priv->fifo_len - 1);
+	}
+}
+
+/**
+ * talitos_submit_batch - submit several descriptors at once
+ * @dev:	the SEC device to be used
+ * @req:	requests; desc, callback and context as for talitos_submit()
+ * @n:		number of requests
+ *
+ * Requests go to the least loaded channels of the calling core's group,
+ * as many per channel as its fifo has room for, with one barrier and a
+ * run of fetch fifo writes per channel.  Returns the number of requests
+ * accepted, the rest found every channel full.
+ */
+static int talitos_submit_batch(struct device *dev,
+				struct talitos_batch_req *req, int n)
+{
+	struct talitos_private *priv = dev_get_drvdata(dev);
+	struct talitos_channel *chan;
+	int grp_id = get_grp_id(priv);
+	int ch, room, i, done = 0;
+	u8 first;
+
+	if (!priv->core_num_chan[grp_id])
+		return 0;
+
+	while (done < n) {
+		ch = talitos_pick_chan(priv, grp_id);
+		if (ch < 0)
+			break;
+
+		chan = &priv->chan[ch];
+		room = min(-chan->submit_count, n - done);
+		first = chan->head;
+		for (i = 0; i < room; i++, done++)
+			talitos_queue_request(dev, priv, chan, &req[done]);
+		talitos_ring_chan(priv, chan, first, room);
+	}
+
+	return done;
+}
+
 /**
  * talitos_submit - submits a descriptor to the device for processing
  * @dev:	the SEC device to be used
@@ -440,57 +836,17 @@ static int talitos_submit(struct device *dev, struct talitos_desc *desc,
 					   void *context, int error),
 			  void *context)
 {
-	struct talitos_private *priv = dev_get_drvdata(dev);
-	struct talitos_request *request;
-	u8 ch;
-	int grp_id = get_grp_id(priv);
+	struct talitos_batch_req req = {
+		.desc = desc,
+		.callback = callback,
+		.context = context,
+	};
 
-	u8 head, last_chan, total_chan;
-	if (priv->core_num_chan[grp_id] > 0) {
-		total_chan = priv->core_num_chan[grp_id];
-		last_chan = priv->last_chan[grp_id];
-		/* select done notification */
-		desc->hdr |= DESC_HDR_DONE_NOTIFY;
-
-		if (last_chan <  total_chan) {
-			ch = priv->core_chan_no[grp_id][last_chan];
-			priv->last_chan[grp_id]++;
-		} else {
-			ch = priv->core_chan_no[grp_id][0];
-			priv->last_chan[grp_id] = 1;
-		}
-		if (priv->chan[ch].submit_count != 0)
-			++priv->chan[ch].submit_count;
-		else
-			/* h/w fifo is full */
-			return -EAGAIN;
-
-		head = priv->chan[ch].head;
-		request = &priv->chan[ch].fifo[head];
-
-		/* map descriptor and save caller data */
-		request->dma_desc = dma_map_single(dev, desc, sizeof(*desc),
-					   DMA_BIDIRECTIONAL);
-		request->callback = callback;
-		request->context = context;
-
-		/* increment fifo head */
-		priv->chan[ch].head = (priv->chan[ch].head + 1) &
-					(priv->fifo_len - 1);
-
-		smp_wmb();
-		request->desc = desc;
-
-		/* GO! */
-		wmb();
-		out_be32(priv->reg + TALITOS_FF(ch, priv),
-			cpu_to_be32(upper_32_bits(request->dma_desc)));
-		out_be32(priv->reg + TALITOS_FF_LO(ch, priv),
-			cpu_to_be32(lower_32_bits(request->dma_desc)));
-		return -EINPROGRESS;
-	} else {
+	/* h/w fifo is full */
+	if (!talitos_submit_batch(dev, &req, 1))
 		return -EAGAIN;
-	}
+
+	return -EINPROGRESS;
 }
 
 #ifdef CONFIG_AS_FASTPATH
@@ -1016,23 +1372,40 @@ static enum dma_status talitos_is_tx_complete(struct dma_chan *chan,
 	return dma_async_is_complete(cookie, last_complete, last_used);
 }
 
+#define TALITOS_XOR_BATCH	8
+
 static void talitos_process_pending(struct talitos_xor_chan *xor_chan)
 {
 	struct talitos_xor_desc *desc, *_desc;
+	struct talitos_batch_req req[TALITOS_XOR_BATCH];
 	unsigned long flags;
-	int status;
+	int i, n, accepted;
 
 	spin_lock_irqsave(&xor_chan->desc_lock, flags);
 
-	list_for_each_entry_safe(desc, _desc, &xor_chan->pending_q, node) {
-		status = talitos_submit(xor_chan->dev, &desc->hwdesc,
-					talitos_release_xor, desc);
-		if (status != -EINPROGRESS)
+	do {
+		n = 0;
+		list_for_each_entry(desc, &xor_chan->pending_q, node) {
+			req[n].desc = &desc->hwdesc;
+			req[n].callback = talitos_release_xor;
+			req[n].context = desc;
+			if (++n == TALITOS_XOR_BATCH)
+				break;
+		}
+		if (!n)
 			break;
 
-		list_del(&desc->node);
-		list_add_tail(&desc->node, &xor_chan->in_progress_q);
-	}
+		accepted = talitos_submit_batch(xor_chan->dev, req, n);
+
+		i = 0;
+		list_for_each_entry_safe(desc, _desc, &xor_chan->pending_q,
+					 node) {
+			if (i++ == accepted)
+				break;
+			list_del(&desc->node);
+			list_add_tail(&desc->node, &xor_chan->in_progress_q);
+		}
+	} while (accepted == TALITOS_XOR_BATCH);
 
 	spin_unlock_irqrestore(&xor_chan->desc_lock, flags);
 }
@@ -1499,9 +1872,7 @@ static void ipsec_esp_unmap(struct device *dev,
 
 	talitos_sg_unmap(dev, edesc, areq->src, areq->dst);
 
-	if (edesc->dma_len)
-		dma_unmap_single(dev, edesc->dma_link_tbl, edesc->dma_len,
-				 DMA_BIDIRECTIONAL);
+	talitos_edesc_unmap_tbl(dev, edesc);
 }
 
 /*
@@ -1895,10 +2266,7 @@ static struct talitos_edesc *talitos_edesc_alloc(struct device *dev,
 	edesc->src_is_chained = src_chained;
 	edesc->dst_is_chained = dst_chained;
 	edesc->dma_len = dma_len;
-	if (dma_len)
-		edesc->dma_link_tbl = dma_map_single(dev, &edesc->link_tbl[0],
-						     edesc->dma_len,
-						     DMA_BIDIRECTIONAL);
+	edesc->dma_link_tbl = edesc->tbl_dma;
 
 	return edesc;
 }
@@ -2038,9 +2406,7 @@ static void common_nonsnoop_unmap(struct device *dev,
 
 	talitos_sg_unmap(dev, edesc, areq->src, areq->dst);
 
-	if (edesc->dma_len)
-		dma_unmap_single(dev, edesc->dma_link_tbl, edesc->dma_len,
-				 DMA_BIDIRECTIONAL);
+	talitos_edesc_unmap_tbl(dev, edesc);
 }
 
 static void ablkcipher_done(struct device *dev,
@@ -2224,9 +2590,7 @@ static void common_nonsnoop_hash_unmap(struct device *dev,
 
 	talitos_sg_unmap(dev, edesc, req_ctx->psrc, NULL);
 
-	if (edesc->dma_len)
-		dma_unmap_single(dev, edesc->dma_link_tbl, edesc->dma_len,
-				 DMA_BIDIRECTIONAL);
+	talitos_edesc_unmap_tbl(dev, edesc);
 
 }
 
@@ -2934,6 +3298,31 @@ static int hw_supports(struct device *dev, __be32 desc_hdr_template)
 	return ret;
 }
 
+static ssize_t talitos_show_edesc_stats(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	struct talitos_private *priv = dev_get_drvdata(dev);
+	struct talitos_edesc_cpu *cc;
+	ssize_t len;
+	int cpu;
+
+	len = sprintf(buf, "depth %u depot %u/%u\n", priv->mag_depth,
+		      priv->depot_nr_full, priv->depot_max);
+	len += sprintf(buf + len, "cpu hits misses remote_frees depot_gets "
+		       "depot_puts overflows\n");
+	for_each_online_cpu(cpu) {
+		cc = per_cpu_ptr(priv->edesc_cpu, cpu);
+		len += sprintf(buf + len, "%d %lu %lu %lu %lu %lu %lu\n", cpu,
+			       cc->hits, cc->misses, cc->remote_frees,
+			       cc->depot_gets, cc->depot_puts, cc->overflows);
+	}
+
+	return len;
+}
+
+static DEVICE_ATTR(edesc_stats, 0444, talitos_show_edesc_stats, NULL);
+
 static int talitos_remove(struct of_device *ofdev)
 {
 	struct device *dev = &ofdev->dev;
@@ -2958,6 +3347,8 @@ static int talitos_remove(struct of_device *ofdev)
 	if (hw_supports(dev, DESC_HDR_SEL0_RNG))
 		talitos_unregister_rng(dev);
 
+	device_remove_file(dev, &dev_attr_edesc_stats);
+
 	for (i = 0; i < priv->num_channels; i++)
 		if (priv->chan[i].fifo)
 			kfree(priv->chan[i].fifo);
@@ -2986,6 +3377,7 @@ static int talitos_remove(struct of_device *ofdev)
 
 	dev_set_drvdata(dev, NULL);
 
+	talitos_edesc_cache_exit(priv);
 	if (priv->netcrypto_cache != NULL)
 		kmem_cache_destroy(priv->netcrypto_cache);
 	kfree(priv);
@@ -3287,6 +3679,18 @@ static int talitos_probe(struct of_device *ofdev,
 		goto err_out;
 	}
 
+	err = talitos_edesc_cache_init(priv);
+	if (err) {
+		dev_err(dev, "failed to fill descriptor magazines\n");
+		goto err_out;
+	}
+
+	err = device_create_file(dev, &dev_attr_edesc_stats);
+	if (err) {
+		dev_err(dev, "failed to create sysfs attributes\n");
+		goto err_out;
+	}
+
 	/*
 	 * register with async_tx xor, if capable
 	 * SEC 2.x support up to 3 RAID sources,
@@ -194,7 +194,19 @@ static void set_ld_eol(struct fsldma_chan *chan,
 
 	desc->hw.next_ln_addr = CPU_TO_DMA(chan,
 		DMA_TO_CPU(chan, desc->hw.next_ln_addr, 64) | FSL_DMA_EOL
-			| snoop_bits, 64);
+			| FSL_DMA_EOSIE | snoop_bits, 64);
+}
+
+/*
+ * Link another transaction behind the last descriptor of one.  The
+ * end-of-segment interrupt stays, so that every transaction completes
+ * on its own even in the middle of a long running chain.
+ */
+static void set_ld_next(struct fsldma_chan *chan,
+			struct fsl_desc_sw *desc, dma_addr_t next)
+{
+	set_desc_next(chan, &desc->hw, next);
+	desc->hw.next_ln_addr |= CPU_TO_DMA(chan, FSL_DMA_EOSIE, 64);
 }
 
 /**
@@ -335,7 +347,7 @@ static void append_ld_queue(struct fsldma_chan *chan,
 	 * This will un-set the EOL bit of the existing transaction, and the
 	 * last link in this transaction will become the EOL descriptor.
 	 */
-	set_desc_next(chan, &tail->hw, desc->async_tx.phys);
+	set_ld_next(chan, tail, desc->async_tx.phys);
 
 	/*
 	 * Add the software descriptor and all children to the list
@@ -482,6 +494,7 @@ static void fsl_dma_free_chan_resources(struct dma_chan *dchan)
 	spin_lock_irqsave(&chan->desc_lock, flags);
 	fsldma_free_desc_list(chan, &chan->ld_pending);
 	fsldma_free_desc_list(chan, &chan->ld_running);
+	chan->hw_last = NULL;
 	spin_unlock_irqrestore(&chan->desc_lock, flags);
 
 	dma_pool_destroy(chan->desc_pool);
@@ -585,6 +598,108 @@ fail:
 	return NULL;
 }
 
+/**
+ * fsl_dma_prep_sg - prepare descriptors for a scatterlist to scatterlist copy
+ * @dchan: DMA channel
+ * @dst_sg: destination scatterlist, already dma mapped
+ * @dst_nents: number of entries in @dst_sg
+ * @src_sg: source scatterlist, already dma mapped
+ * @src_nents: number of entries in @src_sg
+ * @flags: DMAEngine flags
+ *
+ * Every link descriptor covers the largest run that is contiguous in both
+ * lists, so the copy takes as many descriptors as there are boundaries in
+ * the two lists together.  Copying stops at the end of the shorter list.
+ */
+static struct dma_async_tx_descriptor *fsl_dma_prep_sg(struct dma_chan *dchan,
+	struct scatterlist *dst_sg, unsigned int dst_nents,
+	struct scatterlist *src_sg, unsigned int src_nents,
+	unsigned long flags)
+{
+	struct fsldma_chan *chan;
+	struct fsl_desc_sw *first = NULL, *prev = NULL, *new = NULL;
+	size_t dst_avail, src_avail, copy;
+	dma_addr_t dst, src;
+
+	if (!dchan || !dst_sg || !src_sg || !dst_nents || !src_nents)
+		return NULL;
+
+	chan = to_fsl_chan(dchan);
+
+	dst_avail = sg_dma_len(dst_sg);
+	src_avail = sg_dma_len(src_sg);
+
+	for (;;) {
+		copy = min_t(size_t, min(dst_avail, src_avail),
+			     FSL_DMA_BCR_MAX_CNT);
+		if (copy) {
+			dst = sg_dma_address(dst_sg) + sg_dma_len(dst_sg) -
+			      dst_avail;
+			src = sg_dma_address(src_sg) + sg_dma_len(src_sg) -
+			      src_avail;
+
+			new = fsl_dma_alloc_descriptor(chan);
+			if (!new) {
+				dev_err(chan->dev,
+					"No free memory for link descriptor\n");
+				goto fail;
+			}
+
+			set_desc_cnt(chan, &new->hw, copy);
+			set_desc_src(chan, &new->hw, src);
+			set_desc_dst(chan, &new->hw, dst);
+
+			if (!first)
+				first = new;
+			else
+				set_desc_next(chan, &prev->hw,
+					      new->async_tx.phys);
+
+			new->async_tx.cookie = 0;
+			async_tx_ack(&new->async_tx);
+
+			prev = new;
+			dst_avail -= copy;
+			src_avail -= copy;
+
+			/* Insert the link descriptor to the LD ring */
+			list_add_tail(&new->node, &first->tx_list);
+		}
+
+		/* move on to the next entry of whichever list ran out */
+		if (!dst_avail) {
+			if (!--dst_nents)
+				break;
+			dst_sg = sg_next(dst_sg);
+			dst_avail = sg_dma_len(dst_sg);
+		}
+		if (!src_avail) {
+			if (!--src_nents)
+				break;
+			src_sg = sg_next(src_sg);
+			src_avail = sg_dma_len(src_sg);
+		}
+	}
+
+	if (!new)
+		return NULL;
+
+	new->async_tx.flags = flags; /* client is in control of this ack */
+	new->async_tx.cookie = -EBUSY;
+
+	/* Set End-of-link to the last link descriptor of new list*/
+	set_ld_eol(chan, new);
+
+	return &first->async_tx;
+
+fail:
+	if (!first)
+		return NULL;
+
+	fsldma_free_desc_list_reverse(chan, &first->tx_list);
+	return NULL;
+}
+
 /**
  * fsl_dma_prep_slave_sg - prepare descriptors for a DMA_SLAVE transaction
  * @chan: DMA channel
@@ -800,12 +915,43 @@ static int fsl_dma_device_control(struct dma_chan *dchan,
 	/* Remove and free all of the descriptors in the LD queue */
 	fsldma_free_desc_list(chan, &chan->ld_pending);
 	fsldma_free_desc_list(chan, &chan->ld_running);
+	chan->hw_last = NULL;
 
 	spin_unlock_irqrestore(&chan->desc_lock, flags);
 
 	return 0;
 }
 
+/**
+ * fsl_chan_cur_desc - find the running descriptor the controller is on
+ * @chan : Freescale DMA channel
+ *
+ * Only descriptors up to hw_last have been visible to the controller;
+ * any later one at the same address is a recycled descriptor that it
+ * never fetched.  Returns NULL if the controller is not on any of the
+ * running descriptors.
+ *
+ * LOCKING: must hold chan->desc_lock
+ */
+static struct fsl_desc_sw *fsl_chan_cur_desc(struct fsldma_chan *chan)
+{
+	struct fsl_desc_sw *desc;
+	dma_addr_t cdar;
+
+	if (!chan->hw_last)
+		return NULL;
+
+	cdar = get_cdar(chan) & FSL_DMA_NLDA_MASK;
+	list_for_each_entry(desc, &chan->ld_running, node) {
+		if (desc->async_tx.phys == cdar)
+			return desc;
+		if (desc == chan->hw_last)
+			break;
+	}
+
+	return NULL;
+}
+
 /**
  * fsl_dma_update_completed_cookie - Update the completed cookie.
  * @chan : Freescale DMA channel
@@ -820,13 +966,17 @@ static void fsl_dma_update_completed_cookie(struct fsldma_chan *chan)
 
 	spin_lock_irqsave(&chan->desc_lock, flags);
 
-	if (list_empty(&chan->ld_running)) {
+	/*
+	 * New transactions may have been appended behind the one the
+	 * controller works on, so the completed cookie follows the
+	 * controller's current descriptor rather than the end of the list.
+	 */
+	desc = fsl_chan_cur_desc(chan);
+	if (!desc) {
 		dev_dbg(chan->dev, "no running descriptors\n");
 		goto out_unlock;
 	}
 
-	/* Get the last descriptor, update the cookie to that */
-	desc = to_fsl_desc(chan->ld_running.prev);
 	if (dma_is_idle(chan))
 		cookie = desc->async_tx.cookie;
 	else {
@@ -892,6 +1042,8 @@ static void fsl_chan_ld_cleanup(struct fsldma_chan *chan)
 
 		/* Run any dependencies, then free the descriptor */
 		dma_run_dependencies(&desc->async_tx);
+		if (desc == chan->hw_last)
+			chan->hw_last = NULL;
 		dma_pool_free(chan->desc_pool, desc, desc->async_tx.phys);
 	}
 
@@ -902,35 +1054,56 @@ static void fsl_chan_ld_cleanup(struct fsldma_chan *chan)
  * fsl_chan_xfer_ld_queue - transfer any pending transactions
  * @chan : Freescale DMA channel
  *
- * This will make sure that any pending transactions will be run.
- * If the DMA controller is idle, it will be started. Otherwise,
- * the DMA controller's interrupt handler will start any pending
- * transactions when it becomes idle.
+ * Pending transactions are linked behind the running ones.  A busy
+ * controller follows the new link without being halted; if it had
+ * already fetched the old end-of-link descriptor it stops there, and the
+ * EOL interrupt brings us back here to restart it behind the descriptor
+ * it stopped at.  An idle controller is started right away.
  */
 static void fsl_chan_xfer_ld_queue(struct fsldma_chan *chan)
 {
-	struct fsl_desc_sw *desc;
+	struct fsl_desc_sw *desc, *tail;
 	unsigned long flags;
 
 	spin_lock_irqsave(&chan->desc_lock, flags);
 
-	/*
-	 * If the list of pending descriptors is empty, then we
-	 * don't need to do any work at all
-	 */
-	if (list_empty(&chan->ld_pending)) {
-		dev_dbg(chan->dev, "no pending LDs\n");
-		goto out_unlock;
+	if (!list_empty(&chan->ld_pending)) {
+		desc = list_first_entry(&chan->ld_pending, struct fsl_desc_sw,
+					node);
+		if (!list_empty(&chan->ld_running)) {
+			/* this clears the EOL bit of the old tail */
+			tail = to_fsl_desc(chan->ld_running.prev);
+			set_ld_next(chan, tail, desc->async_tx.phys);
+			wmb();
+		}
+		list_splice_tail_init(&chan->ld_pending, &chan->ld_running);
+
+		/*
+		 * Still busy: the controller may reach the new descriptors.
+		 * If it went idle meanwhile, it is restarted below from the
+		 * descriptor after the one it stopped at.
+		 */
+		if (chan->hw_last && !dma_is_idle(chan)) {
+			chan->hw_last = to_fsl_desc(chan->ld_running.prev);
+			goto out_unlock;
+		}
 	}
 
-	/*
-	 * The DMA controller is not idle, which means the interrupt
-	 * handler will start any queued transactions when it runs
-	 * at the end of the current transaction
-	 */
-	if (!dma_is_idle(chan)) {
-		dev_dbg(chan->dev, "DMA controller still busy\n");
+	if (list_empty(&chan->ld_running) || !dma_is_idle(chan))
 		goto out_unlock;
+
+	/* find the first descriptor the controller has not run */
+	desc = fsl_chan_cur_desc(chan);
+	if (desc) {
+		if (desc == to_fsl_desc(chan->ld_running.prev))
+			goto out_unlock;
+		desc = to_fsl_desc(desc->node.next);
+	} else {
+		desc = list_first_entry(&chan->ld_running, struct fsl_desc_sw,
+					node);
+		/* no restart for descriptors it has already run */
+		if (fsldma_desc_status(chan, desc) != DMA_IN_PROGRESS)
+			goto out_unlock;
 	}
 
 	/*
@@ -940,23 +1113,12 @@ static void fsl_chan_xfer_ld_queue(struct fsldma_chan *chan)
 	 */
 	dma_halt(chan);
 
-	/*
-	 * If there are some link descriptors which have not been
-	 * transferred, we need to start the controller
-	 */
-
-	/*
-	 * Move all elements from the queue of pending transactions
-	 * onto the list of running transactions
-	 */
-	desc = list_first_entry(&chan->ld_pending, struct fsl_desc_sw, node);
-	list_splice_tail_init(&chan->ld_pending, &chan->ld_running);
-
 	/*
 	 * Program the descriptor's address into the DMA controller,
 	 * then start the DMA transaction
 	 */
 	set_cdar(chan, desc->async_tx.phys);
+	chan->hw_last = to_fsl_desc(chan->ld_running.prev);
 	dma_start(chan);
 
 out_unlock:
@@ -1336,10 +1498,12 @@ static int __devinit fsldma_of_probe(struct of_device *op,
 	dma_cap_set(DMA_INTERRUPT, fdev->common.cap_mask);
 #endif
 	dma_cap_set(DMA_SLAVE, fdev->common.cap_mask);
+	dma_cap_set(DMA_SG, fdev->common.cap_mask);
 	fdev->common.device_alloc_chan_resources = fsl_dma_alloc_chan_resources;
 	fdev->common.device_free_chan_resources = fsl_dma_free_chan_resources;
 	fdev->common.device_prep_dma_interrupt = fsl_dma_prep_interrupt;
 	fdev->common.device_prep_dma_memcpy = fsl_dma_prep_memcpy;
+	fdev->common.device_prep_dma_sg = fsl_dma_prep_sg;
 	fdev->common.device_tx_status = fsl_tx_status;
 	fdev->common.device_issue_pending = fsl_dma_memcpy_issue_pending;
 	fdev->common.device_prep_slave_sg = fsl_dma_prep_slave_sg;
@@ -106,6 +106,7 @@
 #include <net/route.h>
 #include <net/ip.h>
 #include <linux/jhash.h>
+#include <net/fastroute.h>
 #endif
 
 #include <net/tcp.h>
@@ -183,7 +184,7 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue, int tx_work_limit
 static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue);
 #endif
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull);
+			      int amount_pull, struct napi_struct *napi);
 static void gfar_vlan_rx_register(struct net_device *netdev,
 		                struct vlan_group *grp);
 void gfar_halt(struct net_device *dev);
@@ -314,16 +315,10 @@ unsigned long alloc_bds(struct gfar_private *priv, dma_addr_t *addr)
 	               priv->total_rx_ring_size;
 
 #ifdef CONFIG_GIANFAR_L2SRAM
-	vaddr =  (unsigned long) mpc85xx_cache_sram_alloc(region_size,
-					(phys_addr_t *)addr, ALIGNMENT);
-	if (vaddr == NULL) {
-		/* fallback to normal memory rather than stop working */
-		vaddr = (unsigned long) dma_alloc_coherent(&priv->ofdev->dev,
-				region_size, addr, GFP_KERNEL);
-		priv->bd_in_ram = 1;
-	} else {
-		priv->bd_in_ram = 0;
-	}
+	/* falls back to normal memory rather than stop working */
+	vaddr = (unsigned long) cache_sram_client_alloc(CACHE_SRAM_GIANFAR,
+				&priv->ofdev->dev, region_size, addr,
+				ALIGNMENT);
 #else
 	vaddr = (unsigned long) dma_alloc_coherent(&priv->ofdev->dev,
 				region_size, addr, GFP_KERNEL);
@@ -692,6 +687,16 @@ static inline int gfar_uses_fcb(struct gfar_private *priv)
 	return priv->vlgrp || priv->rx_csum_enable;
 }
 
+/* The NAPI context that polls @rx_queue, for GRO */
+static inline struct napi_struct *gfar_rx_napi(struct gfar_priv_rx_q *rx_queue)
+{
+#ifdef CONFIG_GIANFAR_TXNAPI
+	return &rx_queue->grp->napi_rx;
+#else
+	return &rx_queue->grp->napi;
+#endif
+}
+
 static void free_tx_pointers(struct gfar_private *priv)
 {
 	int i = 0;
@@ -852,7 +857,7 @@ static int gfar_of_init(struct of_device *ofdev, struct net_device **pdev)
 	u32 etsec_clk;
 	u32 max_filer_rules;
 #ifdef CONFIG_GFAR_SW_PKT_STEERING
-	int sps;
+	int sps = 0;
 #endif
 
 	if (!np || !of_device_is_available(np))
@@ -870,7 +875,10 @@ static int gfar_of_init(struct of_device *ofdev, struct net_device **pdev)
 	}
 
 #ifdef CONFIG_GFAR_SW_PKT_STEERING
-	if ((num_online_cpus() == 2) &&
+	/* one tx queue per cpu, so the number of cpus taking part in
+	 * steering is bounded by the tx queues of the controller
+	 */
+	if ((num_online_cpus() > 1) && (num_online_cpus() <= MAX_TX_QS) &&
 		(!of_device_is_compatible(np, "fsl,etsec2"))) {
 		printk(KERN_INFO "ETSEC: IPS Enabled\n");
 		num_tx_qs = num_online_cpus();
@@ -1092,6 +1100,9 @@ static int gfar_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
 	struct gfar_private *priv = netdev_priv(dev);
 	int retVal = 0;
 
+	if (cmd == SIOCSHWTSTAMP)
+		return gfar_hwtstamp_ioctl(dev, rq);
+
 	if (!netif_running(dev))
 		return -EINVAL;
 
@@ -1158,93 +1169,196 @@ static u32 cluster_entry_per_class(struct gfar_private *priv, u32 rqfar,
 }
 
 #ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
-void gfar_setup_hwaccel_tcp4_receive(struct sock *sk, struct sk_buff *skb)
+/*
+ * Hardware TCP receive channels.
+ *
+ * Each channel owns one rx queue and four filer entries (SIA, DIA, SPT
+ * AND'ed into a terminal DPT entry that picks the queue).  A flow asks for
+ * a channel once it is established and past TCP_HWACCEL_THRESHOLD.  Free
+ * channels are used first, then channels whose flow went idle or left
+ * ESTABLISHED, and only then the slowest unpinned channel whose smoothed
+ * rate is below tcp_chl_min_rate.  Otherwise the request is refused and
+ * further requests are held off for TCP_CHL_RETRY, so a busy table does
+ * not thrash.
+ */
+static inline void gfar_write_tcp_filer(struct gfar_private *priv,
+		int idx, u32 rqfcr, u32 rqfpr)
 {
+	priv->ftp_rqfcr[idx] = rqfcr;
+	priv->ftp_rqfpr[idx] = rqfpr;
+	gfar_write_filer(priv, idx, rqfcr, rqfpr);
+}
 
-	int i = 0;
-	int j = 0;
-	u32 rqfcr = 0x0;
-	u32 rqfpr = 0;
+/* Disarm the terminal entry first so that a half written chain never
+ * matches a foreign flow.
+ */
+static void gfar_tcp_chl_clear_filer(struct gfar_private *priv, int ch)
+{
+	int j = priv->tcp_filer_idx + (ch << 2);
+
+	gfar_write_tcp_filer(priv, j + 3, RQFCR_CMP_NOMATCH, FPR_FILER_MASK);
+	gfar_write_tcp_filer(priv, j, RQFCR_CMP_NOMATCH, FPR_FILER_MASK);
+	gfar_write_tcp_filer(priv, j + 1, RQFCR_CMP_NOMATCH, FPR_FILER_MASK);
+	gfar_write_tcp_filer(priv, j + 2, RQFCR_CMP_NOMATCH, FPR_FILER_MASK);
+}
+
+static void gfar_tcp_chl_set_filer(struct gfar_private *priv, int ch,
+		const struct iphdr *iph, const struct tcphdr *th)
+{
+	int j = priv->tcp_filer_idx + (ch << 2);
+
+	gfar_write_tcp_filer(priv, j + 3, RQFCR_CMP_NOMATCH, FPR_FILER_MASK);
+	gfar_write_tcp_filer(priv, j,
+			RQFCR_CMP_EXACT | RQFCR_PID_SIA | RQFCR_AND,
+			ntohl(iph->saddr));
+	gfar_write_tcp_filer(priv, j + 1,
+			RQFCR_CMP_EXACT | RQFCR_PID_DIA | RQFCR_AND,
+			ntohl(iph->daddr));
+	gfar_write_tcp_filer(priv, j + 2,
+			RQFCR_CMP_EXACT | RQFCR_PID_SPT | RQFCR_AND,
+			ntohs(th->source));
+	gfar_write_tcp_filer(priv, j + 3,
+			RQFCR_CMP_EXACT | RQFCR_PID_DPT |
+			((ch + TCP_CHL_OFFSET) << 10),
+			ntohs(th->dest));
+}
+
+/* Called with tcp_chl_lock held.  The socket may be racing through
+ * sk_free(), which clears its binding with the same cmpxchg pair, so
+ * only whoever wins the slot touches sk->tcp_hw_channel.
+ */
+static void gfar_tcp_chl_detach(struct gfar_private *priv, int ch)
+{
+	struct gfar_tcp_channel *chl = &priv->tcp_hw_channel[ch];
+	struct sock *sk;
+
+	gfar_tcp_chl_clear_filer(priv, ch);
+
+	rcu_read_lock();
+	sk = rcu_dereference(chl->sk);
+	if (sk && cmpxchg(&chl->sk, sk, NULL) == sk)
+		cmpxchg(&sk->tcp_hw_channel, (void *)&chl->sk, NULL);
+	rcu_read_unlock();
+	chl->pinned = 0;
+}
+
+void gfar_tcp_chl_update_rate(struct gfar_tcp_channel *chl,
+		unsigned long now)
+{
+	unsigned long hits = chl->hits;
+	unsigned long delta = now - chl->rate_stamp;
+
+	if (delta < HZ)
+		return;
+
+	/* EWMA with weight 1/4 on the last interval */
+	chl->rate = (chl->rate * 3 +
+		     (hits - chl->rate_hits) * HZ / delta) >> 2;
+	chl->rate_hits = hits;
+	chl->rate_stamp = now;
+}
+
+static int gfar_tcp_chl_pin_port(struct gfar_private *priv, u16 port)
+{
+	int i;
+
+	for (i = 0; i < TCP_CHL_PIN_PORTS; i++)
+		if (priv->tcp_chl_pin_ports[i] && priv->tcp_chl_pin_ports[i] == port)
+			return 1;
+	return 0;
+}
+
+static int gfar_tcp_chl_select(struct gfar_private *priv, unsigned long now)
+{
+	struct gfar_tcp_channel *chl;
+	struct sock *sk;
+	unsigned long min_rate = ULONG_MAX;
+	int i, victim = -1;
+
+	for (i = 0; i < priv->tcp_chl_num; i++) {
+		chl = &priv->tcp_hw_channel[i];
+		sk = chl->sk;
+		if (!sk)
+			return i;
+		if (chl->pinned)
+			continue;
+		/* racy peek, the slab is type stable under rcu */
+		if (sk->sk_state != TCP_ESTABLISHED ||
+		    time_after(now, chl->last_hit + TCP_CHL_IDLE))
+			return i;
+		gfar_tcp_chl_update_rate(chl, now);
+		if (chl->rate < min_rate) {
+			min_rate = chl->rate;
+			victim = i;
+		}
+	}
+
+	if (victim >= 0 && min_rate < priv->tcp_chl_min_rate)
+		return victim;
+
+	return -1;
+}
+
+void gfar_setup_hwaccel_tcp4_receive(struct sock *sk, struct sk_buff *skb)
+{
+	struct gfar_private *priv = netdev_priv(skb->skb_owner);
+	struct gfar_tcp_channel *chl;
+	unsigned long now = jiffies;
 	struct tcphdr *th;
 	struct iphdr *iph;
-	struct gfar_private *priv = netdev_priv(skb->skb_owner);
+	int ch;
 
 	if (priv->ptimer_present || !priv->rx_csum_enable ||
-		priv->num_rx_queues < (TCP_CHL_OFFSET + RESERVE_CHL_NUM))
+		!priv->tcp_chl_num)
+		return;
+
+	if (time_before(now, priv->tcp_chl_next_try))
 		return;
 
 	th = tcp_hdr(skb);
 	iph = ip_hdr(skb);
 
-	/*select next empty TCP channel*/
-	for (i = (priv->empty_tcp_channel + 1) % (priv->num_rx_queues - TCP_CHL_OFFSET - 1);
-		i != priv->empty_tcp_channel;
-		i = (i+1) % (priv->num_rx_queues - TCP_CHL_OFFSET - 1)) {
-		if (priv->tcp_hw_channel[i] == NULL)
-			break;
-	}
+	spin_lock_bh(&priv->tcp_chl_lock);
+	rcu_read_lock();
+	ch = gfar_tcp_chl_select(priv, now);
+	rcu_read_unlock();
+	if (ch < 0) {
+		priv->tcp_chl_alloc_fail++;
+		priv->tcp_chl_next_try = now + TCP_CHL_RETRY;
+		goto out;
+	}
+
+	chl = &priv->tcp_hw_channel[ch];
+	if (chl->sk) {
+		gfar_tcp_chl_detach(priv, ch);
+		chl->evictions++;
+	}
+
+	chl->installs++;
+	chl->last_hit = now;
+	chl->rate = 0;
+	chl->rate_hits = chl->hits;
+	chl->rate_stamp = now;
+	chl->pinned = gfar_tcp_chl_pin_port(priv, ntohs(th->dest));
+
+	/* publish the socket before the queue can see its packets */
+	sk->tcp_hw_channel = &chl->sk;
+	rcu_assign_pointer(chl->sk, sk);
+	gfar_tcp_chl_set_filer(priv, ch, iph, th);
+out:
+	spin_unlock_bh(&priv->tcp_chl_lock);
+}
 
-	if (i == priv->empty_tcp_channel)
-		i = (i+1) % (priv->num_rx_queues - TCP_CHL_OFFSET - 1);
-
-	priv->tcp_hw_channel[priv->empty_tcp_channel] = sk;
-	sk->tcp_hw_channel = &(priv->tcp_hw_channel[priv->empty_tcp_channel]);
-
-	j = priv->tcp_filer_idx + (priv->empty_tcp_channel << 2);
-
-	/*setup IPv4 source address*/
-	rqfcr = RQFCR_CMP_EXACT | RQFCR_PID_SIA | RQFCR_AND;
-	rqfpr = ntohl(iph->saddr);
-	priv->ftp_rqfcr[j] = rqfcr;
-	priv->ftp_rqfpr[j] = rqfpr;
-	gfar_write_filer(priv, j, rqfcr, rqfpr);
-	j++;
-	/*setup IPv4 destination address*/
-	rqfcr = RQFCR_CMP_EXACT | RQFCR_PID_DIA | RQFCR_AND;
-	rqfpr = ntohl(iph->daddr);
-	priv->ftp_rqfcr[j] = rqfcr;
-	priv->ftp_rqfpr[j] = rqfpr;
-	gfar_write_filer(priv, j, rqfcr, rqfpr);
-	j++;
-	/*setup TCP source port*/
-	rqfcr = RQFCR_CMP_EXACT | RQFCR_PID_SPT | RQFCR_AND;
-	rqfpr = ntohs(th->source);
-	priv->ftp_rqfcr[j] = rqfcr;
-	priv->ftp_rqfpr[j] = rqfpr;
-	gfar_write_filer(priv, j, rqfcr, rqfpr);
-	j++;
-	/*setup TCP destination port*/
-	rqfcr = RQFCR_CMP_EXACT | RQFCR_PID_DPT | ((priv->empty_tcp_channel + TCP_CHL_OFFSET) << 10);
-	rqfpr = ntohs(th->dest);
-	priv->ftp_rqfcr[j] = rqfcr;
-	priv->ftp_rqfpr[j] = rqfpr;
-	gfar_write_filer(priv, j, rqfcr, rqfpr);
-
-	priv->empty_tcp_channel = i;
-
-	/*clean up tcp channel*/
-	if (priv->tcp_hw_channel[i] != NULL) {
-		priv->tcp_hw_channel[i]->tcp_hw_channel = NULL;
-		priv->tcp_hw_channel[i] = NULL;
-		j = priv->tcp_filer_idx + (i << 2);
-		rqfcr = RQFCR_CMP_NOMATCH;
-		rqfpr = FPR_FILER_MASK;
-		priv->ftp_rqfcr[j] = rqfcr;
-		priv->ftp_rqfpr[j] = rqfpr;
-		gfar_write_filer(priv, j, rqfcr, rqfpr);
-		j++;
-		priv->ftp_rqfcr[j] = rqfcr;
-		priv->ftp_rqfpr[j] = rqfpr;
-		gfar_write_filer(priv, j, rqfcr, rqfpr);
-		j++;
-		priv->ftp_rqfcr[j] = rqfcr;
-		priv->ftp_rqfpr[j] = rqfpr;
-		gfar_write_filer(priv, j, rqfcr, rqfpr);
-		j++;
-		priv->ftp_rqfcr[j] = rqfcr;
-		priv->ftp_rqfpr[j] = rqfpr;
-		gfar_write_filer(priv, j, rqfcr, rqfpr);
-	}
+int gfar_tcp_chl_set_pin(struct gfar_private *priv, int ch, int pin)
+{
+	if (ch < 0 || ch >= priv->tcp_chl_num)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->tcp_chl_lock);
+	priv->tcp_hw_channel[ch].pinned = priv->tcp_hw_channel[ch].sk && pin;
+	spin_unlock_bh(&priv->tcp_chl_lock);
+
+	return 0;
 }
 
 inline void gfar_hwaccel_tcp4_receive(struct gfar_private *priv,
@@ -1256,8 +1370,9 @@ inline void gfar_hwaccel_tcp4_receive(struct gfar_private *priv,
 	int ph_len;
 	struct rxfcb *fcb;
 	struct sock *gfar_sk;
+	struct gfar_tcp_channel *chl;
 
-	gfar_sk = priv->tcp_hw_channel[rx_queue->qindex - TCP_CHL_OFFSET];
+	chl = &priv->tcp_hw_channel[rx_queue->qindex - TCP_CHL_OFFSET];
 
 	fcb = (struct rxfcb *)skb->data;
 
@@ -1267,13 +1382,38 @@ inline void gfar_hwaccel_tcp4_receive(struct gfar_private *priv,
 	/*set IPv4 header*/
 	skb->network_header = skb->data + amount_pull + ETH_HLEN;
 	iph = ip_hdr(skb);
+	th = (struct tcphdr *)((u8 *)iph + (iph->ihl << 2));
+
+	/* The channel may have been handed to another flow, or the socket
+	 * freed and its memory reused, since the filer queued this frame.
+	 */
+	rcu_read_lock();
+	gfar_sk = rcu_dereference(chl->sk);
+	if (gfar_sk && !atomic_inc_not_zero(&gfar_sk->sk_refcnt))
+		gfar_sk = NULL;
+	rcu_read_unlock();
+
+	if (!gfar_sk)
+		goto slow;
+
+	if (unlikely(inet_sk(gfar_sk)->inet_daddr != iph->saddr ||
+		     inet_sk(gfar_sk)->inet_rcv_saddr != iph->daddr ||
+		     inet_sk(gfar_sk)->inet_dport != th->source ||
+		     inet_sk(gfar_sk)->inet_sport != th->dest ||
+		     gfar_sk->tcp_hw_channel != &chl->sk)) {
+		sock_put(gfar_sk);
+		goto slow;
+	}
 
 	if (iph->ihl > 5 || (iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
 		(gfar_sk->sk_state != TCP_ESTABLISHED)) {
-		gfar_process_frame(priv->ndev, skb, amount_pull);
-		return;
+		sock_put(gfar_sk);
+		goto slow;
 	}
 
+	chl->hits++;
+	chl->last_hit = jiffies;
+
 	/*IPv4 header length*/
 	ph_len = iph->ihl << 2;
 	p_len = ntohs(iph->tot_len);
@@ -1305,6 +1445,13 @@ inline void gfar_hwaccel_tcp4_receive(struct gfar_private *priv,
 	} else
 		sk_add_backlog(gfar_sk, skb);
 	bh_unlock_sock(gfar_sk);
+	sock_put(gfar_sk);
+	return;
+
+slow:
+	chl->misses++;
+	gfar_process_frame(priv->ndev, skb, amount_pull,
+			   gfar_rx_napi(rx_queue));
 }
 
 void gfar_init_tcp_filer_rule(struct gfar_private *priv, int index)
@@ -1339,20 +1486,22 @@ void gfar_init_tcp_filer_rule(struct gfar_private *priv, int index)
 	priv->ftp_rqfpr[i] = rqfpr;
 	gfar_write_filer(priv, i, rqfcr, rqfpr);
 	i++;
-	rqfcr = RQFCR_CMP_NOMATCH;
-	rqfpr = FPR_FILER_MASK;
 	priv->tcp_filer_idx = i;
-	priv->empty_tcp_channel = 1;
-
-	for (j = 0; j < (TCP_CHL_NUM << 2); j++) {
-		priv->ftp_rqfcr[i] = rqfcr;
-		priv->ftp_rqfpr[i] = rqfpr;
-		gfar_write_filer(priv, i, rqfcr, rqfpr);
-		i++;
-	}
 
-	for (j = 0; j < TCP_CHL_NUM; j++)
-		priv->tcp_hw_channel[j] = 0;
+	/* The table is rewritten from scratch (probe, resume): unbind any
+	 * flow still holding a channel before its entries go away.
+	 */
+	spin_lock_bh(&priv->tcp_chl_lock);
+	for (j = 0; j < TCP_CHL_NUM; j++) {
+		gfar_tcp_chl_detach(priv, j);
+		i += 4;
+	}
+	priv->tcp_chl_num = min_t(int, TCP_CHL_NUM,
+				  priv->num_rx_queues - TCP_CHL_OFFSET - 1);
+	if (priv->num_rx_queues < (TCP_CHL_OFFSET + RESERVE_CHL_NUM))
+		priv->tcp_chl_num = 0;
+	priv->tcp_chl_next_try = jiffies;
+	spin_unlock_bh(&priv->tcp_chl_lock);
 
 	rqfpr = FPR_FILER_MASK;
 	rqfcr = RQFCR_CMP_NOMATCH | RQFCR_CLE;
@@ -1430,7 +1579,9 @@ out:
 
 }
 
-static int get_cpu_number(unsigned char *eth_pkt, int len)
+#ifdef CONFIG_GFAR_SW_PKT_STEERING
+static int get_cpu_number(struct gfar_private *priv,
+			  unsigned char *eth_pkt, int len)
 {
 	u32 addr1, addr2, ports;
 	struct ipv6hdr *ip6;
@@ -1445,7 +1596,7 @@ static int get_cpu_number(unsigned char *eth_pkt, int len)
 	if (len < ETH_HLEN)
 		return -1;
 	else
-		eth = eth_pkt;
+		eth = (struct ethhdr *)eth_pkt;
 
 	if (unlikely(!simple_hashrnd_initialized)) {
 		get_random_bytes(&simple_hashrnd, 4);
@@ -1497,49 +1648,76 @@ static int get_cpu_number(unsigned char *eth_pkt, int len)
 	}
 
 	hash = jhash_3words(addr1, addr2, ports, simple_hashrnd);
-	cpu = hash & 0x1;
+	cpu = priv->steer_table[((u64)hash * GFAR_STEER_TABLE_SIZE) >> 32];
 
 	return cpu_online(cpu) ? cpu : -1;
 }
 
-#ifdef CONFIG_GFAR_SW_PKT_STEERING
+/* Spread the indirection table evenly over the online cpus */
+static void gfar_init_steer_table(struct gfar_private *priv)
+{
+	int i, cpu = -1;
+
+	for (i = 0; i < GFAR_STEER_TABLE_SIZE; i++) {
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		priv->steer_table[i] = cpu;
+	}
+}
+
 static int gfar_cpu_poll(struct napi_struct *napi, int budget)
 {
 	struct gfar_cpu_dev *cpu_dev = &__get_cpu_var(gfar_cpu_dev);
-	struct sk_buff *skb = NULL, *new_recycle_head = NULL;
+	struct sk_buff *skb = NULL;
 	int cpu = smp_processor_id();
 	int rx_cleaned = 0;
 	struct net_device *dev;
 	struct gfar_private *priv;
+	struct gfar_steer_ring *ring;
+	unsigned int head, tail;
 	int amount_pull;
-	struct shared_buffer *buf = &per_cpu(gfar_cpu_dev, !cpu).tx_queue;
+	int src, n;
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	struct gfar_skb_handler *sh = &cpu_dev->sh;
 #endif
 
-	while (budget--) {
+	/* Serve the producing cpus round robin, starting one further
+	 * along on every poll so that no source is starved.
+	 */
+	src = cpu_dev->poll_start;
+	for (n = 0; n < nr_cpu_ids && rx_cleaned < budget; n++) {
+		src = cpumask_next(src, cpu_online_mask);
+		if (src >= nr_cpu_ids)
+			src = cpumask_first(cpu_online_mask);
+		if (src == cpu)
+			continue;
+
+		ring = per_cpu(gfar_cpu_dev, src).rings[cpu];
+		if (!ring)
+			continue;
+
+		tail = ring->tail;
+		head = ACCESS_ONCE(ring->head);
+		/* read the slots only after the producer published them */
 		smp_rmb();
 
-		spin_lock_irq(&buf->lock);
-		if (buf->buff_cnt == 0) {
-			spin_unlock_irq(&buf->lock);
-			break;
-		} else {
-			skb = buf->buffer[buf->out];
+		while (tail != head && rx_cleaned < budget) {
+			unsigned int idx = tail & (GFAR_CPU_BUFF_SIZE - 1);
+
+			skb = ring->buffer[idx];
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+			/* hand a spare skb back to the producer */
 			if (sh->recycle_count > 0) {
-				new_recycle_head = sh->recycle_queue->next;
-				buf->buffer[buf->out] = sh->recycle_queue;
-				sh->recycle_queue->next = NULL;
-				sh->recycle_queue = new_recycle_head;
+				ring->buffer[idx] = sh->recycle_queue;
+				sh->recycle_queue = sh->recycle_queue->next;
+				ring->buffer[idx]->next = NULL;
 				sh->recycle_count--;
 			} else {
-				buf->buffer[buf->out] = NULL;
+				ring->buffer[idx] = NULL;
 			}
 #endif
-			buf->out = (buf->out + 1) % GFAR_CPU_BUFF_SIZE;
-			buf->buff_cnt--;
-			spin_unlock_irq(&buf->lock);
+			tail++;
 
 			dev = skb->dev;
 			priv = netdev_priv(dev);
@@ -1552,13 +1730,19 @@ static int gfar_cpu_poll(struct napi_struct *napi, int budget)
 				(gfar_uses_fcb(priv) ? GMAC_FCB_LEN : 0) +
 					priv->padding;
 
-			gfar_process_frame(dev, skb, amount_pull);
+			gfar_process_frame(dev, skb, amount_pull, napi);
 
 			rx_cleaned++;
 		}
+
+		/* finish with the slots before giving them back */
+		smp_mb();
+		ring->dequeued += tail - ring->tail;
+		ring->tail = tail;
 	}
+	cpu_dev->poll_start = src;
 
-	if (budget > 0)
+	if (rx_cleaned < budget)
 		napi_complete(napi);
 
 	return rx_cleaned;
@@ -1586,23 +1770,93 @@ void gfar_cpu_setup(struct net_device *dev)
 	return;
 }
 
-static enum hrtimer_restart gfar_cpu_timer_handle(struct hrtimer *timer)
+/* Ring the doorbell of every cpu this cpu queued packets for since the
+ * last doorbell.  Called with interrupts disabled.
+ */
+static void gfar_cpu_kick_pending(struct gfar_cpu_dev *cpu_dev)
 {
-	struct gfar_cpu_dev *this_cpu_dev = &__get_cpu_var(gfar_cpu_dev);
-	struct gfar_cpu_dev *other_cpu_dev =
-		&per_cpu(gfar_cpu_dev, !smp_processor_id());
+	int target;
 
-	if (timer == &this_cpu_dev->intr_coalesce_timer) {
-		fsl_send_msg(other_cpu_dev->msg_virtual_rx, 0x1);
-		this_cpu_dev->intr_coalesce_cnt = 0;
-	} else {
-		fsl_send_msg(this_cpu_dev->msg_virtual_rx, 0x1);
-		other_cpu_dev->intr_coalesce_cnt = 0;
+	for_each_cpu(target, &cpu_dev->doorbell_pending) {
+		cpu_dev->rings[target]->pending = 0;
+		fsl_send_msg(per_cpu(gfar_cpu_dev, target).msg_virtual_rx, 0x1);
 	}
+	cpumask_clear(&cpu_dev->doorbell_pending);
+}
+
+static enum hrtimer_restart gfar_cpu_timer_handle(struct hrtimer *timer)
+{
+	struct gfar_cpu_dev *cpu_dev =
+		container_of(timer, struct gfar_cpu_dev, intr_coalesce_timer);
+
+	gfar_cpu_kick_pending(cpu_dev);
 
 	return HRTIMER_NORESTART;
 }
 
+/* Frees the packets still queued on a ring, and any spares left in it */
+static void gfar_cpu_drain_ring(struct gfar_steer_ring *ring)
+{
+	unsigned int idx;
+
+	for (; ring->tail != ring->head; ring->tail++) {
+		idx = ring->tail & (GFAR_CPU_BUFF_SIZE - 1);
+		dev_kfree_skb_any(ring->buffer[idx]);
+		ring->buffer[idx] = NULL;
+	}
+#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+	/* the consumer hands spare skbs back in the slots it emptied */
+	for (idx = 0; idx < GFAR_CPU_BUFF_SIZE; idx++) {
+		if (ring->buffer[idx])
+			dev_kfree_skb_any(ring->buffer[idx]);
+		ring->buffer[idx] = NULL;
+	}
+#endif
+}
+
+static void gfar_cpu_free_rings(void)
+{
+	struct gfar_cpu_dev *cpu_dev;
+	int i, j;
+
+	for_each_possible_cpu(i) {
+		cpu_dev = &per_cpu(gfar_cpu_dev, i);
+		for_each_possible_cpu(j) {
+			if (!cpu_dev->rings[j])
+				continue;
+			gfar_cpu_drain_ring(cpu_dev->rings[j]);
+			kfree(cpu_dev->rings[j]);
+			cpu_dev->rings[j] = NULL;
+		}
+#ifdef CONFIG_GFAR_SKBUFF_RECYCLING
+		gfar_free_recycle_queue(&cpu_dev->sh, 0);
+#endif
+	}
+}
+
+/* One ring per ordered (source, target) pair of cpus */
+static int gfar_cpu_alloc_rings(void)
+{
+	struct gfar_cpu_dev *cpu_dev;
+	int i, j;
+
+	for_each_possible_cpu(i) {
+		cpu_dev = &per_cpu(gfar_cpu_dev, i);
+		for_each_possible_cpu(j) {
+			if (i == j)
+				continue;
+			cpu_dev->rings[j] = kzalloc_node(
+				sizeof(struct gfar_steer_ring), GFP_KERNEL,
+				cpu_to_node(j));
+			if (!cpu_dev->rings[j]) {
+				gfar_cpu_free_rings();
+				return -ENOMEM;
+			}
+		}
+	}
+	return 0;
+}
+
 void gfar_cpu_dev_init(void)
 {
 	int err = -1;
@@ -1611,12 +1865,17 @@ void gfar_cpu_dev_init(void)
 	struct gfar_cpu_dev *cpu_dev;
 	struct cpumask cpumask_msg_intrs;
 
+	if (gfar_cpu_alloc_rings()) {
+		printk(KERN_WARNING "%s: no memory for steering rings\n",
+			__func__);
+		return;
+	}
+
 	for_each_possible_cpu(i) {
 		cpu_dev = &per_cpu(gfar_cpu_dev, i);
 		cpu_dev->enabled = 0;
 
 		init_dummy_netdev(&cpu_dev->dev);
-		spin_lock_init(&cpu_dev->tx_queue.lock);
 		netif_napi_add(&cpu_dev->dev,
 			&cpu_dev->napi, gfar_cpu_poll, GFAR_DEV_WEIGHT);
 
@@ -1624,7 +1883,7 @@ void gfar_cpu_dev_init(void)
 		if (IS_ERR(cpu_dev->msg_virtual_rx)) {
 			printk(KERN_WARNING
 				"%s: fsl_get_msg_unit returned error %ld!\n",
-				__func__, IS_ERR(cpu_dev->msg_virtual_rx));
+				__func__, PTR_ERR(cpu_dev->msg_virtual_rx));
 			goto msg_fail;
 		}
 
@@ -1642,18 +1901,13 @@ void gfar_cpu_dev_init(void)
 					&cpumask_msg_intrs);
 		fsl_enable_msg(cpu_dev->msg_virtual_rx);
 
-		for (j = 0; j < GFAR_CPU_BUFF_SIZE; j++)
-			cpu_dev->tx_queue.buffer[j] = NULL;
-
-		cpu_dev->tx_queue.in = 0;
-		cpu_dev->tx_queue.out = 0;
-		cpu_dev->tx_queue.buff_cnt = 0;
+		cpumask_clear(&cpu_dev->doorbell_pending);
+		cpu_dev->poll_start = i;
 
 		napi_enable(&cpu_dev->napi);
 
-		cpu_dev->intr_coalesce_cnt = 0;
 		hrtimer_init(&cpu_dev->intr_coalesce_timer, CLOCK_MONOTONIC,
-			 HRTIMER_MODE_ABS);
+			 HRTIMER_MODE_REL_PINNED);
 		cpu_dev->intr_coalesce_timer.function = gfar_cpu_timer_handle;
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 		gfar_reset_skb_handler(&cpu_dev->sh);
@@ -1678,6 +1932,7 @@ msg_fail:
 		fsl_release_msg_unit(cpu_dev->msg_virtual_rx);
 		netif_napi_del(&cpu_dev->napi);
 	}
+	gfar_cpu_free_rings();
 }
 
 void gfar_cpu_dev_exit(void)
@@ -1687,13 +1942,17 @@ void gfar_cpu_dev_exit(void)
 
 	for_each_possible_cpu(i) {
 		cpu_dev = &per_cpu(gfar_cpu_dev, i);
+		if (!cpu_dev->enabled)
+			continue;
 
+		cpu_dev->enabled = 0;
 		hrtimer_cancel(&cpu_dev->intr_coalesce_timer);
 		napi_disable(&cpu_dev->napi);
 		free_irq(cpu_dev->msg_virtual_rx->irq, NULL);
 		fsl_release_msg_unit(cpu_dev->msg_virtual_rx);
 		netif_napi_del(&cpu_dev->napi);
 	}
+	gfar_cpu_free_rings();
 }
 
 int distribute_packet(struct net_device *dev,
@@ -1708,8 +1967,9 @@ int distribute_packet(struct net_device *dev,
 	unsigned int skb_len;
 	unsigned int eth_hdr_offset = 0;
 	unsigned char *eth;
-	struct shared_buffer *buf;
-	ktime_t time;
+	struct gfar_steer_ring *ring;
+	unsigned int head, used, idx;
+	unsigned long flags;
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	struct gfar_skb_handler *sh;
 	struct sk_buff *new_skb;
@@ -1727,7 +1987,7 @@ int distribute_packet(struct net_device *dev,
 		return -1;
 
 	eth = skb_data + eth_hdr_offset;
-	target_cpu = get_cpu_number(eth, skb_len - eth_hdr_offset);
+	target_cpu = get_cpu_number(priv, eth, skb_len - eth_hdr_offset);
 	if (-1 == target_cpu)
 		return -1;
 
@@ -1735,22 +1995,31 @@ int distribute_packet(struct net_device *dev,
 		return -1;
 
 	cpu_dev = &__get_cpu_var(gfar_cpu_dev);
-	if (!cpu_dev->enabled)
+	if (!cpu_dev->enabled ||
+	    !per_cpu(gfar_cpu_dev, target_cpu).enabled)
 		return -1;
 
-	buf = &cpu_dev->tx_queue;
-	spin_lock_irq(&buf->lock);
-	if (buf->buff_cnt == (GFAR_CPU_BUFF_SIZE - 1)) {
+	ring = cpu_dev->rings[target_cpu];
+	head = ring->head;
+	used = head - ACCESS_ONCE(ring->tail);
+	if (used >= GFAR_CPU_BUFF_SIZE) {
+		ring->dropped++;
 		dev_kfree_skb_any(skb);    /* buffer full, drop packet */
-		spin_unlock_irq(&buf->lock);
 		return 0;
 	}
+	if (used >= ring->max_used)
+		ring->max_used = used + 1;
+	/* the consumer may have left a spare skb in the slot; look at it
+	 * only after seeing the tail that freed it
+	 */
+	smp_mb();
+	idx = head & (GFAR_CPU_BUFF_SIZE - 1);
+
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	sh = &cpu_dev->sh;
+	new_skb = ring->buffer[idx];
 	if (sh->recycle_count < sh->recycle_max) {
-		if (buf->buffer[buf->in] != NULL)
-			new_skb = buf->buffer[buf->in];
-		else
+		if (new_skb == NULL)
 			new_skb = gfar_new_skb(dev);
 
 		/* put the obtained/allocated skb into
@@ -1760,31 +2029,38 @@ int distribute_packet(struct net_device *dev,
 			sh->recycle_queue = new_skb;
 			sh->recycle_count++;
 		}
+	} else if (new_skb) {
+		dev_kfree_skb_any(new_skb);
 	}
 #endif
 
 	/* inform other cpu which dev this skb was received on */
 	skb->dev = dev;
-	buf->buffer[buf->in] = skb;
-	buf->in = (buf->in + 1) % GFAR_CPU_BUFF_SIZE;
+	ring->buffer[idx] = skb;
 	smp_wmb();
-	buf->buff_cnt++;
-	spin_unlock_irq(&buf->lock);
-
-	/* raise other core's msg intr */
-	if (0 == cpu_dev->intr_coalesce_cnt++) {
-		time = ktime_set(0, 0);
-		time = ktime_add_ns(time, INTR_COALESCE_TIMEOUT);
-		hrtimer_start(&cpu_dev->intr_coalesce_timer,
-			time, HRTIMER_MODE_ABS);
-	} else {
-		if (cpu_dev->intr_coalesce_cnt == INTR_COALESCE_CNT) {
-			cpu_dev->intr_coalesce_cnt = 0;
-			hrtimer_cancel(&cpu_dev->intr_coalesce_timer);
-			fsl_send_msg(per_cpu
-			(gfar_cpu_dev, target_cpu).msg_virtual_rx, 0x1);
-		}
+	ring->head = head + 1;
+	ring->enqueued++;
+
+	/* raise the target's msg intr once per INTR_COALESCE_CNT packets,
+	 * or when the coalescing timer expires
+	 */
+	local_irq_save(flags);
+	if (ring->pending++ == 0) {
+		cpumask_set_cpu(target_cpu, &cpu_dev->doorbell_pending);
+		if (!hrtimer_active(&cpu_dev->intr_coalesce_timer))
+			hrtimer_start(&cpu_dev->intr_coalesce_timer,
+				ktime_set(0, INTR_COALESCE_TIMEOUT),
+				HRTIMER_MODE_REL_PINNED);
+	} else if (ring->pending >= INTR_COALESCE_CNT) {
+		ring->pending = 0;
+		cpumask_clear_cpu(target_cpu, &cpu_dev->doorbell_pending);
+		fsl_send_msg(per_cpu(gfar_cpu_dev, target_cpu).msg_virtual_rx,
+			0x1);
+		if (cpumask_empty(&cpu_dev->doorbell_pending))
+			hrtimer_try_to_cancel(&cpu_dev->intr_coalesce_timer);
 	}
+	local_irq_restore(flags);
+
 	return 0;
 }
 
@@ -1856,6 +2132,10 @@ static int gfar_probe(struct of_device *ofdev,
 	}
 
 	spin_lock_init(&priv->bflock);
+#ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
+	spin_lock_init(&priv->tcp_chl_lock);
+	priv->tcp_chl_min_rate = TCP_CHL_MIN_RATE;
+#endif
 	INIT_WORK(&priv->reset_task, gfar_reset_task);
 
 	dev_set_drvdata(&ofdev->dev, priv);
@@ -1910,9 +2190,16 @@ static int gfar_probe(struct of_device *ofdev,
 		netif_napi_add(dev, &priv->gfargrp[i].napi, gfar_poll, GFAR_DEV_WEIGHT);
 #endif
 
+	dev->features |= NETIF_F_GRO;
+
 	if (priv->device_flags & FSL_GIANFAR_DEV_HAS_CSUM) {
 		priv->rx_csum_enable = 1;
 		dev->features |= NETIF_F_IP_CSUM | NETIF_F_SG | NETIF_F_HIGHDMA;
+#ifndef CONFIG_RX_TX_BD_XNGE
+		/* TCP segmentation is done by gfar_tso_xmit(); FRAGLIST
+		 * lets forwarded GRO aggregates reach it unsegmented */
+		dev->features |= NETIF_F_TSO | NETIF_F_FRAGLIST;
+#endif
 	} else
 		priv->rx_csum_enable = 0;
 
@@ -2098,6 +2385,10 @@ static int gfar_probe(struct of_device *ofdev,
 	/* Initialize the filer table */
 	gfar_init_filer_table(priv);
 
+#ifdef CONFIG_GFAR_SW_PKT_STEERING
+	gfar_init_steer_table(priv);
+#endif
+
 	/* Create all the sysfs files */
 	gfar_init_sysfs(dev);
 
@@ -2784,14 +3075,10 @@ void free_bds(struct gfar_private *priv)
 			(sizeof(struct rxbd8) + sizeof(struct sk_buff *)) *
 			priv->total_rx_ring_size;
 #ifdef CONFIG_GIANFAR_L2SRAM
-	if (priv->bd_in_ram) {
-		dma_free_coherent(&priv->ofdev->dev,
+	cache_sram_client_free(CACHE_SRAM_GIANFAR, &priv->ofdev->dev,
 			region_size,
 			priv->tx_queue[0]->tx_bd_base,
 			priv->tx_queue[0]->tx_bd_dma_base);
-	} else {
-		mpc85xx_cache_sram_free(priv->tx_queue[0]->tx_bd_base);
-	}
 #else
 	dma_free_coherent(&priv->ofdev->dev,
 			region_size,
@@ -3668,6 +3955,11 @@ static int gfar_tso(struct sk_buff *skb, struct net_device *dev, int rq)
 		nskb = alloc_skb(hsize + doffset + headroom,
 					 GFP_ATOMIC);
 #endif
+		if (unlikely(!nskb)) {
+			dev->stats.tx_dropped++;
+			ret = NETDEV_TX_OK;
+			break;
+		}
 		skb_reserve(nskb, headroom);
 		__skb_put(nskb, doffset+hsize);
 
@@ -3731,12 +4023,15 @@ skip_fraglist:
 		iph->check = ip_fast_csum(skb_network_header(nskb), iph->ihl);
 		ret = gfar_xmit_skb(nskb, dev, rq);
 		if (unlikely(ret != NETDEV_TX_OK)) {
-			skb = nskb;
-			goto out_tso;
+			/* gfar_tso_xmit() made room for all segments, so
+			 * this is unexpected: drop the rest of the frame */
+			dev_kfree_skb_any(nskb);
+			dev->stats.tx_dropped++;
+			ret = NETDEV_TX_OK;
+			break;
 		}
 	} while ((offset += len) < skb->len);
 
-out_tso:
 
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	if (free_skb) {
@@ -3750,6 +4045,176 @@ out_tso:
 	return ret;
 }
 
+/*
+ * Segment a GRO aggregate of linear receive buffers, as gianfar's own,
+ * without copying the payload.  Such an aggregate is a header only skb
+ * whose frag_list holds one skb per received segment, with its payload
+ * right after the headers it arrived with.  The headers are rebuilt in
+ * place from those of the aggregate and each segment is sent as is.
+ */
+static int gfar_tso_frag_list(struct sk_buff *skb, struct net_device *dev,
+			      int rq)
+{
+	unsigned int hdrlen = skb_headlen(skb);
+	struct sk_buff *fskb, *next;
+	struct iphdr *iph;
+	struct tcphdr *th;
+	int first = 1;
+	u32 seq;
+	u16 id;
+
+	seq = ntohl(tcp_hdr(skb)->seq);
+	id = ntohs(ip_hdr(skb)->id);
+
+	fskb = skb_shinfo(skb)->frag_list;
+	skb_shinfo(skb)->frag_list = NULL;
+	skb->len = hdrlen;
+	skb->data_len = 0;
+
+	for (; fskb; fskb = next) {
+		unsigned int len = fskb->len;
+
+		next = fskb->next;
+		fskb->next = NULL;
+
+		memcpy(__skb_push(fskb, hdrlen), skb->data, hdrlen);
+		skb_reset_mac_header(fskb);
+		skb_set_network_header(fskb, skb_network_offset(skb));
+		skb_set_transport_header(fskb, skb_transport_offset(skb));
+		fskb->mac_len = skb->mac_len;
+		fskb->protocol = skb->protocol;
+		fskb->priority = skb->priority;
+		fskb->vlan_tci = skb->vlan_tci;
+		fskb->queue_mapping = skb->queue_mapping;
+		fskb->dev = dev;
+		fskb->ip_summed = CHECKSUM_PARTIAL;
+
+		iph = ip_hdr(fskb);
+		iph->id = htons(id++);
+		iph->tot_len = htons(fskb->len - skb_network_offset(fskb));
+		iph->check = 0;
+		iph->check = ip_fast_csum((u8 *)iph, iph->ihl);
+
+		th = tcp_hdr(fskb);
+		th->seq = htonl(seq);
+		seq += len;
+		if (!first)
+			th->cwr = 0;
+		first = 0;
+		if (next)
+			th->fin = th->psh = 0;
+		th->check = ~tcp_v4_check(fskb->len - skb_transport_offset(fskb),
+					  iph->saddr, iph->daddr, 0);
+
+		if (unlikely(gfar_xmit_skb(fskb, dev, rq) != NETDEV_TX_OK)) {
+			/* room was made for all segments, see gfar_tso_xmit() */
+			dev->stats.tx_dropped++;
+			dev_kfree_skb_any(fskb);
+			while ((fskb = next) != NULL) {
+				next = fskb->next;
+				dev_kfree_skb_any(fskb);
+			}
+			break;
+		}
+	}
+
+	dev_kfree_skb_any(skb);
+	return NETDEV_TX_OK;
+}
+
+/* Returns 1 if gfar_tso_frag_list() can send @skb, hdrlen being the
+ * length of its headers */
+static int gfar_frag_list_ok(struct sk_buff *skb, unsigned int hdrlen)
+{
+	unsigned int mss = skb_shinfo(skb)->gso_size;
+	struct sk_buff *fskb;
+
+	/* a clone shares the frag_list, whose headers are rewritten */
+	if (skb_shared(skb) || skb_cloned(skb) ||
+	    skb_headlen(skb) != hdrlen || skb_shinfo(skb)->nr_frags)
+		return 0;
+
+	skb_walk_frags(skb, fskb) {
+		if (skb_shared(fskb) || skb_cloned(fskb) || skb_is_nonlinear(fskb) ||
+		    fskb->len > mss ||
+		    skb_headroom(fskb) < hdrlen + GMAC_FCB_LEN)
+			return 0;
+	}
+	return 1;
+}
+
+/* Software segmentation, for what gfar_tso() and gfar_tso_frag_list()
+ * don't handle */
+static int gfar_gso_segment(struct sk_buff *skb, struct net_device *dev,
+			    int rq)
+{
+	struct sk_buff *segs, *next;
+
+	segs = skb_gso_segment(skb, dev->features &
+			       ~(NETIF_F_TSO | NETIF_F_FRAGLIST));
+	dev_kfree_skb_any(skb);
+	if (IS_ERR_OR_NULL(segs)) {
+		dev->stats.tx_dropped++;
+		return NETDEV_TX_OK;
+	}
+
+	for (; segs; segs = next) {
+		next = segs->next;
+		segs->next = NULL;
+		if (unlikely(gfar_xmit_skb(segs, dev, rq) != NETDEV_TX_OK)) {
+			dev->stats.tx_dropped++;
+			dev_kfree_skb_any(segs);
+		}
+	}
+	return NETDEV_TX_OK;
+}
+
+/*
+ * Transmit a TCP/IPv4 GSO frame, locally generated or a forwarded GRO
+ * aggregate.  All the TxBDs it needs are reserved up front: a header BD
+ * per segment plus, for page fragments, one per piece of a fragment a
+ * segment covers.  Frames that could never fit the ring are segmented
+ * in software.
+ */
+static int gfar_tso_xmit(struct sk_buff *skb, struct net_device *dev, int rq)
+{
+	struct gfar_private *priv = netdev_priv(dev);
+	struct gfar_priv_tx_q *tx_queue = priv->tx_queue[rq];
+	unsigned int hdrlen = skb_transport_offset(skb) + tcp_hdrlen(skb);
+	unsigned int mss = skb_shinfo(skb)->gso_size;
+	unsigned int bds;
+	struct sk_buff *fskb;
+	int frag_list = 0;
+
+	if (skb_has_frags(skb)) {
+		frag_list = gfar_frag_list_ok(skb, hdrlen);
+		if (!frag_list)
+			return gfar_gso_segment(skb, dev, rq);
+		bds = 0;
+		skb_walk_frags(skb, fskb)
+			bds++;
+	} else if (skb_headlen(skb) != hdrlen) {
+		/* gfar_tso() expects the payload in page fragments */
+		return gfar_gso_segment(skb, dev, rq);
+	} else {
+		bds = 2 * DIV_ROUND_UP(skb->len - hdrlen, mss) +
+		      skb_shinfo(skb)->nr_frags;
+	}
+
+	if (unlikely(bds > tx_queue->tx_ring_size))
+		return gfar_gso_segment(skb, dev, rq);
+
+	if (bds > tx_queue->num_txbdfree) {
+		netif_tx_stop_queue(netdev_get_tx_queue(dev, rq));
+		dev->stats.tx_fifo_errors++;
+		return NETDEV_TX_BUSY;
+	}
+
+	if (frag_list)
+		return gfar_tso_frag_list(skb, dev, rq);
+	return gfar_tso(skb, dev, rq);
+}
+
 /* This is called by the kernel when a frame is ready for transmission. */
 /* It is pointed to by the dev->hard_start_xmit function pointer */
 static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
@@ -3831,7 +4296,14 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	if (skb_shinfo(skb)->gso_size)
-		return gfar_tso(skb, dev, rq);
+		return gfar_tso_xmit(skb, dev, rq);
+
+	/* only GRO aggregates are meant to come with a frag_list */
+	if (unlikely(skb_has_frags(skb)) && __skb_linearize(skb)) {
+		dev->stats.tx_dropped++;
+		kfree_skb(skb);
+		return NETDEV_TX_OK;
+	}
 
 	/* total number of fragments in the SKB */
 	nr_frags = skb_shinfo(skb)->nr_frags;
@@ -3906,11 +4378,13 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	if (priv->ptimer_present) {
 		/* Enable ptp flag so that Tx time stamping happens */
-		if (gfar_ptp_do_txstamp(skb)) {
+		if (gfar_ptp_do_txstamp(skb) ||
+		    (priv->hwts_tx_en && skb_tx(skb)->hardware)) {
 			if (fcb == NULL)
 				fcb = gfar_add_fcb(skb);
 			fcb->ptp = 0x01;
 			lstatus |= BD_LFLAG(TXBD_TOE);
+			skb_tx(skb)->in_progress = 1;
 		}
 	}
 
@@ -4224,21 +4698,6 @@ static int gfar_accept_fastpath(struct net_device *dev, struct dst_entry *dst)
 
 	return 0;
 }
-
-static inline int neigh_is_valid(struct neighbour *neigh)
-{
-	return neigh->nud_state & NUD_VALID;
-}
-
-
-u32 gfar_fastroute_hash(u8 daddr, u8 saddr)
-{
-	u32 hash;
-
-	hash = ((u32)daddr ^ saddr) & NETDEV_FASTROUTE_HMASK;
-
-	return hash;
-}
 #endif
 
 
@@ -4253,8 +4712,7 @@ static inline int try_fastroute(struct sk_buff *skb,
 #ifdef CONFIG_NET_GIANFAR_FP
 	struct ethhdr *eth;
 	struct iphdr *iph;
-	unsigned int hash;
-	struct rtable *rt;
+	struct dst_entry *dst;
 	struct net_device *odev;
 	struct gfar_private *priv = netdev_priv(dev);
 	struct netdev_queue *txq = NULL;
@@ -4270,34 +4728,24 @@ static inline int try_fastroute(struct sk_buff *skb,
 
 	iph = (struct iphdr *)(skb->data + ETH_HLEN);
 
-	/* Generate the hash value */
-	hash = gfar_fastroute_hash((*(u8 *)&iph->daddr),
-				   (*(u8 *)&iph->saddr));
-
-#ifdef FASTPATH_DEBUG
-	printk(KERN_INFO "%s:  hash = %d (%d, %d)\n",
-	       __func__, hash, (*(u8 *)&iph->daddr), (*(u8 *)&iph->saddr));
-#endif
-	rt = (struct rtable *) (dev->fastpath[hash]);
-	/* Only support big endian */
-	if ((rt != NULL)
-	    && ((*(u32 *)(&iph->daddr))	== (*(u32 *)(&rt->rt_dst)))
-	    && ((*(u32 *)(&iph->saddr))	== (*(u32 *)(&rt->rt_src)))
-	    && !(rt->u.dst.obsolete > 0)) {
-		odev = rt->u.dst.dev;  /* get output device */
+	/* The flow cache validates the route and its neighbour; both
+	 * stay alive until rcu_read_unlock().
+	 */
+	rcu_read_lock();
+	dst = fastroute_lookup(dev, skb, iph);
+	if (dst) {
+		odev = dst->dev;  /* get output device */
 		ops = odev->netdev_ops;
 
 		/* Make sure the packet is:
 		 * 1) IPv4
 		 * 2) without any options (header length of 5)
 		 * 3) Not a multicast packet
-		 * 4) going to a valid destination
-		 * 5) Not out of time-to-live
+		 * 4) Not out of time-to-live
 		 */
 		if (iph->version == 4
 		    && iph->ihl == 5
 		    && (!(eth->h_dest[0] & 0x01))
-		    && neigh_is_valid(rt->u.dst.neighbour)
 		    && iph->ttl > 1) {
 
 			q_idx = skb_tx_hash(odev, skb);
@@ -4315,7 +4763,7 @@ static inline int try_fastroute(struct sk_buff *skb,
 
 				memcpy(eth->h_source, odev->dev_addr,
 				       MAC_ADDR_LEN);
-				memcpy(eth->h_dest, rt->u.dst.neighbour->ha,
+				memcpy(eth->h_dest, dst->neighbour->ha,
 				       MAC_ADDR_LEN);
 				skb->dev = odev;
 				if (likely(ops->ndo_start_xmit == gfar_start_xmit)) {
@@ -4333,9 +4781,11 @@ static inline int try_fastroute(struct sk_buff *skb,
 				if (netif_receive_skb(skb) == NET_RX_DROP)
 					priv->extra_stats.kernel_dropped++;
 			}
+			rcu_read_unlock();
 			return 1;
 		}
 	}
+	rcu_read_unlock();
 #endif /* CONFIG_NET_GIANFAR_FP */
 	return 0;
 }
@@ -4545,6 +4995,9 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 			bdp = next_txbd(bdp, base, tx_ring_size);
 		}
 
+		if (unlikely(skb_tx(skb)->in_progress))
+			gfar_ptp_tx_hwtstamp(priv, skb);
+
 #ifdef CONFIG_TCP_FAST_ACK
 		if (skb->sk &&
 		skb->truesize == SKB_DATA_ALIGN(MAX_TCP_HEADER) + sizeof(struct sk_buff) &&
@@ -4672,18 +5125,25 @@ static irqreturn_t gfar_transmit(int irq, void *grp_id)
 	unsigned long flags;
 
 	if (priv->sps) {
-		spin_lock_irqsave(&grp->grplock, flags);
-		if (tstat & (0x8000 >> !cpu))
-			fsl_send_msg(grp->msg_virtual_tx[!cpu], 0x1);
+		unsigned int txf = 0;
+		int i;
 
-		if (tstat & (0x8000 >> cpu))
-			if (napi_schedule_prep(&grp->napi_tx[cpu]))
+		spin_lock_irqsave(&grp->grplock, flags);
+		/* tx queue i belongs to cpu i */
+		for_each_online_cpu(i) {
+			if (!(tstat & (TSTAT_TXF0_MASK >> i)))
+				continue;
+			txf |= TSTAT_TXF0_MASK >> i;
+			if (i != cpu)
+				fsl_send_msg(grp->msg_virtual_tx[i], 0x1);
+			else if (napi_schedule_prep(&grp->napi_tx[cpu]))
 				__napi_schedule(&grp->napi_tx[cpu]);
+		}
 
 		gfar_write(&grp->regs->ievent, IEVENT_TX_MASK);
 
-		/* clear TXF0,TXF1 in TSTAT */
-		gfar_write(&grp->regs->tstat, (tstat & 0xC000));
+		/* clear the TXF bits of the serviced queues in TSTAT */
+		gfar_write(&grp->regs->tstat, txf);
 
 		spin_unlock_irqrestore(&grp->grplock, flags);
 	} else {
@@ -4838,6 +5298,9 @@ static inline void gfar_clean_reclaim_skb(struct sk_buff *skb)
 	skb_reset_tail_pointer(skb);
 	/* shared info clean up */
 	atomic_set(&(skb_shinfo(skb)->dataref), 1);
+	skb_shinfo(skb)->tx_flags.flags = 0;
+	skb_shinfo(skb)->hwtstamps.hwtstamp.tv64 = 0;
+	skb_shinfo(skb)->hwtstamps.syststamp.tv64 = 0;
 	/* We need the data buffer to be aligned properly.  We will
 	 * reserve as many bytes as needed to align the data properly
 	 */
@@ -5157,9 +5620,10 @@ irqreturn_t gfar_receive(int irq, void *grp_id)
 }
 
 /* gfar_process_frame() -- handle one incoming packet if skb
- * isn't NULL.  */
+ * isn't NULL.  Packets go through GRO on @napi, the context polling
+ * them, which flushes the merged packets when it completes.  */
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull)
+			      int amount_pull, struct napi_struct *napi)
 {
 	struct gfar_private *priv = netdev_priv(dev);
 	struct rxfcb *fcb = NULL;
@@ -5247,11 +5711,11 @@ drop_pkt:
 
 	/* Send the packet up the stack */
 	if (unlikely(priv->vlgrp && (fcb->flags & RXFCB_VLN)))
-		ret = vlan_hwaccel_receive_skb(skb, priv->vlgrp, fcb->vlctl);
+		ret = vlan_gro_receive(napi, priv->vlgrp, fcb->vlctl, skb);
 	else
-		ret = netif_receive_skb(skb);
+		ret = napi_gro_receive(napi, skb);
 
-	if (NET_RX_DROP == ret)
+	if (GRO_DROP == ret)
 		priv->extra_stats.kernel_dropped++;
 
 	return 0;
@@ -5416,19 +5880,23 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 							skb, amount_pull);
 					if (ret)
 						gfar_process_frame(dev,
-							skb, amount_pull);
+							skb, amount_pull,
+							gfar_rx_napi(rx_queue));
 				} else {
 					gfar_process_frame(dev,
-						skb, amount_pull);
+						skb, amount_pull,
+						gfar_rx_napi(rx_queue));
 				}
 #else
 #ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
 				if ((rx_queue->qindex >= TCP_CHL_OFFSET) &&
-					priv->tcp_hw_channel[rx_queue->qindex - TCP_CHL_OFFSET]) {
+					(rx_queue->qindex - TCP_CHL_OFFSET <
+					 priv->tcp_chl_num)) {
 					gfar_hwaccel_tcp4_receive(priv, rx_queue, skb, amount_pull);
 				} else
 #endif
-					gfar_process_frame(dev, skb, amount_pull);
+					gfar_process_frame(dev, skb, amount_pull,
+						gfar_rx_napi(rx_queue));
 #endif
 #ifdef CONFIG_RX_TX_BD_XNGE
 				newskb = skb->new_skb;
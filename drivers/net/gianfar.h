@@ -691,6 +691,10 @@ static inline int devfp_register_tx_hook(devfp_hook_t hook)
 #define TCP_CHL_NUM 5
 #define TCP_CHL_OFFSET 2
 #define RESERVE_CHL_NUM 3
+#define TCP_CHL_IDLE		(2 * HZ)	/* idle channels are reclaimed */
+#define TCP_CHL_RETRY		(HZ / 10)	/* backoff when all are busy */
+#define TCP_CHL_MIN_RATE	500		/* pkts/s protecting a channel */
+#define TCP_CHL_PIN_PORTS	8
 
 struct txbd8
 {
@@ -1309,6 +1313,30 @@ struct gfar_priv_grp {
 	u32 rstat_prev;
 };
 
+#ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
+/* A TCP flow bound to a dedicated rx queue by four filer entries.
+ * sk must stay the first member: sk->tcp_hw_channel points at it and
+ * sk_free() clears it through that pointer.
+ */
+struct gfar_tcp_channel {
+	struct sock *sk;
+	int pinned;
+	unsigned long hits;		/* packets delivered to the socket */
+	unsigned long misses;		/* packets that fell back to the stack */
+	unsigned long installs;
+	unsigned long evictions;
+	unsigned long last_hit;		/* jiffies */
+	unsigned long rate;		/* smoothed hits per second */
+	unsigned long rate_hits;	/* hits at rate_stamp */
+	unsigned long rate_stamp;	/* jiffies */
+};
+#endif
+
+#ifdef CONFIG_GFAR_SW_PKT_STEERING
+/* entries in the flow hash to cpu indirection table */
+#define GFAR_STEER_TABLE_SIZE 128
+#endif
+
 /* Struct stolen almost completely (and shamelessly) from the FCC enet source
  * (Ok, that's not so true anymore, but there is a family resemblence)
  * The GFAR buffer descriptors track the ring buffers.  The rx_bd_base
@@ -1346,8 +1374,13 @@ struct gfar_private {
 	u32 cur_filer_idx;
 #ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
 	u16 tcp_filer_idx;
-	u16 empty_tcp_channel;
-	struct sock *tcp_hw_channel[MAX_RX_QS];
+	u16 tcp_chl_num;
+	spinlock_t tcp_chl_lock;	/* channel table and their filer entries */
+	unsigned long tcp_chl_next_try;
+	unsigned long tcp_chl_alloc_fail;
+	unsigned int tcp_chl_min_rate;
+	u16 tcp_chl_pin_ports[TCP_CHL_PIN_PORTS];
+	struct gfar_tcp_channel tcp_hw_channel[TCP_CHL_NUM];
 #endif
 
 	/* wake up ring */
@@ -1414,15 +1447,16 @@ struct gfar_private {
 	struct gfar_regs_1588 __iomem *ptimer;
 	struct resource timer_resource;
 	uint32_t ptimer_present;
-#ifdef CONFIG_GIANFAR_L2SRAM
-	int bd_in_ram;
-#endif
+	/* SO_TIMESTAMPING, set by SIOCSHWTSTAMP */
+	unsigned int hwts_rx_en:1, hwts_tx_en:1;
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	unsigned int skbuff_truesize;
 	struct gfar_skb_handler skb_handler;
 #endif
 #ifdef CONFIG_GFAR_SW_PKT_STEERING
 	int sps; /*flag for s/w packet steering */
+	/* maps a flow hash to the cpu that processes the packet */
+	u8 steer_table[GFAR_STEER_TABLE_SIZE];
 #endif
 	u32 max_filer_rules;
 	u32 *ftp_rqfpr;
@@ -1432,31 +1466,45 @@ struct gfar_private {
 #ifdef CONFIG_GFAR_SW_PKT_STEERING
 #define INTR_COALESCE_CNT 22
 #define INTR_COALESCE_TIMEOUT 32000 /* in nSecs */
-#define GFAR_CPU_BUFF_SIZE 64
+#define GFAR_CPU_BUFF_SIZE 256	/* must be a power of two */
 
-/* producer-consumer buffer for inter cpu packet transfer */
-struct shared_buffer {
-	spinlock_t	lock;
-	struct sk_buff *buffer[GFAR_CPU_BUFF_SIZE];
-	int in;
-	int out;
-	unsigned int buff_cnt;
+/* Lock-free single producer/single consumer ring carrying received skbs
+ * from one cpu to another.  head is only written by the producing cpu,
+ * tail only by the consuming cpu; each side keeps its fields on its own
+ * cache line.  With skb recycling the consumer leaves a spare skb in the
+ * slot it empties, which the producer picks up when it reuses the slot.
+ */
+struct gfar_steer_ring {
+	/* producer side */
+	unsigned int head ____cacheline_aligned_in_smp;
+	unsigned int pending;		/* enqueued since last doorbell */
+	unsigned int max_used;		/* occupancy high watermark */
+	unsigned long enqueued;
+	unsigned long dropped;
+	/* consumer side */
+	unsigned int tail ____cacheline_aligned_in_smp;
+	unsigned long dequeued;
+	struct sk_buff *buffer[GFAR_CPU_BUFF_SIZE] ____cacheline_aligned_in_smp;
 };
 
 struct gfar_cpu_dev {
 	struct net_device dev;
 	struct napi_struct napi;
-	struct shared_buffer tx_queue;
-	int intr_coalesce_cnt;
+	/* rings[i] carries packets from this cpu to cpu i */
+	struct gfar_steer_ring *rings[NR_CPUS];
+	/* targets that have packets queued but no doorbell yet */
+	cpumask_t doorbell_pending;
 	struct hrtimer intr_coalesce_timer;
 	struct fsl_msg_unit *msg_virtual_rx;
 	char int_name[GFAR_INT_NAME_MAX];
+	int poll_start;
 	int enabled;
 #ifdef CONFIG_GFAR_SKBUFF_RECYCLING
 	struct gfar_skb_handler sh;
 #endif
 };
 
+DECLARE_PER_CPU(struct gfar_cpu_dev, gfar_cpu_dev);
 extern int rcv_pkt_steering;
 #endif
 
@@ -1530,6 +1578,8 @@ extern void gfar_ptp_cleanup(struct gfar_private *priv);
 extern int gfar_ptp_do_txstamp(struct sk_buff *skb);
 extern void pmuxcr_guts_write(void);
 extern void gfar_ptp_store_rxstamp(struct net_device *dev, struct sk_buff *skb);
+extern void gfar_ptp_tx_hwtstamp(struct gfar_private *priv, struct sk_buff *skb);
+extern int gfar_hwtstamp_ioctl(struct net_device *dev, struct ifreq *ifr);
 extern int gfar_ioctl_1588(struct net_device *dev, struct ifreq *ifr, int cmd);
 extern void gfar_phy_test(struct mii_bus *bus, struct phy_device *phydev,
 		int enable, u32 regnum, u32 read);
@@ -1538,12 +1588,14 @@ extern void gfar_configure_tx_coalescing(struct gfar_private *priv,
 extern void gfar_configure_rx_coalescing(struct gfar_private *priv,
 					long unsigned int rx_mask);
 void gfar_init_sysfs(struct net_device *dev);
+#ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
+extern void gfar_tcp_chl_update_rate(struct gfar_tcp_channel *chl,
+					unsigned long now);
+extern int gfar_tcp_chl_set_pin(struct gfar_private *priv, int ch, int pin);
+#endif
 
 extern void gfar_1588_proc_init(struct of_device_id *dev_id, int cnt);
 extern void gfar_1588_proc_exit(void);
 extern const struct ethtool_ops gfar_ethtool_ops;
 
-#ifdef CONFIG_NET_GIANFAR_FP
-extern int netdev_fastroute;
-#endif
 #endif /* __GIANFAR_H */
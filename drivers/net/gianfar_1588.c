@@ -18,6 +18,11 @@
 
 #include <linux/vmalloc.h>
 #include <linux/of.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/math64.h>
+#include <linux/net_tstamp.h>
+#include <linux/gianfar_ptp.h>
 #include "gianfar.h"
 #include <linux/of_platform.h>
 
@@ -51,6 +56,37 @@ static struct proc_dir_entry *gfar_1588_proc_file;
 static struct gfar_node_info_t gfar_node;
 static struct gfar_1588_data_t gfar_1588_data;
 
+/*
+ * All the eTSECs are stamped by the one timer in the eTSEC1 block, so
+ * there is a single clock device, bound to the first controller that
+ * maps the timer.  Event message stamps of every port are queued on its
+ * ring while the device is open.
+ */
+#define GFAR_PTP_TS_RING	256	/* power of two */
+
+struct gfar_ptp_clock {
+	struct miscdevice misc;
+	struct gfar_private *priv;
+	spinlock_t lock;		/* timer registers, priv and the ring */
+	wait_queue_head_t wait;
+	atomic_t users;
+	unsigned int head, tail;
+	struct gfar_ptp_ts ring[GFAR_PTP_TS_RING];
+};
+
+static const struct file_operations gfar_ptp_clock_fops;
+
+static struct gfar_ptp_clock gfar_ptp_clk = {
+	.misc = {
+		.minor	= MISC_DYNAMIC_MINOR,
+		.name	= "gfar_ptp",
+		.fops	= &gfar_ptp_clock_fops,
+	},
+	.lock	= __SPIN_LOCK_UNLOCKED(gfar_ptp_clk.lock),
+	.wait	= __WAIT_QUEUE_HEAD_INITIALIZER(gfar_ptp_clk.wait),
+	.users	= ATOMIC_INIT(0),
+};
+
 /*64 bites add and return the result*/
 static u64 add64_oper(u64 addend, u64 augend)
 {
@@ -128,11 +164,29 @@ int gfar_ptp_init(struct gfar_private *priv)
 			gfar_ptp_init_circ(&(priv->rx_time_pdel_req)) ||
 			gfar_ptp_init_circ(&(priv->rx_time_pdel_resp)))
 		return 1;
+
+	if (gfar_ptp_clk.priv == NULL) {
+		gfar_ptp_clk.priv = priv;
+		if (misc_register(&gfar_ptp_clk.misc)) {
+			printk(KERN_ERR "1588: Cannot register %s device\n",
+					gfar_ptp_clk.misc.name);
+			gfar_ptp_clk.priv = NULL;
+		}
+	}
 	return 0;
 }
 
 void gfar_ptp_cleanup(struct gfar_private *priv)
 {
+	unsigned long flags;
+
+	if (gfar_ptp_clk.priv == priv) {
+		misc_deregister(&gfar_ptp_clk.misc);
+		spin_lock_irqsave(&gfar_ptp_clk.lock, flags);
+		gfar_ptp_clk.priv = NULL;
+		spin_unlock_irqrestore(&gfar_ptp_clk.lock, flags);
+	}
+
 	if (priv->ptimer != NULL)
 		iounmap(priv->ptimer);
 
@@ -165,6 +219,37 @@ int gfar_ptp_do_txstamp(struct sk_buff *skb)
 	return 0;
 }
 
+static inline u64 gfar_ptp_ns(const struct gfar_ptp_time *t)
+{
+	return ((u64)t->high << 32) | t->low;
+}
+
+/* Queue the stamp of the PTP event message at skb->data for the reader */
+static void gfar_ptp_clock_record(struct net_device *dev,
+		struct sk_buff *skb, u64 ns, u8 dir)
+{
+	struct gfar_ptp_clock *clk = &gfar_ptp_clk;
+	struct gfar_ptp_ts *ts;
+	unsigned long flags;
+
+	if (!atomic_read(&clk->users))
+		return;
+
+	spin_lock_irqsave(&clk->lock, flags);
+	/* overwrite the oldest stamp when the reader falls behind */
+	if (clk->head - clk->tail == GFAR_PTP_TS_RING)
+		clk->tail++;
+	ts = &clk->ring[clk->head++ & (GFAR_PTP_TS_RING - 1)];
+	ts->ns = ns;
+	ts->ifindex = dev->ifindex;
+	ts->seq_id = *((u16 *)(skb->data + GFAR_PTP_SEQ_ID_OFFS));
+	ts->msg_type = *((u8 *)(skb->data + GFAR_PTP_MSG_TYPE_OFFS)) & 0x0F;
+	ts->dir = dir;
+	spin_unlock_irqrestore(&clk->lock, flags);
+
+	wake_up_interruptible(&clk->wait);
+}
+
 void gfar_ptp_store_rxstamp(struct net_device *dev, struct sk_buff *skb)
 {
 	int msg_type, seq_id, control;
@@ -173,6 +258,12 @@ void gfar_ptp_store_rxstamp(struct net_device *dev, struct sk_buff *skb)
 	u16 udp_port;
 	char pkt_type;
 
+	tmp_rx_time.item.high = *((u32 *)skb->data);
+	tmp_rx_time.item.low = *(((u32 *)skb->data) + 1);
+	if (priv->hwts_rx_en)
+		skb_hwtstamps(skb)->hwtstamp =
+			ns_to_ktime(gfar_ptp_ns(&tmp_rx_time.item));
+
 	pkt_type = *(((char *)skb->data) + GFAR_PTP_PKT_TYPE_OFFS);
 	udp_port = *((u16 *)(skb->data + GFAR_PTP_PORT_OFFS));
 	seq_id = *((u16 *)(skb->data + GFAR_PTP_SEQ_ID_OFFS));
@@ -181,8 +272,8 @@ void gfar_ptp_store_rxstamp(struct net_device *dev, struct sk_buff *skb)
 	/* Check if port is 319 for PTP Event, and check for UDP */
 	if ((udp_port == 0x13F) && (pkt_type == GFAR_PACKET_TYPE_UDP)) {
 		tmp_rx_time.key = seq_id;
-		tmp_rx_time.item.high = *((u32 *)skb->data);
-		tmp_rx_time.item.low = *(((u32 *)skb->data) + 1);
+		gfar_ptp_clock_record(dev, skb, gfar_ptp_ns(&tmp_rx_time.item),
+				GFAR_PTP_TS_RX);
 
 		switch (control) {
 
@@ -379,6 +470,75 @@ static void gfar_get_tx_timestamp(struct gfar __iomem *regs,
 	}
 }
 
+/*
+ * Called from TX cleanup for a frame sent with fcb->ptp set.  The stamp
+ * of the last frame is latched in TMR_TXTS1/2, which is good enough at
+ * PTP message rates.  skb->data still starts with the FCB, so the PTP
+ * offsets are the same as for a received frame with its stamp prefix;
+ * the FCB is pulled before the frame is looped back to the socket.
+ */
+void gfar_ptp_tx_hwtstamp(struct gfar_private *priv, struct sk_buff *skb)
+{
+	struct skb_shared_hwtstamps shhwtstamps;
+	struct gfar_ptp_time tx_time;
+
+	gfar_get_tx_timestamp(priv->gfargrp[0].regs, &tx_time);
+
+	if (gfar_ptp_do_txstamp(skb))
+		gfar_ptp_clock_record(priv->ndev, skb, gfar_ptp_ns(&tx_time),
+				GFAR_PTP_TS_TX);
+
+	if (skb_tx(skb)->hardware) {
+		memset(&shhwtstamps, 0, sizeof(shhwtstamps));
+		shhwtstamps.hwtstamp = ns_to_ktime(gfar_ptp_ns(&tx_time));
+		skb_pull(skb, GMAC_FCB_LEN);
+		skb_tstamp_tx(skb, &shhwtstamps);
+	}
+}
+
+/* SIOCSHWTSTAMP: enable SO_TIMESTAMPING hardware stamps */
+int gfar_hwtstamp_ioctl(struct net_device *dev, struct ifreq *ifr)
+{
+	struct gfar_private *priv = netdev_priv(dev);
+	struct hwtstamp_config config;
+
+	if (copy_from_user(&config, ifr->ifr_data, sizeof(config)))
+		return -EFAULT;
+
+	/* reserved for future extensions */
+	if (config.flags)
+		return -EINVAL;
+
+	switch (config.tx_type) {
+	case HWTSTAMP_TX_OFF:
+		priv->hwts_tx_en = 0;
+		break;
+	case HWTSTAMP_TX_ON:
+		if (!priv->ptimer_present)
+			return -ERANGE;
+		priv->hwts_tx_en = 1;
+		break;
+	default:
+		return -ERANGE;
+	}
+
+	switch (config.rx_filter) {
+	case HWTSTAMP_FILTER_NONE:
+		priv->hwts_rx_en = 0;
+		break;
+	default:
+		if (!priv->ptimer_present)
+			return -ERANGE;
+		/* the timer stamps every frame the controller receives */
+		priv->hwts_rx_en = 1;
+		config.rx_filter = HWTSTAMP_FILTER_ALL;
+		break;
+	}
+
+	return copy_to_user(ifr->ifr_data, &config, sizeof(config)) ?
+		-EFAULT : 0;
+}
+
 static uint8_t gfar_get_rx_time(struct gfar_private *priv, struct ifreq *ifr,
 		struct gfar_ptp_time *rx_time, int mode)
 {
@@ -538,6 +698,177 @@ int gfar_ioctl_1588(struct net_device *dev, struct ifreq *ifr, int cmd)
 	return retval;
 }
 
+static int gfar_ptp_clock_open(struct inode *inode, struct file *file)
+{
+	struct gfar_ptp_clock *clk = &gfar_ptp_clk;
+	unsigned long flags;
+
+	if (atomic_inc_return(&clk->users) == 1) {
+		/* drop whatever a previous reader left behind */
+		spin_lock_irqsave(&clk->lock, flags);
+		clk->tail = clk->head;
+		spin_unlock_irqrestore(&clk->lock, flags);
+	}
+	return 0;
+}
+
+static int gfar_ptp_clock_release(struct inode *inode, struct file *file)
+{
+	atomic_dec(&gfar_ptp_clk.users);
+	return 0;
+}
+
+static ssize_t gfar_ptp_clock_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct gfar_ptp_clock *clk = &gfar_ptp_clk;
+	struct gfar_ptp_ts ts[16];
+	size_t max = count / sizeof(*ts), done = 0, n, i;
+	int err;
+
+	if (!max)
+		return -EINVAL;
+
+	if (file->f_flags & O_NONBLOCK) {
+		if (clk->head == clk->tail)
+			return -EAGAIN;
+	} else {
+		err = wait_event_interruptible(clk->wait,
+				clk->head != clk->tail);
+		if (err)
+			return err;
+	}
+
+	while (done < max) {
+		spin_lock_irq(&clk->lock);
+		n = min_t(size_t, clk->head - clk->tail,
+				min_t(size_t, max - done, ARRAY_SIZE(ts)));
+		for (i = 0; i < n; i++)
+			ts[i] = clk->ring[clk->tail++ & (GFAR_PTP_TS_RING - 1)];
+		spin_unlock_irq(&clk->lock);
+
+		if (!n)
+			break;
+		if (copy_to_user(buf + done * sizeof(*ts), ts, n * sizeof(*ts)))
+			return done ? done * sizeof(*ts) : -EFAULT;
+		done += n;
+	}
+
+	return done * sizeof(*ts);
+}
+
+static unsigned int gfar_ptp_clock_poll(struct file *file, poll_table *wait)
+{
+	struct gfar_ptp_clock *clk = &gfar_ptp_clk;
+
+	poll_wait(file, &clk->wait, wait);
+	return clk->head != clk->tail ? POLLIN | POLLRDNORM : 0;
+}
+
+/* Called with clk->lock held */
+static u64 gfar_ptp_clock_get(struct gfar_private *priv)
+{
+	struct gfar_ptp_time cnt;
+
+	gfar_get_curr_cnt(priv->ptimer, &cnt);
+	return gfar_ptp_ns(&cnt);
+}
+
+static void gfar_ptp_clock_set(struct gfar_private *priv, u64 ns)
+{
+	struct gfar_ptp_time cnt;
+
+	cnt.high = ns >> 32;
+	cnt.low = (u32)ns;
+	gfar_set_1588cnt(priv->ndev, &cnt);
+}
+
+static long gfar_ptp_clock_ioctl(struct file *file, unsigned int cmd,
+		unsigned long arg)
+{
+	struct gfar_ptp_clock *clk = &gfar_ptp_clk;
+	void __user *argp = (void __user *)arg;
+	struct gfar_ptp_clock_time t;
+	unsigned long flags;
+	s64 delta = 0;
+	s32 ppb = 0;
+	u64 ns = 0;
+	u32 rem;
+	int err = 0;
+
+	switch (cmd) {
+	case GFAR_PTP_GETTIME:
+	case GFAR_PTP_FLUSH:
+		break;
+	case GFAR_PTP_SETTIME:
+		if (copy_from_user(&t, argp, sizeof(t)))
+			return -EFAULT;
+		if (t.sec < 0 || t.nsec >= NSEC_PER_SEC)
+			return -EINVAL;
+		ns = (u64)t.sec * NSEC_PER_SEC + t.nsec;
+		break;
+	case GFAR_PTP_ADJTIME:
+		if (copy_from_user(&delta, argp, sizeof(delta)))
+			return -EFAULT;
+		break;
+	case GFAR_PTP_ADJFREQ:
+		if (get_user(ppb, (s32 __user *)argp))
+			return -EFAULT;
+		if (ppb > TMR_PTPD_MAX_FREQ || ppb < -TMR_PTPD_MAX_FREQ)
+			return -ERANGE;
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	spin_lock_irqsave(&clk->lock, flags);
+	if (clk->priv == NULL) {
+		err = -ENODEV;
+		goto out;
+	}
+
+	switch (cmd) {
+	case GFAR_PTP_GETTIME:
+		ns = gfar_ptp_clock_get(clk->priv);
+		break;
+	case GFAR_PTP_SETTIME:
+		gfar_ptp_clock_set(clk->priv, ns);
+		break;
+	case GFAR_PTP_ADJTIME:
+		gfar_ptp_clock_set(clk->priv,
+				gfar_ptp_clock_get(clk->priv) + delta);
+		break;
+	case GFAR_PTP_ADJFREQ:
+		/* TMR_ADD scales the timer rate, freq_compensation is nominal */
+		gfar_write(&clk->priv->ptimer->tmr_add, freq_compensation +
+			div_s64((s64)freq_compensation * ppb, NSEC_PER_SEC));
+		break;
+	case GFAR_PTP_FLUSH:
+		clk->tail = clk->head;
+		break;
+	}
+out:
+	spin_unlock_irqrestore(&clk->lock, flags);
+
+	if (!err && cmd == GFAR_PTP_GETTIME) {
+		t.sec = div_u64_rem(ns, NSEC_PER_SEC, &rem);
+		t.nsec = rem;
+		t.reserved = 0;
+		if (copy_to_user(argp, &t, sizeof(t)))
+			err = -EFAULT;
+	}
+	return err;
+}
+
+static const struct file_operations gfar_ptp_clock_fops = {
+	.owner		= THIS_MODULE,
+	.open		= gfar_ptp_clock_open,
+	.release	= gfar_ptp_clock_release,
+	.read		= gfar_ptp_clock_read,
+	.poll		= gfar_ptp_clock_poll,
+	.unlocked_ioctl	= gfar_ptp_clock_ioctl,
+};
+
 /* 1588 Module intialization and filer table populating routine*/
 void gfar_1588_start(struct net_device *dev)
 {
@@ -361,6 +361,230 @@ static ssize_t gfar_show_max_filer_rules(struct device *dev,
 static DEVICE_ATTR(max_filer_rules, 0444, gfar_show_max_filer_rules,
 				NULL);
 
+#ifdef CONFIG_GFAR_SW_PKT_STEERING
+static ssize_t gfar_show_steer_table(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < GFAR_STEER_TABLE_SIZE; i++)
+		len += sprintf(buf + len, "%d%c", priv->steer_table[i],
+			       (i % 16 == 15) ? '\n' : ' ');
+
+	return len;
+}
+
+/* Takes a list of cpus and repeats it over the whole indirection table,
+ * e.g. "0 1 1" sends one third of the flows to cpu 0 and the rest to
+ * cpu 1.
+ */
+static ssize_t gfar_set_steer_table(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	u8 cpus[GFAR_STEER_TABLE_SIZE];
+	const char *p = buf;
+	char *end;
+	unsigned long cpu;
+	int i, n = 0;
+
+	while (n < GFAR_STEER_TABLE_SIZE) {
+		while (*p == ' ' || *p == '\t' || *p == '\n')
+			p++;
+		if (p >= buf + count || !*p)
+			break;
+		cpu = simple_strtoul(p, &end, 0);
+		if (end == p || cpu >= nr_cpu_ids || !cpu_online(cpu))
+			return -EINVAL;
+		cpus[n++] = cpu;
+		p = end;
+	}
+
+	if (!n)
+		return -EINVAL;
+
+	for (i = 0; i < GFAR_STEER_TABLE_SIZE; i++)
+		priv->steer_table[i] = cpus[i % n];
+
+	return count;
+}
+
+static DEVICE_ATTR(steer_table, 0644, gfar_show_steer_table,
+		   gfar_set_steer_table);
+
+/* The rings are shared by all gianfar devices, one per (src, dst) pair */
+static ssize_t gfar_show_steer_rings(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct gfar_steer_ring *ring;
+	ssize_t len;
+	int src, dst;
+
+	len = scnprintf(buf, PAGE_SIZE,
+			"src dst   used    max   enqueued   dequeued    dropped\n");
+	for_each_online_cpu(src) {
+		for_each_online_cpu(dst) {
+			ring = per_cpu(gfar_cpu_dev, src).rings[dst];
+			if (!ring)
+				continue;
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					 "%3d %3d %6u %6u %10lu %10lu %10lu\n",
+					 src, dst, ring->head - ring->tail,
+					 ring->max_used, ring->enqueued,
+					 ring->dequeued, ring->dropped);
+		}
+	}
+
+	return len;
+}
+
+static DEVICE_ATTR(steer_rings, 0444, gfar_show_steer_rings, NULL);
+#endif
+
+#ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
+static ssize_t gfar_show_tcp_channels(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	struct gfar_tcp_channel *chl;
+	unsigned long now = jiffies;
+	struct sock *sk;
+	ssize_t len;
+	int i;
+
+	len = scnprintf(buf, PAGE_SIZE, "ch pin %21s %21s %8s %10s %10s "
+			"%8s %8s\n", "local", "remote", "rate", "hits",
+			"misses", "installs", "evicts");
+
+	spin_lock_bh(&priv->tcp_chl_lock);
+	for (i = 0; i < priv->tcp_chl_num; i++) {
+		chl = &priv->tcp_hw_channel[i];
+		gfar_tcp_chl_update_rate(chl, now);
+		sk = chl->sk;
+		if (sk)
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+				"%2d %3d %15pI4:%-5u %15pI4:%-5u ", i,
+				chl->pinned, &inet_sk(sk)->inet_rcv_saddr,
+				ntohs(inet_sk(sk)->inet_sport),
+				&inet_sk(sk)->inet_daddr,
+				ntohs(inet_sk(sk)->inet_dport));
+		else
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+				"%2d %3d %21s %21s ", i, 0, "-", "-");
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%8lu %10lu %10lu %8lu %8lu\n", chl->rate,
+				 chl->hits, chl->misses, chl->installs,
+				 chl->evictions);
+	}
+	len += scnprintf(buf + len, PAGE_SIZE - len, "alloc_fail %lu\n",
+			 priv->tcp_chl_alloc_fail);
+	spin_unlock_bh(&priv->tcp_chl_lock);
+
+	return len;
+}
+
+static DEVICE_ATTR(tcp_channels, 0444, gfar_show_tcp_channels, NULL);
+
+/* "<channel> <0|1>" pins or unpins the flow currently on a channel */
+static ssize_t gfar_set_tcp_chl_pin(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	int ch, pin, err;
+
+	if (sscanf(buf, "%d %d", &ch, &pin) != 2)
+		return -EINVAL;
+
+	err = gfar_tcp_chl_set_pin(priv, ch, pin);
+
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(tcp_chl_pin, 0200, NULL, gfar_set_tcp_chl_pin);
+
+static ssize_t gfar_show_tcp_chl_pin_ports(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < TCP_CHL_PIN_PORTS; i++)
+		if (priv->tcp_chl_pin_ports[i])
+			len += sprintf(buf + len, "%u ",
+				       priv->tcp_chl_pin_ports[i]);
+	len += sprintf(buf + len, "\n");
+
+	return len;
+}
+
+/* Flows whose local port is on this list are pinned when they get a
+ * channel; an empty write clears the list.
+ */
+static ssize_t gfar_set_tcp_chl_pin_ports(struct device *dev,
+					  struct device_attribute *attr,
+					  const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+	u16 ports[TCP_CHL_PIN_PORTS];
+	const char *p = buf;
+	char *end;
+	unsigned long port;
+	int n = 0;
+
+	memset(ports, 0, sizeof(ports));
+	while (1) {
+		while (*p == ' ' || *p == '\t' || *p == '\n')
+			p++;
+		if (p >= buf + count || !*p)
+			break;
+		port = simple_strtoul(p, &end, 0);
+		if (end == p || !port || port > 0xffff ||
+		    n >= TCP_CHL_PIN_PORTS)
+			return -EINVAL;
+		ports[n++] = port;
+		p = end;
+	}
+
+	spin_lock_bh(&priv->tcp_chl_lock);
+	memcpy(priv->tcp_chl_pin_ports, ports, sizeof(ports));
+	spin_unlock_bh(&priv->tcp_chl_lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(tcp_chl_pin_ports, 0644, gfar_show_tcp_chl_pin_ports,
+		   gfar_set_tcp_chl_pin_ports);
+
+static ssize_t gfar_show_tcp_chl_min_rate(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+
+	return sprintf(buf, "%u\n", priv->tcp_chl_min_rate);
+}
+
+static ssize_t gfar_set_tcp_chl_min_rate(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct gfar_private *priv = netdev_priv(to_net_dev(dev));
+
+	priv->tcp_chl_min_rate = simple_strtoul(buf, NULL, 0);
+
+	return count;
+}
+
+static DEVICE_ATTR(tcp_chl_min_rate, 0644, gfar_show_tcp_chl_min_rate,
+		   gfar_set_tcp_chl_min_rate);
+#endif
+
 void gfar_init_sysfs(struct net_device *dev)
 {
 	struct gfar_private *priv = netdev_priv(dev);
@@ -382,6 +606,16 @@ void gfar_init_sysfs(struct net_device *dev)
 	rc |= device_create_file(&dev->dev, &dev_attr_recycle_max);
 #endif
 	rc |= device_create_file(&dev->dev, &dev_attr_max_filer_rules);
+#ifdef CONFIG_GFAR_SW_PKT_STEERING
+	rc |= device_create_file(&dev->dev, &dev_attr_steer_table);
+	rc |= device_create_file(&dev->dev, &dev_attr_steer_rings);
+#endif
+#ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
+	rc |= device_create_file(&dev->dev, &dev_attr_tcp_channels);
+	rc |= device_create_file(&dev->dev, &dev_attr_tcp_chl_pin);
+	rc |= device_create_file(&dev->dev, &dev_attr_tcp_chl_pin_ports);
+	rc |= device_create_file(&dev->dev, &dev_attr_tcp_chl_min_rate);
+#endif
 	if (rc)
 		dev_err(&dev->dev, "Error creating gianfar sysfs files.\n");
 }
@@ -42,6 +42,7 @@
 #include <linux/dma-mapping.h>
 #include <linux/spinlock.h>
 #include <sysdev/fsl_soc.h>
+#include <asm/fsl_85xx_cache_sram.h>
 
 #include "tdm_fsl_starlite.h"
 
@@ -287,7 +288,8 @@ static int init_tdm(struct tdm_priv *priv)
 	 */
 	buf_size = TDM_BUF_SIZE(priv->cfg.num_ch, priv->cfg.ch_width,
 			 priv->cfg.num_frames);
-	buf = dma_alloc_coherent(priv->device, buf_size, &physaddr, GFP_KERNEL);
+	buf = cache_sram_client_alloc(CACHE_SRAM_TDM, priv->device, buf_size,
+				      &physaddr, ALIGNED_32_BYTES);
 	if (!buf) {
 		ret = -ENOMEM;
 		goto err_alloc_ip;
@@ -296,7 +298,8 @@ static int init_tdm(struct tdm_priv *priv)
 	priv->dma_input_vaddr = buf;
 	priv->tdm_input_data = ALIGN_ADDRESS(buf, ALIGNED_8_BYTES);
 
-	buf = dma_alloc_coherent(priv->device, buf_size, &physaddr, GFP_KERNEL);
+	buf = cache_sram_client_alloc(CACHE_SRAM_TDM, priv->device, buf_size,
+				      &physaddr, ALIGNED_32_BYTES);
 	if (!buf) {
 		ret = -ENOMEM;
 		goto err_alloc_op;
@@ -343,11 +346,11 @@ err_alloc_tx:
 	dma_free_coherent(priv->device, NUM_OF_TDM_BUF * TCD_BUFFER_SIZE,
 		priv->dma_rx_tcd_vaddr, priv->dma_rx_tcd_paddr);
 err_alloc_rx:
-	dma_free_coherent(priv->device, buf_size, priv->dma_output_vaddr,
-			  priv->dma_output_paddr);
+	cache_sram_client_free(CACHE_SRAM_TDM, priv->device, buf_size,
+			       priv->dma_output_vaddr, priv->dma_output_paddr);
 err_alloc_op:
-	dma_free_coherent(priv->device, buf_size, priv->dma_input_vaddr,
-			  priv->dma_input_paddr);
+	cache_sram_client_free(CACHE_SRAM_TDM, priv->device, buf_size,
+			       priv->dma_input_vaddr, priv->dma_input_paddr);
 err_alloc_ip:
 	return ret;
 }
@@ -746,10 +749,10 @@ static int __devexit tdm_fsl_starlite_remove(struct of_device *ofdev)
 	buf_size =
 	    TDM_BUF_SIZE(priv->cfg.num_ch, priv->cfg.ch_width,
 			 priv->cfg.num_frames);
-	dma_free_coherent(priv->device, buf_size, priv->dma_input_vaddr,
-			  priv->dma_input_paddr);
-	dma_free_coherent(priv->device, buf_size, priv->dma_output_vaddr,
-			  priv->dma_output_paddr);
+	cache_sram_client_free(CACHE_SRAM_TDM, priv->device, buf_size,
+			       priv->dma_input_vaddr, priv->dma_input_paddr);
+	cache_sram_client_free(CACHE_SRAM_TDM, priv->device, buf_size,
+			       priv->dma_output_vaddr, priv->dma_output_paddr);
 
 	/* free the TCDs */
 	dma_free_coherent(priv->device, NUM_OF_TDM_BUF * TCD_BUFFER_SIZE,
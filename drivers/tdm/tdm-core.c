@@ -35,9 +35,15 @@
 #include <linux/irqflags.h>
 #include <linux/list.h>
 #include <linux/smp_lock.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
 #include <asm/uaccess.h>
 #include <linux/io.h>
 
+#include "tdm-interleave.h"
+
 /*
  * core_lock protects tdm_adapter_idr, and guarantees that device,
  * deletion of devices, and attach_adapter and detach_adapter calls
@@ -54,6 +60,13 @@ static int use_latest_tdm_data = 1;
 
 static void tdm_data_tasklet_fn(unsigned long);
 
+/* slots per row of the TDM buffer */
+#define TDM_STRIDE	(ALIGN(TDM_ACTIVE_CHANNELS * TDM_SLOT_WIDTH, 8) / \
+				TDM_SLOT_WIDTH)
+
+/* source for the slots that have nothing to send */
+static const u16 tdm_silence[NUM_OF_FRAMES];
+
 static int tdm_device_match(struct tdm_driver *driver, struct tdm_adapter *adap)
 {
 	/* match on an id table if there is one */
@@ -542,6 +555,233 @@ void tdm_put_adapter(struct tdm_adapter *adap)
 }
 EXPORT_SYMBOL(tdm_put_adapter);
 
+/*
+ * mmap ring
+ *
+ * A port switches to the shared ring on its first mmap().  The
+ * de-interleave and interleave functions then move PCM data straight
+ * between the TDM frame buffers and the mapped area, and the application
+ * only touches the head/tail indices in the header page, so there is no
+ * syscall and no extra copy per processing cycle.  Kernel owned indices
+ * are kept in tdm_port_ring as well; the copies in the shared header are
+ * only ever written, never trusted.
+ */
+struct tdm_port_ring {
+	struct tdm_ring_hdr *hdr;	/* start of the vmalloc_user() area */
+	unsigned long size;
+	u8 *rx_buf;
+	u8 *tx_buf;
+	unsigned int nr_frames;
+	unsigned int frame_size;	/* bytes per buffer */
+	u32 rx_head;
+	u32 tx_tail;
+	unsigned int rx_off;		/* bytes filled in the rx_head buffer */
+	unsigned int tx_off;		/* bytes sent from the tx_tail buffer */
+};
+
+/* serializes ring creation against concurrent mmap() of one port */
+static DEFINE_MUTEX(tdm_ring_lock);
+
+static struct tdm_port_ring *tdm_ring_alloc(struct tdm_port *port)
+{
+	struct tdm_port_ring *ring;
+	struct tdm_ring_hdr *hdr;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return NULL;
+
+	ring->nr_frames = port->ring_frames;
+	/* in full mode a buffer is the whole unchannelised TDM buffer */
+	if (port->driver->adapter->adap_mode & TDM_ADAPTER_MODE_FULL)
+		ring->frame_size = TDM_FULL_BUF_SIZE;
+	else
+		ring->frame_size = port->rx_max_frames * port->slot_width;
+	ring->size = PAGE_SIZE +
+		PAGE_ALIGN(2 * ring->nr_frames * ring->frame_size);
+
+	hdr = vmalloc_user(ring->size);
+	if (!hdr) {
+		kfree(ring);
+		return NULL;
+	}
+
+	hdr->nr_frames = ring->nr_frames;
+	hdr->frame_size = ring->frame_size;
+	hdr->rx_offset = PAGE_SIZE;
+	hdr->tx_offset = PAGE_SIZE + ring->nr_frames * ring->frame_size;
+
+	ring->hdr = hdr;
+	ring->rx_buf = (u8 *)hdr + hdr->rx_offset;
+	ring->tx_buf = (u8 *)hdr + hdr->tx_offset;
+
+	return ring;
+}
+
+static void tdm_ring_free(struct tdm_port_ring *ring)
+{
+	vfree(ring->hdr);
+	kfree(ring);
+}
+
+int tdm_port_mmap(void *h_port, struct vm_area_struct *vma)
+{
+	struct tdm_port *port = (struct tdm_port *)h_port;
+	struct tdm_port_ring *ring;
+	int res;
+
+	if (port == NULL) { /* invalid handle*/
+		pr_err("Invalid Handle\n");
+		return -ENXIO;
+	}
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	mutex_lock(&tdm_ring_lock);
+	ring = port->ring;
+	if (!ring) {
+		ring = tdm_ring_alloc(port);
+		if (!ring) {
+			res = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (vma->vm_end - vma->vm_start != ring->size) {
+		res = -EINVAL;
+		goto out_free;
+	}
+
+	res = remap_vmalloc_range(vma, ring->hdr, 0);
+	if (res)
+		goto out_free;
+
+	if (!port->ring) {
+		/* the ring must be complete before the tasklet sees it */
+		smp_wmb();
+		port->ring = ring;
+		pr_debug("Port %d mapped %u buffer ring\n", port->ch_id,
+			 ring->nr_frames);
+	}
+	mutex_unlock(&tdm_ring_lock);
+	return TDM_E_OK;
+
+out_free:
+	if (!port->ring)
+		tdm_ring_free(ring);
+out:
+	mutex_unlock(&tdm_ring_lock);
+	return res;
+}
+EXPORT_SYMBOL(tdm_port_mmap);
+
+/* Returns -ENODEV if the port has no ring, the poll mask otherwise */
+int tdm_port_ring_poll(void *h_port, unsigned int *mask)
+{
+	struct tdm_port *port = (struct tdm_port *)h_port;
+	struct tdm_port_ring *ring;
+
+	if (port == NULL) { /* invalid handle*/
+		pr_err("Invalid Handle\n");
+		return -ENXIO;
+	}
+
+	ring = port->ring;
+	if (!ring)
+		return -ENODEV;
+
+	*mask = 0;
+	if (ACCESS_ONCE(ring->hdr->rx_tail) != ACCESS_ONCE(ring->rx_head))
+		*mask |= POLLIN | POLLRDNORM;
+	if (ACCESS_ONCE(ring->hdr->tx_head) - ACCESS_ONCE(ring->tx_tail) <
+	    ring->nr_frames)
+		*mask |= POLLOUT | POLLWRNORM;
+
+	return TDM_E_OK;
+}
+EXPORT_SYMBOL(tdm_port_ring_poll);
+
+/* Returns where the next rx chunk of the port goes in its ring, or NULL
+ * when the application has no room for a new buffer.
+ */
+static void *tdm_ring_rx_reserve(struct tdm_port *port)
+{
+	struct tdm_port_ring *ring = port->ring;
+	struct tdm_ring_hdr *hdr = ring->hdr;
+	u32 head = ring->rx_head;
+
+	/* a new buffer is only started when the application has room */
+	if (!ring->rx_off &&
+	    head - ACCESS_ONCE(hdr->rx_tail) >= ring->nr_frames) {
+		hdr->rx_dropped++;
+		port->port_stat.rx_pkt_drop_count++;
+		return NULL;
+	}
+
+	return ring->rx_buf + (head & (ring->nr_frames - 1)) *
+		ring->frame_size + ring->rx_off;
+}
+
+/* Called with rx_channel_lock held, returns 1 when a buffer completed */
+static int tdm_ring_rx_commit(struct tdm_port *port, unsigned int bytes)
+{
+	struct tdm_port_ring *ring = port->ring;
+
+	ring->rx_off += bytes;
+	if (ring->rx_off < ring->frame_size)
+		return 0;
+
+	ring->rx_off = 0;
+	/* publish the data before the index */
+	smp_wmb();
+	ring->rx_head++;
+	ring->hdr->rx_head = ring->rx_head;
+	port->port_stat.rx_pkt_count++;
+
+	if (port->rx_eventfd)
+		eventfd_signal(port->rx_eventfd, 1);
+
+	return 1;
+}
+
+/* Returns the next tx chunk of the port, or NULL on underrun */
+static const void *tdm_ring_tx_peek(struct tdm_port *port)
+{
+	struct tdm_port_ring *ring = port->ring;
+	struct tdm_ring_hdr *hdr = ring->hdr;
+	u32 tail = ring->tx_tail;
+
+	if (!ring->tx_off && tail == ACCESS_ONCE(hdr->tx_head)) {
+		hdr->tx_underrun++;
+		return NULL;
+	}
+	/* read the index before the data */
+	smp_rmb();
+
+	return ring->tx_buf + (tail & (ring->nr_frames - 1)) *
+		ring->frame_size + ring->tx_off;
+}
+
+/* Returns 1 when a buffer was handed back to the application */
+static int tdm_ring_tx_commit(struct tdm_port *port, unsigned int bytes)
+{
+	struct tdm_port_ring *ring = port->ring;
+
+	ring->tx_off += bytes;
+	if (ring->tx_off < ring->frame_size)
+		return 0;
+
+	ring->tx_off = 0;
+	/* done with the data before handing the buffer back */
+	smp_mb();
+	ring->tx_tail++;
+	ring->hdr->tx_tail = ring->tx_tail;
+	port->port_stat.tx_pkt_conf_count++;
+
+	return 1;
+}
+
 
 unsigned int tdm_port_open(struct tdm_driver *driver, int chanid, void **h_port)
 {
@@ -601,6 +841,7 @@ unsigned int tdm_port_open(struct tdm_driver *driver, int chanid, void **h_port)
 	port->first_slot = chanid;
 
 	port->slot_width = TDM_SLOT_WIDTH;
+	port->ring_frames = TDM_RING_DEF_FRAMES;
 
 	/* todo - enable/disable the port with ioctl */
 	port->in_use = 1;
@@ -677,6 +918,11 @@ unsigned int tdm_port_close(void *h_port)
 		}
 		kfree(port->p_port_data);
 	}
+	/* no mapping is left once the file is released */
+	if (port->ring)
+		tdm_ring_free(port->ring);
+	if (port->rx_eventfd)
+		eventfd_ctx_put(port->rx_eventfd);
 	kfree(port);
 	port = NULL;
 out:
@@ -749,6 +995,84 @@ unsigned int tdm_port_ioctl(void *h_port, unsigned int cmd, unsigned long arg)
 		/* todo- Not Supported port->slot_width = arg;*/
 		break;
 
+	case TDM_CHAN_SET_MODE:
+	{
+		struct tdm_adapter *adap = port->driver->adapter;
+		struct tdm_port *p;
+		unsigned long flags;
+
+		switch (arg) {
+		case e_TDM_ADAPTER_MODE_NONE:
+		case e_TDM_ADAPTER_MODE_T1:
+		case e_TDM_ADAPTER_MODE_E1:
+		case e_TDM_ADAPTER_MODE_T1_RAW:
+		case e_TDM_ADAPTER_MODE_E1_RAW:
+			break;
+		default:
+			res = -EINVAL;
+			goto out_err;
+		}
+
+		/* the mode sizes the rings of every port on the adapter */
+		mutex_lock(&tdm_ring_lock);
+		spin_lock_irqsave(&adap->portlist_lock, flags);
+		list_for_each_entry(p, &adap->myports, list) {
+			if (p->in_use || p->ring) {
+				res = -EBUSY;
+				break;
+			}
+		}
+		if (res == TDM_E_OK)
+			adap->adap_mode = arg;
+		spin_unlock_irqrestore(&adap->portlist_lock, flags);
+		mutex_unlock(&tdm_ring_lock);
+
+		if (res != TDM_E_OK) {
+			pr_err("chan %d TDM adapter has active ports", port_num);
+			goto out_err;
+		}
+		pr_info("Port %d set adapter mode 0x%x", port_num, (int)arg);
+		break;
+	}
+
+	case TDM_CHAN_SET_RING_FRAMES:
+		if (port->ring) {
+			pr_err("chan %d TDM ring is mapped", port_num);
+			res = -EBUSY;
+			goto out_err;
+		}
+		if (arg < 2 || arg > TDM_RING_MAX_FRAMES ||
+				(arg & (arg - 1))) {
+			pr_info("Port %d ring size %lu not a power of 2",
+					port_num, arg);
+			res = -EINVAL;
+			goto out_err;
+		}
+		port->ring_frames = arg;
+		break;
+
+	case TDM_CHAN_SET_EVENTFD:
+	{
+		struct eventfd_ctx *ctx = NULL, *old;
+		unsigned long flags;
+
+		if ((int)arg >= 0) {
+			ctx = eventfd_ctx_fdget((int)arg);
+			if (IS_ERR(ctx)) {
+				res = PTR_ERR(ctx);
+				goto out_err;
+			}
+		}
+		spin_lock_irqsave(&port->p_port_data->rx_channel_lock, flags);
+		old = port->rx_eventfd;
+		port->rx_eventfd = ctx;
+		spin_unlock_irqrestore(&port->p_port_data->rx_channel_lock,
+					flags);
+		if (old)
+			eventfd_ctx_put(old);
+		break;
+	}
+
 	default:
 		pr_info("IOCTL Command Not Implemented");
 		break;
@@ -776,6 +1100,9 @@ unsigned int tdm_port_read(void *h_port, void *p_data, u16 *size)
 	if (!port->p_port_data || !port->in_use)
 		return -EIO;
 
+	if (port->ring)
+		return -EBUSY;
+
 	spin_lock_irqsave(&port->p_port_data->rx_channel_lock, flags);
 	rx_bd = port->p_port_data->rx_out_data;
 
@@ -823,16 +1150,27 @@ unsigned int tdm_port_write(void *h_port, void *p_data, u16 size)
 		return -EFAULT;
 	}
 
+	if (size > NUM_OF_FRAMES) {
+		pr_err("Invalid Length %d", size);
+		return -EINVAL;
+	}
+
 	/* todo - verify that chanid is in open state  */
 	if (!port->p_port_data || !port->in_use)
 		return -EIO;
 
+	if (port->ring)
+		return -EBUSY;
+
 	spin_lock_irqsave(&port->p_port_data->tx_channel_lock, flags);
 	tx_bd = port->p_port_data->tx_in_data;
 
 	if (!tx_bd->flag) {
 		tx_bd->length = size;
 		memcpy(tx_bd->p_data, p_data, size * port->slot_width);
+		/* the interleave pass always sends a whole cycle */
+		memset((u8 *)tx_bd->p_data + size * port->slot_width, 0,
+			sizeof(tx_bd->p_data) - size * port->slot_width);
 		tx_bd->flag = 1;
 		tx_bd->offset = 0;
 		port->p_port_data->tx_in_data = (tx_bd->wrap) ?
@@ -932,183 +1270,289 @@ unsigned int tdm_port_get_stats(void *h_port, struct tdm_port_stats *portStat)
 }
 EXPORT_SYMBOL(tdm_port_get_stats);
 
+/* Rx bd of the port to de-interleave into, NULL if it is still full.
+ * Called with rx_channel_lock held.
+ */
+static void *tdm_bd_rx_reserve(struct tdm_port *port)
+{
+	struct tdm_port_data *pd = port->p_port_data;
+	struct tdm_bd *ch_bd = pd->rx_in_data;
+
+	/*if old data is to be discarded */
+	if (use_latest_tdm_data && ch_bd->flag) {
+		ch_bd->flag = 0;
+		ch_bd->offset = 0;
+		if (ch_bd == pd->rx_out_data)
+			pd->rx_out_data = ch_bd->wrap ?
+				pd->rx_data_fifo : ch_bd + 1;
+		port->port_stat.rx_pkt_drop_count++;
+	}
+
+	/* if the bd is not empty */
+	if (ch_bd->flag) {
+		port->port_stat.rx_pkt_drop_count++;
+		return NULL;
+	}
+
+	if (ch_bd->offset == 0)
+		ch_bd->length = port->rx_max_frames;
+
+	return (u8 *)ch_bd->p_data + ch_bd->offset;
+}
+
+static int tdm_bd_rx_commit(struct tdm_port *port, unsigned int bytes)
+{
+	struct tdm_port_data *pd = port->p_port_data;
+	struct tdm_bd *ch_bd = pd->rx_in_data;
+
+	ch_bd->offset += bytes;
+	if (ch_bd->offset < ch_bd->length * port->slot_width)
+		return 0;
+
+	ch_bd->flag = 1;
+	ch_bd->offset = 0;
+	pd->rx_in_data = ch_bd->wrap ? pd->rx_data_fifo : ch_bd + 1;
+	port->port_stat.rx_pkt_count++;
+
+	return 1;
+}
+
+/* tdm_port_write() pads every bd to a full processing cycle */
+static const void *tdm_bd_tx_peek(struct tdm_port *port)
+{
+	struct tdm_bd *ch_bd = port->p_port_data->tx_out_data;
+
+	if (!ch_bd->flag)
+		return NULL;
+
+	return (u8 *)ch_bd->p_data + ch_bd->offset;
+}
+
+static int tdm_bd_tx_commit(struct tdm_port *port, unsigned int bytes)
+{
+	struct tdm_port_data *pd = port->p_port_data;
+	struct tdm_bd *ch_bd = pd->tx_out_data;
+
+	ch_bd->offset += bytes;
+	if (ch_bd->offset < ch_bd->length * port->slot_width)
+		return 0;
+
+	ch_bd->flag = 0;
+	ch_bd->offset = 0;
+	pd->tx_out_data = ch_bd->wrap ? pd->tx_data_fifo : ch_bd + 1;
+	port->port_stat.tx_pkt_conf_count++;
+
+	return 1;
+}
+
+/*
+ * The per port locks are only taken to reserve a destination before the
+ * pass and to commit it afterwards; the pass itself walks the TDM buffer
+ * once for all ports.  A reserved bd is empty, so neither tdm_port_read()
+ * nor the use_latest_tdm_data recycling can touch it in between.
+ */
 static int tdm_data_rx_deinterleave(struct tdm_adapter *adap)
 {
 	struct tdm_port *port, *next;
-	struct tdm_bd	*ch_bd;
-
-	int i, buf_size, ch_data_len = NUM_OF_FRAMES;
-	/* todo - need to be generic for u8 and u16 etc */
-	u16 *input_tdm_buffer;
-	u16 *pcm_buffer;
-	int framer_ch_data_size = NUM_OF_FRAMES;
-	bool ch_data = 0;
-	int bytes_in_fifo_per_frame =
-	    ALIGN_SIZE(TDM_ACTIVE_CHANNELS * TDM_SLOT_WIDTH, 8);
-	int bytes_slot_offset = bytes_in_fifo_per_frame/TDM_SLOT_WIDTH;
-
-	buf_size = tdm_master_recv(adap, (void **)&input_tdm_buffer);
+	struct tdm_port *xport[TDM_ACTIVE_CHANNELS];
+	struct tdm_xfer xfer[TDM_ACTIVE_CHANNELS];
+	unsigned int i, n = 0;
+	unsigned int bytes = NUM_OF_FRAMES * TDM_SLOT_WIDTH;
+	int buf_size, done;
+	void *input_tdm_buffer;
+	void *pcm;
+
+	buf_size = tdm_master_recv(adap, &input_tdm_buffer);
 	if (buf_size <= 0 || !input_tdm_buffer)
 		return -EINVAL;
 
-	/* de-interleaving for all ports*/
 	list_for_each_entry_safe(port, next, &adap->myports, list) {
 		/* if the port is not open */
 		if (!port->in_use || !port->p_port_data)
 			continue;
-
-		ch_bd = port->p_port_data->rx_in_data;
+		if (n == TDM_ACTIVE_CHANNELS ||
+				port->ch_id >= TDM_ACTIVE_CHANNELS)
+			continue;
 
 		spin_lock(&port->p_port_data->rx_channel_lock);
+		pcm = port->ring ? tdm_ring_rx_reserve(port) :
+				tdm_bd_rx_reserve(port);
+		spin_unlock(&port->p_port_data->rx_channel_lock);
+		if (!pcm)
+			continue;
 
-		/*if old data is to be discarded */
-		if (use_latest_tdm_data)
-			if (ch_bd->flag) {
-				ch_bd->flag = 0;
-				ch_bd->offset = 0;
-				if (ch_bd == port->p_port_data->rx_out_data)
-					port->p_port_data->rx_out_data =
-						ch_bd->wrap ?
-						port->p_port_data->rx_data_fifo
-						: ch_bd+1;
-				port->port_stat.rx_pkt_drop_count++;
-			}
-		/* if the bd is empty */
-		if (!ch_bd->flag) {
-			if (ch_bd->offset == 0)
-				ch_bd->length = port->rx_max_frames;
-
-			pcm_buffer = ch_bd->p_data + ch_bd->offset;
-			/* De-interleaving the data */
-			for (i = 0; i < ch_data_len; i++) {
-				pcm_buffer[i] =
-					input_tdm_buffer[i*bytes_slot_offset +
-								port->ch_id];
-			}
-			ch_bd->offset += ch_data_len * port->slot_width;
-
-			if (ch_bd->offset >=
-				(ch_bd->length - framer_ch_data_size)*
-							port->slot_width) {
-				ch_bd->flag = 1;
-				ch_bd->offset = 0;
-				port->p_port_data->rx_in_data = ch_bd->wrap ?
-						port->p_port_data->rx_data_fifo
-						: ch_bd+1;
-				ch_data = 1;
-			}
-		} else {
-			port->port_stat.rx_pkt_drop_count++;
-		}
+		xport[n] = port;
+		xfer[n].slot = port->ch_id;
+		xfer[n].pcm = pcm;
+		n++;
+	}
+
+	if (!n)
+		return TDM_E_OK;
+
+	/* De-interleaving the data */
+	if (TDM_SLOT_WIDTH == 2)
+		tdm_deinterleave_16(input_tdm_buffer, TDM_STRIDE, NUM_OF_FRAMES,
+				xfer, n);
+	else
+		tdm_deinterleave_8(input_tdm_buffer, TDM_STRIDE, NUM_OF_FRAMES,
+				xfer, n);
 
+	for (i = 0; i < n; i++) {
+		port = xport[i];
+		spin_lock(&port->p_port_data->rx_channel_lock);
+		done = port->ring ? tdm_ring_rx_commit(port, bytes) :
+				tdm_bd_rx_commit(port, bytes);
 		spin_unlock(&port->p_port_data->rx_channel_lock);
-		if (ch_data) {
-			/*	Wake up the Port Data Poll event */
+		/*	Wake up the Port Data Poll event */
+		if (done)
 			wake_up_interruptible(&port->ch_wait_queue);
-#ifdef	TDM_CORE_DEBUG
-			pr_info("Port RX-%d-%d\n", port->ch_id, ch_data_len);
-			for (i = 0; i < ch_data_len; i++)
-				pr_info("%x", pcm_buffer[i]);
-			pr_info("\n");
-#endif
-			port->port_stat.rx_pkt_count++;
-			ch_data = 0;
-		}
 	}
+
 	return TDM_E_OK;
 }
 
 static int tdm_data_tx_interleave(struct tdm_adapter *adap)
 {
 	struct tdm_port *port, *next;
-	struct tdm_bd	*ch_bd;
-	int i, buf_size, ch_data_len = NUM_OF_FRAMES;
-	bool last_data = 0;
-	/* todo - need to be generic for u8 and u16 etc */
-	u16 *output_tdm_buffer;
-	u16 *pcm_buffer;
-	int framer_ch_data_size = NUM_OF_FRAMES;
-	int bytes_in_fifo_per_frame =
-	    ALIGN_SIZE(TDM_ACTIVE_CHANNELS * TDM_SLOT_WIDTH, 8);
-	int bytes_slot_offset = bytes_in_fifo_per_frame/TDM_SLOT_WIDTH;
-
-#ifdef TDM_CORE_DEBUG
-	u8	data_flag = 0;
-#endif
-
-	buf_size = tdm_master_get_write_buf(adap, (void **)&output_tdm_buffer);
+	struct tdm_port *xport[TDM_ACTIVE_CHANNELS];
+	const void *src[TDM_MAX_STRIDE];
+	unsigned int i, n = 0;
+	unsigned int bytes = NUM_OF_FRAMES * TDM_SLOT_WIDTH;
+	int buf_size, done;
+	void *output_tdm_buffer;
+	const void *pcm;
+
+	buf_size = tdm_master_get_write_buf(adap, &output_tdm_buffer);
 	if (buf_size <= 0 || !output_tdm_buffer)
 		return -EINVAL;
 
-	memset(output_tdm_buffer, 0, sizeof(buf_size));
+	/* idle and unused slots send silence */
+	for (i = 0; i < TDM_STRIDE; i++)
+		src[i] = tdm_silence;
 
 	list_for_each_entry_safe(port, next, &adap->myports, list) {
 		/* if the channel is open */
 		if (!port->in_use || !port->p_port_data)
 			continue;
-		pr_debug("TX-Tdm %d (slots-)", port->ch_id);
+		if (n == TDM_ACTIVE_CHANNELS ||
+				port->ch_id >= TDM_ACTIVE_CHANNELS)
+			continue;
 
 		spin_lock(&port->p_port_data->tx_channel_lock);
-		ch_bd = port->p_port_data->tx_out_data;
-		if (ch_bd->flag) {
-			pcm_buffer = (u16 *)((uint8_t *)ch_bd->p_data +
-								ch_bd->offset);
-			/*if the buffer has less frames than required */
-			if (framer_ch_data_size >=
-				((ch_bd->length) -
-					(ch_bd->offset/port->slot_width))) {
-				ch_data_len =
-					(ch_bd->length) -
-					(ch_bd->offset/port->slot_width);
-				last_data = 1;
-			} else {
-				ch_data_len = framer_ch_data_size;
-			}
-			/* Interleaving the data */
-			for (i = 0; i < ch_data_len; i++) {
-				/* todo - need to be genric for any size
-				   assignment*/
-				output_tdm_buffer[port->ch_id +
-					bytes_slot_offset * i] = pcm_buffer[i];
-			}
-			/* If all the data of this buffer is transmitted */
-			if (last_data) {
-				ch_bd->flag = 0;
-				ch_bd->offset = 0;
-				port->p_port_data->tx_out_data = ch_bd->wrap ?
-						port->p_port_data->tx_data_fifo
-						: ch_bd+1;
-				port->port_stat.tx_pkt_conf_count++;
-			} else {
-				ch_bd->offset += ch_data_len*port->slot_width;
-			}
-#ifdef	TDM_CORE_DEBUG
-		data_flag = 1;
-#endif
-		}
+		pcm = port->ring ? tdm_ring_tx_peek(port) :
+				tdm_bd_tx_peek(port);
 		spin_unlock(&port->p_port_data->tx_channel_lock);
+		if (!pcm)
+			continue;
+
+		src[port->ch_id] = pcm;
+		xport[n++] = port;
+	}
+
+	/* Interleaving the data, every slot of every row is written */
+	if (TDM_SLOT_WIDTH == 2)
+		tdm_interleave_16(output_tdm_buffer, TDM_STRIDE, NUM_OF_FRAMES,
+				(const u16 * const *)src);
+	else
+		tdm_interleave_8(output_tdm_buffer, TDM_STRIDE, NUM_OF_FRAMES,
+				(const u8 * const *)src);
+
+	for (i = 0; i < n; i++) {
+		port = xport[i];
+		spin_lock(&port->p_port_data->tx_channel_lock);
+		done = port->ring ? tdm_ring_tx_commit(port, bytes) :
+				tdm_bd_tx_commit(port, bytes);
+		spin_unlock(&port->p_port_data->tx_channel_lock);
+		if (done && port->ring)
+			wake_up_interruptible(&port->ch_wait_queue);
 	}
 
-#ifdef	TDM_CORE_DEBUG
-	if (data_flag) {
-		pr_info("TX-TDM Interleaved Data-\n");
-		for (i = 0; i < 64; i++)
-			pr_info("%x", output_tdm_buffer[i]);
-		pr_info("\n");
-	  }
-#endif
 	return TDM_E_OK;
 }
 
+/*
+ * Full mode: the framer is unchannelised (T1/E1 raw) and the TDM buffer
+ * is passed as is.  Every mapped port receives a copy of it, and the
+ * first mapped port with data supplies the transmit buffer.  The bd
+ * fifos are sized for one channel, so ports have to use the mmap ring.
+ */
 static int tdm_data_tx_full(struct tdm_adapter *adap)
 {
-	pr_err("TX full mode data fetch is not supported yet");
+	struct tdm_port *port, *next;
+	void *output_tdm_buffer;
+	const void *pcm;
+	int buf_size, sent = 0;
+
+	buf_size = tdm_master_get_write_buf(adap, &output_tdm_buffer);
+	if (buf_size <= 0 || !output_tdm_buffer)
+		return -EINVAL;
+	if (buf_size > TDM_FULL_BUF_SIZE)
+		buf_size = TDM_FULL_BUF_SIZE;
+
+	list_for_each_entry_safe(port, next, &adap->myports, list) {
+		if (!port->in_use || !port->p_port_data || !port->ring)
+			continue;
+		/* a ring made for channelised mode cannot hold the buffer */
+		if (port->ring->frame_size < buf_size)
+			continue;
+
+		spin_lock(&port->p_port_data->tx_channel_lock);
+		pcm = tdm_ring_tx_peek(port);
+		if (pcm) {
+			memcpy(output_tdm_buffer, pcm, buf_size);
+			tdm_ring_tx_commit(port, port->ring->frame_size);
+		}
+		spin_unlock(&port->p_port_data->tx_channel_lock);
+
+		if (pcm) {
+			wake_up_interruptible(&port->ch_wait_queue);
+			sent = 1;
+			break;
+		}
+	}
+
+	if (!sent)
+		memset(output_tdm_buffer, 0, buf_size);
+
 	return TDM_E_OK;
 }
 
 static int tdm_data_rx_full(struct tdm_adapter *adap)
 {
-	pr_err("RX full mode data fetch is not supported yet");
+	struct tdm_port *port, *next;
+	void *input_tdm_buffer;
+	void *pcm;
+	int buf_size, done;
+
+	buf_size = tdm_master_recv(adap, &input_tdm_buffer);
+	if (buf_size <= 0 || !input_tdm_buffer)
+		return -EINVAL;
+	if (buf_size > TDM_FULL_BUF_SIZE)
+		buf_size = TDM_FULL_BUF_SIZE;
+
+	list_for_each_entry_safe(port, next, &adap->myports, list) {
+		if (!port->in_use || !port->p_port_data)
+			continue;
+		if (!port->ring || port->ring->frame_size < buf_size) {
+			port->port_stat.rx_pkt_drop_count++;
+			continue;
+		}
+
+		spin_lock(&port->p_port_data->rx_channel_lock);
+		done = 0;
+		pcm = tdm_ring_rx_reserve(port);
+		if (pcm) {
+			memcpy(pcm, input_tdm_buffer, buf_size);
+			done = tdm_ring_rx_commit(port,
+					port->ring->frame_size);
+		}
+		spin_unlock(&port->p_port_data->rx_channel_lock);
+
+		if (done)
+			wake_up_interruptible(&port->ch_wait_queue);
+	}
+
 	return TDM_E_OK;
 }
 
@@ -1116,7 +1560,7 @@ static void tdm_data_tasklet_fn(unsigned long data)
 {
 	struct tdm_adapter *adapter = (struct tdm_adapter *)data;
 	if (adapter != NULL) {
-		if (adapter->adap_mode & 0xF0) {
+		if (adapter->adap_mode & TDM_ADAPTER_MODE_FULL) {
 			tdm_data_tx_full(adapter);
 			tdm_data_rx_full(adapter);
 		} else {
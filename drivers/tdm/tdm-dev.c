@@ -226,10 +226,21 @@ static ssize_t tdmdev_write(struct file *file, const char *data_buffer,
 	return size;
 }
 
+static int tdmdev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (!file->private_data) {
+		pr_err("%s--Null file pointer\n", __func__);
+		return -ENXIO;
+	}
+
+	return tdm_port_mmap((void *)file->private_data, vma);
+}
+
 static unsigned int tdmdev_poll(struct file *file, poll_table *wait)
 {
 	int err = TDM_E_OK;
 	int poll_time = 13;
+	unsigned int mask;
 
 	pr_debug("%s ", __func__);
 
@@ -238,6 +249,11 @@ static unsigned int tdmdev_poll(struct file *file, poll_table *wait)
 		return -ENXIO;
 	}
 
+	/* mmap ring: a real poll on the port wait queue */
+	poll_wait(file, tdm_port_get_wait_queue(file->private_data), wait);
+	if (tdm_port_ring_poll((void *)file->private_data, &mask) == TDM_E_OK)
+		return mask;
+
 	/* This function can be called by two process but on different
 	 minor device so locking is not required */
 	/* todo implement it using poll_wait */
@@ -258,6 +274,7 @@ static const struct file_operations tdmdev_fops = {
 	.open		= tdmdev_open,
 	.release	= tdmdev_close,
 	.poll		= tdmdev_poll,
+	.mmap		= tdmdev_mmap,
 };
 
 static struct class *tdm_dev_class;
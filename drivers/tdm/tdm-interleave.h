@@ -0,0 +1,103 @@
+/* drivers/tdm/tdm-interleave.h
+ *
+ * Copyright (C) 2010-2011 Freescale Semiconductor, Inc, All rights reserved.
+ *
+ * One pass interleave/de-interleave of TDM frames.
+ *
+ * A TDM buffer holds 'frames' rows of 'stride' slots each.  Instead of
+ * walking the buffer once per port with a strided loop, these helpers
+ * walk it once and scatter (gather) every open slot in the same pass, so
+ * each cache line of the DMA buffer is brought in once per processing
+ * cycle and every port buffer is written sequentially.
+ *
+ * This file is also built by the user space benchmark in
+ * Documentation/tdm/, so it must only rely on u8/u16.
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ */
+
+#ifndef _TDM_INTERLEAVE_H
+#define _TDM_INTERLEAVE_H
+
+/* Maximum slots in one row, TDM_ACTIVE_CHANNELS rounded up to 8 bytes */
+#define TDM_MAX_STRIDE		(TDM_ACTIVE_CHANNELS + 8)
+
+/* one open rx slot and where its samples go */
+struct tdm_xfer {
+	unsigned int slot;
+	void *pcm;
+};
+
+/*
+ * The buffer is walked in blocks of TDM_ROW_BLOCK rows: a block is a few
+ * hundred bytes at most and stays in L1 while every open slot moves
+ * TDM_ROW_BLOCK samples at once, so each port buffer is written in
+ * 8 byte (16 bit slots) or 4 byte (8 bit slots) pieces and the per slot
+ * bookkeeping is paid once per block instead of once per sample.
+ */
+#define TDM_ROW_BLOCK		4
+
+#define TDM_DEFINE_DEINTERLEAVE(bits)					\
+static inline void tdm_deinterleave_##bits(const u##bits *in,		\
+		unsigned int stride, unsigned int frames,		\
+		const struct tdm_xfer *x, unsigned int n)		\
+{									\
+	const u##bits *c;						\
+	u##bits *o;							\
+	unsigned int f = 0, k;						\
+									\
+	for (; f + TDM_ROW_BLOCK <= frames; f += TDM_ROW_BLOCK,		\
+			in += TDM_ROW_BLOCK * stride) {			\
+		for (k = 0; k < n; k++) {				\
+			c = in + x[k].slot;				\
+			o = (u##bits *)x[k].pcm + f;			\
+			o[0] = c[0];					\
+			o[1] = c[stride];				\
+			o[2] = c[2 * stride];				\
+			o[3] = c[3 * stride];				\
+		}							\
+	}								\
+	for (; f < frames; f++, in += stride)				\
+		for (k = 0; k < n; k++)					\
+			((u##bits *)x[k].pcm)[f] = in[x[k].slot];	\
+}
+
+/*
+ * src[] has one entry per slot of the row, pointing at silence for the
+ * slots without data, so every row is written out completely and the
+ * output buffer never needs to be cleared first.
+ */
+#define TDM_DEFINE_INTERLEAVE(bits)					\
+static inline void tdm_interleave_##bits(u##bits *out,			\
+		unsigned int stride, unsigned int frames,		\
+		const u##bits * const *src)				\
+{									\
+	const u##bits *c;						\
+	u##bits *o;							\
+	unsigned int f = 0, s;						\
+									\
+	for (; f + TDM_ROW_BLOCK <= frames; f += TDM_ROW_BLOCK,		\
+			out += TDM_ROW_BLOCK * stride) {		\
+		for (s = 0; s < stride; s++) {				\
+			c = src[s] + f;					\
+			o = out + s;					\
+			o[0] = c[0];					\
+			o[stride] = c[1];				\
+			o[2 * stride] = c[2];				\
+			o[3 * stride] = c[3];				\
+		}							\
+	}								\
+	for (; f < frames; f++, out += stride)				\
+		for (s = 0; s < stride; s++)				\
+			out[s] = src[s][f];				\
+}
+
+TDM_DEFINE_DEINTERLEAVE(8)
+TDM_DEFINE_DEINTERLEAVE(16)
+TDM_DEFINE_INTERLEAVE(8)
+TDM_DEFINE_INTERLEAVE(16)
+
+#endif /* _TDM_INTERLEAVE_H */
@@ -0,0 +1,46 @@
+#ifndef _LINUX_GIANFAR_PTP_H
+#define _LINUX_GIANFAR_PTP_H
+
+/*
+ * eTSEC IEEE 1588 timer clock device, /dev/gfar_ptp
+ *
+ * The ioctls read, step and slew the timer that stamps the frames handed
+ * to SO_TIMESTAMPING.  read() returns an array of struct gfar_ptp_ts, one
+ * per PTP event message stamped since the last read, so a daemon can
+ * collect every RX and TX stamp in a single system call.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+struct gfar_ptp_clock_time {
+	__s64	sec;
+	__u32	nsec;
+	__u32	reserved;
+};
+
+#define GFAR_PTP_TS_RX		0
+#define GFAR_PTP_TS_TX		1
+
+struct gfar_ptp_ts {
+	__u64	ns;		/* timer value latched by the hardware */
+	__u32	ifindex;	/* interface the message went through */
+	__u16	seq_id;		/* PTP sequenceId */
+	__u8	msg_type;	/* PTP messageType */
+	__u8	dir;		/* GFAR_PTP_TS_RX or GFAR_PTP_TS_TX */
+};
+
+#define GFAR_PTP_IOC_MAGIC	0xE1
+
+#define GFAR_PTP_GETTIME	_IOR(GFAR_PTP_IOC_MAGIC, 1, \
+					struct gfar_ptp_clock_time)
+#define GFAR_PTP_SETTIME	_IOW(GFAR_PTP_IOC_MAGIC, 2, \
+					struct gfar_ptp_clock_time)
+/* step the clock by a signed number of nanoseconds */
+#define GFAR_PTP_ADJTIME	_IOW(GFAR_PTP_IOC_MAGIC, 3, __s64)
+/* run the clock at nominal + ppb parts per billion */
+#define GFAR_PTP_ADJFREQ	_IOW(GFAR_PTP_IOC_MAGIC, 4, __s32)
+/* drop the stamps not read yet */
+#define GFAR_PTP_FLUSH		_IO(GFAR_PTP_IOC_MAGIC, 5)
+
+#endif /* _LINUX_GIANFAR_PTP_H */
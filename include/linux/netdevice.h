@@ -1075,10 +1075,8 @@ struct net_device {
 	#endif /* CONFIG_LACP || CONFIG_LACP_MODULE */      
 	
 #ifdef CONFIG_NET_GIANFAR_FP
-#define NETDEV_FASTROUTE_HMASK 0xF
-	/* Semi-private data. Keep it at the end of device struct. */
-	rwlock_t		fastpath_lock;
-	struct dst_entry	*fastpath[NETDEV_FASTROUTE_HMASK+1];
+	/* Fast route flow cache, see net/core/fastroute.c */
+	struct fastroute_table	*fastpath;
 #endif
 	/* macvlan */
 	struct macvlan_port	*macvlan_port;
@@ -1317,6 +1315,13 @@ static inline struct net_device *first_net_device(struct net *net)
 		net_device_entry(net->dev_base_head.next);
 }
 
+static inline struct net_device *first_net_device_rcu(struct net *net)
+{
+	struct list_head *lh = rcu_dereference(net->dev_base_head.next);
+
+	return lh == &net->dev_base_head ? NULL : net_device_entry(lh);
+}
+
 extern int 			netdev_boot_setup_check(struct net_device *dev);
 extern unsigned long		netdev_boot_base(const char *prefix, int unit);
 extern struct net_device    *dev_getbyhwaddr(struct net *net, unsigned short type, char *hwaddr);
@@ -0,0 +1,152 @@
+#ifndef _IP_SET_H
+#define _IP_SET_H
+
+/*
+ * IP sets: named sets of addresses, networks and ports which the "set"
+ * match looks packets up in, managed over nfnetlink.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/types.h>
+
+/* Longest set and type name including the terminating nul */
+#define IPSET_MAXNAMELEN	32
+
+/* Sets are referred to by their index in the kernel */
+typedef __u16 ip_set_id_t;
+
+#define IPSET_INVALID_ID	65535
+
+/* Message types of NFNL_SUBSYS_IPSET */
+enum ipset_cmd {
+	IPSET_CMD_NONE,
+	IPSET_CMD_CREATE,	/* SETNAME, TYPENAME, FAMILY, DATA */
+	IPSET_CMD_DESTROY,	/* SETNAME, all unreferenced sets without */
+	IPSET_CMD_FLUSH,	/* SETNAME, all sets without */
+	IPSET_CMD_RENAME,	/* SETNAME, SETNAME2 */
+	IPSET_CMD_SWAP,		/* SETNAME, SETNAME2 */
+	IPSET_CMD_LIST,		/* SETNAME, all sets without; dump only */
+	IPSET_CMD_ADD,		/* SETNAME, DATA or ADT */
+	IPSET_CMD_DEL,		/* SETNAME, DATA or ADT */
+	IPSET_CMD_TEST,		/* SETNAME, DATA */
+	IPSET_MSG_MAX,
+};
+
+/* Attributes of the messages */
+enum {
+	IPSET_ATTR_UNSPEC,
+	IPSET_ATTR_SETNAME,	/* NLA_NUL_STRING */
+	IPSET_ATTR_SETNAME2,	/* NLA_NUL_STRING */
+	IPSET_ATTR_TYPENAME,	/* NLA_NUL_STRING, "hash:ip" ... */
+	IPSET_ATTR_FAMILY,	/* NLA_U8, NFPROTO_IPV4 */
+	IPSET_ATTR_DATA,	/* nested, the attributes below */
+	IPSET_ATTR_ADT,		/* nested, any number of IPSET_ATTR_DATA */
+	__IPSET_ATTR_CMD_MAX,
+};
+#define IPSET_ATTR_CMD_MAX	(__IPSET_ATTR_CMD_MAX - 1)
+
+/* Attributes inside IPSET_ATTR_DATA, integers in network byte order */
+enum {
+	IPSET_ATTR_DATA_UNSPEC,
+	IPSET_ATTR_IP,		/* NLA_U32 */
+	IPSET_ATTR_CIDR,	/* NLA_U8 */
+	IPSET_ATTR_PORT,	/* NLA_U16 */
+	IPSET_ATTR_PORT_TO,	/* NLA_U16, last port of a range */
+	IPSET_ATTR_PROTO,	/* NLA_U8 */
+	IPSET_ATTR_HASHSIZE,	/* NLA_U32, create and list */
+	IPSET_ATTR_MAXELEM,	/* NLA_U32, create and list */
+	IPSET_ATTR_ELEMENTS,	/* NLA_U32, list */
+	IPSET_ATTR_REFERENCES,	/* NLA_U32, list */
+	IPSET_ATTR_MEMSIZE,	/* NLA_U32, list */
+	__IPSET_ATTR_DATA_MAX,
+};
+#define IPSET_ATTR_DATA_MAX	(__IPSET_ATTR_DATA_MAX - 1)
+
+/*
+ * Which packet field every dimension of a set is taken from: bit n
+ * set means the source address or port for dimension n.
+ */
+#define IPSET_DIM_MAX		3
+#define IPSET_DIM_SRC(n)	(1 << (n))
+
+#ifdef __KERNEL__
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/netlink.h>
+#include <linux/skbuff.h>
+#include <net/netlink.h>
+
+enum ipset_adt {
+	IPSET_ADD,
+	IPSET_DEL,
+	IPSET_TEST,
+};
+
+struct ip_set;
+
+/* What a set type does, called with the nfnl mutex held but for kadt */
+struct ip_set_type_variant {
+	/* Look the packet up, rcu_read_lock() held: 1 if it is in the set */
+	int (*kadt)(const struct ip_set *set, const struct sk_buff *skb,
+		    u8 flags);
+	/* Add, delete or test an element given in IPSET_ATTR_DATA */
+	int (*uadt)(struct ip_set *set, struct nlattr *tb[],
+		    enum ipset_adt adt, u32 nlflags);
+	void (*flush)(struct ip_set *set);
+	void (*destroy)(struct ip_set *set);
+	/* Set parameters for IPSET_CMD_LIST */
+	int (*head)(const struct ip_set *set, struct sk_buff *skb);
+	/*
+	 * Elements for IPSET_CMD_LIST from position @pos[0..1] on, under
+	 * rcu_read_lock().  Returns -EMSGSIZE with @pos updated when the
+	 * skb is full.
+	 */
+	int (*list)(const struct ip_set *set, struct sk_buff *skb,
+		    unsigned long *pos);
+};
+
+struct ip_set_type {
+	struct list_head	list;
+	const char		*name;
+	u8			family;
+	u8			dimension;
+	/* Set up set->data and set->variant from IPSET_ATTR_DATA */
+	int (*create)(struct ip_set *set, struct nlattr *tb[]);
+	struct module		*me;
+};
+
+struct ip_set {
+	char			name[IPSET_MAXNAMELEN];
+	const struct ip_set_type *type;
+	const struct ip_set_type_variant *variant;
+	/* Matches using the set, under the nfnl mutex */
+	u32			ref;
+	void			*data;
+	struct rcu_head		rcu;
+};
+
+extern int ip_set_type_register(struct ip_set_type *type);
+extern void ip_set_type_unregister(struct ip_set_type *type);
+
+/* For the set match */
+extern ip_set_id_t ip_set_get_byname(const char *name, u8 *dimension);
+extern void ip_set_put_byindex(ip_set_id_t index);
+extern int ip_set_test(ip_set_id_t index, const struct sk_buff *skb,
+		       u8 flags);
+
+/* For the set types */
+extern const struct nla_policy ip_set_data_policy[IPSET_ATTR_DATA_MAX + 1];
+extern bool ip_set_get_ip4_port(const struct sk_buff *skb, bool src,
+				__be16 *port, u8 *proto);
+
+static inline __be32 ip_set_netmask(u8 cidr)
+{
+	return cidr ? htonl(~0U << (32 - cidr)) : 0;
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* _IP_SET_H */
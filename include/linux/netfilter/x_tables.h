@@ -399,6 +399,8 @@ struct xt_table_info {
 	unsigned int stacksize;
 	unsigned int __percpu *stackptr;
 	void ***jumpstack;
+	/* Rule lookup structure of the family if any, one vmalloc()ed block */
+	void *classifier;
 	/* ipt_entry tables: one per CPU */
 	/* Note : this field MUST be the last one, see XT_TABLE_INFO_SZ */
 	void *entries[1];
@@ -465,10 +467,15 @@ extern void xt_free_table_info(struct xt_table_info *info);
  *  During replace any readers that are using the old tables have to complete
  *  before freeing the old table. This is handled by the write locking
  *  necessary for reading the counters.
+ *
+ * "seq" counts the table traversals started on the cpu, nested ones
+ * included, so matches can tell one traversal from the next even when
+ * the skb is at the same address.
  */
 struct xt_info_lock {
 	spinlock_t lock;
 	unsigned char readers;
+	unsigned int seq;
 };
 DECLARE_PER_CPU(struct xt_info_lock, xt_info_locks);
 
@@ -491,6 +498,7 @@ static inline void xt_info_rdlock_bh(void)
 
 	local_bh_disable();
 	lock = &__get_cpu_var(xt_info_locks);
+	lock->seq++;
 	if (likely(!lock->readers++))
 		spin_lock(&lock->lock);
 }
@@ -504,6 +512,12 @@ static inline void xt_info_rdunlock_bh(void)
 	local_bh_enable();
 }
 
+/* Traversal sequence of this cpu, BH must be disabled. */
+static inline unsigned int xt_info_seq(void)
+{
+	return __get_cpu_var(xt_info_locks).seq;
+}
+
 /*
  * The "writer" side needs to get exclusive access to the lock,
  * regardless of readers.  This must be called with bottom half
@@ -0,0 +1,20 @@
+#ifndef _XT_SET_H
+#define _XT_SET_H
+
+#include <linux/types.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+/* Flags */
+#define XT_SET_INVERT		(1 << 0)
+
+struct xt_set_info_match {
+	char		name[IPSET_MAXNAMELEN];
+	/* IPSET_DIM_SRC() bits, as many as the set has dimensions */
+	__u8		dim_flags;
+	__u8		flags;
+
+	/* Used internally by the kernel */
+	ip_set_id_t	index;
+};
+
+#endif /* _XT_SET_H */
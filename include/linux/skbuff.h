@@ -567,6 +567,11 @@ extern void	      skb_abort_seq_read(struct skb_seq_state *st);
 extern unsigned int   skb_find_text(struct sk_buff *skb, unsigned int from,
 				    unsigned int to, struct ts_config *config,
 				    struct ts_state *state);
+extern unsigned int   skb_find_text_set(struct sk_buff *skb,
+					unsigned int from, unsigned int to,
+					struct ts_config *config,
+					struct ts_state *state,
+					unsigned long *found);
 
 #ifdef NET_SKBUFF_DATA_USES_OFFSET
 static inline unsigned char *skb_end_pointer(const struct sk_buff *skb)
@@ -55,4 +55,12 @@
 #define IOCTL_TDM_SET_RX_LENGTH		_IOW(TDM_TYPE_BASE,	\
 						TDM_CHAN_SET_RX_LENGTH, int)
 
+/* set number of buffers per direction of the mmap ring */
+#define IOCTL_TDM_SET_RING_FRAMES	_IOW(TDM_TYPE_BASE,	\
+						TDM_CHAN_SET_RING_FRAMES, int)
+
+/* attach an eventfd signalled for every received buffer */
+#define IOCTL_TDM_SET_EVENTFD		_IOW(TDM_TYPE_BASE,	\
+						TDM_CHAN_SET_EVENTFD, int)
+
 #endif /* _LINUX_TDM_DEV_H */
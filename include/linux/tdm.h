@@ -26,8 +26,9 @@
 #ifndef _LINUX_TDM_H
 #define _LINUX_TDM_H
 
-#ifdef __KERNEL__
 #include <linux/types.h>
+
+#ifdef __KERNEL__
 #include <linux/module.h>
 #include <linux/mod_devicetable.h>
 #include <linux/device.h>	/* for struct device */
@@ -63,6 +64,9 @@ struct tdm_algorithm;
 struct tdm_adapter;
 struct tdm_port;
 struct tdm_driver;
+struct tdm_port_ring;
+struct eventfd_ctx;
+struct vm_area_struct;
 
 /* Align addr on a size boundary - adjust address up if needed */
 static inline int ALIGN_SIZE(u32 size, u32 alignment)
@@ -193,6 +197,11 @@ struct tdm_port {
 
 	struct tdm_driver *driver;	/* driver for this port */
 	struct list_head list;		/* list of ports */
+
+	unsigned int ring_frames;	/* buffers per direction of ring */
+	struct tdm_port_ring *ring;	/* mmap ring, replaces the bd fifos
+					   once mapped */
+	struct eventfd_ctx *rx_eventfd;	/* signalled per received buffer */
 };
 
 /* tdm_algorithm is for accessing the routines of device */
@@ -217,6 +226,13 @@ enum tdm_adapter_mode {
 	e_TDM_ADAPTER_MODE_E1_RAW = 0x20,
 };
 
+/* unchannelised modes, the TDM buffer is passed to the ports as is */
+#define TDM_ADAPTER_MODE_FULL	0xF0
+
+/* Size of one full mode buffer: NUM_OF_FRAMES rows of all slots */
+#define TDM_FULL_BUF_SIZE	(ALIGN(TDM_ACTIVE_CHANNELS * TDM_SLOT_WIDTH, 8) \
+				 * NUM_OF_FRAMES)
+
 /* tdm_process_mode used for testing the tdm device in normal mode or internal
  * loopback or external loopback
  */
@@ -284,6 +300,9 @@ extern unsigned int tdm_port_ioctl(void *, unsigned int, unsigned long);
 extern unsigned int tdm_port_read(void *, void *, u16 *);
 extern unsigned int tdm_port_write(void *, void *, u16);
 extern unsigned int tdm_port_poll(void *, unsigned int);
+extern int tdm_port_mmap(void *, struct vm_area_struct *);
+extern int tdm_port_ring_poll(void *, unsigned int *);
+extern wait_queue_head_t *tdm_port_get_wait_queue(void *);
 
 static inline int tdm_add_driver(struct tdm_driver *driver)
 {
@@ -319,8 +338,41 @@ typedef enum {
 	TDM_CHAN_SET_SLOT_WIDTH,/* Width of the slot */
 	TDM_CHAN_ENABLE_TDM,	/* Enable the TDM port of respective channel */
 	TDM_CHAN_DISABLE_TDM,	/* Disable the TDM port of respective channel */
-	TDM_CHAN_SET_RX_LENGTH	/* Minimum Received Port Buffer Length
+	TDM_CHAN_SET_RX_LENGTH,	/* Minimum Received Port Buffer Length
 				   before allowing Read Operation in Port Mode*/
+	TDM_CHAN_SET_RING_FRAMES,/* Buffers per direction of the mmap ring,
+				   power of 2, before the first mmap() */
+	TDM_CHAN_SET_EVENTFD	/* eventfd signalled per received buffer,
+				   -1 to detach */
 } tdm_cmd_types;
 
+/*
+ * Shared ring of a port mapped through mmap() on the tdm device.
+ *
+ * The mapping starts with this header page, followed by the rx and the
+ * tx buffer arrays at rx_offset and tx_offset.  Each buffer holds one
+ * processing cycle (frame_size bytes).  Indices are free running and
+ * taken modulo nr_frames:
+ *  rx: the kernel fills rx_head, the application consumes up to it and
+ *      advances rx_tail.
+ *  tx: the application fills tx_head, the kernel transmits up to it and
+ *      advances tx_tail.
+ * Once a ring is mapped read() and write() on the port are refused.
+ */
+struct tdm_ring_hdr {
+	__u32 rx_head;		/* written by the kernel */
+	__u32 rx_tail;		/* written by the application */
+	__u32 tx_head;		/* written by the application */
+	__u32 tx_tail;		/* written by the kernel */
+	__u32 nr_frames;
+	__u32 frame_size;
+	__u32 rx_offset;
+	__u32 tx_offset;
+	__u32 rx_dropped;	/* buffers lost to a full rx ring */
+	__u32 tx_underrun;	/* cycles sent as silence */
+};
+
+#define TDM_RING_DEF_FRAMES	16
+#define TDM_RING_MAX_FRAMES	1024
+
 #endif /* _LINUX_TDM_H */
@@ -16,19 +16,34 @@ struct ts_config;
 /**
  * struct ts_state - search state
  * @offset: offset for next match
+ * @pattern: index of the pattern found, for pattern set searches
  * @cb: control buffer, for persistent variables of get_next_block()
  */
 struct ts_state
 {
 	unsigned int		offset;
+	unsigned int		pattern;
 	char			cb[40];
 };
 
+/**
+ * struct ts_pattern - one pattern of a pattern set
+ * @data: pattern data
+ * @len: length of pattern, 0 for an unused slot
+ */
+struct ts_pattern
+{
+	const void		*data;
+	unsigned int		len;
+};
+
 /**
  * struct ts_ops - search module operations
  * @name: name of search algorithm
  * @init: initialization function to prepare a search
+ * @init_set: prepare a search for a set of patterns (optional)
  * @find: find the next occurrence of the pattern
+ * @find_set: find every pattern of the set occurring in the text (optional)
  * @destroy: destroy algorithm specific parts of a search configuration
  * @get_pattern: return head of pattern
  * @get_pattern_len: return length of pattern
@@ -38,8 +53,13 @@ struct ts_ops
 {
 	const char		*name;
 	struct ts_config *	(*init)(const void *, unsigned int, gfp_t, int);
+	struct ts_config *	(*init_set)(const struct ts_pattern *,
+					    unsigned int, gfp_t, int);
 	unsigned int		(*find)(struct ts_config *,
 					struct ts_state *);
+	unsigned int		(*find_set)(struct ts_config *,
+					    struct ts_state *,
+					    unsigned long *);
 	void			(*destroy)(struct ts_config *);
 	void *			(*get_pattern)(struct ts_config *);
 	unsigned int		(*get_pattern_len)(struct ts_config *);
@@ -126,6 +146,32 @@ static inline unsigned int textsearch_find(struct ts_config *conf,
 	return textsearch_next(conf, state);
 }
 
+/**
+ * textsearch_find_set - search for all patterns of a set
+ * @conf: search configuration from textsearch_prepare_set()
+ * @state: search state
+ * @found: bitmap indexed by pattern
+ *
+ * Walks the text once and sets the bit of every pattern occurring in
+ * it in @found.
+ *
+ * Returns the number of bits that were newly set.
+ */
+static inline unsigned int textsearch_find_set(struct ts_config *conf,
+					       struct ts_state *state,
+					       unsigned long *found)
+{
+	unsigned int ret;
+
+	state->offset = 0;
+	ret = conf->ops->find_set(conf, state, found);
+
+	if (conf->finish)
+		conf->finish(conf, state);
+
+	return ret;
+}
+
 /**
  * textsearch_get_pattern - return head of the pattern
  * @conf: search configuration
@@ -148,6 +194,9 @@ extern int textsearch_register(struct ts_ops *);
 extern int textsearch_unregister(struct ts_ops *);
 extern struct ts_config *textsearch_prepare(const char *, const void *,
 					    unsigned int, gfp_t, int);
+extern struct ts_config *textsearch_prepare_set(const char *,
+						const struct ts_pattern *,
+						unsigned int, gfp_t, int);
 extern void textsearch_destroy(struct ts_config *conf);
 extern unsigned int textsearch_find_continuous(struct ts_config *,
 					       struct ts_state *,
@@ -5,12 +5,25 @@
 
 struct crypto_aead;
 
+struct esp_stats {
+	unsigned long	out_packets;
+	unsigned long	out_async;
+	unsigned long	in_packets;
+	unsigned long	in_async;
+};
+
 struct esp_data {
 	/* 0..255 */
 	int padlen;
 
 	/* Confidentiality & Integrity */
 	struct crypto_aead *aead;
+
+	/* Set if aead is a pcrypt instance */
+	int parallel;
+
+	/* Per-cpu packet counts of this SA */
+	struct esp_stats __percpu *stats;
 };
 
 extern void *pskb_put(struct sk_buff *skb, struct sk_buff *tail, int len);
@@ -0,0 +1,46 @@
+#ifndef _NET_FASTROUTE_H
+#define _NET_FASTROUTE_H
+
+/*
+ *	Per-device IPv4 fast route flow cache
+ *
+ *	The cache sits in front of ip_route_input() for drivers that
+ *	implement ndo_accept_fastpath.  Entries are keyed on the full
+ *	(saddr, daddr, protocol, sport, dport, tos) tuple of a forwarded
+ *	flow and hold a reference to the route that ip_forward() resolved
+ *	for it.  Lookups are lockless under rcu_read_lock().
+ */
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+
+struct net_device;
+struct sk_buff;
+struct iphdr;
+struct dst_entry;
+struct ctl_table;
+
+extern int netdev_fastroute;
+extern int netdev_fastroute_obstacles;
+extern int netdev_fastroute_size;
+extern int netdev_fastroute_timeout;
+
+/* Called from the driver RX path with rcu_read_lock() held.  The
+ * returned dst_entry is not referenced; it stays valid until
+ * rcu_read_unlock().
+ */
+extern struct dst_entry *fastroute_lookup(struct net_device *dev,
+					  struct sk_buff *skb,
+					  const struct iphdr *iph);
+extern void fastroute_insert(struct net_device *dev, struct sk_buff *skb,
+			     struct dst_entry *dst);
+extern void dev_clear_fastroute(struct net_device *dev);
+extern int fastroute_sysctl_size(struct ctl_table *table, int write,
+				 void __user *buffer, size_t *lenp,
+				 loff_t *ppos);
+extern int fastroute_sysctl_timeout(struct ctl_table *table, int write,
+				    void __user *buffer, size_t *lenp,
+				    loff_t *ppos);
+
+#endif
+#endif
@@ -106,8 +106,22 @@ extern struct flow_cache_object *flow_cache_lookup(
 		struct net *net, struct flowi *key, u16 family,
 		u8 dir, flow_resolve_t resolver, void *ctx);
 
+typedef int (*flow_match_t)(struct flowi *key, u16 family, u8 dir,
+			    void *arg);
+
 extern void flow_cache_flush(void);
+extern void flow_cache_invalidate(flow_match_t match, void *arg);
 extern atomic_t flow_cache_genid;
+extern atomic_t flow_cache_scoped_genid;
+
+/* Changes whenever a cached flow may resolve differently, for users that
+ * keep a resolution outside of the flow cache.
+ */
+static inline u32 flow_cache_resolve_genid(void)
+{
+	return atomic_read(&flow_cache_genid) +
+	       atomic_read(&flow_cache_scoped_genid);
+}
 
 static inline int flow_cache_uli_match(struct flowi *fl1, struct flowi *fl2)
 {
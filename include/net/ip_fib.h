@@ -231,6 +231,7 @@ extern int mpls_ip_fib_lookup (struct net *net, struct flowi *flp, struct fib_re
 /* Exported by fib_{hash|trie}.c */
 extern void fib_hash_init(void);
 extern struct fib_table *fib_hash_table(u32 id);
+extern void fib_free_table(struct fib_table *tb);
 
 static inline void fib_combine_itag(u32 *itag, struct fib_result *res)
 {
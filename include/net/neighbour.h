@@ -109,7 +109,9 @@ struct neighbour {
 	atomic_t		refcnt;
 	int			(*output)(struct sk_buff *skb);
 	struct sk_buff_head	arp_queue;
-	struct timer_list	timer;
+	struct list_head	timer_node;
+	unsigned long		timer_expires;
+	struct rcu_head		rcu;
 	const struct neigh_ops	*ops;
 	u8			primary_key[0];
 };
@@ -138,6 +140,13 @@ struct pneigh_entry {
  *	neighbour table manipulation
  */
 
+struct neigh_hash_table {
+	struct neighbour	**hash_buckets;
+	unsigned int		hash_mask;
+	struct rcu_head		rcu;
+};
+
+struct neigh_wheel;
 
 struct neigh_table {
 	struct neigh_table	*next;
@@ -165,9 +174,11 @@ struct neigh_table {
 	unsigned long		last_rand;
 	struct kmem_cache		*kmem_cachep;
 	struct neigh_statistics	__percpu *stats;
-	struct neighbour	**hash_buckets;
-	unsigned int		hash_mask;
+	struct neigh_hash_table	*nht;
+	struct neigh_hash_table	*nht_old;
+	struct work_struct	hash_work;
 	__u32			hash_rnd;
+	struct neigh_wheel	*wheel;
 	struct pneigh_entry	**phash_buckets;
 };
 
@@ -102,6 +102,9 @@ struct nf_conn {
 	/* Have we seen traffic both ways yet? (bitset) */
 	unsigned long status;
 
+	/* cpu whose unconfirmed or dying list holds us */
+	u16 cpu;
+
 	/* If we were expected by an expectation, this will be it */
 	struct nf_conn *master;
 
@@ -125,10 +128,9 @@ struct nf_conn {
 		 */
 		char *app_proto;
 		/*
-		 * application layer data so far. NULL after match decision.
+		 * xt_layer7 scanner state. NULL after match decision.
 		 */
-		char *app_data;
-		unsigned int app_data_len;
+		struct xt_layer7_scan *scan;
 		/*
 		* for l7pm
 		*
@@ -227,7 +229,7 @@ extern struct nf_conntrack_tuple_hash *
 __nf_conntrack_find(struct net *net, u16 zone,
 		    const struct nf_conntrack_tuple *tuple);
 
-extern void nf_conntrack_hash_insert(struct nf_conn *ct);
+extern int nf_conntrack_hash_check_insert(struct nf_conn *ct);
 extern void nf_ct_delete_from_lists(struct nf_conn *ct);
 extern void nf_ct_insert_dying_list(struct nf_conn *ct);
 
@@ -13,6 +13,8 @@
 #define _NF_CONNTRACK_CORE_H
 
 #include <linux/netfilter.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
 #include <net/netfilter/nf_conntrack_l4proto.h>
 #include <net/netfilter/nf_conntrack_ecache.h>
@@ -74,6 +76,45 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
+/* Only serializes ctnetlink updates, see nf_conntrack_locks. */
 extern spinlock_t nf_conntrack_lock ;
 
+/*
+ * Locks of the conntrack hash.  Hash tables have a power of two size of
+ * at least CONNTRACK_LOCKS buckets and a tuple goes to the bucket given
+ * by the top bits of its hash, so the lock of a tuple, chosen the same
+ * way, does not change when the table is resized.
+ */
+#define CONNTRACK_LOCKS 1024
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_bucket_lock(spinlock_t *lock);
+
+/* Lock of bucket @bucket of a table of @size buckets */
+static inline spinlock_t *nf_conntrack_bucket_lockp(unsigned int bucket,
+						    unsigned int size)
+{
+	return &nf_conntrack_locks[bucket / (size / CONNTRACK_LOCKS)];
+}
+
+/* Held while the hash is walked bucket by bucket, no resize runs then. */
+extern struct mutex nf_conntrack_hash_mutex;
+
+extern seqcount_t nf_conntrack_generation;
+
+/* The current table and its size for lockless walkers, under RCU. */
+static inline struct hlist_nulls_head *
+nf_conntrack_get_ht(struct net *net, unsigned int *size)
+{
+	struct hlist_nulls_head *hash;
+	unsigned int sequence;
+
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		hash = rcu_dereference(net->ct.hash);
+		*size = net->ct.htable_size;
+	} while (read_seqcount_retry(&nf_conntrack_generation, sequence));
+
+	return hash;
+}
+
 #endif /* _NF_CONNTRACK_CORE_H */
@@ -4,11 +4,18 @@
 
 #ifndef _NF_CONNTRACK_EXPECT_H
 #define _NF_CONNTRACK_EXPECT_H
+#include <linux/hash.h>
+#include <linux/spinlock.h>
 #include <net/netfilter/nf_conntrack.h>
 
 extern unsigned int nf_ct_expect_hsize;
 extern unsigned int nf_ct_expect_max;
 
+#define NF_CT_EXPECT_LOCKS_BITS	8
+#define NF_CT_EXPECT_LOCKS	(1 << NF_CT_EXPECT_LOCKS_BITS)
+
+extern spinlock_t nf_ct_expect_master_locks[NF_CT_EXPECT_LOCKS];
+
 struct nf_conntrack_expect {
 	/* Conntrack expectation list member */
 	struct hlist_node lnode;
@@ -59,6 +66,24 @@ static inline struct net *nf_ct_exp_net(struct nf_conntrack_expect *exp)
 	return nf_ct_net(exp->master);
 }
 
+/*
+ * The lock of the expectations of a master conntrack: it protects the
+ * expectations list and the expecting counters of its helper area, and
+ * is taken with BH disabled.  Only the pointer is used, so it can be
+ * computed for a master that may be gone already.
+ */
+static inline spinlock_t *nf_ct_expect_master_lock(const struct nf_conn *ct)
+{
+	return &nf_ct_expect_master_locks[hash_ptr((void *)ct,
+						   NF_CT_EXPECT_LOCKS_BITS)];
+}
+
+/* Still on the list of its master?  Call with the master lock held. */
+static inline bool nf_ct_expect_linked(const struct nf_conntrack_expect *exp)
+{
+	return !hlist_unhashed(&exp->lnode);
+}
+
 struct nf_conntrack_expect_policy {
 	unsigned int	max_expected;
 	unsigned int	timeout;
@@ -88,6 +113,10 @@ nf_ct_find_expectation(struct net *net, u16 zone,
 void nf_ct_unlink_expect(struct nf_conntrack_expect *exp);
 void nf_ct_remove_expectations(struct nf_conn *ct);
 void nf_ct_unexpect_related(struct nf_conntrack_expect *exp);
+void nf_ct_expect_iterate_destroy(struct net *net,
+				  int (*iter)(struct nf_conntrack_expect *exp,
+					      void *data),
+				  void *data);
 
 /* Allocate space for an expectation: this is mandatory before calling
    nf_ct_expect_related.  You will have to call put afterwards. */
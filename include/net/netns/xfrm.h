@@ -8,6 +8,7 @@
 #include <net/dst_ops.h>
 
 struct ctl_table_header;
+struct xfrm_policy_prefix;
 
 struct xfrm_policy_hash {
 	struct hlist_head	*table;
@@ -39,6 +40,7 @@ struct netns_xfrm {
 	struct hlist_head	*policy_byidx;
 	unsigned int		policy_idx_hmask;
 	struct hlist_head	policy_inexact[XFRM_POLICY_MAX * 2];
+	struct xfrm_policy_prefix *policy_byprefix[XFRM_POLICY_MAX];
 	struct xfrm_policy_hash	policy_bydst[XFRM_POLICY_MAX * 2];
 	unsigned int		policy_count[XFRM_POLICY_MAX * 2];
 	struct work_struct	policy_hash_work;
@@ -114,6 +114,10 @@ struct rt_cache_stat {
         unsigned int gc_dst_overflow;
         unsigned int in_hlist_search;
         unsigned int out_hlist_search;
+        unsigned int gc_lazy;
+        unsigned int gc_budget_hit;
+        unsigned int flush_deferred;
+        unsigned int flush_swept;
 };
 
 extern struct ip_rt_acct __percpu *ip_rt_acct;
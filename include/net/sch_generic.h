@@ -44,6 +44,7 @@ struct Qdisc {
 #define TCQ_F_INGRESS		4
 #define TCQ_F_CAN_BYPASS	8
 #define TCQ_F_MQROOT		16
+#define TCQ_F_DEFER_ENQUEUE	32
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	struct Qdisc_ops	*ops;
@@ -70,6 +71,7 @@ struct Qdisc {
 	 * For performance sake on SMP, we put highly modified fields at the end
 	 */
 	unsigned long		state;
+	struct sk_buff		*defer_list;
 	struct sk_buff_head	q;
 	struct gnet_stats_basic_packed bstats;
 	struct gnet_stats_queue	qstats;
@@ -403,6 +405,50 @@ static inline int qdisc_enqueue_root(struct sk_buff *skb, struct Qdisc *sch)
 	return qdisc_enqueue(skb, sch) & NET_XMIT_MASK;
 }
 
+/*
+ * Root qdiscs with TCQ_F_DEFER_ENQUEUE take packets without the root lock:
+ * dev_queue_xmit() pushes them onto ->defer_list and the qdisc moves them
+ * into its own queues from its dequeue routine, in arrival order.
+ */
+static inline void qdisc_defer_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct sk_buff *head;
+
+	do {
+		head = ACCESS_ONCE(sch->defer_list);
+		skb->next = head;
+	} while (cmpxchg(&sch->defer_list, head, skb) != head);
+}
+
+/* Detaches the deferred packets, oldest first, chained through skb->next */
+static inline struct sk_buff *qdisc_defer_splice(struct Qdisc *sch)
+{
+	struct sk_buff *skb, *next, *list = NULL;
+
+	if (!ACCESS_ONCE(sch->defer_list))
+		return NULL;
+
+	skb = xchg(&sch->defer_list, NULL);
+	while (skb) {
+		next = skb->next;
+		skb->next = list;
+		list = skb;
+		skb = next;
+	}
+	return list;
+}
+
+static inline void qdisc_defer_purge(struct Qdisc *sch)
+{
+	struct sk_buff *skb, *next;
+
+	for (skb = qdisc_defer_splice(sch); skb; skb = next) {
+		next = skb->next;
+		kfree_skb(skb);
+		sch->qstats.drops++;
+	}
+}
+
 static inline void __qdisc_update_bstats(struct Qdisc *sch, unsigned int len)
 {
 	sch->bstats.bytes += len;
@@ -481,6 +481,7 @@ struct xfrm_policy {
 #endif
 	struct hlist_node	bydst;
 	struct hlist_node	byidx;
+	struct hlist_node	byprefix;
 
 	/* This lock only affects elements except for entry. */
 	rwlock_t		lock;
@@ -491,6 +492,7 @@ struct xfrm_policy {
 	atomic_t		genid;
 	u32			priority;
 	u32			index;
+	u64			pos;
 	struct xfrm_mark	mark;
 	struct xfrm_selector	selector;
 	struct xfrm_lifetime_cfg lft;
@@ -1465,6 +1467,8 @@ struct xfrm_policy *xfrm_policy_bysel_ctx(struct net *net, u32 mark,
 					  int *err);
 struct xfrm_policy *xfrm_policy_byid(struct net *net, u32 mark, u8, int dir, u32 id, int delete, int *err);
 int xfrm_policy_flush(struct net *net, u8 type, struct xfrm_audit *audit_info);
+struct xfrm_policy *xfrm_policy_check_flow(struct net *net, struct flowi *fl,
+					   u16 family, u8 dir);
 u32 xfrm_get_acqseq(void);
 extern int xfrm_alloc_spi(struct xfrm_state *x, u32 minspi, u32 maxspi);
 struct xfrm_state *xfrm_find_acq(struct net *net, struct xfrm_mark *mark,
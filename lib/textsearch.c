@@ -69,6 +69,13 @@
  *   no match was found. Subsequent occurences can be found by calling
  *   textsearch_next() regardless of the linearity of the data.
  *
+ *   Algorithms implementing init_set() and find_set() can also search
+ *   for a whole set of patterns at once. textsearch_prepare_set() takes
+ *   an array of struct ts_pattern, find() then reports the index of the
+ *   pattern it found in state->pattern, and textsearch_find_set() walks
+ *   the data once and marks every pattern occurring in it in a bitmap
+ *   indexed like the array.
+ *
  *   Once you're done using a configuration it must be given back via
  *   textsearch_destroy.
  *
@@ -126,6 +133,25 @@ static inline struct ts_ops *lookup_ts_algo(const char *name)
 	return NULL;
 }
 
+static struct ts_ops *get_ts_algo(const char *name, int flags)
+{
+	struct ts_ops *ops = lookup_ts_algo(name);
+
+#ifdef CONFIG_MODULES
+	/*
+	 * Why not always autoload you may ask. Some users are
+	 * in a situation where requesting a module may deadlock,
+	 * especially when the module is located on a NFS mount.
+	 */
+	if (ops == NULL && flags & TS_AUTOLOAD) {
+		request_module("ts_%s", name);
+		ops = lookup_ts_algo(name);
+	}
+#endif
+
+	return ops;
+}
+
 /**
  * textsearch_register - register a textsearch module
  * @ops: operations lookup table
@@ -267,19 +293,7 @@ struct ts_config *textsearch_prepare(const char *algo, const void *pattern,
 	if (len == 0)
 		return ERR_PTR(-EINVAL);
 
-	ops = lookup_ts_algo(algo);
-#ifdef CONFIG_MODULES
-	/*
-	 * Why not always autoload you may ask. Some users are
-	 * in a situation where requesting a module may deadlock,
-	 * especially when the module is located on a NFS mount.
-	 */
-	if (ops == NULL && flags & TS_AUTOLOAD) {
-		request_module("ts_%s", algo);
-		ops = lookup_ts_algo(algo);
-	}
-#endif
-
+	ops = get_ts_algo(algo, flags);
 	if (ops == NULL)
 		goto errout;
 
@@ -299,6 +313,58 @@ errout:
 	return ERR_PTR(err);
 }
 
+/**
+ * textsearch_prepare_set - Prepare a search for a set of patterns
+ * @algo: name of search algorithm
+ * @patterns: array of patterns
+ * @n: number of patterns
+ * @gfp_mask: allocation mask
+ * @flags: search flags
+ *
+ * Like textsearch_prepare() but for algorithms able to search for
+ * several patterns at once. A pattern is identified by its index in
+ * @patterns; slots with a zero length pattern are never found.
+ *
+ * Returns a new textsearch configuration or a ERR_PTR(). -EINVAL is
+ * returned if no pattern is given and -EOPNOTSUPP if the algorithm
+ * only handles single patterns.
+ */
+struct ts_config *textsearch_prepare_set(const char *algo,
+					 const struct ts_pattern *patterns,
+					 unsigned int n, gfp_t gfp_mask,
+					 int flags)
+{
+	int err = -ENOENT;
+	struct ts_config *conf;
+	struct ts_ops *ops;
+
+	if (n == 0)
+		return ERR_PTR(-EINVAL);
+
+	ops = get_ts_algo(algo, flags);
+	if (ops == NULL)
+		goto errout;
+
+	err = -EOPNOTSUPP;
+	if (ops->init_set == NULL || ops->find_set == NULL)
+		goto errout;
+
+	conf = ops->init_set(patterns, n, gfp_mask, flags);
+	if (IS_ERR(conf)) {
+		err = PTR_ERR(conf);
+		goto errout;
+	}
+
+	conf->ops = ops;
+	return conf;
+
+errout:
+	if (ops)
+		module_put(ops->owner);
+
+	return ERR_PTR(err);
+}
+
 /**
  * textsearch_destroy - destroy a search configuration
  * @conf: search configuration
@@ -320,5 +386,6 @@ void textsearch_destroy(struct ts_config *conf)
 EXPORT_SYMBOL(textsearch_register);
 EXPORT_SYMBOL(textsearch_unregister);
 EXPORT_SYMBOL(textsearch_prepare);
+EXPORT_SYMBOL(textsearch_prepare_set);
 EXPORT_SYMBOL(textsearch_find_continuous);
 EXPORT_SYMBOL(textsearch_destroy);
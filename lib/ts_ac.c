@@ -0,0 +1,373 @@
+/*
+ * lib/ts_ac.c		Aho-Corasick multi-pattern text search implementation
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   Implements the string-matching automaton of Aho and Corasick [1]
+ *   for a set of patterns. The patterns are stored in a trie whose
+ *   missing goto transitions are filled in from the failure function,
+ *   which turns the trie into a DFA: every byte of text costs exactly one
+ *   table lookup, whatever the number and the length of the patterns.
+ *
+ *   To keep the table small, bytes are folded into classes, one for
+ *   every byte value occurring in some pattern and one for all the
+ *   others. With TS_IGNORECASE upper case letters share the class of
+ *   their lower case letter.
+ *
+ *   find() returns the occurrence that ends first, and the longest one
+ *   if several patterns end on the same byte; its index in the set is
+ *   stored in state->pattern. Like kmp, subsequent searches continue
+ *   behind the end of the occurrence found. find_set() walks the whole
+ *   text once and marks every pattern that occurs in it.
+ *
+ *   [1] A. V. Aho, M. J. Corasick
+ *       Efficient string matching: an aid to bibliographic search,
+ *       Communications of the ACM 18(6), 1975
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/bitops.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/textsearch.h>
+
+/*
+ * A transition holds the row offset (state * ncls) of the next state,
+ * AC_OUT is set if some pattern ends in that state.
+ */
+#define AC_OUT		0x80000000U
+
+/* limit of the transition table, 64MB */
+#define AC_MAX_ENTRIES	(1U << 24)
+
+struct ac_out
+{
+	u32		id;
+	u32		len;
+	u32		next;	/* index + 1 of the next output, 0 at the end */
+};
+
+struct ts_ac
+{
+	unsigned int	npatterns;	/* non-empty ones */
+	unsigned int	nstates;
+	unsigned int	ncls;
+	u32 *		delta;		/* nstates x ncls transitions */
+	u32 *		out;		/* per state: index + 1 into outs */
+	struct ac_out *	outs;		/* one per pattern */
+	u8 *		pattern;	/* first pattern, for get_pattern() */
+	unsigned int	pattern_len;
+	u8		cls[256];
+};
+
+static void *ac_alloc(size_t size, gfp_t gfp_mask)
+{
+	if (size > PAGE_SIZE && (gfp_mask & __GFP_WAIT))
+		return __vmalloc(size, gfp_mask | __GFP_HIGHMEM | __GFP_ZERO,
+				 PAGE_KERNEL);
+	return kzalloc(size, gfp_mask);
+}
+
+static void ac_free(const void *p)
+{
+	if (is_vmalloc_addr(p))
+		vfree(p);
+	else
+		kfree(p);
+}
+
+static unsigned int ac_find(struct ts_config *conf, struct ts_state *state)
+{
+	struct ts_ac *ac = ts_config_priv(conf);
+	const u32 *delta = ac->delta;
+	const u8 *cls = ac->cls;
+	unsigned int i, s = 0, text_len, consumed = state->offset;
+	const struct ac_out *o;
+	const u8 *text;
+	u32 e;
+
+	for (;;) {
+		text_len = conf->get_next_block(consumed, &text, conf, state);
+
+		if (unlikely(text_len == 0))
+			break;
+
+		for (i = 0; i < text_len; i++) {
+			e = delta[s + cls[text[i]]];
+			s = e & ~AC_OUT;
+			if (unlikely(e & AC_OUT)) {
+				o = &ac->outs[ac->out[s / ac->ncls] - 1];
+				state->pattern = o->id;
+				state->offset = consumed + i + 1;
+				return state->offset - o->len;
+			}
+		}
+
+		consumed += text_len;
+	}
+
+	return UINT_MAX;
+}
+
+static unsigned int ac_find_set(struct ts_config *conf,
+				struct ts_state *state, unsigned long *found)
+{
+	struct ts_ac *ac = ts_config_priv(conf);
+	const u32 *delta = ac->delta;
+	const u8 *cls = ac->cls;
+	unsigned int i, o, s = 0, n = 0, text_len, consumed = state->offset;
+	const u8 *text;
+	u32 e;
+
+	for (;;) {
+		text_len = conf->get_next_block(consumed, &text, conf, state);
+
+		if (unlikely(text_len == 0))
+			break;
+
+		for (i = 0; i < text_len; i++) {
+			e = delta[s + cls[text[i]]];
+			s = e & ~AC_OUT;
+			if (likely(!(e & AC_OUT)))
+				continue;
+
+			for (o = ac->out[s / ac->ncls]; o; o = ac->outs[o - 1].next)
+				if (!__test_and_set_bit(ac->outs[o - 1].id, found))
+					n++;
+			/* nothing left to find */
+			if (n == ac->npatterns)
+				return n;
+		}
+
+		consumed += text_len;
+	}
+
+	return n;
+}
+
+static int ac_build(struct ts_ac *ac, const struct ts_pattern *patterns,
+		    unsigned int n, unsigned int maxstates, gfp_t gfp_mask,
+		    int flags)
+{
+	const int icase = flags & TS_IGNORECASE;
+	unsigned int i, j, c, s, o, f, ncls, head, tail, nstates = 1;
+	DECLARE_BITMAP(used, 256);
+	u32 *delta, *fail, *queue;
+	const u8 *p;
+
+	/* byte classes: 0 for bytes in no pattern unless there are none */
+	bitmap_zero(used, 256);
+	for (i = 0; i < n; i++) {
+		p = patterns[i].data;
+		for (j = 0; j < patterns[i].len; j++)
+			__set_bit(icase ? tolower(p[j]) : p[j], used);
+	}
+	ncls = bitmap_full(used, 256) ? 0 : 1;
+	for (c = 0; c < 256; c++)
+		if (test_bit(c, used))
+			ac->cls[c] = ncls++;
+	if (icase)
+		for (c = 0; c < 256; c++)
+			ac->cls[c] = ac->cls[tolower(c)];
+	ac->ncls = ncls;
+
+	if (maxstates > AC_MAX_ENTRIES / ncls)
+		return -E2BIG;
+
+	delta = ac_alloc(maxstates * ncls * sizeof(u32), gfp_mask);
+	ac->delta = delta;
+	ac->out = ac_alloc(maxstates * sizeof(u32), gfp_mask);
+	ac->outs = ac_alloc(n * sizeof(struct ac_out), gfp_mask);
+	fail = ac_alloc(2 * maxstates * sizeof(u32), gfp_mask);
+	if (!delta || !ac->out || !ac->outs || !fail) {
+		if (fail)
+			ac_free(fail);
+		return -ENOMEM;
+	}
+	queue = fail + maxstates;
+
+	/* trie, 0 stands for no transition as nothing goes to the root */
+	for (i = 0; i < n; i++) {
+		p = patterns[i].data;
+		if (!patterns[i].len)
+			continue;
+		for (s = 0, j = 0; j < patterns[i].len; j++) {
+			u32 *t = &delta[s * ncls + ac->cls[p[j]]];
+
+			if (!*t)
+				*t = nstates++;
+			s = *t;
+		}
+		ac->outs[i].id = i;
+		ac->outs[i].len = patterns[i].len;
+		ac->outs[i].next = ac->out[s];
+		ac->out[s] = i + 1;
+	}
+
+	/*
+	 * Breadth first, so the failure state of a state, which is less
+	 * deep, has its row completed and its outputs linked already.
+	 */
+	head = tail = 0;
+	for (c = 0; c < ncls; c++) {
+		s = delta[c];
+		if (s) {
+			fail[s] = 0;
+			queue[tail++] = s;
+		}
+	}
+	while (head < tail) {
+		s = queue[head++];
+		f = fail[s];
+
+		/* the state also ends every pattern its failure state ends */
+		o = ac->out[s];
+		if (o) {
+			while (ac->outs[o - 1].next)
+				o = ac->outs[o - 1].next;
+			ac->outs[o - 1].next = ac->out[f];
+		} else
+			ac->out[s] = ac->out[f];
+
+		for (c = 0; c < ncls; c++) {
+			u32 *t = &delta[s * ncls + c];
+
+			if (*t) {
+				fail[*t] = delta[f * ncls + c];
+				queue[tail++] = *t;
+			} else
+				*t = delta[f * ncls + c];
+		}
+	}
+	ac_free(fail);
+
+	for (i = 0; i < nstates * ncls; i++) {
+		s = delta[i];
+		delta[i] = s * ncls | (ac->out[s] ? AC_OUT : 0);
+	}
+	ac->nstates = nstates;
+
+	/* shared prefixes leave the end of the table unused */
+	if (nstates < maxstates) {
+		delta = ac_alloc(nstates * ncls * sizeof(u32), gfp_mask);
+		if (delta) {
+			memcpy(delta, ac->delta, nstates * ncls * sizeof(u32));
+			ac_free(ac->delta);
+			ac->delta = delta;
+		}
+	}
+
+	return 0;
+}
+
+static void ac_destroy(struct ts_config *conf)
+{
+	struct ts_ac *ac = ts_config_priv(conf);
+
+	if (ac->delta)
+		ac_free(ac->delta);
+	if (ac->out)
+		ac_free(ac->out);
+	if (ac->outs)
+		ac_free(ac->outs);
+}
+
+static struct ts_config *ac_init_set(const struct ts_pattern *patterns,
+				     unsigned int n, gfp_t gfp_mask, int flags)
+{
+	struct ts_config *conf;
+	struct ts_ac *ac;
+	unsigned int i, first = n, count = 0, total = 1;
+	int err;
+
+	for (i = 0; i < n; i++) {
+		if (!patterns[i].len)
+			continue;
+		if (total + patterns[i].len < total)
+			return ERR_PTR(-E2BIG);
+		total += patterns[i].len;
+		if (!count++)
+			first = i;
+	}
+	if (!count)
+		return ERR_PTR(-EINVAL);
+
+	conf = alloc_ts_config(sizeof(*ac) + patterns[first].len, gfp_mask);
+	if (IS_ERR(conf))
+		return conf;
+
+	conf->flags = flags;
+	ac = ts_config_priv(conf);
+	ac->npatterns = count;
+	ac->pattern = (u8 *) ac + sizeof(*ac);
+	ac->pattern_len = patterns[first].len;
+	memcpy(ac->pattern, patterns[first].data, ac->pattern_len);
+
+	err = ac_build(ac, patterns, n, total, gfp_mask, flags);
+	if (err) {
+		ac_destroy(conf);
+		kfree(conf);
+		return ERR_PTR(err);
+	}
+
+	return conf;
+}
+
+static struct ts_config *ac_init(const void *pattern, unsigned int len,
+				 gfp_t gfp_mask, int flags)
+{
+	struct ts_pattern p = {
+		.data	= pattern,
+		.len	= len,
+	};
+
+	return ac_init_set(&p, 1, gfp_mask, flags);
+}
+
+static void *ac_get_pattern(struct ts_config *conf)
+{
+	struct ts_ac *ac = ts_config_priv(conf);
+	return ac->pattern;
+}
+
+static unsigned int ac_get_pattern_len(struct ts_config *conf)
+{
+	struct ts_ac *ac = ts_config_priv(conf);
+	return ac->pattern_len;
+}
+
+static struct ts_ops ac_ops = {
+	.name		  = "ac",
+	.find		  = ac_find,
+	.find_set	  = ac_find_set,
+	.init		  = ac_init,
+	.init_set	  = ac_init_set,
+	.destroy	  = ac_destroy,
+	.get_pattern	  = ac_get_pattern,
+	.get_pattern_len  = ac_get_pattern_len,
+	.owner		  = THIS_MODULE,
+	.list		  = LIST_HEAD_INIT(ac_ops.list)
+};
+
+static int __init init_ac(void)
+{
+	return textsearch_register(&ac_ops);
+}
+
+static void __exit exit_ac(void)
+{
+	textsearch_unregister(&ac_ops);
+}
+
+MODULE_LICENSE("GPL");
+
+module_init(init_ac);
+module_exit(exit_ac);
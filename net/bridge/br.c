@@ -46,6 +46,8 @@ static int __init br_init(void)
 	if (err)
 		goto err_out;
 
+	br_fdb_selftest();
+
 	err = register_pernet_subsys(&br_net_ops);
 	if (err)
 		goto err_out1;
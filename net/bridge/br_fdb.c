@@ -28,9 +28,13 @@
 static struct kmem_cache *br_fdb_cache __read_mostly;
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		      const unsigned char *addr);
+static void br_fdb_resize(struct work_struct *work);
 
 static u32 fdb_salt __read_mostly;
 
+/* Entries examined per run of the aging timer */
+#define BR_FDB_GC_BUDGET	512
+
 int __init br_fdb_init(void)
 {
 	br_fdb_cache = kmem_cache_create("bridge_fdb_cache",
@@ -49,6 +53,68 @@ void br_fdb_fini(void)
 	kmem_cache_destroy(br_fdb_cache);
 }
 
+static struct net_bridge_fdb_htable *fdb_htable_alloc(u32 buckets)
+{
+	struct net_bridge_fdb_htable *ht;
+	size_t size = buckets * sizeof(struct hlist_head);
+
+	ht = kmalloc(sizeof(*ht), GFP_KERNEL);
+	if (!ht)
+		return NULL;
+
+	if (size <= PAGE_SIZE)
+		ht->hash = kzalloc(size, GFP_KERNEL);
+	else
+		ht->hash = (struct hlist_head *)
+			__get_free_pages(GFP_KERNEL | __GFP_ZERO,
+					 get_order(size));
+	if (!ht->hash) {
+		kfree(ht);
+		return NULL;
+	}
+	ht->mask = buckets - 1;
+	return ht;
+}
+
+static void fdb_htable_free(struct net_bridge_fdb_htable *ht)
+{
+	size_t size = (ht->mask + 1) * sizeof(struct hlist_head);
+
+	if (size <= PAGE_SIZE)
+		kfree(ht->hash);
+	else
+		free_pages((unsigned long)ht->hash, get_order(size));
+	kfree(ht);
+}
+
+static void fdb_htable_free_rcu(struct rcu_head *head)
+{
+	fdb_htable_free(container_of(head, struct net_bridge_fdb_htable, rcu));
+}
+
+int br_fdb_hash_init(struct net_bridge *br)
+{
+	int i;
+
+	br->fdb = fdb_htable_alloc(BR_HASH_SIZE);
+	if (!br->fdb)
+		return -ENOMEM;
+	br->fdb_old = NULL;
+
+	for (i = 0; i < BR_FDB_LOCKS; i++)
+		spin_lock_init(&br->fdb_lock[i]);
+	atomic_set(&br->fdb_count, 0);
+	INIT_WORK(&br->fdb_resize_work, br_fdb_resize);
+	br->fdb_gc_next = 0;
+	return 0;
+}
+
+/* Called once the bridge can't learn any more, all entries are gone */
+void br_fdb_hash_fini(struct net_bridge *br)
+{
+	cancel_work_sync(&br->fdb_resize_work);
+	fdb_htable_free(br->fdb);
+}
 
 /* if topology_changing then use forward_delay (default 15 sec)
  * otherwise keep longer (default 5 minutes)
@@ -65,11 +131,22 @@ static inline int has_expired(const struct net_bridge *br,
 		time_before_eq(fdb->ageing_timer + hold_time(br), jiffies);
 }
 
-static inline int br_mac_hash(const unsigned char *mac)
+static inline u32 br_mac_hash(const unsigned char *mac)
 {
 	/* use 1 byte of OUI cnd 3 bytes of NIC */
 	u32 key = get_unaligned((u32 *)(mac + 2));
-	return jhash_1word(key, fdb_salt) & (BR_HASH_SIZE - 1);
+	return jhash_1word(key, fdb_salt);
+}
+
+static inline spinlock_t *fdb_lock(struct net_bridge *br, u32 hash)
+{
+	return &br->fdb_lock[hash & (BR_FDB_LOCKS - 1)];
+}
+
+static inline struct hlist_head *fdb_bucket(struct net_bridge_fdb_htable *ht,
+					    u32 hash)
+{
+	return &ht->hash[hash & ht->mask];
 }
 
 static void fdb_rcu_free(struct rcu_head *head)
@@ -79,94 +156,269 @@ static void fdb_rcu_free(struct rcu_head *head)
 	kmem_cache_free(br_fdb_cache, ent);
 }
 
-static inline void fdb_delete(struct net_bridge_fdb_entry *f)
+/* Called with the bucket lock held */
+static inline void fdb_delete(struct net_bridge *br,
+			      struct net_bridge_fdb_entry *f)
 {
 	hlist_del_rcu(&f->hlist);
+	atomic_dec(&br->fdb_count);
 	call_rcu(&f->rcu, fdb_rcu_free);
 }
 
-void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
+/*
+ * Double the hash table once it holds more than two entries per bucket.
+ * The new table is published first, so that entries are only ever
+ * created in it, then the old one is emptied bucket by bucket under the
+ * bucket locks.  Until that is done lookups fall back to the old table;
+ * a reader racing with the move of an entry may miss it, which costs a
+ * flood or a recheck under the bucket lock.
+ */
+static void br_fdb_resize(struct work_struct *work)
 {
-	struct net_bridge *br = p->br;
-	int i;
+	struct net_bridge *br = container_of(work, struct net_bridge,
+					     fdb_resize_work);
+	struct net_bridge_fdb_htable *ht, *old;
+	u32 i, buckets;
+
+	old = br->fdb;
+	buckets = (old->mask + 1) * 2;
+	if (br->fdb_old || buckets > (1 << BR_FDB_HASH_MAX_BITS) ||
+	    atomic_read(&br->fdb_count) <= 2 * (old->mask + 1))
+		return;
 
-	spin_lock_bh(&br->hash_lock);
+	ht = fdb_htable_alloc(buckets);
+	if (!ht)
+		return;
 
-	/* Search all chains since old address/hash is unknown */
-	for (i = 0; i < BR_HASH_SIZE; i++) {
-		struct hlist_node *h;
-		hlist_for_each(h, &br->hash[i]) {
-			struct net_bridge_fdb_entry *f;
-
-			f = hlist_entry(h, struct net_bridge_fdb_entry, hlist);
-			if (f->dst == p && f->is_local) {
-				/* maybe another port has same hw addr? */
-				struct net_bridge_port *op;
-				list_for_each_entry(op, &br->port_list, list) {
-					if (op != p &&
-					    !compare_ether_addr(op->dev->dev_addr,
-								f->addr.addr)) {
-						f->dst = op;
-						goto insert;
-					}
-				}
+	/*
+	 * Without a non-reentrant workqueue a requeued resize may run on
+	 * another CPU at the same time; only one of them may switch tables.
+	 */
+	spin_lock_bh(&br->fdb_lock[0]);
+	if (br->fdb != old || br->fdb_old) {
+		spin_unlock_bh(&br->fdb_lock[0]);
+		fdb_htable_free(ht);
+		return;
+	}
+	rcu_assign_pointer(br->fdb_old, old);
+	rcu_assign_pointer(br->fdb, ht);
+	spin_unlock_bh(&br->fdb_lock[0]);
+
+	/*
+	 * A writer reads the table pointers under its bucket lock; taking
+	 * that lock here for each bucket orders it after the switch above,
+	 * so nothing can be added to a bucket that was already emptied.
+	 */
+	for (i = 0; i <= old->mask; i++) {
+		struct net_bridge_fdb_entry *f;
+		struct hlist_node *h, *n;
 
-				/* delete old one */
-				fdb_delete(f);
-				goto insert;
+		spin_lock_bh(fdb_lock(br, i));
+		hlist_for_each_entry_safe(f, h, n, &old->hash[i], hlist) {
+			hlist_del_rcu(&f->hlist);
+			hlist_add_head_rcu(&f->hlist,
+					   fdb_bucket(ht, br_mac_hash(f->addr.addr)));
+		}
+		spin_unlock_bh(fdb_lock(br, i));
+
+		if (!(i & (BR_FDB_LOCKS - 1)))
+			cond_resched();
+	}
+
+	rcu_assign_pointer(br->fdb_old, NULL);
+
+	/* wait for writers that may still be looking at the old table */
+	for (i = 0; i < BR_FDB_LOCKS; i++) {
+		spin_lock_bh(&br->fdb_lock[i]);
+		spin_unlock_bh(&br->fdb_lock[i]);
+	}
+	call_rcu(&old->rcu, fdb_htable_free_rcu);
+
+	/* learning may have gone on meanwhile */
+	if (atomic_read(&br->fdb_count) > 2 * (ht->mask + 1))
+		schedule_work(&br->fdb_resize_work);
+}
+
+/*
+ * Call @fn for every entry with its bucket lock held, until it returns
+ * nonzero.  The table being emptied by a resize is walked before the
+ * one being filled, and the walk is repeated if a resize started
+ * meanwhile, so that an entry moving between tables is not missed.
+ */
+static int fdb_walk(struct net_bridge *br,
+		    int (*fn)(struct net_bridge *br,
+			      struct net_bridge_fdb_entry *f, void *arg),
+		    void *arg)
+{
+	struct net_bridge_fdb_htable *tables[2];
+	int t, ret = 0;
+	u32 i;
+
+	rcu_read_lock();
+	do {
+		tables[0] = rcu_dereference(br->fdb_old);
+		tables[1] = rcu_dereference(br->fdb);
+
+		for (t = 0; t < 2; t++) {
+			if (!tables[t])
+				continue;
+			for (i = 0; i <= tables[t]->mask; i++) {
+				struct net_bridge_fdb_entry *f;
+				struct hlist_node *h, *n;
+
+				spin_lock_bh(fdb_lock(br, i));
+				hlist_for_each_entry_safe(f, h, n,
+						&tables[t]->hash[i], hlist) {
+					ret = fn(br, f, arg);
+					if (ret)
+						break;
+				}
+				spin_unlock_bh(fdb_lock(br, i));
+				if (ret)
+					goto out;
 			}
 		}
+	} while (tables[1] != rcu_dereference(br->fdb));
+ out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * Hand the local entry of @p over to another port with the same
+ * address, if there is one.
+ */
+static int fdb_move_local(struct net_bridge *br, struct net_bridge_fdb_entry *f,
+			  const struct net_bridge_port *p)
+{
+	struct net_bridge_port *op;
+
+	list_for_each_entry(op, &br->port_list, list) {
+		if (op != p &&
+		    !compare_ether_addr(op->dev->dev_addr, f->addr.addr)) {
+			f->dst = op;
+			return 1;
+		}
 	}
- insert:
-	/* insert new address,  may fail if invalid address or dup. */
-	fdb_insert(br, p, newaddr);
+	return 0;
+}
+
+static int fdb_changeaddr(struct net_bridge *br, struct net_bridge_fdb_entry *f,
+			  void *arg)
+{
+	struct net_bridge_port *p = arg;
 
-	spin_unlock_bh(&br->hash_lock);
+	if (f->dst != p || !f->is_local)
+		return 0;
+
+	/* maybe another port has same hw addr? */
+	if (!fdb_move_local(br, f, p))
+		/* delete old one */
+		fdb_delete(br, f);
+	return 1;
 }
 
+void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
+{
+	struct net_bridge *br = p->br;
+
+	/* Search all chains since old address/hash is unknown */
+	fdb_walk(br, fdb_changeaddr, p);
+
+	/* insert new address,  may fail if invalid address or dup. */
+	br_fdb_insert(br, p, newaddr);
+}
+
+/*
+ * Aging works through the table a bounded number of entries at a time,
+ * rearming the timer for the next tick until the sweep is complete and
+ * then for the earliest expiry seen during the sweep.  A resize in the
+ * middle of a sweep only makes some entries be looked at twice or wait
+ * for the next sweep.
+ */
 void br_fdb_cleanup(unsigned long _data)
 {
 	struct net_bridge *br = (struct net_bridge *)_data;
 	unsigned long delay = hold_time(br);
-	unsigned long next_timer = jiffies + br->ageing_time;
-	int i;
+	struct net_bridge_fdb_htable *ht;
+	int budget = BR_FDB_GC_BUDGET;
+	u32 i;
+
+	i = br->fdb_gc_next;
+	if (!i)
+		br->fdb_gc_expires = jiffies + br->ageing_time;
 
-	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	rcu_read_lock();
+	ht = rcu_dereference(br->fdb);
+	for (; i <= ht->mask && budget > 0; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *h, *n;
 
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
+		spin_lock(fdb_lock(br, i));
+		hlist_for_each_entry_safe(f, h, n, &ht->hash[i], hlist) {
 			unsigned long this_timer;
+
+			budget--;
 			if (f->is_static)
 				continue;
 			this_timer = f->ageing_timer + delay;
 			if (time_before_eq(this_timer, jiffies))
-				fdb_delete(f);
-			else if (time_before(this_timer, next_timer))
-				next_timer = this_timer;
+				fdb_delete(br, f);
+			else if (time_before(this_timer, br->fdb_gc_expires))
+				br->fdb_gc_expires = this_timer;
 		}
+		spin_unlock(fdb_lock(br, i));
 	}
-	spin_unlock_bh(&br->hash_lock);
+	if (i > ht->mask)
+		i = 0;
+	rcu_read_unlock();
 
-	mod_timer(&br->gc_timer, round_jiffies_up(next_timer));
+	br->fdb_gc_next = i;
+	if (i)
+		mod_timer(&br->gc_timer, jiffies + 1);
+	else
+		mod_timer(&br->gc_timer, round_jiffies_up(br->fdb_gc_expires));
+}
+
+static int fdb_flush(struct net_bridge *br, struct net_bridge_fdb_entry *f,
+		     void *arg)
+{
+	if (!f->is_static)
+		fdb_delete(br, f);
+	return 0;
 }
 
 /* Completely flush all dynamic entries in forwarding database.*/
 void br_fdb_flush(struct net_bridge *br)
 {
-	int i;
+	fdb_walk(br, fdb_flush, NULL);
+}
 
-	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
-		struct net_bridge_fdb_entry *f;
-		struct hlist_node *h, *n;
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
-			if (!f->is_static)
-				fdb_delete(f);
-		}
-	}
-	spin_unlock_bh(&br->hash_lock);
+struct fdb_port_arg {
+	const struct net_bridge_port	*p;
+	int				do_all;
+};
+
+static int fdb_delete_by_port(struct net_bridge *br,
+			      struct net_bridge_fdb_entry *f, void *arg)
+{
+	struct fdb_port_arg *pa = arg;
+
+	if (f->dst != pa->p)
+		return 0;
+
+	if (f->is_static && !pa->do_all)
+		return 0;
+	/*
+	 * if multiple ports all have the same device address
+	 * then when one port is deleted, assign
+	 * the local entry to other port
+	 */
+	if (f->is_local && fdb_move_local(br, f, pa->p))
+		return 0;
+
+	fdb_delete(br, f);
+	return 0;
 }
 
 /* Flush all entries refering to a specific port.
@@ -176,60 +428,51 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 			   const struct net_bridge_port *p,
 			   int do_all)
 {
-	int i;
-
-	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
-		struct hlist_node *h, *g;
+	struct fdb_port_arg pa = { .p = p, .do_all = do_all };
 
-		hlist_for_each_safe(h, g, &br->hash[i]) {
-			struct net_bridge_fdb_entry *f
-				= hlist_entry(h, struct net_bridge_fdb_entry, hlist);
-			if (f->dst != p)
-				continue;
+	fdb_walk(br, fdb_delete_by_port, &pa);
+}
 
-			if (f->is_static && !do_all)
-				continue;
-			/*
-			 * if multiple ports all have the same device address
-			 * then when one port is deleted, assign
-			 * the local entry to other port
-			 */
-			if (f->is_local) {
-				struct net_bridge_port *op;
-				list_for_each_entry(op, &br->port_list, list) {
-					if (op != p &&
-					    !compare_ether_addr(op->dev->dev_addr,
-								f->addr.addr)) {
-						f->dst = op;
-						goto skip_delete;
-					}
-				}
-			}
+static inline struct net_bridge_fdb_entry *fdb_find(struct hlist_head *head,
+						    const unsigned char *addr)
+{
+	struct hlist_node *h;
+	struct net_bridge_fdb_entry *fdb;
 
-			fdb_delete(f);
-		skip_delete: ;
-		}
+	hlist_for_each_entry_rcu(fdb, h, head, hlist) {
+		if (!compare_ether_addr(fdb->addr.addr, addr))
+			return fdb;
 	}
-	spin_unlock_bh(&br->hash_lock);
+	return NULL;
+}
+
+/*
+ * Look @addr up in @ht and, while a resize is moving entries out of it,
+ * in @old.  Called under rcu_read_lock or with the bucket lock held.
+ */
+static inline struct net_bridge_fdb_entry *fdb_lookup(
+	struct net_bridge_fdb_htable *ht, struct net_bridge_fdb_htable *old,
+	u32 hash, const unsigned char *addr)
+{
+	struct net_bridge_fdb_entry *fdb;
+
+	fdb = fdb_find(fdb_bucket(ht, hash), addr);
+	if (!fdb && unlikely(old))
+		fdb = fdb_find(fdb_bucket(old, hash), addr);
+	return fdb;
 }
 
 /* No locking or refcounting, assumes caller has no preempt (rcu_read_lock) */
 struct net_bridge_fdb_entry *__br_fdb_get(struct net_bridge *br,
 					  const unsigned char *addr)
 {
-	struct hlist_node *h;
 	struct net_bridge_fdb_entry *fdb;
 
-	hlist_for_each_entry_rcu(fdb, h, &br->hash[br_mac_hash(addr)], hlist) {
-		if (!compare_ether_addr(fdb->addr.addr, addr)) {
-			if (unlikely(has_expired(br, fdb)))
-				break;
-			return fdb;
-		}
-	}
-
-	return NULL;
+	fdb = fdb_lookup(rcu_dereference(br->fdb), rcu_dereference(br->fdb_old),
+			 br_mac_hash(addr), addr);
+	if (fdb && unlikely(has_expired(br, fdb)))
+		return NULL;
+	return fdb;
 }
 
 #if defined(CONFIG_ATM_LANE) || defined(CONFIG_ATM_LANE_MODULE)
@@ -261,38 +504,53 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 		   unsigned long maxnum, unsigned long skip)
 {
 	struct __fdb_entry *fe = buf;
-	int i, num = 0;
+	struct net_bridge_fdb_htable *tables[2];
+	int t, num = 0;
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *f;
+	u32 i;
 
 	memset(buf, 0, maxnum*sizeof(struct __fdb_entry));
 
+	/*
+	 * Like any dump this is only a snapshot; during a resize an
+	 * entry may be reported twice or not at all.
+	 */
 	rcu_read_lock();
-	for (i = 0; i < BR_HASH_SIZE; i++) {
-		hlist_for_each_entry_rcu(f, h, &br->hash[i], hlist) {
-			if (num >= maxnum)
-				goto out;
-
-			if (has_expired(br, f))
-				continue;
-
-			if (skip) {
-				--skip;
-				continue;
-			}
+	tables[0] = rcu_dereference(br->fdb_old);
+	tables[1] = rcu_dereference(br->fdb);
+	for (t = 0; t < 2; t++) {
+		if (!tables[t])
+			continue;
+		for (i = 0; i <= tables[t]->mask; i++) {
+			hlist_for_each_entry_rcu(f, h, &tables[t]->hash[i],
+						 hlist) {
+				if (num >= maxnum)
+					goto out;
+
+				if (has_expired(br, f))
+					continue;
+
+				if (skip) {
+					--skip;
+					continue;
+				}
 
-			/* convert from internal format to API */
-			memcpy(fe->mac_addr, f->addr.addr, ETH_ALEN);
+				/* convert from internal format to API */
+				memcpy(fe->mac_addr, f->addr.addr, ETH_ALEN);
 
-			/* due to ABI compat need to split into hi/lo */
-			fe->port_no = f->dst->port_no;
-			fe->port_hi = f->dst->port_no >> 8;
+				/* due to ABI compat need to split into hi/lo */
+				fe->port_no = f->dst->port_no;
+				fe->port_hi = f->dst->port_no >> 8;
 
-			fe->is_local = f->is_local;
-			if (!f->is_static)
-				fe->ageing_timer_value = jiffies_to_clock_t(jiffies - f->ageing_timer);
-			++fe;
-			++num;
+				fe->is_local = f->is_local;
+				if (!f->is_static)
+					fe->ageing_timer_value =
+						jiffies_to_clock_t(jiffies -
+							f->ageing_timer);
+				++fe;
+				++num;
+			}
 		}
 	}
 
@@ -302,49 +560,42 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 	return num;
 }
 
-static inline struct net_bridge_fdb_entry *fdb_find(struct hlist_head *head,
-						    const unsigned char *addr)
-{
-	struct hlist_node *h;
-	struct net_bridge_fdb_entry *fdb;
-
-	hlist_for_each_entry_rcu(fdb, h, head, hlist) {
-		if (!compare_ether_addr(fdb->addr.addr, addr))
-			return fdb;
-	}
-	return NULL;
-}
-
-static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
+/* Called with the bucket lock of @hash held */
+static struct net_bridge_fdb_entry *fdb_create(struct net_bridge *br, u32 hash,
 					       struct net_bridge_port *source,
 					       const unsigned char *addr,
 					       int is_local)
 {
+	struct net_bridge_fdb_htable *ht = br->fdb;
 	struct net_bridge_fdb_entry *fdb;
 
 	fdb = kmem_cache_alloc(br_fdb_cache, GFP_ATOMIC);
 	if (fdb) {
 		memcpy(fdb->addr.addr, addr, ETH_ALEN);
-		hlist_add_head_rcu(&fdb->hlist, head);
-
 		fdb->dst = source;
 		fdb->is_local = is_local;
 		fdb->is_static = is_local;
 		fdb->ageing_timer = jiffies;
+		hlist_add_head_rcu(&fdb->hlist, fdb_bucket(ht, hash));
+
+		if (atomic_inc_return(&br->fdb_count) > 2 * (ht->mask + 1) &&
+		    ht->mask < (1 << BR_FDB_HASH_MAX_BITS) - 1 && !br->fdb_old)
+			schedule_work(&br->fdb_resize_work);
 	}
 	return fdb;
 }
 
+/* Called with the bucket lock of @addr held */
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		  const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
+	u32 hash = br_mac_hash(addr);
 	struct net_bridge_fdb_entry *fdb;
 
 	if (!is_valid_ether_addr(addr))
 		return -EINVAL;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_lookup(br->fdb, br->fdb_old, hash, addr);
 	if (fdb) {
 		/* it is okay to have multiple ports with same
 		 * address, just use the first one.
@@ -354,10 +605,10 @@ static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		br_warn(br, "adding interface %s with same address "
 		       "as a received packet\n",
 		       source->dev->name);
-		fdb_delete(fdb);
+		fdb_delete(br, fdb);
 	}
 
-	if (!fdb_create(head, source, addr, 1))
+	if (!fdb_create(br, hash, source, addr, 1))
 		return -ENOMEM;
 
 	return 0;
@@ -366,18 +617,19 @@ static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 int br_fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		  const unsigned char *addr)
 {
+	spinlock_t *lock = fdb_lock(br, br_mac_hash(addr));
 	int ret;
 
-	spin_lock_bh(&br->hash_lock);
+	spin_lock_bh(lock);
 	ret = fdb_insert(br, source, addr);
-	spin_unlock_bh(&br->hash_lock);
+	spin_unlock_bh(lock);
 	return ret;
 }
 
 void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 		   const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
+	u32 hash = br_mac_hash(addr);
 	struct net_bridge_fdb_entry *fdb;
 
 	/* some users want to always flood. */
@@ -389,7 +641,8 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 	      source->state == BR_STATE_FORWARDING))
 		return;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_lookup(rcu_dereference(br->fdb),
+			 rcu_dereference(br->fdb_old), hash, addr);
 	if (likely(fdb)) {
 		/* attempt to update an entry for a local interface */
 		if (unlikely(fdb->is_local)) {
@@ -398,17 +651,21 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 					"own address as source address\n",
 					source->dev->name);
 		} else {
-			/* fastpath: update of existing entry */
-			fdb->dst = source;
-			fdb->ageing_timer = jiffies;
+			/* fastpath: update of existing entry, no lock */
+			if (unlikely(fdb->dst != source))
+				fdb->dst = source;
+			if (fdb->ageing_timer != jiffies)
+				fdb->ageing_timer = jiffies;
 		}
 	} else {
-		spin_lock(&br->hash_lock);
-		if (!fdb_find(head, addr))
-			fdb_create(head, source, addr, 0);
+		spinlock_t *lock = fdb_lock(br, hash);
+
+		spin_lock(lock);
+		if (!fdb_lookup(br->fdb, br->fdb_old, hash, addr))
+			fdb_create(br, hash, source, addr, 0);
 		/* else  we lose race and someone else inserts
 		 * it first, don't bother updating
 		 */
-		spin_unlock(&br->hash_lock);
+		spin_unlock(lock);
 	}
 }
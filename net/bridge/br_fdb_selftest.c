@@ -0,0 +1,188 @@
+/*
+ *	Forwarding database self-test
+ *	Linux ethernet bridge
+ *
+ *	Learns 65536 MAC addresses on a private bridge with a single
+ *	forwarding port, refreshes and looks all of them up, and ages them
+ *	out again, checking the results and timing each step.  The rates,
+ *	the final hash size and the longest run of the aging timer go to
+ *	the kernel log.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/etherdevice.h>
+#include <linux/workqueue.h>
+#include <asm/div64.h>
+#include "br_private.h"
+
+#define FDB_TEST_MACS	65536
+#define FDB_TEST_BATCH	1024
+
+static void __init fdb_test_addr(unsigned char *addr, u32 i, u8 oui)
+{
+	/* spread the keys over the whole hash input */
+	__be32 key = htonl(i * 2654435761u);
+
+	addr[0] = 0x02;
+	addr[1] = oui;
+	memcpy(addr + 2, &key, sizeof(key));
+}
+
+static u64 __init fdb_test_ns(ktime_t start, u32 n)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	do_div(ns, n);
+	return ns;
+}
+
+/* Learn or refresh every test address, as the receive path would */
+static void __init fdb_test_update(struct net_bridge *br,
+				   struct net_bridge_port *p)
+{
+	unsigned char addr[ETH_ALEN];
+	u32 i, j;
+
+	for (i = 0; i < FDB_TEST_MACS; i += FDB_TEST_BATCH) {
+		local_bh_disable();
+		rcu_read_lock();
+		for (j = i; j < i + FDB_TEST_BATCH; j++) {
+			fdb_test_addr(addr, j, 0);
+			br_fdb_update(br, p, addr);
+		}
+		rcu_read_unlock();
+		local_bh_enable();
+		cond_resched();
+	}
+}
+
+/* Returns the number of test addresses not found on @p */
+static u32 __init fdb_test_lookup(struct net_bridge *br,
+				  struct net_bridge_port *p, u8 oui)
+{
+	struct net_bridge_fdb_entry *fdb;
+	unsigned char addr[ETH_ALEN];
+	u32 i, j, missing = 0;
+
+	for (i = 0; i < FDB_TEST_MACS; i += FDB_TEST_BATCH) {
+		rcu_read_lock();
+		for (j = i; j < i + FDB_TEST_BATCH; j++) {
+			fdb_test_addr(addr, j, oui);
+			fdb = __br_fdb_get(br, addr);
+			if (!fdb || fdb->dst != p ||
+			    compare_ether_addr(fdb->addr.addr, addr))
+				missing++;
+		}
+		rcu_read_unlock();
+		cond_resched();
+	}
+	return missing;
+}
+
+/* Aging rearms the timer; keep it from running behind our back */
+static void __init fdb_test_gc_nop(unsigned long data)
+{
+}
+
+void __init br_fdb_selftest(void)
+{
+	u64 learn_ns, refresh_ns, lookup_ns, miss_ns, gc_ns, gc_max = 0;
+	struct net_bridge_port *p;
+	struct net_bridge *br;
+	u32 missing, found, buckets, runs = 0;
+	ktime_t start;
+	int err = 0;
+
+	br = kzalloc(sizeof(*br), GFP_KERNEL);
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!br || !p || br_fdb_hash_init(br)) {
+		pr_err("bridge: fdb self-test: out of memory\n");
+		goto out_free;
+	}
+
+	spin_lock_init(&br->lock);
+	INIT_LIST_HEAD(&br->port_list);
+	br->ageing_time = 300 * HZ;
+	br->forward_delay = 15 * HZ;
+	setup_timer(&br->gc_timer, fdb_test_gc_nop, 0);
+
+	p->br = br;
+	p->port_no = 1;
+	p->state = BR_STATE_FORWARDING;
+
+	start = ktime_get();
+	fdb_test_update(br, p);
+	learn_ns = fdb_test_ns(start, FDB_TEST_MACS);
+
+	/* let the table finish growing */
+	do {
+		schedule_work(&br->fdb_resize_work);
+		flush_scheduled_work();
+	} while (br->fdb_old ||
+		 (atomic_read(&br->fdb_count) > 2 * (br->fdb->mask + 1) &&
+		  br->fdb->mask < (1 << BR_FDB_HASH_MAX_BITS) - 1));
+	buckets = br->fdb->mask + 1;
+
+	start = ktime_get();
+	fdb_test_update(br, p);
+	refresh_ns = fdb_test_ns(start, FDB_TEST_MACS);
+
+	start = ktime_get();
+	missing = fdb_test_lookup(br, p, 0);
+	lookup_ns = fdb_test_ns(start, FDB_TEST_MACS);
+
+	start = ktime_get();
+	found = FDB_TEST_MACS - fdb_test_lookup(br, p, 1);
+	miss_ns = fdb_test_ns(start, FDB_TEST_MACS);
+
+	if (missing || found || atomic_read(&br->fdb_count) != FDB_TEST_MACS) {
+		pr_err("bridge: fdb self-test: %u of %u addresses missing, "
+		       "%u unknown ones found, %d entries\n",
+		       missing, FDB_TEST_MACS, found,
+		       atomic_read(&br->fdb_count));
+		err = 1;
+	}
+
+	/* expire everything in one sweep of the aging timer */
+	br->ageing_time = 1;
+	schedule_timeout_uninterruptible(2);
+	do {
+		local_bh_disable();
+		start = ktime_get();
+		br_fdb_cleanup((unsigned long)br);
+		gc_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		local_bh_enable();
+		gc_max = max(gc_max, gc_ns);
+		runs++;
+	} while (br->fdb_gc_next);
+	del_timer_sync(&br->gc_timer);
+
+	if (atomic_read(&br->fdb_count)) {
+		pr_err("bridge: fdb self-test: %d entries left after aging\n",
+		       atomic_read(&br->fdb_count));
+		err = 1;
+	}
+
+	pr_info("bridge: fdb self-test: %u MACs in %u buckets, learn %llu ns, "
+		"refresh %llu ns, lookup %llu ns, miss %llu ns per MAC, "
+		"aging %u runs of at most %llu ns%s\n",
+		FDB_TEST_MACS, buckets, learn_ns, refresh_ns, lookup_ns,
+		miss_ns, runs, gc_max, err ? ", FAILED" : "");
+
+	br_fdb_delete_by_port(br, p, 1);
+	br_fdb_hash_fini(br);
+	/* the entries go back to the cache after a grace period */
+	rcu_barrier();
+out_free:
+	kfree(p);
+	kfree(br);
+}
@@ -196,9 +196,14 @@ static struct net_device *new_bridge_dev(struct net *net, const char *name)
 		return NULL;
 	}
 
+	if (br_fdb_hash_init(br)) {
+		free_percpu(br->stats);
+		free_netdev(dev);
+		return NULL;
+	}
+
 	spin_lock_init(&br->lock);
 	INIT_LIST_HEAD(&br->port_list);
-	spin_lock_init(&br->hash_lock);
 
 	br->bridge_id.prio[0] = 0x80;
 	br->bridge_id.prio[1] = 0x00;
@@ -311,6 +316,7 @@ int br_add_bridge(struct net *net, const char *name)
 	return ret;
 
 out_free:
+	br_fdb_hash_fini(netdev_priv(dev));
 	free_netdev(dev);
 	goto out;
 }
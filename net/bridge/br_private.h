@@ -20,6 +20,15 @@
 #define BR_HASH_BITS 8
 #define BR_HASH_SIZE (1 << BR_HASH_BITS)
 
+/* The fdb hash starts at BR_HASH_SIZE buckets and doubles up to this */
+#define BR_FDB_HASH_MAX_BITS	16
+/*
+ * Bucket locks of the fdb hash; bucket b is covered by lock
+ * b & (BR_FDB_LOCKS - 1) whatever the table size, so an entry keeps
+ * its lock when the table grows.
+ */
+#define BR_FDB_LOCKS		64
+
 #define BR_HOLD_TIME (1*HZ)
 
 #define BR_PORT_BITS	10
@@ -68,6 +77,13 @@ struct net_bridge_fdb_entry
 	unsigned char			is_static;
 };
 
+struct net_bridge_fdb_htable
+{
+	struct hlist_head		*hash;
+	u32				mask;
+	struct rcu_head			rcu;
+};
+
 struct net_bridge_port_group {
 	struct net_bridge_port		*port;
 	struct net_bridge_port_group	*next;
@@ -159,8 +175,13 @@ struct net_bridge
 	struct net_device		*dev;
 
 	struct br_cpu_netstats __percpu *stats;
-	spinlock_t			hash_lock;
-	struct hlist_head		hash[BR_HASH_SIZE];
+	struct net_bridge_fdb_htable	*fdb;
+	struct net_bridge_fdb_htable	*fdb_old;	/* being resized */
+	spinlock_t			fdb_lock[BR_FDB_LOCKS];
+	atomic_t			fdb_count;
+	struct work_struct		fdb_resize_work;
+	u32				fdb_gc_next;	/* aging cursor */
+	unsigned long			fdb_gc_expires;
 	unsigned long			feature_mask;
 #ifdef CONFIG_BRIDGE_NETFILTER
 	struct rtable 			fake_rtable;
@@ -288,6 +309,8 @@ extern void br_netpoll_disable(struct net_bridge *br,
 /* br_fdb.c */
 extern int br_fdb_init(void);
 extern void br_fdb_fini(void);
+extern int br_fdb_hash_init(struct net_bridge *br);
+extern void br_fdb_hash_fini(struct net_bridge *br);
 extern void br_fdb_flush(struct net_bridge *br);
 extern void br_fdb_changeaddr(struct net_bridge_port *p,
 			      const unsigned char *newaddr);
@@ -306,6 +329,15 @@ extern void br_fdb_update(struct net_bridge *br,
 			  struct net_bridge_port *source,
 			  const unsigned char *addr);
 
+#ifdef CONFIG_BRIDGE_FDB_SELFTEST
+/* br_fdb_selftest.c */
+extern void br_fdb_selftest(void);
+#else
+static inline void br_fdb_selftest(void)
+{
+}
+#endif
+
 /* br_forward.c */
 extern void br_deliver(const struct net_bridge_port *to,
 		struct sk_buff *skb);
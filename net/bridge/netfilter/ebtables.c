@@ -195,6 +195,7 @@ unsigned int ebt_do_table (unsigned int hook, struct sk_buff *skb,
 	acpar.hooknum = hook;
 
 	read_lock_bh(&table->lock);
+	__get_cpu_var(xt_info_locks).seq++;
 	private = table->private;
 	cb_base = COUNTER_BASE(private->counters, private->nentries,
 	   smp_processor_id());
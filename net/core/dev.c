@@ -133,6 +133,7 @@
 #include <linux/random.h>
 #include <trace/events/napi.h>
 #include <linux/pci.h>
+#include <net/fastroute.h>
 
 #include "net-sysfs.h"
 
@@ -142,9 +143,6 @@
 /* This should be increased if a protocol with a bigger head is added. */
 #define GRO_MAX_HEAD (MAX_HEADER + 128)
 
-#ifdef CONFIG_NET_GIANFAR_FP
-static void dev_do_clear_fastroute(struct net_device *dev);
-#endif
 /*
  *	The list of packet types we will receive (as opposed to discard)
  *	and the routines to invoke.
@@ -369,38 +367,6 @@ static inline void netdev_set_addr_lockdep_class(struct net_device *dev)
 }
 #endif
 
-#ifdef CONFIG_NET_GIANFAR_FP
-static void dev_do_clear_fastroute(struct net_device *dev)
-{
-	if (dev->netdev_ops->ndo_accept_fastpath) {
-		int i;
-
-		for (i = 0; i <= NETDEV_FASTROUTE_HMASK; i++) {
-			struct dst_entry *dst;
-
-			write_lock_irq(&dev->fastpath_lock);
-			dst = dev->fastpath[i];
-			dev->fastpath[i] = NULL;
-			write_unlock_irq(&dev->fastpath_lock);
-
-			dst_release(dst);
-		}
-	}
-}
-
-void dev_clear_fastroute(struct net_device *dev)
-{
-	if (dev) {
-		dev_do_clear_fastroute(dev);
-	} else {
-		read_lock(&dev_base_lock);
-		for_each_netdev(dev_net(dev), dev)
-			dev_do_clear_fastroute(dev);
-		read_unlock(&dev_base_lock);
-	}
-}
-#endif
-
 /*******************************************************************************
 
 		Protocol management and registration routines
@@ -2128,6 +2094,27 @@ static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 	spinlock_t *root_lock = qdisc_lock(q);
 	int rc;
 
+	if (q->flags & TCQ_F_DEFER_ENQUEUE) {
+		/*
+		 * Queue the packet without the lock.  If somebody else holds
+		 * the lock, the packet is picked up by the next dequeue, from
+		 * the running CPU or from net_tx_action().  The verdict of
+		 * the real enqueue is not known here.
+		 */
+		skb_dst_force(skb);
+		qdisc_defer_enqueue(skb, q);
+		if (spin_trylock(root_lock)) {
+			if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED,
+					      &q->state)))
+				qdisc_defer_purge(q);
+			else
+				qdisc_run(q);
+			spin_unlock(root_lock);
+		} else
+			__netif_schedule(q);
+		return NET_XMIT_SUCCESS;
+	}
+
 	spin_lock(root_lock);
 	if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED, &q->state))) {
 		kfree_skb(skb);
@@ -5411,9 +5398,6 @@ int register_netdevice(struct net_device *dev)
 	netdev_set_addr_lockdep_class(dev);
 	netdev_init_queue_locks(dev);
 
-#ifdef CONFIG_NET_GIANFAR_FP
-	dev->fastpath_lock = __RW_LOCK_UNLOCKED();
-#endif
 	dev->iflink = -1;
 
 #ifdef CONFIG_RPS
@@ -0,0 +1,754 @@
+/*
+ *	Per-device IPv4 fast route flow cache
+ *
+ *	Replaces the sixteen slot dev->fastpath[] array, which was indexed
+ *	by the low octets of the source and destination address, with a
+ *	real flow cache:
+ *
+ *	- entries are hashed on (saddr, daddr, protocol, ports) with jhash
+ *	- the number of entries per device is set by
+ *	  /proc/sys/net/core/netdev_fastroute_size
+ *	- lookups run lockless under RCU, insert/remove take a per-table
+ *	  spinlock
+ *	- when the table is full a CLOCK (second chance) scan picks the
+ *	  least recently used entry as the victim
+ *	- a per-table timer sweeps a bounded number of buckets per tick and
+ *	  drops idle entries, entries whose route went obsolete and entries
+ *	  whose neighbour is no longer valid
+ *	- /proc/net/fastroute dumps the entries and /proc/net/stat/fastroute
+ *	  the per-device counters
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/percpu.h>
+#include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+#include <linux/notifier.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/sysctl.h>
+#include <net/net_namespace.h>
+#include <net/ip.h>
+#include <net/dst.h>
+#include <net/neighbour.h>
+#include <net/fastroute.h>
+
+#define FASTROUTE_MIN_SIZE	64
+#define FASTROUTE_MAX_SIZE	(1 << 20)
+#define FASTROUTE_GC_INTERVAL	HZ
+#define FASTROUTE_GC_MIN_BUCKETS 16
+#define FASTROUTE_EVICT_SCAN	8
+
+int netdev_fastroute_size __read_mostly = 8192;
+int netdev_fastroute_timeout __read_mostly = 30 * HZ;
+
+struct fastroute_entry {
+	struct hlist_node	hnode;
+	struct list_head	lru;
+	__be32			saddr;
+	__be32			daddr;
+	__be32			ports;
+	u8			protocol;
+	u8			tos;
+	u8			referenced;
+	u8			dead;
+	unsigned long		lastuse;
+	unsigned long		hits;
+	struct dst_entry	*dst;
+	struct rcu_head		rcu;
+};
+
+struct fastroute_stats {
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		inserts;
+	unsigned long		evictions;
+	unsigned long		expired;
+	unsigned long		invalid;
+};
+
+struct fastroute_table {
+	spinlock_t		lock;
+	struct hlist_head	*hash;
+	unsigned int		hmask;
+	int			vmalloced;
+	unsigned int		count;
+	unsigned int		max;
+	unsigned int		gc_bucket;
+	u32			rnd;
+	struct list_head	lru;
+	struct timer_list	gc_timer;
+	struct fastroute_stats __percpu *stats;
+};
+
+static struct kmem_cache *fastroute_cachep __read_mostly;
+
+#define FASTROUTE_STAT_INC(t, field) \
+	(per_cpu_ptr((t)->stats, smp_processor_id())->field++)
+
+static inline u32 fastroute_hash(const struct fastroute_table *t,
+				 __be32 saddr, __be32 daddr, u8 protocol,
+				 __be32 ports)
+{
+	return jhash_3words((__force u32)saddr, (__force u32)daddr,
+			    (__force u32)ports ^ protocol, t->rnd) & t->hmask;
+}
+
+/* Ports are only part of the key for the first fragment-free datagram of
+ * port based protocols; everything else is keyed on addresses only.
+ */
+static __be32 fastroute_ports(const struct sk_buff *skb,
+			      const struct iphdr *iph)
+{
+	const __be32 *pp;
+	__be32 _ports;
+
+	if (iph->frag_off & htons(IP_MF | IP_OFFSET))
+		return 0;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_SCTP:
+		pp = skb_header_pointer(skb, (const u8 *)iph - skb->data +
+					iph->ihl * 4, sizeof(_ports), &_ports);
+		return pp ? *pp : 0;
+	}
+	return 0;
+}
+
+static inline int fastroute_dst_valid(const struct dst_entry *dst)
+{
+	return dst->obsolete <= 0 && dst->neighbour &&
+	       (dst->neighbour->nud_state & NUD_VALID);
+}
+
+static void fastroute_entry_free_rcu(struct rcu_head *head)
+{
+	struct fastroute_entry *e =
+		container_of(head, struct fastroute_entry, rcu);
+
+	dst_release(e->dst);
+	kmem_cache_free(fastroute_cachep, e);
+}
+
+/* Caller holds t->lock */
+static void fastroute_unlink(struct fastroute_table *t,
+			     struct fastroute_entry *e)
+{
+	e->dead = 1;
+	hlist_del_rcu(&e->hnode);
+	list_del(&e->lru);
+	t->count--;
+	call_rcu(&e->rcu, fastroute_entry_free_rcu);
+}
+
+/* Caller holds t->lock.  Second chance scan from the cold end of the LRU
+ * list: entries hit since the last pass are rotated to the hot end, the
+ * first one that was not is dropped.
+ */
+static void fastroute_evict(struct fastroute_table *t)
+{
+	struct fastroute_entry *e;
+	int scan = FASTROUTE_EVICT_SCAN;
+
+	while (!list_empty(&t->lru)) {
+		e = list_first_entry(&t->lru, struct fastroute_entry, lru);
+		if (e->referenced && --scan > 0) {
+			e->referenced = 0;
+			list_move_tail(&e->lru, &t->lru);
+			continue;
+		}
+		fastroute_unlink(t, e);
+		FASTROUTE_STAT_INC(t, evictions);
+		return;
+	}
+}
+
+struct dst_entry *fastroute_lookup(struct net_device *dev,
+				   struct sk_buff *skb,
+				   const struct iphdr *iph)
+{
+	struct fastroute_table *t = rcu_dereference(dev->fastpath);
+	struct fastroute_entry *e;
+	struct hlist_node *n;
+	__be32 ports;
+	u32 hash;
+
+	if (unlikely(!t))
+		return NULL;
+
+	ports = fastroute_ports(skb, iph);
+	hash = fastroute_hash(t, iph->saddr, iph->daddr, iph->protocol, ports);
+
+	hlist_for_each_entry_rcu(e, n, &t->hash[hash], hnode) {
+		if (e->saddr != iph->saddr || e->daddr != iph->daddr ||
+		    e->ports != ports || e->protocol != iph->protocol ||
+		    e->tos != iph->tos)
+			continue;
+
+		if (unlikely(!fastroute_dst_valid(e->dst))) {
+			spin_lock(&t->lock);
+			if (!e->dead) {
+				fastroute_unlink(t, e);
+				FASTROUTE_STAT_INC(t, invalid);
+			}
+			spin_unlock(&t->lock);
+			break;
+		}
+
+		e->hits++;
+		e->referenced = 1;
+		if (e->lastuse != jiffies)
+			e->lastuse = jiffies;
+		FASTROUTE_STAT_INC(t, hits);
+		return e->dst;
+	}
+
+	FASTROUTE_STAT_INC(t, misses);
+	return NULL;
+}
+EXPORT_SYMBOL(fastroute_lookup);
+
+/* Called from ip_forward_finish() in softirq context for packets that
+ * took the slow path and got a RTCF_FAST route.
+ */
+void fastroute_insert(struct net_device *dev, struct sk_buff *skb,
+		      struct dst_entry *dst)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	struct fastroute_table *t;
+	struct fastroute_entry *e;
+	struct hlist_node *n;
+	__be32 ports;
+	u32 hash;
+
+	rcu_read_lock();
+	t = rcu_dereference(dev->fastpath);
+	if (!t || !fastroute_dst_valid(dst))
+		goto out;
+
+	ports = fastroute_ports(skb, iph);
+	hash = fastroute_hash(t, iph->saddr, iph->daddr, iph->protocol, ports);
+
+	spin_lock(&t->lock);
+	hlist_for_each_entry(e, n, &t->hash[hash], hnode) {
+		if (e->saddr != iph->saddr || e->daddr != iph->daddr ||
+		    e->ports != ports || e->protocol != iph->protocol ||
+		    e->tos != iph->tos)
+			continue;
+
+		/* Output queue was busy or the entry raced with a
+		 * route change; keep it if the route is still the same.
+		 */
+		if (e->dst == dst) {
+			e->lastuse = jiffies;
+			goto unlock;
+		}
+		fastroute_unlink(t, e);
+		break;
+	}
+
+	if (t->count >= t->max)
+		fastroute_evict(t);
+
+	e = kmem_cache_alloc(fastroute_cachep, GFP_ATOMIC);
+	if (!e)
+		goto unlock;
+
+	e->saddr = iph->saddr;
+	e->daddr = iph->daddr;
+	e->ports = ports;
+	e->protocol = iph->protocol;
+	e->tos = iph->tos;
+	e->referenced = 0;
+	e->dead = 0;
+	e->lastuse = jiffies;
+	e->hits = 0;
+	e->dst = dst_clone(dst);
+
+	hlist_add_head_rcu(&e->hnode, &t->hash[hash]);
+	list_add_tail(&e->lru, &t->lru);
+	t->count++;
+	FASTROUTE_STAT_INC(t, inserts);
+unlock:
+	spin_unlock(&t->lock);
+out:
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(fastroute_insert);
+
+/* Drop every entry, or only those routed out of @odev */
+static void fastroute_flush(struct fastroute_table *t,
+			    const struct net_device *odev)
+{
+	struct fastroute_entry *e, *tmp;
+
+	spin_lock_bh(&t->lock);
+	list_for_each_entry_safe(e, tmp, &t->lru, lru)
+		if (!odev || e->dst->dev == odev)
+			fastroute_unlink(t, e);
+	spin_unlock_bh(&t->lock);
+}
+
+static void fastroute_gc(unsigned long data)
+{
+	struct fastroute_table *t = (struct fastroute_table *)data;
+	unsigned long timeout = netdev_fastroute_timeout;
+	unsigned int buckets = t->hmask + 1;
+	unsigned int budget;
+	struct fastroute_entry *e;
+	struct hlist_node *n, *tmp;
+
+	/* Sweep the whole table once per idle timeout */
+	budget = buckets;
+	if (timeout > FASTROUTE_GC_INTERVAL)
+		budget = max_t(unsigned int, FASTROUTE_GC_MIN_BUCKETS,
+			       buckets / (timeout / FASTROUTE_GC_INTERVAL));
+	if (budget > buckets)
+		budget = buckets;
+
+	spin_lock(&t->lock);
+	while (t->count && budget--) {
+		hlist_for_each_entry_safe(e, n, tmp, &t->hash[t->gc_bucket],
+					  hnode) {
+			if (!fastroute_dst_valid(e->dst)) {
+				fastroute_unlink(t, e);
+				FASTROUTE_STAT_INC(t, invalid);
+			} else if (time_after(jiffies, e->lastuse + timeout)) {
+				fastroute_unlink(t, e);
+				FASTROUTE_STAT_INC(t, expired);
+			}
+		}
+		t->gc_bucket = (t->gc_bucket + 1) & t->hmask;
+	}
+	spin_unlock(&t->lock);
+
+	mod_timer(&t->gc_timer, jiffies + FASTROUTE_GC_INTERVAL);
+}
+
+static struct fastroute_table *fastroute_table_create(unsigned int size)
+{
+	struct fastroute_table *t;
+	unsigned int buckets;
+	size_t sz;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return NULL;
+
+	t->stats = alloc_percpu(struct fastroute_stats);
+	if (!t->stats)
+		goto err_free;
+
+	buckets = roundup_pow_of_two(size);
+	sz = buckets * sizeof(struct hlist_head);
+	t->hash = (void *)__get_free_pages(GFP_KERNEL | __GFP_NOWARN |
+					   __GFP_ZERO, get_order(sz));
+	if (!t->hash) {
+		t->hash = vmalloc(sz);
+		if (!t->hash)
+			goto err_stats;
+		memset(t->hash, 0, sz);
+		t->vmalloced = 1;
+	}
+
+	spin_lock_init(&t->lock);
+	INIT_LIST_HEAD(&t->lru);
+	t->hmask = buckets - 1;
+	t->max = size;
+	get_random_bytes(&t->rnd, sizeof(t->rnd));
+
+	setup_timer(&t->gc_timer, fastroute_gc, (unsigned long)t);
+	mod_timer(&t->gc_timer, jiffies + FASTROUTE_GC_INTERVAL);
+	return t;
+
+err_stats:
+	free_percpu(t->stats);
+err_free:
+	kfree(t);
+	return NULL;
+}
+
+/* The table must already be unpublished and a grace period elapsed */
+static void fastroute_table_destroy(struct fastroute_table *t)
+{
+	del_timer_sync(&t->gc_timer);
+	fastroute_flush(t, NULL);
+
+	if (t->vmalloced)
+		vfree(t->hash);
+	else
+		free_pages((unsigned long)t->hash,
+			   get_order((t->hmask + 1) * sizeof(struct hlist_head)));
+	free_percpu(t->stats);
+	kfree(t);
+}
+
+/* Caller holds RTNL */
+static void fastroute_table_replace(struct net_device *dev,
+				    struct fastroute_table *t)
+{
+	struct fastroute_table *old = dev->fastpath;
+
+	rcu_assign_pointer(dev->fastpath, t);
+	if (old) {
+		synchronize_rcu();
+		fastroute_table_destroy(old);
+	}
+}
+
+/* Drop entries in every table that route out of @odev */
+static void fastroute_flush_all(const struct net_device *odev)
+{
+	struct net_device *dev;
+	struct fastroute_table *t;
+	struct net *net;
+
+	rcu_read_lock();
+	for_each_net_rcu(net) {
+		for_each_netdev_rcu(net, dev) {
+			t = rcu_dereference(dev->fastpath);
+			if (t)
+				fastroute_flush(t, odev);
+		}
+	}
+	rcu_read_unlock();
+}
+
+void dev_clear_fastroute(struct net_device *dev)
+{
+	struct fastroute_table *t;
+
+	if (dev) {
+		rcu_read_lock();
+		t = rcu_dereference(dev->fastpath);
+		if (t)
+			fastroute_flush(t, NULL);
+		rcu_read_unlock();
+	} else {
+		fastroute_flush_all(NULL);
+	}
+}
+EXPORT_SYMBOL(dev_clear_fastroute);
+
+int fastroute_sysctl_size(ctl_table *table, int write,
+			  void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int old = netdev_fastroute_size;
+	struct net_device *dev;
+	struct net *net;
+	int ret;
+
+	ret = proc_dointvec(table, write, buffer, lenp, ppos);
+	if (ret || !write || netdev_fastroute_size == old)
+		return ret;
+
+	if (netdev_fastroute_size < FASTROUTE_MIN_SIZE ||
+	    netdev_fastroute_size > FASTROUTE_MAX_SIZE) {
+		netdev_fastroute_size = old;
+		return -EINVAL;
+	}
+
+	rtnl_lock();
+	for_each_net(net) {
+		for_each_netdev(net, dev) {
+			struct fastroute_table *t;
+
+			if (!dev->fastpath)
+				continue;
+			t = fastroute_table_create(netdev_fastroute_size);
+			if (!t) {
+				ret = -ENOMEM;
+				continue;
+			}
+			fastroute_table_replace(dev, t);
+		}
+	}
+	rtnl_unlock();
+
+	return ret;
+}
+
+/* The timeout is read as an unsigned long, so it has to stay positive */
+int fastroute_sysctl_timeout(ctl_table *table, int write,
+			     void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int timeout = netdev_fastroute_timeout;
+	ctl_table tmp = *table;
+	int ret;
+
+	tmp.data = &timeout;
+	ret = proc_dointvec_jiffies(&tmp, write, buffer, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	if (timeout < 1)
+		return -EINVAL;
+
+	netdev_fastroute_timeout = timeout;
+	return 0;
+}
+
+static int fastroute_netdev_event(struct notifier_block *this,
+				  unsigned long event, void *ptr)
+{
+	struct net_device *dev = ptr;
+
+	switch (event) {
+	case NETDEV_REGISTER:
+		if (dev->netdev_ops->ndo_accept_fastpath && !dev->fastpath) {
+			struct fastroute_table *t;
+
+			t = fastroute_table_create(netdev_fastroute_size);
+			if (!t)
+				printk(KERN_WARNING "%s: no memory for fast "
+				       "route cache, fast path disabled\n",
+				       dev->name);
+			rcu_assign_pointer(dev->fastpath, t);
+		}
+		break;
+	case NETDEV_UNREGISTER:
+		fastroute_table_replace(dev, NULL);
+		fastroute_flush_all(dev);
+		break;
+	case NETDEV_DOWN:
+	case NETDEV_CHANGEMTU:
+	case NETDEV_CHANGEADDR:
+		dev_clear_fastroute(dev);
+		fastroute_flush_all(dev);
+		break;
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block fastroute_netdev_notifier = {
+	.notifier_call = fastroute_netdev_event,
+};
+
+#ifdef CONFIG_PROC_FS
+struct fastroute_iter_state {
+	struct seq_net_private	p;
+	struct net_device	*dev;
+	unsigned int		bucket;
+};
+
+static struct fastroute_entry *fastroute_get_first(struct seq_file *seq,
+						   struct net_device *dev)
+{
+	struct fastroute_iter_state *st = seq->private;
+	struct fastroute_table *t;
+	struct hlist_node *n;
+
+	for (; dev; dev = next_net_device_rcu(dev), st->bucket = 0) {
+		t = rcu_dereference(dev->fastpath);
+		if (!t)
+			continue;
+		for (; st->bucket <= t->hmask; st->bucket++) {
+			n = rcu_dereference(t->hash[st->bucket].first);
+			if (n) {
+				st->dev = dev;
+				return hlist_entry(n, struct fastroute_entry,
+						   hnode);
+			}
+		}
+	}
+	return NULL;
+}
+
+static struct fastroute_entry *fastroute_get_next(struct seq_file *seq,
+						  struct fastroute_entry *e)
+{
+	struct fastroute_iter_state *st = seq->private;
+	struct hlist_node *n = rcu_dereference(e->hnode.next);
+
+	if (n)
+		return hlist_entry(n, struct fastroute_entry, hnode);
+
+	st->bucket++;
+	return fastroute_get_first(seq, st->dev);
+}
+
+static void *fastroute_seq_start(struct seq_file *seq, loff_t *pos)
+	__acquires(RCU)
+{
+	struct fastroute_iter_state *st = seq->private;
+	struct fastroute_entry *e;
+	loff_t n = *pos;
+
+	rcu_read_lock();
+	if (!n)
+		return SEQ_START_TOKEN;
+
+	st->bucket = 0;
+	e = fastroute_get_first(seq,
+			first_net_device_rcu(seq_file_net(seq)));
+	while (e && --n)
+		e = fastroute_get_next(seq, e);
+	return e;
+}
+
+static void *fastroute_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct fastroute_iter_state *st = seq->private;
+
+	++*pos;
+	if (v == SEQ_START_TOKEN) {
+		st->bucket = 0;
+		return fastroute_get_first(seq,
+				first_net_device_rcu(seq_file_net(seq)));
+	}
+	return fastroute_get_next(seq, v);
+}
+
+static void fastroute_seq_stop(struct seq_file *seq, void *v)
+	__releases(RCU)
+{
+	rcu_read_unlock();
+}
+
+static int fastroute_seq_show(struct seq_file *seq, void *v)
+{
+	struct fastroute_iter_state *st = seq->private;
+	struct fastroute_entry *e = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(seq, "Iface\tSource\tDestination\tProto\tSport\t"
+			 "Dport\tTOS\tOutIface\tHits\tIdle\n");
+		return 0;
+	}
+
+	seq_printf(seq, "%s\t%pI4\t%pI4\t%u\t%u\t%u\t%02x\t%s\t%lu\t%u\n",
+		   st->dev->name, &e->saddr, &e->daddr, e->protocol,
+		   ntohs(((__be16 *)&e->ports)[0]),
+		   ntohs(((__be16 *)&e->ports)[1]), e->tos,
+		   e->dst->dev ? e->dst->dev->name : "*", e->hits,
+		   jiffies_to_msecs(jiffies - e->lastuse));
+	return 0;
+}
+
+static const struct seq_operations fastroute_seq_ops = {
+	.start	= fastroute_seq_start,
+	.next	= fastroute_seq_next,
+	.stop	= fastroute_seq_stop,
+	.show	= fastroute_seq_show,
+};
+
+static int fastroute_seq_open(struct inode *inode, struct file *file)
+{
+	return seq_open_net(inode, file, &fastroute_seq_ops,
+			    sizeof(struct fastroute_iter_state));
+}
+
+static const struct file_operations fastroute_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = fastroute_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = seq_release_net,
+};
+
+static int fastroute_stat_show(struct seq_file *seq, void *v)
+{
+	struct net *net = seq->private;
+	struct net_device *dev;
+	int cpu;
+
+	seq_puts(seq, "Iface    entries     size     hits   misses  "
+		 "inserts  evicted  expired  invalid\n");
+
+	rcu_read_lock();
+	for_each_netdev_rcu(net, dev) {
+		struct fastroute_table *t = rcu_dereference(dev->fastpath);
+		struct fastroute_stats sum;
+
+		if (!t)
+			continue;
+
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			const struct fastroute_stats *s =
+				per_cpu_ptr(t->stats, cpu);
+
+			sum.hits += s->hits;
+			sum.misses += s->misses;
+			sum.inserts += s->inserts;
+			sum.evictions += s->evictions;
+			sum.expired += s->expired;
+			sum.invalid += s->invalid;
+		}
+		seq_printf(seq, "%-8s %8u %8u %8lu %8lu %8lu %8lu %8lu %8lu\n",
+			   dev->name, t->count, t->max, sum.hits, sum.misses,
+			   sum.inserts, sum.evictions, sum.expired,
+			   sum.invalid);
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static int fastroute_stat_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, fastroute_stat_show);
+}
+
+static const struct file_operations fastroute_stat_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = fastroute_stat_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = single_release_net,
+};
+
+static int __net_init fastroute_proc_init_net(struct net *net)
+{
+	if (!proc_net_fops_create(net, "fastroute", S_IRUGO,
+				  &fastroute_seq_fops))
+		return -ENOMEM;
+
+	if (!proc_create("fastroute", S_IRUGO, net->proc_net_stat,
+			 &fastroute_stat_fops)) {
+		proc_net_remove(net, "fastroute");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void __net_exit fastroute_proc_exit_net(struct net *net)
+{
+	remove_proc_entry("fastroute", net->proc_net_stat);
+	proc_net_remove(net, "fastroute");
+}
+
+static struct pernet_operations fastroute_net_ops = {
+	.init = fastroute_proc_init_net,
+	.exit = fastroute_proc_exit_net,
+};
+#endif /* CONFIG_PROC_FS */
+
+static int __init fastroute_init(void)
+{
+	fastroute_cachep = kmem_cache_create("fastroute_cache",
+					     sizeof(struct fastroute_entry),
+					     0, SLAB_HWCACHE_ALIGN | SLAB_PANIC,
+					     NULL);
+#ifdef CONFIG_PROC_FS
+	register_pernet_subsys(&fastroute_net_ops);
+#endif
+	return register_netdevice_notifier(&fastroute_netdev_notifier);
+}
+
+subsys_initcall(fastroute_init);
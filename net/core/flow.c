@@ -47,6 +47,8 @@ struct flow_cache_percpu {
 
 struct flow_flush_info {
 	struct flow_cache		*cache;
+	flow_match_t			match;
+	void				*arg;
 	atomic_t			cpuleft;
 	struct completion		completion;
 };
@@ -62,6 +64,7 @@ struct flow_cache {
 };
 
 atomic_t flow_cache_genid = ATOMIC_INIT(0);
+atomic_t flow_cache_scoped_genid = ATOMIC_INIT(0);
 static struct flow_cache flow_cache_global;
 static struct kmem_cache *flow_cachep;
 
@@ -306,7 +309,10 @@ static void flow_cache_flush_tasklet(unsigned long data)
 	for (i = 0; i < flow_cache_hash_size(fc); i++) {
 		hlist_for_each_entry_safe(fle, entry, tmp,
 					  &fcp->hash_table[i], u.hlist) {
-			if (flow_entry_valid(fle))
+			if (flow_entry_valid(fle) &&
+			    !(info->match &&
+			      info->match(&fle->key, fle->family, fle->dir,
+					  info->arg)))
 				continue;
 
 			deleted++;
@@ -333,7 +339,7 @@ static void flow_cache_flush_per_cpu(void *data)
 	tasklet_schedule(tasklet);
 }
 
-void flow_cache_flush(void)
+static void __flow_cache_flush(flow_match_t match, void *arg)
 {
 	struct flow_flush_info info;
 	static DEFINE_MUTEX(flow_flush_sem);
@@ -342,6 +348,8 @@ void flow_cache_flush(void)
 	get_online_cpus();
 	mutex_lock(&flow_flush_sem);
 	info.cache = &flow_cache_global;
+	info.match = match;
+	info.arg = arg;
 	atomic_set(&info.cpuleft, num_online_cpus());
 	init_completion(&info.completion);
 
@@ -355,6 +363,22 @@ void flow_cache_flush(void)
 	put_online_cpus();
 }
 
+void flow_cache_flush(void)
+{
+	__flow_cache_flush(NULL, NULL);
+}
+
+/* Drop the flows @match selects from every cpu's cache, along with the
+ * stale ones, and leave the rest alone.  Unlike bumping flow_cache_genid
+ * this lets a change that only concerns some flows, such as a new xfrm
+ * policy, keep the cache warm for all the others.  Sleeps.
+ */
+void flow_cache_invalidate(flow_match_t match, void *arg)
+{
+	atomic_inc(&flow_cache_scoped_genid);
+	__flow_cache_flush(match, arg);
+}
+
 static void __init flow_cache_cpu_prepare(struct flow_cache *fc,
 					  struct flow_cache_percpu *fcp)
 {
@@ -426,4 +450,5 @@ static int __init flow_cache_init_global(void)
 module_init(flow_cache_init_global);
 
 EXPORT_SYMBOL(flow_cache_genid);
+EXPORT_SYMBOL(flow_cache_scoped_genid);
 EXPORT_SYMBOL(flow_cache_lookup);
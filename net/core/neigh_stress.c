@@ -0,0 +1,283 @@
+/*
+ * Neighbour table stress test.
+ *
+ * Registers a private neighbour table keyed by 32 bit addresses on the
+ * loopback device of the initial namespace, and runs one thread per
+ * online CPU doing random lookups, creations, state updates and
+ * releases on it for a while.  The key space is large enough for the
+ * hash table to be resized several times under load and the short
+ * reachable/probe times keep the timer wheel busy:
+ *
+ *	modprobe neigh_stress seconds=30 keys=65536
+ *
+ * Every hit is checked against the key it was looked up with, and the
+ * number of hashed entries is checked against the table count at the
+ * end.  The results go to the kernel log and loading fails with -EAGAIN,
+ * or -EIO if a check failed, so the module can be loaded again.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/cpu.h>
+#include <linux/slab.h>
+#include <linux/random.h>
+#include <linux/jhash.h>
+#include <linux/delay.h>
+#include <linux/etherdevice.h>
+#include <net/net_namespace.h>
+#include <net/neighbour.h>
+
+static unsigned int seconds = 10;
+module_param(seconds, uint, 0);
+MODULE_PARM_DESC(seconds, "Duration of the test");
+
+static unsigned int keys = 65536;
+module_param(keys, uint, 0);
+MODULE_PARM_DESC(keys, "Number of different neighbour addresses");
+
+struct neigh_stress_stats {
+	unsigned long	lookups;
+	unsigned long	hits;
+	unsigned long	creates;
+	unsigned long	updates;
+	unsigned long	errors;
+};
+
+static struct neigh_table neigh_stress_tbl;
+static struct net_device *neigh_stress_dev;
+static u32 neigh_stress_rnd;
+
+static u32 neigh_stress_hash(const void *pkey, const struct net_device *dev)
+{
+	return jhash_2words(*(u32 *)pkey, dev->ifindex, neigh_stress_rnd);
+}
+
+static void neigh_stress_solicit(struct neighbour *neigh, struct sk_buff *skb)
+{
+}
+
+static void neigh_stress_error_report(struct neighbour *neigh,
+				      struct sk_buff *skb)
+{
+	kfree_skb(skb);
+}
+
+static int neigh_stress_output(struct sk_buff *skb)
+{
+	kfree_skb(skb);
+	return 0;
+}
+
+static const struct neigh_ops neigh_stress_ops = {
+	.family =		AF_UNSPEC,
+	.solicit =		neigh_stress_solicit,
+	.error_report =		neigh_stress_error_report,
+	.output =		neigh_stress_output,
+	.connected_output =	neigh_stress_output,
+	.hh_output =		neigh_stress_output,
+	.queue_xmit =		neigh_stress_output,
+};
+
+static int neigh_stress_constructor(struct neighbour *neigh)
+{
+	neigh->ops = &neigh_stress_ops;
+	neigh->output = neigh->ops->output;
+	return 0;
+}
+
+static struct neigh_table neigh_stress_tbl = {
+	.family =	AF_UNSPEC,
+	.entry_size =	sizeof(struct neighbour) + 4,
+	.key_len =	4,
+	.hash =		neigh_stress_hash,
+	.constructor =	neigh_stress_constructor,
+	.id =		"neigh_stress",
+	.parms = {
+		.tbl =			&neigh_stress_tbl,
+		.base_reachable_time =	HZ / 2,
+		.retrans_time =		HZ / 10,
+		.gc_staletime =		2 * HZ,
+		.reachable_time =	HZ / 2,
+		.delay_probe_time =	HZ / 4,
+		.queue_len =		3,
+		.ucast_probes =		2,
+		.mcast_probes =		1,
+	},
+	.gc_interval =	HZ,
+};
+
+/* A hit must be the entry that was asked for */
+static int neigh_stress_check(struct neighbour *n, __be32 key)
+{
+	return n->tbl == &neigh_stress_tbl && n->dev == neigh_stress_dev &&
+	       !memcmp(n->primary_key, &key, sizeof(key));
+}
+
+static void neigh_stress_op(struct neigh_stress_stats *st)
+{
+	__be32 key = htonl(random32() % keys);
+	u32 r = random32() >> 24;
+	struct neighbour *n;
+	u8 lladdr[ETH_ALEN];
+
+	st->lookups++;
+	if (r < 128) {
+		/* plain lookup, as in the output path */
+		n = neigh_lookup(&neigh_stress_tbl, &key, neigh_stress_dev);
+		if (!n)
+			return;
+		st->hits++;
+		if (!neigh_stress_check(n, key))
+			st->errors++;
+		neigh_release(n);
+		return;
+	}
+
+	n = __neigh_lookup(&neigh_stress_tbl, &key, neigh_stress_dev, 1);
+	if (!n)
+		return;
+	st->creates++;
+	if (!neigh_stress_check(n, key))
+		st->errors++;
+
+	if (r < 192) {
+		/* start resolution: INCOMPLETE, probes, then FAILED */
+		neigh_event_send(n, NULL);
+	} else if (r < 240) {
+		/* resolved: REACHABLE, DELAY, PROBE, ... */
+		memset(lladdr, 0, sizeof(lladdr));
+		memcpy(lladdr + 2, &key, sizeof(key));
+		neigh_update(n, lladdr, NUD_REACHABLE,
+			     NEIGH_UPDATE_F_OVERRIDE | NEIGH_UPDATE_F_ADMIN);
+		st->updates++;
+	} else {
+		/* administrative delete, left for the garbage collector */
+		neigh_update(n, NULL, NUD_FAILED,
+			     NEIGH_UPDATE_F_OVERRIDE | NEIGH_UPDATE_F_ADMIN);
+		st->updates++;
+	}
+	neigh_release(n);
+}
+
+static int neigh_stress_thread(void *arg)
+{
+	struct neigh_stress_stats *st = arg;
+
+	while (!kthread_should_stop()) {
+		neigh_stress_op(st);
+		if (!(st->lookups & 0xff))
+			cond_resched();
+	}
+	return 0;
+}
+
+static void neigh_stress_count(struct neighbour *n, void *arg)
+{
+	(*(unsigned int *)arg)++;
+}
+
+static int __init neigh_stress_init(void)
+{
+	struct neigh_stress_stats *stats, total;
+	struct task_struct **threads;
+	unsigned int cpu, hashed = 0, buckets, entries;
+	unsigned long grows = 0;
+	int err = 0;
+
+	if (!seconds || !keys)
+		return -EINVAL;
+
+	stats = kcalloc(nr_cpu_ids, sizeof(*stats), GFP_KERNEL);
+	threads = kcalloc(nr_cpu_ids, sizeof(*threads), GFP_KERNEL);
+	if (!stats || !threads) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	get_random_bytes(&neigh_stress_rnd, sizeof(neigh_stress_rnd));
+	neigh_stress_dev = init_net.loopback_dev;
+	neigh_stress_tbl.gc_thresh1 = keys / 8;
+	neigh_stress_tbl.gc_thresh2 = keys / 2;
+	neigh_stress_tbl.gc_thresh3 = keys;
+	neigh_table_init_no_netlink(&neigh_stress_tbl);
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		threads[cpu] = kthread_create(neigh_stress_thread, &stats[cpu],
+					      "neigh_stress/%u", cpu);
+		if (IS_ERR(threads[cpu])) {
+			threads[cpu] = NULL;
+			continue;
+		}
+		kthread_bind(threads[cpu], cpu);
+		wake_up_process(threads[cpu]);
+	}
+	put_online_cpus();
+
+	msleep_interruptible(seconds * 1000);
+
+	memset(&total, 0, sizeof(total));
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		if (!threads[cpu])
+			continue;
+		kthread_stop(threads[cpu]);
+		total.lookups += stats[cpu].lookups;
+		total.hits += stats[cpu].hits;
+		total.creates += stats[cpu].creates;
+		total.updates += stats[cpu].updates;
+		total.errors += stats[cpu].errors;
+	}
+
+	/*
+	 * Let a resize in progress finish and stop the garbage collector;
+	 * with the threads gone the entries can't change any more.
+	 */
+	cancel_delayed_work_sync(&neigh_stress_tbl.gc_work);
+	flush_scheduled_work();
+	neigh_for_each(&neigh_stress_tbl, neigh_stress_count, &hashed);
+	read_lock_bh(&neigh_stress_tbl.lock);
+	buckets = neigh_stress_tbl.nht->hash_mask + 1;
+	read_unlock_bh(&neigh_stress_tbl.lock);
+	entries = atomic_read(&neigh_stress_tbl.entries);
+	for_each_possible_cpu(cpu)
+		grows += per_cpu_ptr(neigh_stress_tbl.stats, cpu)->hash_grows;
+
+	printk(KERN_INFO "neigh_stress: %us, %lu ops, %lu hits, %lu creates, "
+	       "%lu updates, %u entries in %u buckets, %lu grows\n",
+	       seconds, total.lookups, total.hits, total.creates,
+	       total.updates, hashed, buckets, grows);
+
+	if (total.errors || hashed != entries) {
+		printk(KERN_ERR "neigh_stress: %lu bad hits, %u hashed "
+		       "of %u entries\n", total.errors, hashed, entries);
+		err = -EIO;
+	}
+
+	neigh_table_clear(&neigh_stress_tbl);
+
+	/* nothing to keep loaded */
+	if (!err)
+		err = -EAGAIN;
+out_free:
+	kfree(threads);
+	kfree(stats);
+	return err;
+}
+
+/*
+ * If an init function is provided, an exit function must also be provided
+ * to allow module unload.
+ */
+static void __exit neigh_stress_exit(void) { }
+
+module_init(neigh_stress_init);
+module_exit(neigh_stress_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Neighbour table stress test");
@@ -56,7 +56,35 @@
 
 #define PNEIGH_HASHMASK		0xF
 
-static void neigh_timer_handler(unsigned long arg);
+/* Buckets moved from the old hash table per lock hold while resizing */
+#define NEIGH_HASH_MIGRATE_CHUNK	64
+
+/*
+ * Neighbour timers are kept on a per-table wheel of NEIGH_WHEEL_SLOTS
+ * slots, NEIGH_WHEEL_TICK jiffies each, driven by a single kernel timer.
+ * Expiry is rounded up to the next tick; entries further away than the
+ * wheel span are parked in its last slot and re-queued when it fires.
+ */
+#define NEIGH_WHEEL_SLOTS	512
+#if HZ >= 1000
+#define NEIGH_WHEEL_SHIFT	4
+#elif HZ >= 250
+#define NEIGH_WHEEL_SHIFT	3
+#else
+#define NEIGH_WHEEL_SHIFT	1
+#endif
+#define NEIGH_WHEEL_TICK	(1UL << NEIGH_WHEEL_SHIFT)
+
+struct neigh_wheel {
+	spinlock_t		lock;
+	unsigned long		clock;		/* next tick to expire */
+	unsigned int		pending;
+	struct timer_list	timer;
+	struct list_head	expired;
+	struct list_head	slot[NEIGH_WHEEL_SLOTS];
+};
+
+static void neigh_timer_handler(struct neighbour *neigh);
 static void __neigh_notify(struct neighbour *n, int type, int flags);
 static void neigh_update_notify(struct neighbour *neigh);
 static int pneigh_ifdown(struct neigh_table *tbl, struct net_device *dev);
@@ -70,6 +98,13 @@ static const struct file_operations neigh_stat_seq_fops;
    Neighbour hash table buckets are protected with rwlock tbl->lock.
 
    - All the scans/updates to hash buckets MUST be made under this lock.
+     The only exception are neigh_lookup() and neigh_lookup_nodev(),
+     which walk the chains under rcu_read_lock_bh(). Entries and hash
+     tables are freed after a grace period for their sake, and an entry
+     is only returned if its refcnt is not already zero.
+   - While the table is resized tbl->nht_old holds the previous table,
+     whose buckets are moved to tbl->nht a chunk at a time. Full table
+     walks must visit both, see neigh_walk_bucket().
    - NOTHING clever should be made under this lock: no callbacks
      to protocol backends, no attempts to send something to network.
      It will result in deadlocks, if backend/driver wants to use neighbour
@@ -85,7 +120,7 @@ static const struct file_operations neigh_stat_seq_fops;
 
    neigh->lock mainly serializes ll address data and its validity state.
    However, the same lock is used to protect another entry fields:
-    - timer
+    - timer (the wheel itself is protected by its own spinlock)
     - resolution queue
 
    Again, nothing clever shall be made under neigh->lock,
@@ -126,19 +161,35 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 }
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
+/*
+ * Bucket @b of a full table walk: the buckets of the current hash table
+ * followed, while a resize is in progress, by those of the old one.
+ * Returns NULL past the last bucket. The caller holds tbl->lock.
+ */
+static struct neighbour **neigh_walk_bucket(struct neigh_table *tbl,
+					    unsigned int b)
+{
+	struct neigh_hash_table *nht = tbl->nht;
+
+	if (b > nht->hash_mask) {
+		b -= nht->hash_mask + 1;
+		nht = tbl->nht_old;
+		if (!nht || b > nht->hash_mask)
+			return NULL;
+	}
+	return &nht->hash_buckets[b];
+}
 
 static int neigh_forced_gc(struct neigh_table *tbl)
 {
+	struct neighbour *n, **np;
 	int shrunk = 0;
 	int i;
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
 
 	write_lock_bh(&tbl->lock);
-	for (i = 0; i <= tbl->hash_mask; i++) {
-		struct neighbour *n, **np;
-
-		np = &tbl->hash_buckets[i];
+	for (i = 0; (np = neigh_walk_bucket(tbl, i)) != NULL; i++) {
 		while ((n = *np) != NULL) {
 			/* Neighbour record may be discarded if:
 			 * - nobody refers to it.
@@ -166,10 +217,59 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 	return shrunk;
 }
 
+static inline struct list_head *neigh_wheel_slot(struct neigh_wheel *w,
+						 unsigned long tick)
+{
+	return &w->slot[(tick >> NEIGH_WHEEL_SHIFT) & (NEIGH_WHEEL_SLOTS - 1)];
+}
+
+/* Called with w->lock held */
+static void __neigh_wheel_add(struct neigh_wheel *w, struct neighbour *n)
+{
+	unsigned long last, tick;
+
+	if (!w->pending)
+		w->clock = jiffies & ~(NEIGH_WHEEL_TICK - 1);
+	last = w->clock + (NEIGH_WHEEL_SLOTS - 1) * NEIGH_WHEEL_TICK;
+
+	tick = ALIGN(n->timer_expires, NEIGH_WHEEL_TICK);
+	if (time_before(tick, w->clock))
+		tick = w->clock;
+	else if (time_after(tick, last))
+		tick = last;
+
+	list_add_tail(&n->timer_node, neigh_wheel_slot(w, tick));
+	w->pending++;
+
+	if (!timer_pending(&w->timer) || time_before(tick, w->timer.expires))
+		mod_timer(&w->timer, tick);
+}
+
+/*
+ * (Re)queue the timer of @n to fire at @when. Like mod_timer(), returns
+ * 1 if it was already pending, in which case it keeps its reference.
+ */
+static int neigh_mod_timer(struct neighbour *n, unsigned long when)
+{
+	struct neigh_wheel *w = n->tbl->wheel;
+	int pending;
+
+	spin_lock_bh(&w->lock);
+	pending = !list_empty(&n->timer_node);
+	if (pending) {
+		list_del(&n->timer_node);
+		w->pending--;
+	}
+	n->timer_expires = when;
+	__neigh_wheel_add(w, n);
+	spin_unlock_bh(&w->lock);
+	return pending;
+}
+
 static void neigh_add_timer(struct neighbour *n, unsigned long when)
 {
 	neigh_hold(n);
-	if (unlikely(mod_timer(&n->timer, when))) {
+	if (unlikely(neigh_mod_timer(n, when))) {
 		printk("NEIGH: BUG, double timer add, state is %x\n",
 		       n->nud_state);
 		dump_stack();
@@ -178,12 +278,88 @@ static void neigh_add_timer(struct neighbour *n, unsigned long when)
 
 static int neigh_del_timer(struct neighbour *n)
 {
-	if ((n->nud_state & NUD_IN_TIMER) &&
-	    del_timer(&n->timer)) {
+	struct neigh_wheel *w = n->tbl->wheel;
+	int pending = 0;
+
+	if (!(n->nud_state & NUD_IN_TIMER))
+		return 0;
+
+	spin_lock_bh(&w->lock);
+	if (!list_empty(&n->timer_node)) {
+		list_del_init(&n->timer_node);
+		w->pending--;
+		pending = 1;
+	}
+	spin_unlock_bh(&w->lock);
+
+	if (pending)
 		neigh_release(n);
-		return 1;
+	return pending;
+}
+
+/*
+ * Expire all wheel slots up to the current tick. Entries parked beyond
+ * the wheel span are re-queued, the others are handed to
+ * neigh_timer_handler() one at a time with the wheel unlocked; an entry
+ * is off the wheel by then, so neigh_del_timer() leaves its reference
+ * to the handler just as del_timer() does for a running timer.
+ */
+static void neigh_wheel_run(unsigned long arg)
+{
+	struct neigh_wheel *w = (struct neigh_wheel *)arg;
+	struct neighbour *n;
+	unsigned int i;
+
+	spin_lock(&w->lock);
+	while (w->pending && time_after_eq(jiffies, w->clock)) {
+		list_splice_tail_init(neigh_wheel_slot(w, w->clock),
+				      &w->expired);
+		w->clock += NEIGH_WHEEL_TICK;
 	}
-	return 0;
+
+	while (!list_empty(&w->expired)) {
+		n = list_first_entry(&w->expired, struct neighbour, timer_node);
+		list_del_init(&n->timer_node);
+		w->pending--;
+
+		if (time_before(jiffies, n->timer_expires)) {
+			__neigh_wheel_add(w, n);
+			continue;
+		}
+
+		spin_unlock(&w->lock);
+		neigh_timer_handler(n);
+		spin_lock(&w->lock);
+	}
+
+	for (i = 0; w->pending && i < NEIGH_WHEEL_SLOTS; i++) {
+		unsigned long tick = w->clock + i * NEIGH_WHEEL_TICK;
+
+		if (!list_empty(neigh_wheel_slot(w, tick))) {
+			mod_timer(&w->timer, tick);
+			break;
+		}
+	}
+	spin_unlock(&w->lock);
+}
+
+static struct neigh_wheel *neigh_wheel_alloc(void)
+{
+	struct neigh_wheel *w;
+	unsigned int i;
+
+	w = kmalloc(sizeof(*w), GFP_KERNEL);
+	if (!w)
+		return NULL;
+
+	spin_lock_init(&w->lock);
+	w->clock = jiffies & ~(NEIGH_WHEEL_TICK - 1);
+	w->pending = 0;
+	setup_timer(&w->timer, neigh_wheel_run, (unsigned long)w);
+	INIT_LIST_HEAD(&w->expired);
+	for (i = 0; i < NEIGH_WHEEL_SLOTS; i++)
+		INIT_LIST_HEAD(&w->slot[i]);
+	return w;
 }
 
 static void pneigh_queue_purge(struct sk_buff_head *list)
@@ -198,11 +374,10 @@ static void pneigh_queue_purge(struct sk_buff_head *list)
 
 static void neigh_flush_dev(struct neigh_table *tbl, struct net_device *dev)
 {
+	struct neighbour *n, **np;
 	int i;
 
-	for (i = 0; i <= tbl->hash_mask; i++) {
-		struct neighbour *n, **np = &tbl->hash_buckets[i];
-
+	for (i = 0; (np = neigh_walk_bucket(tbl, i)) != NULL; i++) {
 		while ((n = *np) != NULL) {
 			if (dev && n->dev != dev) {
 				np = &n->next;
@@ -283,7 +458,7 @@ static struct neighbour *neigh_alloc(struct neigh_table *tbl)
 	n->nud_state	  = NUD_NONE;
 	n->output	  = neigh_blackhole;
 	n->parms	  = neigh_parms_clone(&tbl->parms);
-	setup_timer(&n->timer, neigh_timer_handler, (unsigned long)n);
+	INIT_LIST_HEAD(&n->timer_node);
 
 	NEIGH_CACHE_STAT_INC(tbl, allocs);
 	n->tbl		  = tbl;
@@ -297,85 +472,145 @@ out_entries:
 	goto out;
 }
 
-static struct neighbour **neigh_hash_alloc(unsigned int entries)
+static struct neigh_hash_table *neigh_hash_alloc(unsigned int entries)
 {
 	unsigned long size = entries * sizeof(struct neighbour *);
-	struct neighbour **ret;
+	struct neigh_hash_table *ret;
 
+	ret = kmalloc(sizeof(*ret), GFP_KERNEL);
+	if (!ret)
+		return NULL;
 	if (size <= PAGE_SIZE) {
-		ret = kzalloc(size, GFP_ATOMIC);
+		ret->hash_buckets = kzalloc(size, GFP_KERNEL);
 	} else {
-		ret = (struct neighbour **)
-		      __get_free_pages(GFP_ATOMIC|__GFP_ZERO, get_order(size));
+		ret->hash_buckets = (struct neighbour **)
+			__get_free_pages(GFP_KERNEL|__GFP_ZERO, get_order(size));
 	}
+	if (!ret->hash_buckets) {
+		kfree(ret);
+		return NULL;
+	}
+	ret->hash_mask = entries - 1;
 	return ret;
 }
 
-static void neigh_hash_free(struct neighbour **hash, unsigned int entries)
+static void neigh_hash_free(struct neigh_hash_table *nht)
 {
-	unsigned long size = entries * sizeof(struct neighbour *);
+	unsigned long size = (nht->hash_mask + 1) * sizeof(struct neighbour *);
 
 	if (size <= PAGE_SIZE)
-		kfree(hash);
+		kfree(nht->hash_buckets);
 	else
-		free_pages((unsigned long)hash, get_order(size));
+		free_pages((unsigned long)nht->hash_buckets, get_order(size));
+	kfree(nht);
 }
 
-static void neigh_hash_grow(struct neigh_table *tbl, unsigned long new_entries)
+static void neigh_hash_free_rcu(struct rcu_head *head)
 {
-	struct neighbour **new_hash, **old_hash;
-	unsigned int i, new_hash_mask, old_entries;
+	neigh_hash_free(container_of(head, struct neigh_hash_table, rcu));
+}
 
-	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
+/*
+ * Grow the hash table to twice its size. The new table is published at
+ * once and the entries are moved over from the old one a chunk of
+ * buckets at a time, so that neither lookups nor updates wait for the
+ * whole table to be rehashed. hash_rnd is kept: entries are only moved
+ * to a bigger table, never rehashed within one, and the per-protocol
+ * hash functions can keep reading it without synchronization.
+ *
+ * A lockless lookup racing with an entry being moved may miss it;
+ * neigh_create() rechecks both tables under tbl->lock, so the worst
+ * outcome is a slow path lookup.
+ */
+static void neigh_hash_grow(struct work_struct *work)
+{
+	struct neigh_table *tbl = container_of(work, struct neigh_table,
+					       hash_work);
+	struct neigh_hash_table *old_nht, *new_nht;
+	unsigned int i, old_entries;
 
-	BUG_ON(!is_power_of_2(new_entries));
-	new_hash = neigh_hash_alloc(new_entries);
-	if (!new_hash)
+	read_lock_bh(&tbl->lock);
+	old_entries = tbl->nht->hash_mask + 1;
+	read_unlock_bh(&tbl->lock);
+
+	if (atomic_read(&tbl->entries) <= old_entries)
 		return;
 
-	old_entries = tbl->hash_mask + 1;
-	new_hash_mask = new_entries - 1;
-	old_hash = tbl->hash_buckets;
+	new_nht = neigh_hash_alloc(old_entries << 1);
+	if (!new_nht)
+		return;
+
+	write_lock_bh(&tbl->lock);
+	old_nht = tbl->nht;
+	if (tbl->nht_old || old_nht->hash_mask + 1 != old_entries) {
+		/* lost a race with another run of this work */
+		write_unlock_bh(&tbl->lock);
+		neigh_hash_free(new_nht);
+		return;
+	}
+	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
+	rcu_assign_pointer(tbl->nht_old, old_nht);
+	rcu_assign_pointer(tbl->nht, new_nht);
+	write_unlock_bh(&tbl->lock);
 
-	get_random_bytes(&tbl->hash_rnd, sizeof(tbl->hash_rnd));
 	for (i = 0; i < old_entries; i++) {
-		struct neighbour *n, *next;
+		struct neighbour *n;
 
-		for (n = old_hash[i]; n; n = next) {
-			unsigned int hash_val = tbl->hash(n->primary_key, n->dev);
+		if (i % NEIGH_HASH_MIGRATE_CHUNK == 0) {
+			if (i) {
+				write_unlock_bh(&tbl->lock);
+				cond_resched();
+			}
+			write_lock_bh(&tbl->lock);
+		}
 
-			hash_val &= new_hash_mask;
-			next = n->next;
+		while ((n = old_nht->hash_buckets[i]) != NULL) {
+			unsigned int hash_val = tbl->hash(n->primary_key, n->dev);
 
-			n->next = new_hash[hash_val];
-			new_hash[hash_val] = n;
+			hash_val &= new_nht->hash_mask;
+			old_nht->hash_buckets[i] = n->next;
+			n->next = new_nht->hash_buckets[hash_val];
+			rcu_assign_pointer(new_nht->hash_buckets[hash_val], n);
 		}
 	}
-	tbl->hash_buckets = new_hash;
-	tbl->hash_mask = new_hash_mask;
+	rcu_assign_pointer(tbl->nht_old, NULL);
+	write_unlock_bh(&tbl->lock);
 
-	neigh_hash_free(old_hash, old_entries);
+	call_rcu(&old_nht->rcu, neigh_hash_free_rcu);
 }
 
 struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
 			       struct net_device *dev)
 {
-	struct neighbour *n;
+	struct neigh_hash_table *nht;
+	struct neighbour *n = NULL;
 	int key_len = tbl->key_len;
 	u32 hash_val;
+	int old;
 
 	NEIGH_CACHE_STAT_INC(tbl, lookups);
 
-	read_lock_bh(&tbl->lock);
+	rcu_read_lock_bh();
 	hash_val = tbl->hash(pkey, dev);
-	for (n = tbl->hash_buckets[hash_val & tbl->hash_mask]; n; n = n->next) {
-		if (dev == n->dev && !memcmp(n->primary_key, pkey, key_len)) {
-			neigh_hold(n);
-			NEIGH_CACHE_STAT_INC(tbl, hits);
+	for (old = 0; old < 2; old++) {
+		nht = old ? rcu_dereference_bh(tbl->nht_old) :
+			    rcu_dereference_bh(tbl->nht);
+		if (!nht)
 			break;
+		n = rcu_dereference_bh(nht->hash_buckets[hash_val & nht->hash_mask]);
+		for (; n; n = rcu_dereference_bh(n->next)) {
+			if (dev == n->dev &&
+			    !memcmp(n->primary_key, pkey, key_len)) {
+				if (!atomic_inc_not_zero(&n->refcnt))
+					n = NULL;
+				else
+					NEIGH_CACHE_STAT_INC(tbl, hits);
+				goto out;
+			}
 		}
 	}
-	read_unlock_bh(&tbl->lock);
+out:
+	rcu_read_unlock_bh();
 	return n;
 }
 EXPORT_SYMBOL(neigh_lookup);
@@ -383,23 +618,35 @@ EXPORT_SYMBOL(neigh_lookup);
 struct neighbour *neigh_lookup_nodev(struct neigh_table *tbl, struct net *net,
 				     const void *pkey)
 {
-	struct neighbour *n;
+	struct neigh_hash_table *nht;
+	struct neighbour *n = NULL;
 	int key_len = tbl->key_len;
 	u32 hash_val;
+	int old;
 
 	NEIGH_CACHE_STAT_INC(tbl, lookups);
 
-	read_lock_bh(&tbl->lock);
+	rcu_read_lock_bh();
 	hash_val = tbl->hash(pkey, NULL);
-	for (n = tbl->hash_buckets[hash_val & tbl->hash_mask]; n; n = n->next) {
-		if (!memcmp(n->primary_key, pkey, key_len) &&
-		    net_eq(dev_net(n->dev), net)) {
-			neigh_hold(n);
-			NEIGH_CACHE_STAT_INC(tbl, hits);
+	for (old = 0; old < 2; old++) {
+		nht = old ? rcu_dereference_bh(tbl->nht_old) :
+			    rcu_dereference_bh(tbl->nht);
+		if (!nht)
 			break;
+		n = rcu_dereference_bh(nht->hash_buckets[hash_val & nht->hash_mask]);
+		for (; n; n = rcu_dereference_bh(n->next)) {
+			if (!memcmp(n->primary_key, pkey, key_len) &&
+			    net_eq(dev_net(n->dev), net)) {
+				if (!atomic_inc_not_zero(&n->refcnt))
+					n = NULL;
+				else
+					NEIGH_CACHE_STAT_INC(tbl, hits);
+				goto out;
+			}
 		}
 	}
-	read_unlock_bh(&tbl->lock);
+out:
+	rcu_read_unlock_bh();
 	return n;
 }
 EXPORT_SYMBOL(neigh_lookup_nodev);
@@ -409,7 +656,8 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 {
 	u32 hash_val;
 	int key_len = tbl->key_len;
-	int error;
+	int error, old;
+	struct neigh_hash_table *nht;
 	struct neighbour *n1, *rc, *n = neigh_alloc(tbl);
 
 	if (!n) {
@@ -436,30 +684,39 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 
 	n->confirmed = jiffies - (n->parms->base_reachable_time << 1);
 
-	write_lock_bh(&tbl->lock);
+	hash_val = tbl->hash(pkey, dev);
 
-	if (atomic_read(&tbl->entries) > (tbl->hash_mask + 1))
-		neigh_hash_grow(tbl, (tbl->hash_mask + 1) << 1);
+	write_lock_bh(&tbl->lock);
 
-	hash_val = tbl->hash(pkey, dev) & tbl->hash_mask;
+	if (atomic_read(&tbl->entries) > (tbl->nht->hash_mask + 1) &&
+	    !tbl->nht_old)
+		schedule_work(&tbl->hash_work);
 
 	if (n->parms->dead) {
 		rc = ERR_PTR(-EINVAL);
 		goto out_tbl_unlock;
 	}
 
-	for (n1 = tbl->hash_buckets[hash_val]; n1; n1 = n1->next) {
-		if (dev == n1->dev && !memcmp(n1->primary_key, pkey, key_len)) {
-			neigh_hold(n1);
-			rc = n1;
-			goto out_tbl_unlock;
+	for (old = 0; old < 2; old++) {
+		nht = old ? tbl->nht_old : tbl->nht;
+		if (!nht)
+			break;
+		for (n1 = nht->hash_buckets[hash_val & nht->hash_mask]; n1;
+		     n1 = n1->next) {
+			if (dev == n1->dev &&
+			    !memcmp(n1->primary_key, pkey, key_len)) {
+				neigh_hold(n1);
+				rc = n1;
+				goto out_tbl_unlock;
+			}
 		}
 	}
 
-	n->next = tbl->hash_buckets[hash_val];
-	tbl->hash_buckets[hash_val] = n;
+	nht = tbl->nht;
 	n->dead = 0;
 	neigh_hold(n);
+	n->next = nht->hash_buckets[hash_val & nht->hash_mask];
+	rcu_assign_pointer(nht->hash_buckets[hash_val & nht->hash_mask], n);
 	write_unlock_bh(&tbl->lock);
 	NEIGH_PRINTK2("neigh %p is created.\n", n);
 	rc = n;
@@ -616,6 +873,13 @@ static inline void neigh_parms_put(struct neigh_parms *parms)
 		neigh_parms_destroy(parms);
 }
 
+static void neigh_destroy_rcu(struct rcu_head *head)
+{
+	struct neighbour *neigh = container_of(head, struct neighbour, rcu);
+
+	kmem_cache_free(neigh->tbl->kmem_cachep, neigh);
+}
+
 /*
  *	neighbour must already be out of the table;
  *
@@ -655,7 +919,7 @@ void neigh_destroy(struct neighbour *neigh)
 	NEIGH_PRINTK2("neigh %p is destroyed.\n", neigh);
 
 	atomic_dec(&neigh->tbl->entries);
-	kmem_cache_free(neigh->tbl->kmem_cachep, neigh);
+	call_rcu(&neigh->rcu, neigh_destroy_rcu);
 }
 EXPORT_SYMBOL(neigh_destroy);
 
@@ -715,9 +979,7 @@ static void neigh_periodic_work(struct work_struct *work)
 				neigh_rand_reach_time(p->base_reachable_time);
 	}
 
-	for (i = 0 ; i <= tbl->hash_mask; i++) {
-		np = &tbl->hash_buckets[i];
-
+	for (i = 0 ; (np = neigh_walk_bucket(tbl, i)) != NULL; i++) {
 		while ((n = *np) != NULL) {
 			unsigned int state;
 
@@ -748,7 +1010,7 @@ next_elt:
 		}
 		/*
 		 * It's fine to release lock here, even if hash table
-		 * grows while we are preempted.
+		 * grows or entries migrate while we are preempted.
 		 */
 		write_unlock_bh(&tbl->lock);
 		cond_resched();
@@ -797,10 +1059,9 @@ static void neigh_invalidate(struct neighbour *neigh)
 
 /* Called when a timer expires for a neighbour entry. */
 
-static void neigh_timer_handler(unsigned long arg)
+static void neigh_timer_handler(struct neighbour *neigh)
 {
 	unsigned long now, next;
-	struct neighbour *neigh = (struct neighbour *)arg;
 	unsigned state;
 	int notify = 0;
 
@@ -867,7 +1128,7 @@ static void neigh_timer_handler(unsigned long arg)
 	if (neigh->nud_state & NUD_IN_TIMER) {
 		if (time_before(next, jiffies + HZ/2))
 			next = jiffies + HZ/2;
-		if (!mod_timer(&neigh->timer, next))
+		if (!neigh_mod_timer(neigh, next))
 			neigh_hold(neigh);
 	}
 	if (neigh->nud_state & (NUD_INCOMPLETE | NUD_PROBE)) {
@@ -1436,15 +1697,20 @@ void neigh_table_init_no_netlink(struct neigh_table *tbl)
 		panic("cannot create neighbour proc dir entry");
 #endif
 
-	tbl->hash_mask = 1;
-	tbl->hash_buckets = neigh_hash_alloc(tbl->hash_mask + 1);
+	tbl->nht = neigh_hash_alloc(2);
+	tbl->nht_old = NULL;
+	INIT_WORK(&tbl->hash_work, neigh_hash_grow);
 
 	phsize = (PNEIGH_HASHMASK + 1) * sizeof(struct pneigh_entry *);
 	tbl->phash_buckets = kzalloc(phsize, GFP_KERNEL);
 
-	if (!tbl->hash_buckets || !tbl->phash_buckets)
+	if (!tbl->nht || !tbl->phash_buckets)
 		panic("cannot allocate neighbour cache hashes");
 
+	tbl->wheel = neigh_wheel_alloc();
+	if (!tbl->wheel)
+		panic("cannot allocate neighbour timer wheel");
+
 	get_random_bytes(&tbl->hash_rnd, sizeof(tbl->hash_rnd));
 
 	rwlock_init(&tbl->lock);
@@ -1486,11 +1752,13 @@ int neigh_table_clear(struct neigh_table *tbl)
 	struct neigh_table **tp;
 
 	/* It is not clean... Fix it to unload IPv6 module safely */
-	cancel_delayed_work(&tbl->gc_work);
+	cancel_delayed_work_sync(&tbl->gc_work);
 	flush_scheduled_work();
 	del_timer_sync(&tbl->proxy_timer);
 	pneigh_queue_purge(&tbl->proxy_queue);
+	cancel_work_sync(&tbl->hash_work);
 	neigh_ifdown(tbl, NULL);
+	del_timer_sync(&tbl->wheel->timer);
 	if (atomic_read(&tbl->entries))
 		printk(KERN_CRIT "neighbour leakage\n");
 	write_lock(&neigh_tbl_lock);
@@ -1502,8 +1770,14 @@ int neigh_table_clear(struct neigh_table *tbl)
 	}
 	write_unlock(&neigh_tbl_lock);
 
-	neigh_hash_free(tbl->hash_buckets, tbl->hash_mask + 1);
-	tbl->hash_buckets = NULL;
+	/* entries and old hash tables are freed after a grace period */
+	rcu_barrier();
+
+	neigh_hash_free(tbl->nht);
+	tbl->nht = NULL;
+
+	kfree(tbl->wheel);
+	tbl->wheel = NULL;
 
 	kfree(tbl->phash_buckets);
 	tbl->phash_buckets = NULL;
@@ -1757,7 +2031,7 @@ static int neightbl_fill_info(struct sk_buff *skb, struct neigh_table *tbl,
 			.ndtc_last_flush	= jiffies_to_msecs(flush_delta),
 			.ndtc_last_rand		= jiffies_to_msecs(rand_delta),
 			.ndtc_hash_rnd		= tbl->hash_rnd,
-			.ndtc_hash_mask		= tbl->hash_mask,
+			.ndtc_hash_mask		= tbl->nht->hash_mask,
 			.ndtc_proxy_qlen	= tbl->proxy_queue.qlen,
 		};
 
@@ -2089,17 +2363,17 @@ static int neigh_dump_table(struct neigh_table *tbl, struct sk_buff *skb,
 			    struct netlink_callback *cb)
 {
 	struct net * net = sock_net(skb->sk);
-	struct neighbour *n;
+	struct neighbour *n, **np;
 	int rc, h, s_h = cb->args[1];
 	int idx, s_idx = idx = cb->args[2];
 
 	read_lock_bh(&tbl->lock);
-	for (h = 0; h <= tbl->hash_mask; h++) {
+	for (h = 0; (np = neigh_walk_bucket(tbl, h)) != NULL; h++) {
 		if (h < s_h)
 			continue;
 		if (h > s_h)
 			s_idx = 0;
-		for (n = tbl->hash_buckets[h], idx = 0; n; n = n->next) {
+		for (n = *np, idx = 0; n; n = n->next) {
 			if (!net_eq(dev_net(n->dev), net))
 				continue;
 			if (idx < s_idx)
@@ -2150,13 +2424,12 @@ static int neigh_dump_info(struct sk_buff *skb, struct netlink_callback *cb)
 
 void neigh_for_each(struct neigh_table *tbl, void (*cb)(struct neighbour *, void *), void *cookie)
 {
+	struct neighbour *n, **np;
 	int chain;
 
 	read_lock_bh(&tbl->lock);
-	for (chain = 0; chain <= tbl->hash_mask; chain++) {
-		struct neighbour *n;
-
-		for (n = tbl->hash_buckets[chain]; n; n = n->next)
+	for (chain = 0; (np = neigh_walk_bucket(tbl, chain)) != NULL; chain++) {
+		for (n = *np; n; n = n->next)
 			cb(n, cookie);
 	}
 	read_unlock_bh(&tbl->lock);
@@ -2167,12 +2440,10 @@ EXPORT_SYMBOL(neigh_for_each);
 void __neigh_for_each_release(struct neigh_table *tbl,
 			      int (*cb)(struct neighbour *))
 {
+	struct neighbour *n, **np;
 	int chain;
 
-	for (chain = 0; chain <= tbl->hash_mask; chain++) {
-		struct neighbour *n, **np;
-
-		np = &tbl->hash_buckets[chain];
+	for (chain = 0; (np = neigh_walk_bucket(tbl, chain)) != NULL; chain++) {
 		while ((n = *np) != NULL) {
 			int release;
 
@@ -2198,12 +2469,12 @@ static struct neighbour *neigh_get_first(struct seq_file *seq)
 	struct neigh_seq_state *state = seq->private;
 	struct net *net = seq_file_net(seq);
 	struct neigh_table *tbl = state->tbl;
-	struct neighbour *n = NULL;
+	struct neighbour *n = NULL, **np;
 	int bucket = state->bucket;
 
 	state->flags &= ~NEIGH_SEQ_IS_PNEIGH;
-	for (bucket = 0; bucket <= tbl->hash_mask; bucket++) {
-		n = tbl->hash_buckets[bucket];
+	for (bucket = 0; (np = neigh_walk_bucket(tbl, bucket)) != NULL; bucket++) {
+		n = *np;
 
 		while (n) {
 			if (!net_eq(dev_net(n->dev), net))
@@ -2239,6 +2510,7 @@ static struct neighbour *neigh_get_next(struct seq_file *seq,
 	struct neigh_seq_state *state = seq->private;
 	struct net *net = seq_file_net(seq);
 	struct neigh_table *tbl = state->tbl;
+	struct neighbour **np;
 
 	if (state->neigh_sub_iter) {
 		void *v = state->neigh_sub_iter(state, n, pos);
@@ -2269,10 +2541,11 @@ static struct neighbour *neigh_get_next(struct seq_file *seq,
 		if (n)
 			break;
 
-		if (++state->bucket > tbl->hash_mask)
+		np = neigh_walk_bucket(tbl, ++state->bucket);
+		if (!np)
 			break;
 
-		n = tbl->hash_buckets[state->bucket];
+		n = *np;
 	}
 
 	if (n && pos)
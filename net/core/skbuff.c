@@ -2411,6 +2411,32 @@ unsigned int skb_find_text(struct sk_buff *skb, unsigned int from,
 }
 EXPORT_SYMBOL(skb_find_text);
 
+/**
+ * skb_find_text_set - Find a set of text patterns in skb data
+ * @skb: the buffer to look in
+ * @from: search offset
+ * @to: search limit
+ * @config: textsearch configuration from textsearch_prepare_set()
+ * @state: uninitialized textsearch state variable
+ * @found: bitmap indexed by pattern
+ *
+ * Walks the skb data once, including paged and fragmented parts, and
+ * sets the bit of every pattern of the set occurring in it in @found.
+ * Returns the number of bits newly set.
+ */
+unsigned int skb_find_text_set(struct sk_buff *skb, unsigned int from,
+			       unsigned int to, struct ts_config *config,
+			       struct ts_state *state, unsigned long *found)
+{
+	config->get_next_block = skb_ts_get_next_block;
+	config->finish = skb_ts_finish;
+
+	skb_prepare_seq_read(skb, from, to, TS_SKB_CB(state));
+
+	return textsearch_find_set(config, state, found);
+}
+EXPORT_SYMBOL(skb_find_text_set);
+
 /**
  * skb_append_datato_frags: - append the user data to a skb
  * @sk: sock  structure
@@ -1123,8 +1123,11 @@ static void __sk_free(struct sock *sk)
 
 #ifdef CONFIG_GFAR_HW_TCP_RECEIVE_OFFLOAD
 	if (sk->tcp_hw_channel) {
-		*((struct sock **)sk->tcp_hw_channel) = NULL;
-		sk->tcp_hw_channel = NULL;
+		struct sock **slot = xchg(&sk->tcp_hw_channel, NULL);
+
+		/* the driver may have handed the channel to another flow */
+		if (slot)
+			cmpxchg(slot, sk, NULL);
 	}
 #endif
 	put_net(sock_net(sk));
@@ -18,6 +18,7 @@
 
 #include <net/ip.h>
 #include <net/sock.h>
+#include <net/fastroute.h>
 
 #ifdef CONFIG_RPS
 static int rps_sock_flow_sysctl(ctl_table *table, int write,
@@ -78,9 +79,6 @@ static int rps_sock_flow_sysctl(ctl_table *table, int write,
 }
 #endif /* CONFIG_RPS */
 
-#ifdef CONFIG_NET_GIANFAR_FP
-extern int netdev_fastroute;
-#endif
 
 #ifdef CONFIG_GFAR_SW_PKT_STEERING
 extern int rcv_pkt_steering;
@@ -110,6 +108,20 @@ static struct ctl_table net_core_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec
 	},
+	{
+		.procname	= "netdev_fastroute_size",
+		.data		= &netdev_fastroute_size,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= fastroute_sysctl_size
+	},
+	{
+		.procname	= "netdev_fastroute_timeout",
+		.data		= &netdev_fastroute_timeout,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= fastroute_sysctl_timeout
+	},
 #endif
 #ifdef CONFIG_GFAR_SW_PKT_STEERING
 	{
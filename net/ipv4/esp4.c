@@ -12,6 +12,9 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/in6.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <net/icmp.h>
 #include <net/protocol.h>
 #include <net/udp.h>
@@ -23,6 +26,20 @@ struct esp_skb_cb {
 
 #define ESP_SKB_CB(__skb) ((struct esp_skb_cb *)&((__skb)->cb[0]))
 
+static int parallel;
+module_param(parallel, bool, 0644);
+MODULE_PARM_DESC(parallel, "Spread the crypto of each new SA over all cpus "
+		 "through pcrypt, completing packets in order");
+
+static DEFINE_PER_CPU(struct esp_stats, esp4_stats);
+
+/* Count on the cpu that submits or completes the request */
+#define ESP_INC_STATS(esp, field)				\
+	do {							\
+		irqsafe_cpu_inc((esp)->stats->field);		\
+		irqsafe_cpu_inc(esp4_stats.field);		\
+	} while (0)
+
 /*
  * Allocate an AEAD request structure with extra space for SG and IV.
  *
@@ -96,7 +113,9 @@ static inline struct scatterlist *esp_givreq_sg(
 static void esp_output_done(struct crypto_async_request *base, int err)
 {
 	struct sk_buff *skb = base->data;
+	struct esp_data *esp = skb_dst(skb)->xfrm->data;
 
+	ESP_INC_STATS(esp, out_async);
 	kfree(ESP_SKB_CB(skb)->tmp);
 	xfrm_output_resume(skb, err);
 }
@@ -214,6 +233,7 @@ static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 			      XFRM_SKB_CB(skb)->seq.output);
 
 	ESP_SKB_CB(skb)->tmp = tmp;
+	ESP_INC_STATS(esp, out_packets);
 	err = crypto_aead_givencrypt(req);
 	if (err == -EINPROGRESS)
 		goto error;
@@ -312,7 +332,9 @@ out:
 static void esp_input_done(struct crypto_async_request *base, int err)
 {
 	struct sk_buff *skb = base->data;
+	struct esp_data *esp = xfrm_input_state(skb)->data;
 
+	ESP_INC_STATS(esp, in_async);
 	xfrm_input_resume(skb, esp_input_done2(skb, err));
 }
 
@@ -372,6 +394,7 @@ static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 	aead_request_set_crypt(req, sg, sg, elen, iv);
 	aead_request_set_assoc(req, asg, sizeof(*esph));
 
+	ESP_INC_STATS(esp, in_packets);
 	err = crypto_aead_decrypt(req);
 	if (err == -EINPROGRESS)
 		goto out;
@@ -438,16 +461,42 @@ static void esp_destroy(struct xfrm_state *x)
 		return;
 
 	crypto_free_aead(esp->aead);
+	free_percpu(esp->stats);
 	kfree(esp);
 }
 
+/*
+ * In parallel mode try the pcrypt instance of the algorithm first.  It
+ * runs the requests of one tfm, and so of one SA, on all cpus, or on all
+ * channels of a crypto engine fed from them, and completes them in the
+ * order they were submitted.  Fall back to the algorithm itself if there
+ * is no pcrypt.
+ */
+static struct crypto_aead *esp_alloc_aead(struct esp_data *esp,
+					  const char *name)
+{
+	char pcrypt_name[CRYPTO_MAX_ALG_NAME];
+	struct crypto_aead *aead;
+
+	if (parallel &&
+	    snprintf(pcrypt_name, CRYPTO_MAX_ALG_NAME, "pcrypt(%s)",
+		     name) < CRYPTO_MAX_ALG_NAME) {
+		aead = crypto_alloc_aead(pcrypt_name, 0, 0);
+		if (!IS_ERR(aead)) {
+			esp->parallel = 1;
+			return aead;
+		}
+	}
+	return crypto_alloc_aead(name, 0, 0);
+}
+
 static int esp_init_aead(struct xfrm_state *x)
 {
 	struct esp_data *esp = x->data;
 	struct crypto_aead *aead;
 	int err;
 
-	aead = crypto_alloc_aead(x->aead->alg_name, 0, 0);
+	aead = esp_alloc_aead(esp, x->aead->alg_name);
 	err = PTR_ERR(aead);
 	if (IS_ERR(aead))
 		goto error;
@@ -489,7 +538,7 @@ static int esp_init_authenc(struct xfrm_state *x)
 		     x->ealg->alg_name) >= CRYPTO_MAX_ALG_NAME)
 		goto error;
 
-	aead = crypto_alloc_aead(authenc_name, 0, 0);
+	aead = esp_alloc_aead(esp, authenc_name);
 	err = PTR_ERR(aead);
 	if (IS_ERR(aead))
 		goto error;
@@ -560,6 +609,10 @@ static int esp_init_state(struct xfrm_state *x)
 
 	x->data = esp;
 
+	esp->stats = alloc_percpu(struct esp_stats);
+	if (!esp->stats)
+		return -ENOMEM;
+
 	if (x->aead)
 		err = esp_init_aead(x);
 	else
@@ -622,15 +675,154 @@ static const struct net_protocol esp4_protocol = {
 	.netns_ok	=	1,
 };
 
+#ifdef CONFIG_PROC_FS
+static int esp4_seq_show_state(struct xfrm_state *x, int count, void *ptr)
+{
+	struct seq_file *seq = ptr;
+	struct esp_data *esp = x->data;
+	struct esp_stats sum = { 0 };
+	int cpu;
+
+	if (x->type != &esp_type || !esp || !esp->stats)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct esp_stats *st = per_cpu_ptr(esp->stats, cpu);
+
+		sum.out_packets += st->out_packets;
+		sum.out_async += st->out_async;
+		sum.in_packets += st->in_packets;
+		sum.in_async += st->in_async;
+	}
+
+	seq_printf(seq, "%08x %-15pI4 %-8s %10lu %10lu %10lu %10lu %s\n",
+		   ntohl(x->id.spi), &x->id.daddr.a4,
+		   esp->parallel ? "parallel" : "serial",
+		   sum.out_packets, sum.out_async, sum.in_packets,
+		   sum.in_async,
+		   crypto_tfm_alg_driver_name(crypto_aead_tfm(esp->aead)));
+	return 0;
+}
+
+/* One line per ESP SA of the namespace */
+static int esp4_seq_show(struct seq_file *seq, void *v)
+{
+	struct xfrm_state_walk walk;
+
+	seq_puts(seq, "SPI      Destination     Mode      OutPackets   "
+		 "OutAsync  InPackets    InAsync Algorithm\n");
+	xfrm_state_walk_init(&walk, IPPROTO_ESP);
+	xfrm_state_walk(seq_file_net(seq), &walk, esp4_seq_show_state, seq);
+	xfrm_state_walk_done(&walk);
+	return 0;
+}
+
+static int esp4_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, esp4_seq_show);
+}
+
+static const struct file_operations esp4_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = esp4_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = single_release_net,
+};
+
+/*
+ * One line per cpu: packets handed to the crypto layer by that cpu, and
+ * asynchronous completions that ran on it.
+ */
+static int esp4_stat_seq_show(struct seq_file *seq, void *v)
+{
+	int cpu;
+
+	seq_puts(seq, "out_packets out_async in_packets in_async\n");
+	for_each_possible_cpu(cpu) {
+		struct esp_stats *st = &per_cpu(esp4_stats, cpu);
+
+		seq_printf(seq, "%08lx %08lx %08lx %08lx\n",
+			   st->out_packets, st->out_async,
+			   st->in_packets, st->in_async);
+	}
+	return 0;
+}
+
+static int esp4_stat_seq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, esp4_stat_seq_show, NULL);
+}
+
+static const struct file_operations esp4_stat_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = esp4_stat_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = single_release,
+};
+
+static int __net_init esp4_net_init(struct net *net)
+{
+	if (!proc_net_fops_create(net, "esp4", S_IRUGO, &esp4_seq_fops))
+		goto out_esp4;
+	if (!proc_create("esp4", S_IRUGO, net->proc_net_stat,
+			 &esp4_stat_seq_fops))
+		goto out_stat;
+	return 0;
+
+out_stat:
+	proc_net_remove(net, "esp4");
+out_esp4:
+	return -ENOMEM;
+}
+
+static void __net_exit esp4_net_exit(struct net *net)
+{
+	remove_proc_entry("esp4", net->proc_net_stat);
+	proc_net_remove(net, "esp4");
+}
+
+static struct pernet_operations esp4_net_ops = {
+	.init = esp4_net_init,
+	.exit = esp4_net_exit,
+};
+
+static int __init esp4_proc_init(void)
+{
+	return register_pernet_subsys(&esp4_net_ops);
+}
+
+static void esp4_proc_exit(void)
+{
+	unregister_pernet_subsys(&esp4_net_ops);
+}
+#else
+static inline int esp4_proc_init(void)
+{
+	return 0;
+}
+
+static inline void esp4_proc_exit(void)
+{
+}
+#endif
+
 static int __init esp4_init(void)
 {
+	if (esp4_proc_init() < 0) {
+		printk(KERN_INFO "ip esp init: can't add proc files\n");
+		return -ENOMEM;
+	}
 	if (xfrm_register_type(&esp_type, AF_INET) < 0) {
 		printk(KERN_INFO "ip esp init: can't add xfrm type\n");
+		esp4_proc_exit();
 		return -EAGAIN;
 	}
 	if (inet_add_protocol(&esp4_protocol, IPPROTO_ESP) < 0) {
 		printk(KERN_INFO "ip esp init: can't add protocol\n");
 		xfrm_unregister_type(&esp_type, AF_INET);
+		esp4_proc_exit();
 		return -EAGAIN;
 	}
 	return 0;
@@ -642,6 +834,7 @@ static void __exit esp4_fini(void)
 		printk(KERN_INFO "ip esp close: can't remove protocol\n");
 	if (xfrm_unregister_type(&esp_type, AF_INET) < 0)
 		printk(KERN_INFO "ip esp close: can't remove xfrm type\n");
+	esp4_proc_exit();
 }
 
 module_init(esp4_init);
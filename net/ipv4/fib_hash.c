@@ -274,6 +274,7 @@ out:
 	read_unlock(&fib_hash_lock);
 	return err;
 }
+EXPORT_SYMBOL_GPL(fib_table_lookup);
 
 void fib_table_select_default(struct fib_table *tb,
 			      const struct flowi *flp, struct fib_result *res)
@@ -793,6 +794,11 @@ struct fib_table *fib_hash_table(u32 id)
 	return tb;
 }
 
+void fib_free_table(struct fib_table *tb)
+{
+	kfree(tb);
+}
+
 /* ------------------------------------------------------------------------ */
 #ifdef CONFIG_PROC_FS
 
@@ -100,19 +100,42 @@ struct node {
 	t_key key;
 };
 
+/* What a lookup reads first, the rcu_head last */
+struct leaf_info {
+	struct hlist_node hlist;
+	int plen;
+	struct list_head falh;
+	struct rcu_head rcu;
+};
+
+/*
+ * With CONFIG_IP_FIB_TRIE_COMPACT a leaf carries the leaf_info of its
+ * first prefix length, which for most leaves is the only one, so that
+ * a lookup finds key, prefix length and alias list in one cache line
+ * instead of two separate allocations.  Everything up to li.rcu is what
+ * a lookup reads: 32 bytes on 32-bit, 64 on 64-bit, and the leaves are
+ * cache line aligned so that it stays within one line.
+ */
 struct leaf {
 	unsigned long parent;
 	t_key key;
 	struct hlist_head list;
+#ifdef CONFIG_IP_FIB_TRIE_COMPACT
+	struct leaf_info li;
+#endif
 	struct rcu_head rcu;
 };
 
-struct leaf_info {
-	struct hlist_node hlist;
-	struct rcu_head rcu;
-	int plen;
-	struct list_head falh;
-};
+#ifdef CONFIG_IP_FIB_TRIE_COMPACT
+/* plen of an inline leaf_info not in use yet; it is never reused */
+#define LEAF_INFO_UNUSED	-1
+#define TRIE_LEAF_SLAB_FLAGS	SLAB_HWCACHE_ALIGN
+/* start the child array on a cache line of its own */
+#define TNODE_CHILD_ALIGN	____cacheline_aligned
+#else
+#define TNODE_CHILD_ALIGN
+#define TRIE_LEAF_SLAB_FLAGS	0
+#endif
 
 struct tnode {
 	unsigned long parent;
@@ -126,7 +149,7 @@ struct tnode {
 		struct work_struct work;
 		struct tnode *tnode_free;
 	};
-	struct node *child[0];
+	struct node *child[0] TNODE_CHILD_ALIGN;
 };
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
@@ -153,7 +176,7 @@ struct trie_stat {
 struct trie {
 	struct node *trie;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-	struct trie_use_stats stats;
+	struct trie_use_stats __percpu *stats;
 #endif
 };
 
@@ -357,8 +380,13 @@ static void __leaf_info_free_rcu(struct rcu_head *head)
 	kfree(container_of(head, struct leaf_info, rcu));
 }
 
-static inline void free_leaf_info(struct leaf_info *leaf)
+static inline void free_leaf_info(struct leaf *l, struct leaf_info *leaf)
 {
+#ifdef CONFIG_IP_FIB_TRIE_COMPACT
+	/* the inline one goes with the leaf */
+	if (leaf == &l->li)
+		return;
+#endif
 	call_rcu(&leaf->rcu, __leaf_info_free_rcu);
 }
 
@@ -429,13 +457,23 @@ static struct leaf *leaf_new(void)
 	if (l) {
 		l->parent = T_LEAF;
 		INIT_HLIST_HEAD(&l->list);
+#ifdef CONFIG_IP_FIB_TRIE_COMPACT
+		l->li.plen = LEAF_INFO_UNUSED;
+#endif
 	}
 	return l;
 }
 
-static struct leaf_info *leaf_info_new(int plen)
+static struct leaf_info *leaf_info_new(struct leaf *l, int plen)
 {
-	struct leaf_info *li = kmalloc(sizeof(struct leaf_info),  GFP_KERNEL);
+	struct leaf_info *li;
+
+#ifdef CONFIG_IP_FIB_TRIE_COMPACT
+	if (l->li.plen == LEAF_INFO_UNUSED)
+		li = &l->li;
+	else
+#endif
+		li = kmalloc(sizeof(struct leaf_info),  GFP_KERNEL);
 	if (li) {
 		li->plen = plen;
 		INIT_LIST_HEAD(&li->falh);
@@ -628,7 +666,7 @@ static struct node *resize(struct trie *t, struct tnode *tn)
 		if (IS_ERR(tn)) {
 			tn = old_tn;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.resize_node_skipped++;
+			this_cpu_inc(t->stats->resize_node_skipped);
 #endif
 			break;
 		}
@@ -655,7 +693,7 @@ static struct node *resize(struct trie *t, struct tnode *tn)
 		if (IS_ERR(tn)) {
 			tn = old_tn;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.resize_node_skipped++;
+			this_cpu_inc(t->stats->resize_node_skipped);
 #endif
 			break;
 		}
@@ -1088,7 +1126,7 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 
 	if (n != NULL && IS_LEAF(n) && tkey_equals(key, n->key)) {
 		l = (struct leaf *) n;
-		li = leaf_info_new(plen);
+		li = leaf_info_new(l, plen);
 
 		if (!li)
 			return NULL;
@@ -1103,7 +1141,7 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 		return NULL;
 
 	l->key = key;
-	li = leaf_info_new(plen);
+	li = leaf_info_new(l, plen);
 
 	if (!li) {
 		free_leaf(l);
@@ -1141,7 +1179,7 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 		}
 
 		if (!tn) {
-			free_leaf_info(li);
+			free_leaf_info(l, li);
 			free_leaf(l);
 			return NULL;
 		}
@@ -1365,9 +1403,9 @@ static int check_leaf(struct trie *t, struct leaf *l,
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 		if (err <= 0)
-			t->stats.semantic_match_passed++;
+			this_cpu_inc(t->stats->semantic_match_passed);
 		else
-			t->stats.semantic_match_miss++;
+			this_cpu_inc(t->stats->semantic_match_miss);
 #endif
 		if (err <= 0)
 			return err;
@@ -1399,7 +1437,7 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi *flp,
 		goto failed;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-	t->stats.gets++;
+	this_cpu_inc(t->stats->gets);
 #endif
 
 	/* Just a leaf? */
@@ -1423,7 +1461,7 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi *flp,
 
 		if (n == NULL) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.null_node_hit++;
+			this_cpu_inc(t->stats->null_node_hit);
 #endif
 			goto backtrace;
 		}
@@ -1564,7 +1602,7 @@ backtrace:
 			chopped_off = 0;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.backtrack++;
+			this_cpu_inc(t->stats->backtrack);
 #endif
 			goto backtrace;
 		}
@@ -1575,6 +1613,7 @@ found:
 	rcu_read_unlock();
 	return ret;
 }
+EXPORT_SYMBOL_GPL(fib_table_lookup);
 
 /*
  * Remove the leaf and return parent.
@@ -1665,7 +1704,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	if (list_empty(fa_head)) {
 		hlist_del_rcu(&li->hlist);
-		free_leaf_info(li);
+		free_leaf_info(l, li);
 	}
 
 	if (hlist_empty(&l->list))
@@ -1709,7 +1748,7 @@ static int trie_flush_leaf(struct leaf *l)
 
 		if (list_empty(&li->falh)) {
 			hlist_del_rcu(&li->hlist);
-			free_leaf_info(li);
+			free_leaf_info(l, li);
 		}
 	}
 	return found;
@@ -2003,10 +2042,14 @@ void __init fib_hash_init(void)
 					  sizeof(struct fib_alias),
 					  0, SLAB_PANIC, NULL);
 
+#ifdef CONFIG_IP_FIB_TRIE_COMPACT
+	BUILD_BUG_ON(offsetof(struct leaf, li.rcu) > L1_CACHE_BYTES);
+#endif
 	trie_leaf_kmem = kmem_cache_create("ip_fib_trie",
 					   max(sizeof(struct leaf),
 					       sizeof(struct leaf_info)),
-					   0, SLAB_PANIC, NULL);
+					   0, SLAB_PANIC | TRIE_LEAF_SLAB_FLAGS,
+					   NULL);
 }
 
 
@@ -2026,6 +2069,13 @@ struct fib_table *fib_hash_table(u32 id)
 
 	t = (struct trie *) tb->tb_data;
 	memset(t, 0, sizeof(*t));
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	t->stats = alloc_percpu(struct trie_use_stats);
+	if (!t->stats) {
+		kfree(tb);
+		return NULL;
+	}
+#endif
 
 	if (id == RT_TABLE_LOCAL)
 		pr_info("IPv4 FIB: Using LC-trie version %s\n", VERSION);
@@ -2033,6 +2083,16 @@ struct fib_table *fib_hash_table(u32 id)
 	return tb;
 }
 
+void fib_free_table(struct fib_table *tb)
+{
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	struct trie *t = (struct trie *) tb->tb_data;
+
+	free_percpu(t->stats);
+#endif
+	kfree(tb);
+}
+
 #ifdef CONFIG_PROC_FS
 /* Depth first Trie walk iterator */
 struct fib_trie_iter {
@@ -2170,7 +2230,12 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 	bytes = sizeof(struct leaf) * stat->leaves;
 
 	seq_printf(seq, "\tPrefixes:       %u\n", stat->prefixes);
+#ifdef CONFIG_IP_FIB_TRIE_COMPACT
+	/* the first prefix of each leaf is stored in the leaf */
+	bytes += sizeof(struct leaf_info) * (stat->prefixes - stat->leaves);
+#else
 	bytes += sizeof(struct leaf_info) * stat->prefixes;
+#endif
 
 	seq_printf(seq, "\tInternal nodes: %u\n\t", stat->tnodes);
 	bytes += sizeof(struct tnode) * stat->tnodes;
@@ -2195,8 +2260,22 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 static void trie_show_usage(struct seq_file *seq,
-			    const struct trie_use_stats *stats)
+			    const struct trie_use_stats __percpu *pcpu)
 {
+	struct trie_use_stats s = { 0 }, *stats = &s;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct trie_use_stats *c = per_cpu_ptr(pcpu, cpu);
+
+		s.gets += c->gets;
+		s.backtrack += c->backtrack;
+		s.semantic_match_passed += c->semantic_match_passed;
+		s.semantic_match_miss += c->semantic_match_miss;
+		s.null_node_hit += c->null_node_hit;
+		s.resize_node_skipped += c->resize_node_skipped;
+	}
+
 	seq_printf(seq, "\nCounters:\n---------\n");
 	seq_printf(seq, "gets = %u\n", stats->gets);
 	seq_printf(seq, "backtracks = %u\n", stats->backtrack);
@@ -2248,7 +2327,7 @@ static int fib_triestat_seq_show(struct seq_file *seq, void *v)
 			trie_collect_stats(t, &stat);
 			trie_show_stats(seq, &stat);
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			trie_show_usage(seq, &t->stats);
+			trie_show_usage(seq, t->stats);
 #endif
 		}
 	}
@@ -43,17 +43,11 @@
 #include <net/route.h>
 #include <net/xfrm.h>
 #include <linux/netfilter_table_index.h>
+#include <net/fastroute.h>
 
 bool firewall_rules;
 EXPORT_SYMBOL(firewall_rules);
 
-#ifdef CONFIG_NET_GIANFAR_FP
-extern int netdev_fastroute;
-extern int netdev_fastroute_obstacles;
-
-extern u32 gfar_fastroute_hash(u8 daddr, u8 saddr);
-#endif
-
 static int ip_forward_finish(struct sk_buff *skb)
 {
 	struct ip_options * opt	= &(IPCB(skb)->opt);
@@ -66,28 +60,9 @@ static int ip_forward_finish(struct sk_buff *skb)
 #ifdef CONFIG_NET_GIANFAR_FP
 	else {
 		struct rtable *rt = skb_rtable(skb);
-#ifdef FASTPATH_DEBUG
-		if (printk_ratelimit())
-			printk(KERN_INFO" %s: rt = %p, rt->rt_flags = %x "
-			       "(fast=%x), netdev_fastroute_ob=%d\n",
-			       __func___, rt, rt ? rt->rt_flags : 0,
-			       RTCF_FAST, netdev_fastroute_obstacles);
-#endif
-		if ((rt->rt_flags & RTCF_FAST) && !netdev_fastroute_obstacles) {
-			struct dst_entry *old_dst;
-			unsigned h = gfar_fastroute_hash(*(u8 *)&rt->rt_dst,
-							 *(u8 *)&rt->rt_src);
-#ifdef FASTPATH_DEBUG
-			if (printk_ratelimit())
-				printk(KERN_INFO " h = %d (%d, %d)\n",
-				       h, rt->rt_dst, rt->rt_src);
-#endif
-			write_lock_irq(&skb->dev->fastpath_lock);
-			old_dst = skb->dev->fastpath[h];
-			skb->dev->fastpath[h] = dst_clone(&rt->u.dst);
-			write_unlock_irq(&skb->dev->fastpath_lock);
-			dst_release(old_dst);
-		}
+
+		if ((rt->rt_flags & RTCF_FAST) && !netdev_fastroute_obstacles)
+			fastroute_insert(skb->dev, skb, &rt->u.dst);
 	}
 #endif
 	return dst_output(skb);
@@ -24,6 +24,10 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/log2.h>
+#include <linux/random.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
@@ -294,6 +298,703 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+/*
+ * Rule classifier, the bit vector scheme of Lakshman and Stiliadis.
+ *
+ * The values of every header field ip_packet_match() looks at are cut
+ * into classes matched by the same rules: address intervals, protocol
+ * numbers and interface names.  Each class has a bitmap of the rules
+ * whose ipt_ip may match it.  A packet looks up its five classes and
+ * ANDs their bitmaps; rules without a bit fail ip_packet_match() and
+ * are stepped over, just as linear evaluation would have stepped over
+ * them.  Address masks which are not prefixes and interface patterns
+ * other than a plain name count as wildcards, so a bitmap may have too
+ * many bits but never too few.
+ */
+static unsigned int classify_min __read_mostly = 32;
+module_param(classify_min, uint, 0644);
+MODULE_PARM_DESC(classify_min,
+		 "Build a rule classifier for tables of this many rules, 0 never");
+
+/* Larger classifiers are not built, the table is evaluated linearly */
+#define IPT_CLS_MAX_SIZE	(32 << 20)
+
+enum {
+	IPT_CLS_SRC,
+	IPT_CLS_DST,
+	IPT_CLS_PROTO,
+	IPT_CLS_IN,
+	IPT_CLS_OUT,
+	IPT_CLS_DIMS
+};
+
+struct ipt_cls {
+	unsigned int		rules;
+	unsigned int		words;		/* longs per bitmap */
+	const u32		*offset;	/* of each rule in the table */
+	const unsigned long	*bitmap;
+	/* source and destination: first address of each interval */
+	unsigned int		nrange[2];
+	const u32		*range[2];
+	const u32		*range_map[2];
+	u32			proto_map[256];
+	/* in and out: sorted names rules ask for, then the others */
+	unsigned int		nname[2];
+	const char		(*name[2])[IFNAMSIZ];
+	const u32		*name_map[2];
+	u32			name_other[2];
+};
+
+struct ipt_cls_key {
+	/* targets may rewrite these and send the packet on */
+	__be32			saddr;
+	__be32			daddr;
+	u8			protocol;
+	const unsigned long	*bm[IPT_CLS_DIMS];
+};
+
+static inline const unsigned long *
+ipt_cls_bitmap(const struct ipt_cls *cls, u32 index)
+{
+	return cls->bitmap + index * cls->words;
+}
+
+static const unsigned long *
+ipt_cls_range(const struct ipt_cls *cls, int d, __be32 addr)
+{
+	const u32 *range = cls->range[d];
+	unsigned int lo = 0, hi = cls->nrange[d] - 1, mid;
+	u32 a = ntohl(addr);
+
+	/* the first interval starts at 0 */
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (range[mid] <= a)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return ipt_cls_bitmap(cls, cls->range_map[d][lo]);
+}
+
+static const unsigned long *
+ipt_cls_name(const struct ipt_cls *cls, int d, const char *dev)
+{
+	int lo = 0, hi = cls->nname[d] - 1, mid, c;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		c = strncmp(dev, cls->name[d][mid], IFNAMSIZ);
+		if (c == 0)
+			return ipt_cls_bitmap(cls, cls->name_map[d][mid]);
+		if (c < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return ipt_cls_bitmap(cls, cls->name_other[d]);
+}
+
+static void ipt_cls_lookup(const struct ipt_cls *cls, struct ipt_cls_key *key,
+			   const struct iphdr *ip,
+			   const char *indev, const char *outdev)
+{
+	key->saddr    = ip->saddr;
+	key->daddr    = ip->daddr;
+	key->protocol = ip->protocol;
+	key->bm[IPT_CLS_SRC]   = ipt_cls_range(cls, 0, ip->saddr);
+	key->bm[IPT_CLS_DST]   = ipt_cls_range(cls, 1, ip->daddr);
+	key->bm[IPT_CLS_PROTO] = ipt_cls_bitmap(cls,
+						cls->proto_map[ip->protocol]);
+	key->bm[IPT_CLS_IN]    = ipt_cls_name(cls, 0, indev);
+	key->bm[IPT_CLS_OUT]   = ipt_cls_name(cls, 1, outdev);
+}
+
+static inline bool ipt_cls_stale(const struct ipt_cls_key *key,
+				 const struct iphdr *ip)
+{
+	return key->saddr != ip->saddr || key->daddr != ip->daddr ||
+	       key->protocol != ip->protocol;
+}
+
+/* Index of the first rule from @i on that may match, cls->rules if none */
+static unsigned int ipt_cls_next_index(const struct ipt_cls *cls,
+				       const struct ipt_cls_key *key,
+				       unsigned int i)
+{
+	const unsigned long * const *bm = key->bm;
+	unsigned long bits;
+	unsigned int w;
+
+	for (w = i / BITS_PER_LONG; w < cls->words; w++) {
+		bits = bm[0][w] & bm[1][w] & bm[2][w] & bm[3][w] & bm[4][w];
+		if (w == i / BITS_PER_LONG)
+			bits &= ~0UL << (i % BITS_PER_LONG);
+		if (bits)
+			return w * BITS_PER_LONG + __ffs(bits);
+	}
+	return cls->rules;
+}
+
+/* Replaces ipt_next_entry(): the rules in between do not match anyway. */
+static struct ipt_entry *
+ipt_cls_next(const struct ipt_cls *cls, const struct ipt_cls_key *key,
+	     const void *table_base, const struct ipt_entry *e)
+{
+	u32 off = (const void *)e - table_base;
+	unsigned int lo = 0, hi = cls->rules - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cls->offset[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	lo = ipt_cls_next_index(cls, key, lo + 1);
+	if (likely(lo < cls->rules))
+		return get_entry(table_base, cls->offset[lo]);
+	/* cannot happen in a table that passed mark_source_chains() */
+	return ipt_next_entry(e);
+}
+
+/* Building */
+
+struct ipt_cls_event {
+	u32			pos;
+	u32			rule;	/* << 1, | 1 where the interval ends */
+};
+
+struct ipt_cls_build {
+	unsigned int		rules;
+	unsigned int		words;
+	const struct ipt_ip	**ip;
+	u32			*offset;
+	unsigned long		*cur;
+	/* bitmaps, each stored once */
+	unsigned long		*bitmap;
+	unsigned int		nbitmap;
+	unsigned int		maxbitmap;
+	u32			*hash;
+	u32			*chain;
+	unsigned int		hashmask;
+	/* results for the address and interface fields */
+	u32			*range[2];
+	u32			*range_map[2];
+	unsigned int		nrange[2];
+	char			(*name[2])[IFNAMSIZ];
+	u32			*name_map[2];
+	unsigned int		nname[2];
+	u32			name_other[2];
+	u32			proto_map[256];
+};
+
+/* Index of the bitmap b->cur, added if it is new; -1 without memory. */
+static int ipt_cls_add(struct ipt_cls_build *b)
+{
+	size_t len = b->words * sizeof(unsigned long);
+	u32 h = jhash(b->cur, len, 0) & b->hashmask;
+	unsigned long *bitmap;
+	unsigned int i, max;
+	u32 *chain;
+
+	for (i = b->hash[h]; i; i = b->chain[i - 1])
+		if (memcmp(b->bitmap + (i - 1) * b->words, b->cur, len) == 0)
+			return i - 1;
+
+	if (b->nbitmap == b->maxbitmap) {
+		max = b->maxbitmap * 2;
+		if ((u64)max * len > IPT_CLS_MAX_SIZE)
+			return -1;
+		bitmap = vmalloc(max * len);
+		chain = vmalloc(max * sizeof(u32));
+		if (!bitmap || !chain) {
+			vfree(bitmap);
+			vfree(chain);
+			return -1;
+		}
+		memcpy(bitmap, b->bitmap, b->nbitmap * len);
+		memcpy(chain, b->chain, b->nbitmap * sizeof(u32));
+		vfree(b->bitmap);
+		vfree(b->chain);
+		b->bitmap = bitmap;
+		b->chain = chain;
+		b->maxbitmap = max;
+	}
+
+	i = b->nbitmap++;
+	memcpy(b->bitmap + i * b->words, b->cur, len);
+	b->chain[i] = b->hash[h];
+	b->hash[h] = i + 1;
+	return i;
+}
+
+/*
+ * The intervals of host order addresses with (addr & msk) == net, or
+ * the others if @inv.  Returns their number, -1 to match any address.
+ */
+static int ipt_cls_addr(__be32 net, __be32 msk, bool inv, u32 *lo, u32 *hi)
+{
+	u32 m = ntohl(msk), a = ntohl(net);
+	int n = 0;
+
+	/* not a prefix */
+	if (~m & (~m + 1))
+		return -1;
+	/* never equal */
+	if (a & ~m)
+		return inv ? -1 : 0;
+	if (!inv) {
+		lo[0] = a;
+		hi[0] = a | ~m;
+		return 1;
+	}
+	if (a) {
+		lo[n] = 0;
+		hi[n] = a - 1;
+		n++;
+	}
+	if ((a | ~m) != 0xFFFFFFFF) {
+		lo[n] = (a | ~m) + 1;
+		hi[n] = 0xFFFFFFFF;
+		n++;
+	}
+	return n;
+}
+
+static int ipt_cls_event_cmp(const void *a, const void *b)
+{
+	const struct ipt_cls_event *x = a, *y = b;
+
+	return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+static int ipt_cls_build_addr(struct ipt_cls_build *b, int d)
+{
+	struct ipt_cls_event *ev;
+	unsigned int r, j, k, nev = 0;
+	u32 lo[2], hi[2], pos;
+	int i, n, index;
+
+	ev = vmalloc(4 * b->rules * sizeof(*ev));
+	b->range[d] = vmalloc((4 * b->rules + 1) * sizeof(u32));
+	b->range_map[d] = vmalloc((4 * b->rules + 1) * sizeof(u32));
+	if (!ev || !b->range[d] || !b->range_map[d]) {
+		vfree(ev);
+		return -ENOMEM;
+	}
+
+	memset(b->cur, 0, b->words * sizeof(unsigned long));
+	for (r = 0; r < b->rules; r++) {
+		const struct ipt_ip *ip = b->ip[r];
+
+		if (d == 0)
+			n = ipt_cls_addr(ip->src.s_addr, ip->smsk.s_addr,
+					 ip->invflags & IPT_INV_SRCIP, lo, hi);
+		else
+			n = ipt_cls_addr(ip->dst.s_addr, ip->dmsk.s_addr,
+					 ip->invflags & IPT_INV_DSTIP, lo, hi);
+		if (n < 0) {
+			__set_bit(r, b->cur);
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			ev[nev].pos = lo[i];
+			ev[nev++].rule = r << 1;
+			if (hi[i] == 0xFFFFFFFF)
+				continue;
+			ev[nev].pos = hi[i] + 1;
+			ev[nev++].rule = r << 1 | 1;
+		}
+	}
+	sort(ev, nev, sizeof(*ev), ipt_cls_event_cmp, NULL);
+
+	/* sweep over the addresses, one interval per change of the rules */
+	for (pos = 0, j = 0, k = 0;;) {
+		for (; j < nev && ev[j].pos == pos; j++) {
+			if (ev[j].rule & 1)
+				__clear_bit(ev[j].rule >> 1, b->cur);
+			else
+				__set_bit(ev[j].rule >> 1, b->cur);
+		}
+		index = ipt_cls_add(b);
+		if (index < 0) {
+			vfree(ev);
+			return -ENOMEM;
+		}
+		if (k == 0 || b->range_map[d][k - 1] != index) {
+			b->range[d][k] = pos;
+			b->range_map[d][k++] = index;
+		}
+		if (j == nev)
+			break;
+		pos = ev[j].pos;
+	}
+	b->nrange[d] = k;
+	vfree(ev);
+	return 0;
+}
+
+static int ipt_cls_build_proto(struct ipt_cls_build *b)
+{
+	DECLARE_BITMAP(used, 256);
+	unsigned int r, v;
+	int index;
+
+	bitmap_zero(used, 256);
+	for (r = 0; r < b->rules; r++)
+		__set_bit(b->ip[r]->proto, used);
+	/* proto 0 is any protocol, so 0 stands for all unused values */
+	__clear_bit(0, used);
+
+	for (v = 0; v < 256; v++) {
+		if (v && !test_bit(v, used)) {
+			b->proto_map[v] = b->proto_map[0];
+			continue;
+		}
+		memset(b->cur, 0, b->words * sizeof(unsigned long));
+		for (r = 0; r < b->rules; r++) {
+			const struct ipt_ip *ip = b->ip[r];
+
+			if (!ip->proto ||
+			    (ip->proto == v) ^ !!(ip->invflags & IPT_INV_PROTO))
+				__set_bit(r, b->cur);
+		}
+		index = ipt_cls_add(b);
+		if (index < 0)
+			return -ENOMEM;
+		b->proto_map[v] = index;
+	}
+	return 0;
+}
+
+enum {
+	IPT_CLS_ANY,
+	IPT_CLS_NONE,
+	IPT_CLS_NAME,
+};
+
+/* Whether @iface/@mask is one plain name, matches everything or nothing */
+static int ipt_cls_iface(const char *iface, const unsigned char *mask,
+			 bool inv)
+{
+	unsigned int i, len = strnlen(iface, IFNAMSIZ);
+
+	for (i = 0; i < IFNAMSIZ; i++)
+		if (mask[i])
+			break;
+	if (i == IFNAMSIZ)
+		return inv ? IPT_CLS_NONE : IPT_CLS_ANY;
+
+	/* the name and its terminating nul, nothing else */
+	if (len == IFNAMSIZ)
+		return IPT_CLS_ANY;
+	for (i = 0; i < IFNAMSIZ; i++)
+		if (mask[i] != (i <= len ? 0xFF : 0))
+			return IPT_CLS_ANY;
+	return IPT_CLS_NAME;
+}
+
+static int ipt_cls_name_cmp(const void *a, const void *b)
+{
+	return strncmp(a, b, IFNAMSIZ);
+}
+
+static int ipt_cls_build_iface(struct ipt_cls_build *b, int d)
+{
+	char (*name)[IFNAMSIZ];
+	unsigned int r, k, n = 0;
+	int index, type, c;
+
+	name = vmalloc(b->rules * IFNAMSIZ);
+	b->name[d] = name;
+	b->name_map[d] = vmalloc(b->rules * sizeof(u32));
+	if (!name || !b->name_map[d])
+		return -ENOMEM;
+
+	for (r = 0; r < b->rules; r++) {
+		const struct ipt_ip *ip = b->ip[r];
+
+		if (d == 0)
+			type = ipt_cls_iface(ip->iniface, ip->iniface_mask,
+					     ip->invflags & IPT_INV_VIA_IN);
+		else
+			type = ipt_cls_iface(ip->outiface, ip->outiface_mask,
+					     ip->invflags & IPT_INV_VIA_OUT);
+		if (type != IPT_CLS_NAME)
+			continue;
+		memset(name[n], 0, IFNAMSIZ);
+		strcpy(name[n++], d == 0 ? ip->iniface : ip->outiface);
+	}
+	sort(name, n, IFNAMSIZ, ipt_cls_name_cmp, NULL);
+	for (r = 0, k = 0; r < n; r++)
+		if (k == 0 || strncmp(name[k - 1], name[r], IFNAMSIZ))
+			memcpy(name[k++], name[r], IFNAMSIZ);
+	b->nname[d] = k;
+
+	/* one bitmap per name, then one for all the other names */
+	for (k = 0; k <= b->nname[d]; k++) {
+		memset(b->cur, 0, b->words * sizeof(unsigned long));
+		for (r = 0; r < b->rules; r++) {
+			const struct ipt_ip *ip = b->ip[r];
+			const char *iface;
+			bool inv;
+
+			iface = d == 0 ? ip->iniface : ip->outiface;
+			inv = ip->invflags & (d == 0 ? IPT_INV_VIA_IN :
+						       IPT_INV_VIA_OUT);
+			type = ipt_cls_iface(iface,
+					     d == 0 ? ip->iniface_mask :
+						      ip->outiface_mask, inv);
+			if (type == IPT_CLS_NONE)
+				continue;
+			if (type == IPT_CLS_NAME) {
+				c = k < b->nname[d] &&
+				    strncmp(iface, name[k], IFNAMSIZ) == 0;
+				if (!(c ^ inv))
+					continue;
+			}
+			__set_bit(r, b->cur);
+		}
+		index = ipt_cls_add(b);
+		if (index < 0)
+			return -ENOMEM;
+		if (k < b->nname[d])
+			b->name_map[d][k] = index;
+		else
+			b->name_other[d] = index;
+	}
+	return 0;
+}
+
+/* Everything in one block, which goes with the xt_table_info */
+static struct ipt_cls *ipt_cls_pack(const struct ipt_cls_build *b)
+{
+	size_t size, bitmaps, offset, range[2], name[2];
+	struct ipt_cls *cls;
+	void *p;
+	int d;
+
+	bitmaps = (size_t)b->nbitmap * b->words * sizeof(unsigned long);
+	offset  = b->rules * sizeof(u32);
+	size = sizeof(*cls) + bitmaps + offset;
+	for (d = 0; d < 2; d++) {
+		range[d] = b->nrange[d] * sizeof(u32);
+		name[d] = b->nname[d] * (IFNAMSIZ + sizeof(u32));
+		size += 2 * range[d] + name[d];
+	}
+	if (size > IPT_CLS_MAX_SIZE)
+		return NULL;
+
+	cls = vmalloc(size);
+	if (!cls)
+		return NULL;
+
+	cls->rules = b->rules;
+	cls->words = b->words;
+	memcpy(cls->proto_map, b->proto_map, sizeof(cls->proto_map));
+
+	/* the bitmaps first, they want long alignment */
+	p = cls + 1;
+	cls->bitmap = memcpy(p, b->bitmap, bitmaps);
+	p += bitmaps;
+	cls->offset = memcpy(p, b->offset, offset);
+	p += offset;
+	for (d = 0; d < 2; d++) {
+		cls->nrange[d] = b->nrange[d];
+		cls->range[d] = memcpy(p, b->range[d], range[d]);
+		p += range[d];
+		cls->range_map[d] = memcpy(p, b->range_map[d], range[d]);
+		p += range[d];
+		cls->nname[d] = b->nname[d];
+		cls->name_other[d] = b->name_other[d];
+		cls->name_map[d] = memcpy(p, b->name_map[d],
+					  b->nname[d] * sizeof(u32));
+		p += b->nname[d] * sizeof(u32);
+		cls->name[d] = memcpy(p, b->name[d], b->nname[d] * IFNAMSIZ);
+		p += b->nname[d] * IFNAMSIZ;
+	}
+	return cls;
+}
+
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER_SELFTEST
+#define IPT_CLS_PROBES	1024
+
+static __be32 ipt_cls_probe_addr(__be32 net, __be32 msk)
+{
+	u32 a = ntohl(net), m = ntohl(msk);
+
+	switch (random32() % 5) {
+	case 0:
+		return net;
+	case 1:
+		return htonl(a - 1);
+	case 2:
+		return htonl((a | ~m) + 1);
+	case 3:
+		return htonl(a | (random32() & ~m));
+	default:
+		return random32();
+	}
+}
+
+static void ipt_cls_probe_iface(char *dev, const char *iface)
+{
+	memset(dev, 0, IFNAMSIZ);
+	switch (random32() % 4) {
+	case 0:
+		break;
+	case 1:
+		snprintf(dev, IFNAMSIZ, "%.*s%u", IFNAMSIZ - 3, iface,
+			 random32() % 8);
+		break;
+	default:
+		strncpy(dev, iface, IFNAMSIZ - 1);
+		break;
+	}
+}
+
+/* The first rule from @i on the classifier lets through and which matches */
+static unsigned int ipt_cls_probe_next(const struct ipt_cls *cls,
+				       const struct ipt_cls_key *key,
+				       const struct ipt_cls_build *b,
+				       const struct iphdr *ip,
+				       const char *indev, const char *outdev,
+				       int isfrag, unsigned int i)
+{
+	for (i = ipt_cls_next_index(cls, key, i);
+	     i < b->rules &&
+	     !ip_packet_match(ip, indev, outdev, b->ip[i], isfrag);
+	     i = ipt_cls_next_index(cls, key, i + 1))
+		;
+	return i;
+}
+
+/*
+ * Probe packets made up from the rules go through linear evaluation
+ * and through the classifier, which must stop at the same rules.
+ */
+static bool ipt_cls_selftest(const struct ipt_cls *cls,
+			     const struct ipt_cls_build *b)
+{
+	char indev[IFNAMSIZ] __attribute__((aligned(sizeof(long))));
+	char outdev[IFNAMSIZ] __attribute__((aligned(sizeof(long))));
+	unsigned int p, i, lin, next;
+	struct ipt_cls_key key;
+	struct iphdr ip;
+	int isfrag;
+
+	for (p = 0; p < IPT_CLS_PROBES; p++) {
+		const struct ipt_ip *a = b->ip[random32() % b->rules];
+		const struct ipt_ip *c = b->ip[random32() % b->rules];
+
+		memset(&ip, 0, sizeof(ip));
+		ip.saddr = ipt_cls_probe_addr(a->src.s_addr, a->smsk.s_addr);
+		ip.daddr = ipt_cls_probe_addr(c->dst.s_addr, c->dmsk.s_addr);
+		ip.protocol = random32() % 4 ? b->ip[random32() %
+						     b->rules]->proto :
+					       random32();
+		ipt_cls_probe_iface(indev, a->iniface);
+		ipt_cls_probe_iface(outdev, c->outiface);
+		isfrag = random32() % 2;
+
+		ipt_cls_lookup(cls, &key, &ip, indev, outdev);
+		next = ipt_cls_probe_next(cls, &key, b, &ip, indev, outdev,
+					  isfrag, 0);
+		for (i = 0; i < b->rules; i++) {
+			lin = ip_packet_match(&ip, indev, outdev, b->ip[i],
+					      isfrag);
+			if (!lin)
+				continue;
+			if (next != i) {
+				pr_err("classifier stops at rule %u, linear "
+				       "evaluation at %u for %pI4 > %pI4 "
+				       "proto %u in %s out %s\n", next, i,
+				       &ip.saddr, &ip.daddr, ip.protocol,
+				       indev, outdev);
+				return false;
+			}
+			next = ipt_cls_probe_next(cls, &key, b, &ip, indev,
+						  outdev, isfrag, i + 1);
+		}
+	}
+	return true;
+}
+#endif
+
+/* Build the classifier of a checked table, it is fine to go without. */
+static void ipt_cls_build(struct xt_table_info *info, const void *entry0)
+{
+	struct ipt_cls_build b;
+	const struct ipt_entry *iter;
+	struct ipt_cls *cls = NULL;
+	unsigned int r, hashsize;
+	int d;
+
+	if (!classify_min || info->number < classify_min)
+		return;
+
+	memset(&b, 0, sizeof(b));
+	b.rules = info->number;
+	b.words = BITS_TO_LONGS(b.rules);
+	b.maxbitmap = 64;
+	hashsize = roundup_pow_of_two(4 * b.rules);
+	b.hashmask = hashsize - 1;
+
+	b.ip = vmalloc(b.rules * sizeof(*b.ip));
+	b.offset = vmalloc(b.rules * sizeof(u32));
+	b.cur = vmalloc(b.words * sizeof(unsigned long));
+	b.bitmap = vmalloc(b.maxbitmap * b.words * sizeof(unsigned long));
+	b.chain = vmalloc(b.maxbitmap * sizeof(u32));
+	b.hash = vmalloc(hashsize * sizeof(u32));
+	if (!b.ip || !b.offset || !b.cur || !b.bitmap || !b.chain || !b.hash)
+		goto out;
+	memset(b.hash, 0, hashsize * sizeof(u32));
+
+	r = 0;
+	xt_entry_foreach(iter, entry0, info->size) {
+		b.ip[r] = &iter->ip;
+		b.offset[r++] = (const void *)iter - entry0;
+	}
+
+	if (ipt_cls_build_addr(&b, 0) || ipt_cls_build_addr(&b, 1) ||
+	    ipt_cls_build_proto(&b) ||
+	    ipt_cls_build_iface(&b, 0) || ipt_cls_build_iface(&b, 1))
+		goto out;
+
+	cls = ipt_cls_pack(&b);
+	if (!cls)
+		goto out;
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER_SELFTEST
+	if (!ipt_cls_selftest(cls, &b)) {
+		pr_err("rule classifier self-test failed, "
+		       "evaluating the table linearly\n");
+		vfree(cls);
+		cls = NULL;
+		goto out;
+	}
+#endif
+	duprintf("classifier: %u rules, %u bitmaps, %u+%u intervals, "
+		 "%u+%u names\n", b.rules, b.nbitmap, b.nrange[0],
+		 b.nrange[1], b.nname[0], b.nname[1]);
+out:
+	info->classifier = cls;
+	for (d = 0; d < 2; d++) {
+		vfree(b.range[d]);
+		vfree(b.range_map[d]);
+		vfree(b.name[d]);
+		vfree(b.name_map[d]);
+	}
+	vfree(b.hash);
+	vfree(b.chain);
+	vfree(b.bitmap);
+	vfree(b.cur);
+	vfree(b.offset);
+	vfree(b.ip);
+}
+#endif /* CONFIG_IP_NF_IPTABLES_CLASSIFIER */
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -312,6 +1013,10 @@ ipt_do_table(struct sk_buff *skb,
 	unsigned int *stackptr, origptr, cpu;
 	const struct xt_table_info *private;
 	struct xt_action_param acpar;
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	const struct ipt_cls *cls;
+	struct ipt_cls_key key;
+#endif
 
 	/* Initialization */
 	ip = ip_hdr(skb);
@@ -341,6 +1046,11 @@ ipt_do_table(struct sk_buff *skb,
 	origptr    = *stackptr;
 
 	e = get_entry(table_base, private->hook_entry[hook]);
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	cls = private->classifier;
+	if (cls)
+		ipt_cls_lookup(cls, &key, ip, indev, outdev);
+#endif
 
 	pr_debug("Entering %s(hook %u); sp at %u (UF %p)\n",
 		 table->name, hook, origptr,
@@ -354,6 +1064,12 @@ ipt_do_table(struct sk_buff *skb,
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+			if (cls) {
+				e = ipt_cls_next(cls, &key, table_base, e);
+				continue;
+			}
+#endif
 			e = ipt_next_entry(e);
 			continue;
 		}
@@ -422,11 +1138,21 @@ ipt_do_table(struct sk_buff *skb,
 		verdict = t->u.kernel.target->target(skb, &acpar);
 		/* Target might have changed stuff. */
 		ip = ip_hdr(skb);
-		if (verdict == IPT_CONTINUE)
+		if (verdict == IPT_CONTINUE) {
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+			if (cls) {
+				if (ipt_cls_stale(&key, ip))
+					ipt_cls_lookup(cls, &key, ip,
+						       indev, outdev);
+				e = ipt_cls_next(cls, &key, table_base, e);
+				continue;
+			}
+#endif
 			e = ipt_next_entry(e);
-		else
+		} else {
 			/* Verdict */
 			break;
+		}
 	} while (!acpar.hotdrop);
 	xt_info_rdunlock_bh();
 	pr_debug("Exiting %s; resetting sp from %u to %u\n",
@@ -875,6 +1601,9 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	ipt_cls_build(newinfo, entry0);
+#endif
 	return ret;
 }
 
@@ -1798,6 +2527,10 @@ translate_compat_table(struct net *net,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFIER
+	ipt_cls_build(newinfo, entry1);
+#endif
+
 	*pinfo = newinfo;
 	*pentry0 = entry1;
 	xt_free_table_info(info);
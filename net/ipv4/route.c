@@ -177,10 +177,21 @@ static int ip_rt_mtu_expires __read_mostly	= 10 * 60 * HZ;
 static int ip_rt_min_pmtu __read_mostly		= 512 + 20 + 20;
 static int ip_rt_min_advmss __read_mostly	= 256;
 static int rt_chain_length_max __read_mostly	= 20;
+static int ip_rt_gc_lazy_buckets __read_mostly	= 2;
+static int ip_rt_gc_budget __read_mostly	= 1024;
+
+/* Buckets swept by one run of the deferred flush */
+#define RT_FLUSH_CHUNK	1024
 
 static struct delayed_work expires_work;
 static unsigned long expires_ljiffies;
 
+static void rt_flush_worker(struct work_struct *work);
+static DECLARE_DELAYED_WORK(rt_flush_work, rt_flush_worker);
+static DEFINE_MUTEX(rt_flush_mutex);
+static unsigned long rt_flush_restart;
+static unsigned int rt_flush_pos;
+
 /*
  *	Interface to generic destination cache.
  */
@@ -514,12 +525,13 @@ static int rt_cpu_seq_show(struct seq_file *seq, void *v)
 	struct rt_cache_stat *st = v;
 
 	if (v == SEQ_START_TOKEN) {
-		seq_printf(seq, "entries  in_hit in_slow_tot in_slow_mc in_no_route in_brd in_martian_dst in_martian_src  out_hit out_slow_tot out_slow_mc  gc_total gc_ignored gc_goal_miss gc_dst_overflow in_hlist_search out_hlist_search\n");
+		seq_printf(seq, "entries  in_hit in_slow_tot in_slow_mc in_no_route in_brd in_martian_dst in_martian_src  out_hit out_slow_tot out_slow_mc  gc_total gc_ignored gc_goal_miss gc_dst_overflow in_hlist_search out_hlist_search gc_lazy gc_budget_hit flush_deferred flush_swept\n");
 		return 0;
 	}
 
 	seq_printf(seq,"%08x  %08x %08x %08x %08x %08x %08x %08x "
-		   " %08x %08x %08x %08x %08x %08x %08x %08x %08x \n",
+		   " %08x %08x %08x %08x %08x %08x %08x %08x %08x "
+		   "%08x %08x %08x %08x \n",
 		   atomic_read(&ipv4_dst_ops.entries),
 		   st->in_hit,
 		   st->in_slow_tot,
@@ -538,7 +550,12 @@ static int rt_cpu_seq_show(struct seq_file *seq, void *v)
 		   st->gc_goal_miss,
 		   st->gc_dst_overflow,
 		   st->in_hlist_search,
-		   st->out_hlist_search
+		   st->out_hlist_search,
+
+		   st->gc_lazy,
+		   st->gc_budget_hit,
+		   st->flush_deferred,
+		   st->flush_swept
 		);
 	return 0;
 }
@@ -769,17 +786,20 @@ static inline int rt_is_expired(struct rtable *rth)
 }
 
 /*
- * Perform a full scan of hash table and free all entries.
+ * Scan buckets [start, end) of the hash table and free all entries of
+ * an invalidated generation.
  * Can be called by a softirq or a process.
  * In the later case, we want to be reschedule if necessary
  */
-static void rt_do_flush(int process_context)
+static void rt_do_flush_range(unsigned int start, unsigned int end,
+			      int process_context)
 {
 	unsigned int i;
 	struct rtable *rth, *next;
 	struct rtable * tail;
+	struct rtable ** prev, * p;
 
-	for (i = 0; i <= rt_hash_mask; i++) {
+	for (i = start; i < end; i++) {
 		if (process_context && need_resched())
 			cond_resched();
 		rth = rt_hash_table[i].chain;
@@ -787,10 +807,6 @@ static void rt_do_flush(int process_context)
 			continue;
 
 		spin_lock_bh(rt_hash_lock_addr(i));
-#ifdef CONFIG_NET_NS
-		{
-		struct rtable ** prev, * p;
-
 		rth = rt_hash_table[i].chain;
 
 		/* defer releasing the head of the list after spin_unlock */
@@ -809,23 +825,88 @@ static void rt_do_flush(int process_context)
 			} else {
 				*prev = next;
 				rt_free(p);
+				RT_CACHE_STAT_INC(flush_swept);
 			}
 		}
-		}
-#else
-		rth = rt_hash_table[i].chain;
-		rt_hash_table[i].chain = NULL;
-		tail = NULL;
-#endif
 		spin_unlock_bh(rt_hash_lock_addr(i));
 
 		for (; rth != tail; rth = next) {
 			next = rth->u.dst.rt_next;
 			rt_free(rth);
+			RT_CACHE_STAT_INC(flush_swept);
 		}
 	}
 }
 
+static void rt_do_flush(int process_context)
+{
+	rt_do_flush_range(0, rt_hash_mask + 1, process_context);
+}
+
+/*
+ * Entries of an invalidated generation are never returned by lookups,
+ * so there is no hurry to free them: inserts drop the ones on their own
+ * chain, and this work sweeps the rest RT_FLUSH_CHUNK buckets a jiffy,
+ * in process context.  A flush while a sweep is under way starts it
+ * over from the first bucket.
+ */
+static void rt_flush_worker(struct work_struct *work)
+{
+	unsigned int end;
+
+	mutex_lock(&rt_flush_mutex);
+	if (test_and_clear_bit(0, &rt_flush_restart))
+		rt_flush_pos = 0;
+	end = min(rt_flush_pos + RT_FLUSH_CHUNK, rt_hash_mask + 1);
+	rt_do_flush_range(rt_flush_pos, end, 1);
+	rt_flush_pos = end;
+	if (rt_flush_pos <= rt_hash_mask || test_bit(0, &rt_flush_restart))
+		schedule_delayed_work(&rt_flush_work, 1);
+	mutex_unlock(&rt_flush_mutex);
+}
+
+static void rt_flush_deferred(void)
+{
+	RT_CACHE_STAT_INC(flush_deferred);
+	set_bit(0, &rt_flush_restart);
+	schedule_delayed_work(&rt_flush_work, 0);
+}
+
+/*
+ * Expiry on the insert path: every new entry pays for a look at
+ * ip_rt_gc_lazy_buckets other buckets, so stale and aged entries leave
+ * at the rate new ones arrive rather than in rt_garbage_collect()
+ * bursts.  Buckets whose lock is busy are skipped.
+ */
+static void rt_lazy_expire(void)
+{
+	static unsigned int rover;
+	struct rtable *rth, **rthp;
+	unsigned int i;
+	int n;
+
+	for (n = ip_rt_gc_lazy_buckets; n > 0; n--) {
+		i = rover++ & rt_hash_mask;
+		rthp = &rt_hash_table[i].chain;
+		if (*rthp == NULL)
+			continue;
+		if (!spin_trylock_bh(rt_hash_lock_addr(i)))
+			continue;
+		while ((rth = *rthp) != NULL) {
+			if (rt_is_expired(rth) ||
+			    rt_may_expire(rth, ip_rt_gc_timeout,
+					  ip_rt_gc_timeout)) {
+				*rthp = rth->u.dst.rt_next;
+				rt_free(rth);
+				RT_CACHE_STAT_INC(gc_lazy);
+				continue;
+			}
+			rthp = &rth->u.dst.rt_next;
+		}
+		spin_unlock_bh(rt_hash_lock_addr(i));
+	}
+}
+
 /*
  * While freeing expired entries, we compute average chain length
  * and standard deviation, using fixed-point arithmetic.
@@ -961,7 +1042,7 @@ static void rt_cache_invalidate(struct net *net)
 
 /*
  * delay < 0  : invalidate cache (fast : entries will be deleted later)
- * delay >= 0 : invalidate & flush cache (can be long)
+ * delay >= 0 : invalidate cache & sweep it from a work (see above)
  */
 void rt_cache_flush(struct net *net, int delay)
 {
@@ -971,10 +1052,13 @@ void rt_cache_flush(struct net *net, int delay)
 		route_flush_fn();
 #endif
 	if (delay >= 0)
-		rt_do_flush(!in_softirq());
+		rt_flush_deferred();
 }
 
-/* Flush previous cache invalidated entries from the cache */
+/*
+ * Flush previous cache invalidated entries from the cache, now: they
+ * hold references to devices being unregistered.
+ */
 void rt_cache_flush_batch(void)
 {
 	rt_do_flush(!in_softirq());
@@ -985,6 +1069,7 @@ static void rt_emergency_hash_rebuild(struct net *net)
 	if (net_ratelimit())
 		printk(KERN_WARNING "Route hash chain too long!\n");
 	rt_cache_invalidate(net);
+	rt_flush_deferred();
 }
 
 /*
@@ -1052,6 +1137,7 @@ static int rt_garbage_collect(struct dst_ops *ops)
 
 	do {
 		int i, k;
+		int budget = ip_rt_gc_budget ? : rt_hash_mask + 1;
 
 		for (i = rt_hash_mask, k = rover; i >= 0; i--) {
 			unsigned long tmo = expire;
@@ -1073,12 +1159,25 @@ static int rt_garbage_collect(struct dst_ops *ops)
 			spin_unlock_bh(rt_hash_lock_addr(k));
 			if (goal <= 0)
 				break;
+			/*
+			 * Leave the rest to the insert path and the next
+			 * call unless the table is full.
+			 */
+			if (--budget <= 0 &&
+			    atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size)
+				break;
 		}
 		rover = k;
 
 		if (goal <= 0)
 			goto work_done;
 
+		if (budget <= 0 &&
+		    atomic_read(&ipv4_dst_ops.entries) < ip_rt_max_size) {
+			RT_CACHE_STAT_INC(gc_budget_hit);
+			goto out;
+		}
+
 		/* Goal is not achieved. We stop process if:
 
 		   - if expire reduced to zero. Otherwise, expire is halfed.
@@ -1322,6 +1421,8 @@ restart:
 
 	spin_unlock_bh(rt_hash_lock_addr(hash));
 
+	rt_lazy_expire();
+
 skip_hashing:
 	if (rp) {
 		*rp = rt;
@@ -3201,6 +3302,8 @@ static int ipv4_sysctl_rtcache_flush(ctl_table *__ctl, int write,
 	return -EINVAL;
 }
 
+static int zero;
+
 static ctl_table ipv4_route_table[] = {
 	{
 		.procname	= "gc_thresh",
@@ -3288,6 +3391,22 @@ static ctl_table ipv4_route_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+	{
+		.procname	= "gc_lazy_buckets",
+		.data		= &ip_rt_gc_lazy_buckets,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
+	{
+		.procname	= "gc_budget",
+		.data		= &ip_rt_gc_budget,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
 	{
 		.procname	= "mtu_expires",
 		.data		= &ip_rt_mtu_expires,
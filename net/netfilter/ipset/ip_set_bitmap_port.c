@@ -0,0 +1,220 @@
+/*
+ * The bitmap:port set type: one bit for every TCP, UDP, UDP-Lite or
+ * SCTP port of a range given at creation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/bitops.h>
+#include <linux/skbuff.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+struct bitmap_port {
+	unsigned long		*map;
+	u16			first_port;
+	u16			last_port;
+	u32			elements;
+	size_t			memsize;
+};
+
+static int bitmap_port_kadt(const struct ip_set *set,
+			    const struct sk_buff *skb, u8 flags)
+{
+	const struct bitmap_port *map = set->data;
+	__be16 __port;
+	u16 port;
+	u8 proto;
+
+	if (!ip_set_get_ip4_port(skb, flags & IPSET_DIM_SRC(0),
+				 &__port, &proto))
+		return 0;
+	port = ntohs(__port);
+	if (port < map->first_port || port > map->last_port)
+		return 0;
+	return test_bit(port - map->first_port, map->map);
+}
+
+static int bitmap_port_uadt(struct ip_set *set, struct nlattr *tb[],
+			    enum ipset_adt adt, u32 nlflags)
+{
+	struct bitmap_port *map = set->data;
+	u16 port, port_to;
+	bool excl = nlflags & NLM_F_EXCL;
+	u32 id;
+
+	if (!tb[IPSET_ATTR_PORT])
+		return -EINVAL;
+	port = ntohs(nla_get_be16(tb[IPSET_ATTR_PORT]));
+	port_to = port;
+	if (tb[IPSET_ATTR_PORT_TO]) {
+		if (adt == IPSET_TEST)
+			return -EINVAL;
+		port_to = ntohs(nla_get_be16(tb[IPSET_ATTR_PORT_TO]));
+		if (port_to < port)
+			swap(port, port_to);
+	}
+	if (port < map->first_port || port_to > map->last_port)
+		return -ERANGE;
+
+	for (id = port - map->first_port;
+	     id <= port_to - map->first_port; id++) {
+		switch (adt) {
+		case IPSET_ADD:
+			if (!test_and_set_bit(id, map->map))
+				map->elements++;
+			else if (excl)
+				return -EEXIST;
+			break;
+		case IPSET_DEL:
+			if (test_and_clear_bit(id, map->map))
+				map->elements--;
+			else if (excl)
+				return -ENOENT;
+			break;
+		default:
+			return test_bit(id, map->map) ? 0 : -ENOENT;
+		}
+	}
+	return 0;
+}
+
+static void bitmap_port_flush(struct ip_set *set)
+{
+	struct bitmap_port *map = set->data;
+
+	bitmap_zero(map->map, map->last_port - map->first_port + 1);
+	map->elements = 0;
+}
+
+static void bitmap_port_destroy(struct ip_set *set)
+{
+	struct bitmap_port *map = set->data;
+
+	if (is_vmalloc_addr(map->map))
+		vfree(map->map);
+	else
+		kfree(map->map);
+	kfree(map);
+}
+
+static int bitmap_port_head(const struct ip_set *set, struct sk_buff *skb)
+{
+	const struct bitmap_port *map = set->data;
+	struct nlattr *nest;
+
+	nest = nla_nest_start(skb, IPSET_ATTR_DATA | NLA_F_NESTED);
+	if (!nest)
+		goto nla_put_failure;
+	NLA_PUT_BE16(skb, IPSET_ATTR_PORT, htons(map->first_port));
+	NLA_PUT_BE16(skb, IPSET_ATTR_PORT_TO, htons(map->last_port));
+	NLA_PUT_U32(skb, IPSET_ATTR_ELEMENTS, htonl(map->elements));
+	NLA_PUT_U32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref));
+	NLA_PUT_U32(skb, IPSET_ATTR_MEMSIZE,
+		    htonl(sizeof(*map) + map->memsize));
+	nla_nest_end(skb, nest);
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+/* @pos[0]: the next port to list, relative to first_port */
+static int bitmap_port_list(const struct ip_set *set, struct sk_buff *skb,
+			    unsigned long *pos)
+{
+	const struct bitmap_port *map = set->data;
+	unsigned long size = map->last_port - map->first_port + 1;
+	struct nlattr *nest;
+
+	for (; (pos[0] = find_next_bit(map->map, size, pos[0])) < size;
+	     pos[0]++) {
+		nest = nla_nest_start(skb, IPSET_ATTR_DATA | NLA_F_NESTED);
+		if (!nest)
+			return -EMSGSIZE;
+		NLA_PUT_BE16(skb, IPSET_ATTR_PORT,
+			     htons(map->first_port + pos[0]));
+		nla_nest_end(skb, nest);
+	}
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(skb, nest);
+	return -EMSGSIZE;
+}
+
+static const struct ip_set_type_variant bitmap_port_variant = {
+	.kadt		= bitmap_port_kadt,
+	.uadt		= bitmap_port_uadt,
+	.flush		= bitmap_port_flush,
+	.destroy	= bitmap_port_destroy,
+	.head		= bitmap_port_head,
+	.list		= bitmap_port_list,
+};
+
+static int bitmap_port_create(struct ip_set *set, struct nlattr *tb[])
+{
+	struct bitmap_port *map;
+	u16 first_port, last_port;
+
+	if (!tb[IPSET_ATTR_PORT] || !tb[IPSET_ATTR_PORT_TO])
+		return -EINVAL;
+	first_port = ntohs(nla_get_be16(tb[IPSET_ATTR_PORT]));
+	last_port = ntohs(nla_get_be16(tb[IPSET_ATTR_PORT_TO]));
+	if (last_port < first_port)
+		swap(first_port, last_port);
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	map->first_port = first_port;
+	map->last_port = last_port;
+	map->memsize = BITS_TO_LONGS(last_port - first_port + 1) *
+		       sizeof(unsigned long);
+	if (map->memsize <= PAGE_SIZE)
+		map->map = kzalloc(map->memsize, GFP_KERNEL);
+	else
+		map->map = __vmalloc(map->memsize,
+				     GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO,
+				     PAGE_KERNEL);
+	if (!map->map) {
+		kfree(map);
+		return -ENOMEM;
+	}
+
+	set->data = map;
+	set->variant = &bitmap_port_variant;
+	return 0;
+}
+
+static struct ip_set_type bitmap_port_type __read_mostly = {
+	.name		= "bitmap:port",
+	.family		= NFPROTO_IPV4,
+	.dimension	= 1,
+	.create		= bitmap_port_create,
+	.me		= THIS_MODULE,
+};
+
+static int __init bitmap_port_init(void)
+{
+	return ip_set_type_register(&bitmap_port_type);
+}
+
+static void __exit bitmap_port_fini(void)
+{
+	ip_set_type_unregister(&bitmap_port_type);
+}
+
+module_init(bitmap_port_init);
+module_exit(bitmap_port_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("bitmap:port IP set type");
+MODULE_ALIAS("ip_set_bitmap:port");
@@ -0,0 +1,627 @@
+/*
+ * IP set core: set types, the sets and their nfnetlink interface.
+ *
+ * Sets live in a fixed array and are referred to by index, so the set
+ * match never looks up names on the packet path.  Packets look sets up
+ * under RCU only; everything else runs under the nfnl mutex.  Swapping
+ * two sets exchanges their array slots, which switches every rule
+ * using one of them at once.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <net/netlink.h>
+#include <net/ip.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+static LIST_HEAD(ip_set_type_list);
+static DEFINE_MUTEX(ip_set_type_mutex);
+
+/* All sets, written under the nfnl mutex */
+static struct ip_set **ip_set_list;
+
+static unsigned int max_sets = CONFIG_IP_SET_MAX;
+module_param(max_sets, uint, 0400);
+MODULE_PARM_DESC(max_sets, "Maximal number of sets");
+
+/* Set types */
+
+static struct ip_set_type *__find_set_type(const char *name, u8 family)
+{
+	struct ip_set_type *type;
+
+	list_for_each_entry(type, &ip_set_type_list, list)
+		if (strcmp(type->name, name) == 0 && type->family == family)
+			return type;
+	return NULL;
+}
+
+/*
+ * Find a type and hold its module.  Returns -EAGAIN after loading the
+ * module, nfnetlink then replays the message.
+ */
+static int find_set_type_get(const char *name, u8 family,
+			     struct ip_set_type **found)
+{
+	struct ip_set_type *type;
+
+	mutex_lock(&ip_set_type_mutex);
+	type = __find_set_type(name, family);
+	if (type && !try_module_get(type->me))
+		type = NULL;
+	mutex_unlock(&ip_set_type_mutex);
+	if (type) {
+		*found = type;
+		return 0;
+	}
+
+#ifdef CONFIG_MODULES
+	nfnl_unlock();
+	request_module("ip_set_%s", name);
+	nfnl_lock();
+	mutex_lock(&ip_set_type_mutex);
+	type = __find_set_type(name, family);
+	mutex_unlock(&ip_set_type_mutex);
+	if (type)
+		return -EAGAIN;
+#endif
+	return -ENOENT;
+}
+
+int ip_set_type_register(struct ip_set_type *type)
+{
+	int ret = 0;
+
+	if (type->dimension < 1 || type->dimension > IPSET_DIM_MAX)
+		return -EINVAL;
+
+	mutex_lock(&ip_set_type_mutex);
+	if (__find_set_type(type->name, type->family))
+		ret = -EEXIST;
+	else
+		list_add_tail(&type->list, &ip_set_type_list);
+	mutex_unlock(&ip_set_type_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ip_set_type_register);
+
+void ip_set_type_unregister(struct ip_set_type *type)
+{
+	mutex_lock(&ip_set_type_mutex);
+	list_del(&type->list);
+	mutex_unlock(&ip_set_type_mutex);
+}
+EXPORT_SYMBOL_GPL(ip_set_type_unregister);
+
+/* Helpers for the types */
+
+const struct nla_policy ip_set_data_policy[IPSET_ATTR_DATA_MAX + 1] = {
+	[IPSET_ATTR_IP]		= { .type = NLA_U32 },
+	[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+	[IPSET_ATTR_PORT]	= { .type = NLA_U16 },
+	[IPSET_ATTR_PORT_TO]	= { .type = NLA_U16 },
+	[IPSET_ATTR_PROTO]	= { .type = NLA_U8 },
+	[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+	[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+};
+EXPORT_SYMBOL_GPL(ip_set_data_policy);
+
+/* The port of a TCP, UDP, UDP-Lite or SCTP packet, false without one */
+bool ip_set_get_ip4_port(const struct sk_buff *skb, bool src,
+			 __be16 *port, u8 *proto)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	__be16 _ports[2];
+	const __be16 *ports;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_SCTP:
+		break;
+	default:
+		return false;
+	}
+	/* only the first fragment has the ports */
+	if (ntohs(iph->frag_off) & IP_OFFSET)
+		return false;
+
+	ports = skb_header_pointer(skb, ip_hdrlen(skb), sizeof(_ports),
+				   _ports);
+	if (!ports)
+		return false;
+
+	*port = src ? ports[0] : ports[1];
+	*proto = iph->protocol;
+	return true;
+}
+EXPORT_SYMBOL_GPL(ip_set_get_ip4_port);
+
+/* Interface of the set match */
+
+static ip_set_id_t __find_set_id(const char *name)
+{
+	ip_set_id_t i;
+
+	for (i = 0; i < max_sets; i++)
+		if (ip_set_list[i] &&
+		    strncmp(ip_set_list[i]->name, name, IPSET_MAXNAMELEN) == 0)
+			return i;
+	return IPSET_INVALID_ID;
+}
+
+/* Find a set and take a reference, which keeps it from being destroyed */
+ip_set_id_t ip_set_get_byname(const char *name, u8 *dimension)
+{
+	ip_set_id_t index;
+
+	nfnl_lock();
+	index = __find_set_id(name);
+	if (index != IPSET_INVALID_ID) {
+		ip_set_list[index]->ref++;
+		*dimension = ip_set_list[index]->type->dimension;
+	}
+	nfnl_unlock();
+	return index;
+}
+EXPORT_SYMBOL_GPL(ip_set_get_byname);
+
+void ip_set_put_byindex(ip_set_id_t index)
+{
+	nfnl_lock();
+	if (ip_set_list[index])
+		ip_set_list[index]->ref--;
+	nfnl_unlock();
+}
+EXPORT_SYMBOL_GPL(ip_set_put_byindex);
+
+/* Whether the packet is in the set, BH context under rcu_read_lock() */
+int ip_set_test(ip_set_id_t index, const struct sk_buff *skb, u8 flags)
+{
+	const struct ip_set *set;
+	int ret = 0;
+
+	rcu_read_lock();
+	set = rcu_dereference(ip_set_list[index]);
+	if (likely(set))
+		ret = set->variant->kadt(set, skb, flags);
+	rcu_read_unlock();
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ip_set_test);
+
+/* Netlink interface */
+
+static const struct nla_policy ip_set_policy[IPSET_ATTR_CMD_MAX + 1] = {
+	[IPSET_ATTR_SETNAME]	= { .type = NLA_NUL_STRING,
+				    .len = IPSET_MAXNAMELEN - 1 },
+	[IPSET_ATTR_SETNAME2]	= { .type = NLA_NUL_STRING,
+				    .len = IPSET_MAXNAMELEN - 1 },
+	[IPSET_ATTR_TYPENAME]	= { .type = NLA_NUL_STRING,
+				    .len = IPSET_MAXNAMELEN - 1 },
+	[IPSET_ATTR_FAMILY]	= { .type = NLA_U8 },
+	[IPSET_ATTR_DATA]	= { .type = NLA_NESTED },
+	[IPSET_ATTR_ADT]	= { .type = NLA_NESTED },
+};
+
+static int ip_set_parse_data(const struct nlattr *attr, struct nlattr *tb[])
+{
+	return nla_parse_nested(tb, IPSET_ATTR_DATA_MAX, attr,
+				ip_set_data_policy);
+}
+
+static struct ip_set *find_set(const struct nlattr *attr, ip_set_id_t *id)
+{
+	ip_set_id_t i;
+
+	if (!attr)
+		return NULL;
+	i = __find_set_id(nla_data(attr));
+	if (i == IPSET_INVALID_ID)
+		return NULL;
+	if (id)
+		*id = i;
+	return ip_set_list[i];
+}
+
+static int ip_set_create(struct sock *ctnl, struct sk_buff *skb,
+			 const struct nlmsghdr *nlh,
+			 const struct nlattr * const attr[])
+{
+	struct nlattr *tb[IPSET_ATTR_DATA_MAX + 1] = {};
+	struct ip_set_type *type;
+	struct ip_set *set;
+	ip_set_id_t i, index = IPSET_INVALID_ID;
+	u8 family;
+	int ret;
+
+	if (!attr[IPSET_ATTR_SETNAME] || !attr[IPSET_ATTR_TYPENAME] ||
+	    !attr[IPSET_ATTR_FAMILY])
+		return -EINVAL;
+	family = nla_get_u8(attr[IPSET_ATTR_FAMILY]);
+	if (attr[IPSET_ATTR_DATA]) {
+		ret = ip_set_parse_data(attr[IPSET_ATTR_DATA], tb);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (find_set(attr[IPSET_ATTR_SETNAME], NULL))
+		return nlh->nlmsg_flags & NLM_F_EXCL ? -EEXIST : 0;
+	for (i = 0; i < max_sets; i++)
+		if (!ip_set_list[i]) {
+			index = i;
+			break;
+		}
+	if (index == IPSET_INVALID_ID)
+		return -ENFILE;
+
+	ret = find_set_type_get(nla_data(attr[IPSET_ATTR_TYPENAME]), family,
+				&type);
+	if (ret < 0)
+		return ret;
+
+	set = kzalloc(sizeof(*set), GFP_KERNEL);
+	if (!set) {
+		ret = -ENOMEM;
+		goto put_type;
+	}
+	nla_strlcpy(set->name, attr[IPSET_ATTR_SETNAME], IPSET_MAXNAMELEN);
+	set->type = type;
+	ret = type->create(set, tb);
+	if (ret < 0)
+		goto free_set;
+
+	rcu_assign_pointer(ip_set_list[index], set);
+	return 0;
+
+free_set:
+	kfree(set);
+put_type:
+	module_put(type->me);
+	return ret;
+}
+
+static void ip_set_destroy_set(ip_set_id_t index)
+{
+	struct ip_set *set = ip_set_list[index];
+
+	rcu_assign_pointer(ip_set_list[index], NULL);
+	synchronize_rcu();
+	set->variant->destroy(set);
+	module_put(set->type->me);
+	kfree(set);
+}
+
+static int ip_set_destroy(struct sock *ctnl, struct sk_buff *skb,
+			  const struct nlmsghdr *nlh,
+			  const struct nlattr * const attr[])
+{
+	ip_set_id_t i;
+
+	if (attr[IPSET_ATTR_SETNAME]) {
+		if (!find_set(attr[IPSET_ATTR_SETNAME], &i))
+			return -ENOENT;
+		if (ip_set_list[i]->ref)
+			return -EBUSY;
+		ip_set_destroy_set(i);
+		return 0;
+	}
+
+	for (i = 0; i < max_sets; i++)
+		if (ip_set_list[i] && ip_set_list[i]->ref)
+			return -EBUSY;
+	for (i = 0; i < max_sets; i++)
+		if (ip_set_list[i])
+			ip_set_destroy_set(i);
+	return 0;
+}
+
+static int ip_set_flush(struct sock *ctnl, struct sk_buff *skb,
+			const struct nlmsghdr *nlh,
+			const struct nlattr * const attr[])
+{
+	struct ip_set *set;
+	ip_set_id_t i;
+
+	if (attr[IPSET_ATTR_SETNAME]) {
+		set = find_set(attr[IPSET_ATTR_SETNAME], NULL);
+		if (!set)
+			return -ENOENT;
+		set->variant->flush(set);
+		return 0;
+	}
+
+	for (i = 0; i < max_sets; i++)
+		if (ip_set_list[i])
+			ip_set_list[i]->variant->flush(ip_set_list[i]);
+	return 0;
+}
+
+static int ip_set_rename(struct sock *ctnl, struct sk_buff *skb,
+			 const struct nlmsghdr *nlh,
+			 const struct nlattr * const attr[])
+{
+	struct ip_set *set;
+
+	if (!attr[IPSET_ATTR_SETNAME2])
+		return -EINVAL;
+	set = find_set(attr[IPSET_ATTR_SETNAME], NULL);
+	if (!set)
+		return -ENOENT;
+	if (find_set(attr[IPSET_ATTR_SETNAME2], NULL))
+		return -EEXIST;
+
+	nla_strlcpy(set->name, attr[IPSET_ATTR_SETNAME2], IPSET_MAXNAMELEN);
+	return 0;
+}
+
+/*
+ * The rules keep using the same index, so exchanging the slots of two
+ * sets moves every rule over to the other set in one step.  The names
+ * and the references stay with the slots, only the contents move.
+ */
+static int ip_set_swap(struct sock *ctnl, struct sk_buff *skb,
+		       const struct nlmsghdr *nlh,
+		       const struct nlattr * const attr[])
+{
+	struct ip_set *from, *to;
+	ip_set_id_t from_id, to_id;
+	char from_name[IPSET_MAXNAMELEN];
+
+	from = find_set(attr[IPSET_ATTR_SETNAME], &from_id);
+	to = find_set(attr[IPSET_ATTR_SETNAME2], &to_id);
+	if (!from || !to)
+		return -ENOENT;
+	/* the rules were checked against the dimension of the type */
+	if (from->type != to->type)
+		return -EINVAL;
+
+	strncpy(from_name, from->name, IPSET_MAXNAMELEN);
+	strncpy(from->name, to->name, IPSET_MAXNAMELEN);
+	strncpy(to->name, from_name, IPSET_MAXNAMELEN);
+
+	swap(from->ref, to->ref);
+	rcu_assign_pointer(ip_set_list[from_id], to);
+	rcu_assign_pointer(ip_set_list[to_id], from);
+	return 0;
+}
+
+static int ip_set_adt(struct ip_set *set, const struct nlattr *attr,
+		      enum ipset_adt adt, u32 nlflags)
+{
+	struct nlattr *tb[IPSET_ATTR_DATA_MAX + 1];
+	int ret;
+
+	ret = ip_set_parse_data(attr, tb);
+	if (ret < 0)
+		return ret;
+	return set->variant->uadt(set, tb, adt, nlflags);
+}
+
+static int ip_set_add_del(const struct nlmsghdr *nlh,
+			  const struct nlattr * const attr[],
+			  enum ipset_adt adt)
+{
+	struct ip_set *set;
+	struct nlattr *nla;
+	int rem, ret = 0;
+
+	set = find_set(attr[IPSET_ATTR_SETNAME], NULL);
+	if (!set)
+		return -ENOENT;
+
+	if (attr[IPSET_ATTR_DATA])
+		return ip_set_adt(set, attr[IPSET_ATTR_DATA], adt,
+				  nlh->nlmsg_flags);
+	if (!attr[IPSET_ATTR_ADT])
+		return -EINVAL;
+
+	/* a batch stops at the first element that fails */
+	nla_for_each_nested(nla, attr[IPSET_ATTR_ADT], rem) {
+		if (nla_type(nla) != IPSET_ATTR_DATA)
+			return -EINVAL;
+		ret = ip_set_adt(set, nla, adt, nlh->nlmsg_flags);
+		if (ret < 0)
+			break;
+	}
+	return ret;
+}
+
+static int ip_set_uadd(struct sock *ctnl, struct sk_buff *skb,
+		       const struct nlmsghdr *nlh,
+		       const struct nlattr * const attr[])
+{
+	return ip_set_add_del(nlh, attr, IPSET_ADD);
+}
+
+static int ip_set_udel(struct sock *ctnl, struct sk_buff *skb,
+		       const struct nlmsghdr *nlh,
+		       const struct nlattr * const attr[])
+{
+	return ip_set_add_del(nlh, attr, IPSET_DEL);
+}
+
+/* 0 if the element is in the set, -ENOENT if it is not */
+static int ip_set_utest(struct sock *ctnl, struct sk_buff *skb,
+			const struct nlmsghdr *nlh,
+			const struct nlattr * const attr[])
+{
+	struct ip_set *set;
+
+	set = find_set(attr[IPSET_ATTR_SETNAME], NULL);
+	if (!set)
+		return -ENOENT;
+	if (!attr[IPSET_ATTR_DATA])
+		return -EINVAL;
+	return ip_set_adt(set, attr[IPSET_ATTR_DATA], IPSET_TEST, 0);
+}
+
+/*
+ * One or more messages per set: the first one has the parameters in
+ * IPSET_ATTR_DATA, all of them elements in IPSET_ATTR_ADT.  args[0] is
+ * the set being dumped, args[1..2] the position in it.
+ */
+static int ip_set_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *attr[IPSET_ATTR_CMD_MAX + 1];
+	const struct ip_set *set;
+	struct nlmsghdr *nlh;
+	struct nfgenmsg *nfmsg;
+	struct nlattr *nest;
+	ip_set_id_t only = IPSET_INVALID_ID;
+	int ret;
+
+	ret = nlmsg_parse(cb->nlh, sizeof(struct nfgenmsg), attr,
+			  IPSET_ATTR_CMD_MAX, ip_set_policy);
+	if (ret < 0)
+		return ret;
+
+	rcu_read_lock();
+	if (attr[IPSET_ATTR_SETNAME]) {
+		only = __find_set_id(nla_data(attr[IPSET_ATTR_SETNAME]));
+		if (only == IPSET_INVALID_ID) {
+			rcu_read_unlock();
+			return -ENOENT;
+		}
+		if (cb->args[0] < only)
+			cb->args[0] = only;
+	}
+
+	for (; cb->args[0] < max_sets; cb->args[0]++, cb->args[1] = 0,
+					cb->args[2] = 0) {
+		if (only != IPSET_INVALID_ID && cb->args[0] != only)
+			break;
+		set = rcu_dereference(ip_set_list[cb->args[0]]);
+		if (!set)
+			continue;
+
+		nlh = nlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+				cb->nlh->nlmsg_seq,
+				NFNL_SUBSYS_IPSET << 8 | IPSET_CMD_LIST,
+				sizeof(*nfmsg), NLM_F_MULTI);
+		if (!nlh)
+			goto out;
+		nfmsg = nlmsg_data(nlh);
+		nfmsg->nfgen_family = set->type->family;
+		nfmsg->version = NFNETLINK_V0;
+		nfmsg->res_id = 0;
+
+		NLA_PUT_STRING(skb, IPSET_ATTR_SETNAME, set->name);
+		NLA_PUT_STRING(skb, IPSET_ATTR_TYPENAME, set->type->name);
+		NLA_PUT_U8(skb, IPSET_ATTR_FAMILY, set->type->family);
+		if (!cb->args[1] && !cb->args[2] &&
+		    set->variant->head(set, skb) < 0)
+			goto nla_put_failure;
+		nest = nla_nest_start(skb, IPSET_ATTR_ADT | NLA_F_NESTED);
+		if (!nest)
+			goto nla_put_failure;
+		ret = set->variant->list(set, skb, &cb->args[1]);
+		nla_nest_end(skb, nest);
+		nlmsg_end(skb, nlh);
+		if (ret == -EMSGSIZE)
+			goto out;
+	}
+out:
+	rcu_read_unlock();
+	return skb->len;
+
+nla_put_failure:
+	nlmsg_cancel(skb, nlh);
+	rcu_read_unlock();
+	return skb->len;
+}
+
+static int ip_set_list_sets(struct sock *ctnl, struct sk_buff *skb,
+			    const struct nlmsghdr *nlh,
+			    const struct nlattr * const attr[])
+{
+	if (!(nlh->nlmsg_flags & NLM_F_DUMP))
+		return -EOPNOTSUPP;
+	return netlink_dump_start(ctnl, skb, nlh, ip_set_dump, NULL);
+}
+
+static const struct nfnl_callback ip_set_netlink_cb[IPSET_MSG_MAX] = {
+	[IPSET_CMD_CREATE]	= { .call = ip_set_create,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_DESTROY]	= { .call = ip_set_destroy,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_FLUSH]	= { .call = ip_set_flush,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_RENAME]	= { .call = ip_set_rename,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_SWAP]	= { .call = ip_set_swap,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_LIST]	= { .call = ip_set_list_sets,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_ADD]		= { .call = ip_set_uadd,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_DEL]		= { .call = ip_set_udel,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+	[IPSET_CMD_TEST]	= { .call = ip_set_utest,
+				    .attr_count = IPSET_ATTR_CMD_MAX,
+				    .policy = ip_set_policy },
+};
+
+static const struct nfnetlink_subsystem ip_set_netlink_subsys = {
+	.name		= "ip_set",
+	.subsys_id	= NFNL_SUBSYS_IPSET,
+	.cb_count	= IPSET_MSG_MAX,
+	.cb		= ip_set_netlink_cb,
+};
+
+static int __init ip_set_init(void)
+{
+	int ret;
+
+	if (max_sets == 0 || max_sets >= IPSET_INVALID_ID)
+		max_sets = CONFIG_IP_SET_MAX;
+
+	ip_set_list = kzalloc(max_sets * sizeof(struct ip_set *), GFP_KERNEL);
+	if (!ip_set_list)
+		return -ENOMEM;
+
+	ret = nfnetlink_subsys_register(&ip_set_netlink_subsys);
+	if (ret < 0) {
+		pr_err("cannot register with nfnetlink (%d)\n", ret);
+		kfree(ip_set_list);
+	}
+	return ret;
+}
+
+static void __exit ip_set_fini(void)
+{
+	/* every set holds its type module, so none is left */
+	nfnetlink_subsys_unregister(&ip_set_netlink_subsys);
+	kfree(ip_set_list);
+}
+
+module_init(ip_set_init);
+module_exit(ip_set_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("IP sets");
+MODULE_ALIAS_NFNL_SUBSYS(NFNL_SUBSYS_IPSET);
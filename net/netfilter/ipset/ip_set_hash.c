@@ -0,0 +1,618 @@
+/*
+ * The hash:ip, hash:net and hash:ip,port set types.
+ *
+ * All three keep their elements in one hash table of RCU lists and
+ * differ only in the key: an address, a network with its prefix
+ * length, or an address with a protocol and port.  hash:net looks a
+ * packet up once for every prefix length it has elements of.
+ *
+ * Elements are added and deleted under the nfnl mutex.  The table
+ * doubles once there are more elements than buckets; the elements are
+ * copied into the new table, which is then switched to, so lookups
+ * never see a chain in the middle of a move.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/rculist.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+#define HASH_DEFAULT_SIZE	1024
+#define HASH_MIN_SIZE		64
+#define HASH_DEFAULT_MAXELEM	65536
+/* addresses added or deleted at once by hash:ip with a prefix length */
+#define HASH_MAX_RANGE		65536
+
+enum hash_kind {
+	HASH_IP,
+	HASH_NET,
+	HASH_IPPORT,
+};
+
+struct hash_key {
+	__be32			ip;
+	__be16			port;
+	u8			proto;
+	u8			cidr;
+};
+
+struct hash_elem {
+	struct hlist_node	node;
+	struct rcu_head		rcu;
+	struct hash_key		key;
+};
+
+struct hash_table {
+	unsigned int		size;
+	struct hlist_head	bucket[0];
+};
+
+struct ip_set_hash {
+	struct hash_table	*table;
+	enum hash_kind		kind;
+	u32			initval;
+	u32			elements;
+	u32			maxelem;
+	/* hash:net: the prefix lengths in use and how many of each */
+	DECLARE_BITMAP(cidrs, 33);
+	u32			nets[33];
+};
+
+static struct hash_table *hash_table_alloc(unsigned int size)
+{
+	size_t len = sizeof(struct hash_table) +
+		     size * sizeof(struct hlist_head);
+	struct hash_table *t;
+
+	if (len <= PAGE_SIZE)
+		t = kzalloc(len, GFP_KERNEL);
+	else
+		t = __vmalloc(len, GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO,
+			      PAGE_KERNEL);
+	if (t)
+		t->size = size;
+	return t;
+}
+
+/* Free a table no reader can see any more, with its elements */
+static void hash_table_free(struct hash_table *t)
+{
+	struct hash_elem *e;
+	struct hlist_node *n, *next;
+	unsigned int i;
+
+	for (i = 0; i < t->size; i++)
+		hlist_for_each_entry_safe(e, n, next, &t->bucket[i], node)
+			kfree(e);
+	if (is_vmalloc_addr(t))
+		vfree(t);
+	else
+		kfree(t);
+}
+
+static void hash_elem_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct hash_elem, rcu));
+}
+
+static inline u32 hash_index(const struct ip_set_hash *h,
+			     const struct hash_table *t,
+			     const struct hash_key *key)
+{
+	return jhash2((const u32 *)key, sizeof(*key) / sizeof(u32),
+		      h->initval) & (t->size - 1);
+}
+
+static inline bool hash_key_equal(const struct hash_key *a,
+				  const struct hash_key *b)
+{
+	return a->ip == b->ip && a->port == b->port &&
+	       a->proto == b->proto && a->cidr == b->cidr;
+}
+
+/* @t: h->table, under rcu_read_lock() or the nfnl mutex */
+static struct hash_elem *hash_find(const struct ip_set_hash *h,
+				   const struct hash_table *t,
+				   const struct hash_key *key)
+{
+	struct hash_elem *e;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(e, n, &t->bucket[hash_index(h, t, key)],
+				 node)
+		if (hash_key_equal(&e->key, key))
+			return e;
+	return NULL;
+}
+
+/* Double the table, the old one stays in use if that fails. */
+static void hash_grow(struct ip_set_hash *h)
+{
+	struct hash_table *old = h->table, *t;
+	struct hash_elem *e, *copy;
+	struct hlist_node *n;
+	unsigned int i;
+
+	t = hash_table_alloc(old->size * 2);
+	if (!t)
+		return;
+	for (i = 0; i < old->size; i++) {
+		hlist_for_each_entry(e, n, &old->bucket[i], node) {
+			copy = kmemdup(e, sizeof(*e), GFP_KERNEL);
+			if (!copy) {
+				hash_table_free(t);
+				return;
+			}
+			hlist_add_head(&copy->node,
+				       &t->bucket[hash_index(h, t, &copy->key)]);
+		}
+	}
+
+	rcu_assign_pointer(h->table, t);
+	synchronize_rcu();
+	hash_table_free(old);
+}
+
+static int hash_add(struct ip_set_hash *h, const struct hash_key *key,
+		    u32 nlflags)
+{
+	struct hash_elem *e;
+
+	if (hash_find(h, h->table, key))
+		return nlflags & NLM_F_EXCL ? -EEXIST : 0;
+	if (h->elements >= h->maxelem)
+		return -ENOSPC;
+
+	e = kmalloc(sizeof(*e), GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+	e->key = *key;
+
+	/* lookups of a new prefix length must find the element */
+	if (h->kind == HASH_NET && h->nets[key->cidr]++ == 0)
+		set_bit(key->cidr, h->cidrs);
+
+	hlist_add_head_rcu(&e->node,
+			   &h->table->bucket[hash_index(h, h->table, key)]);
+	if (++h->elements > h->table->size)
+		hash_grow(h);
+	return 0;
+}
+
+static int hash_del(struct ip_set_hash *h, const struct hash_key *key,
+		    u32 nlflags)
+{
+	struct hash_elem *e;
+
+	e = hash_find(h, h->table, key);
+	if (!e)
+		return nlflags & NLM_F_EXCL ? -ENOENT : 0;
+
+	hlist_del_rcu(&e->node);
+	call_rcu(&e->rcu, hash_elem_free_rcu);
+	h->elements--;
+	if (h->kind == HASH_NET && --h->nets[key->cidr] == 0)
+		clear_bit(key->cidr, h->cidrs);
+	return 0;
+}
+
+static int hash_adt(struct ip_set_hash *h, const struct hash_key *key,
+		    enum ipset_adt adt, u32 nlflags)
+{
+	switch (adt) {
+	case IPSET_ADD:
+		return hash_add(h, key, nlflags);
+	case IPSET_DEL:
+		return hash_del(h, key, nlflags);
+	default:
+		return hash_find(h, h->table, key) ? 0 : -ENOENT;
+	}
+}
+
+/* Packet lookups */
+
+static inline int hash_lookup(const struct ip_set_hash *h,
+			      const struct hash_key *key)
+{
+	return hash_find(h, rcu_dereference(h->table), key) != NULL;
+}
+
+static inline __be32 hash_addr(const struct sk_buff *skb, bool src)
+{
+	return src ? ip_hdr(skb)->saddr : ip_hdr(skb)->daddr;
+}
+
+static int hash_ip_kadt(const struct ip_set *set, const struct sk_buff *skb,
+			u8 flags)
+{
+	struct hash_key key = {
+		.ip	= hash_addr(skb, flags & IPSET_DIM_SRC(0)),
+		.cidr	= 32,
+	};
+
+	return hash_lookup(set->data, &key);
+}
+
+static int hash_net_kadt(const struct ip_set *set, const struct sk_buff *skb,
+			 u8 flags)
+{
+	const struct ip_set_hash *h = set->data;
+	__be32 ip = hash_addr(skb, flags & IPSET_DIM_SRC(0));
+	struct hash_key key = {};
+	int cidr;
+
+	for (cidr = 32; cidr > 0; cidr--) {
+		if (!test_bit(cidr, h->cidrs))
+			continue;
+		key.ip = ip & ip_set_netmask(cidr);
+		key.cidr = cidr;
+		if (hash_lookup(h, &key))
+			return 1;
+	}
+	return 0;
+}
+
+static int hash_ipport_kadt(const struct ip_set *set,
+			    const struct sk_buff *skb, u8 flags)
+{
+	struct hash_key key = {
+		.ip	= hash_addr(skb, flags & IPSET_DIM_SRC(0)),
+		.cidr	= 32,
+	};
+
+	if (!ip_set_get_ip4_port(skb, flags & IPSET_DIM_SRC(1),
+				 &key.port, &key.proto))
+		return 0;
+	return hash_lookup(set->data, &key);
+}
+
+/* Elements from userspace */
+
+static int hash_ip_uadt(struct ip_set *set, struct nlattr *tb[],
+			enum ipset_adt adt, u32 nlflags)
+{
+	struct hash_key key = { .cidr = 32 };
+	u32 ip, n, i;
+	u8 cidr = 32;
+	int ret = 0;
+
+	if (!tb[IPSET_ATTR_IP])
+		return -EINVAL;
+	if (tb[IPSET_ATTR_CIDR])
+		cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+	if (cidr > 32 || (adt == IPSET_TEST && cidr != 32))
+		return -EINVAL;
+
+	/* a prefix length adds or deletes all addresses of the network */
+	n = cidr ? 1U << (32 - cidr) : 0;
+	if (!n || n > HASH_MAX_RANGE)
+		return -ERANGE;
+	ip = ntohl(nla_get_be32(tb[IPSET_ATTR_IP]) & ip_set_netmask(cidr));
+
+	for (i = 0; i < n && ret == 0; i++) {
+		key.ip = htonl(ip + i);
+		ret = hash_adt(set->data, &key, adt, nlflags);
+	}
+	return ret;
+}
+
+static int hash_net_uadt(struct ip_set *set, struct nlattr *tb[],
+			 enum ipset_adt adt, u32 nlflags)
+{
+	struct hash_key key = {};
+
+	if (!tb[IPSET_ATTR_IP])
+		return -EINVAL;
+	key.cidr = tb[IPSET_ATTR_CIDR] ? nla_get_u8(tb[IPSET_ATTR_CIDR]) : 32;
+	if (key.cidr == 0 || key.cidr > 32)
+		return -EINVAL;
+	key.ip = nla_get_be32(tb[IPSET_ATTR_IP]) & ip_set_netmask(key.cidr);
+
+	return hash_adt(set->data, &key, adt, nlflags);
+}
+
+static int hash_ipport_uadt(struct ip_set *set, struct nlattr *tb[],
+			    enum ipset_adt adt, u32 nlflags)
+{
+	struct hash_key key = { .cidr = 32, .proto = IPPROTO_TCP };
+	u16 port, port_to;
+	int ret = 0;
+
+	if (!tb[IPSET_ATTR_IP] || !tb[IPSET_ATTR_PORT])
+		return -EINVAL;
+	key.ip = nla_get_be32(tb[IPSET_ATTR_IP]);
+	if (tb[IPSET_ATTR_PROTO])
+		key.proto = nla_get_u8(tb[IPSET_ATTR_PROTO]);
+	switch (key.proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_SCTP:
+		break;
+	default:
+		return -EPROTONOSUPPORT;
+	}
+
+	port = ntohs(nla_get_be16(tb[IPSET_ATTR_PORT]));
+	port_to = port;
+	if (tb[IPSET_ATTR_PORT_TO]) {
+		if (adt == IPSET_TEST)
+			return -EINVAL;
+		port_to = ntohs(nla_get_be16(tb[IPSET_ATTR_PORT_TO]));
+		if (port_to < port)
+			swap(port, port_to);
+	}
+
+	for (;;) {
+		key.port = htons(port);
+		ret = hash_adt(set->data, &key, adt, nlflags);
+		if (ret < 0 || port == port_to)
+			break;
+		port++;
+	}
+	return ret;
+}
+
+/* Common to the three types */
+
+static void hash_flush(struct ip_set *set)
+{
+	struct ip_set_hash *h = set->data;
+	struct hash_table *old = h->table, *t;
+	struct hash_elem *e;
+	struct hlist_node *n, *next;
+	unsigned int i;
+
+	t = hash_table_alloc(old->size);
+	if (t) {
+		rcu_assign_pointer(h->table, t);
+		synchronize_rcu();
+		hash_table_free(old);
+	} else {
+		for (i = 0; i < old->size; i++)
+			hlist_for_each_entry_safe(e, n, next,
+						  &old->bucket[i], node) {
+				hlist_del_rcu(&e->node);
+				call_rcu(&e->rcu, hash_elem_free_rcu);
+			}
+	}
+	h->elements = 0;
+	memset(h->nets, 0, sizeof(h->nets));
+	bitmap_zero(h->cidrs, 33);
+}
+
+static void hash_destroy(struct ip_set *set)
+{
+	struct ip_set_hash *h = set->data;
+
+	/* calls from hash_del() and hash_flush() may still be pending */
+	rcu_barrier();
+	hash_table_free(h->table);
+	kfree(h);
+}
+
+static int hash_head(const struct ip_set *set, struct sk_buff *skb)
+{
+	const struct ip_set_hash *h = set->data;
+	const struct hash_table *t = rcu_dereference(h->table);
+	struct nlattr *nest;
+
+	nest = nla_nest_start(skb, IPSET_ATTR_DATA | NLA_F_NESTED);
+	if (!nest)
+		goto nla_put_failure;
+	NLA_PUT_U32(skb, IPSET_ATTR_HASHSIZE, htonl(t->size));
+	NLA_PUT_U32(skb, IPSET_ATTR_MAXELEM, htonl(h->maxelem));
+	NLA_PUT_U32(skb, IPSET_ATTR_ELEMENTS, htonl(h->elements));
+	NLA_PUT_U32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref));
+	NLA_PUT_U32(skb, IPSET_ATTR_MEMSIZE,
+		    htonl(sizeof(*h) + sizeof(*t) +
+			  t->size * sizeof(struct hlist_head) +
+			  h->elements * sizeof(struct hash_elem)));
+	nla_nest_end(skb, nest);
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int hash_list_elem(const struct ip_set_hash *h, struct sk_buff *skb,
+			  const struct hash_key *key)
+{
+	struct nlattr *nest;
+
+	nest = nla_nest_start(skb, IPSET_ATTR_DATA | NLA_F_NESTED);
+	if (!nest)
+		return -EMSGSIZE;
+	NLA_PUT_BE32(skb, IPSET_ATTR_IP, key->ip);
+	if (h->kind == HASH_NET)
+		NLA_PUT_U8(skb, IPSET_ATTR_CIDR, key->cidr);
+	if (h->kind == HASH_IPPORT) {
+		NLA_PUT_BE16(skb, IPSET_ATTR_PORT, key->port);
+		NLA_PUT_U8(skb, IPSET_ATTR_PROTO, key->proto);
+	}
+	nla_nest_end(skb, nest);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(skb, nest);
+	return -EMSGSIZE;
+}
+
+/* @pos: bucket, then elements of it already listed */
+static int hash_list(const struct ip_set *set, struct sk_buff *skb,
+		     unsigned long *pos)
+{
+	const struct ip_set_hash *h = set->data;
+	const struct hash_table *t = rcu_dereference(h->table);
+	const struct hash_elem *e;
+	struct hlist_node *n;
+	unsigned long i;
+
+	for (; pos[0] < t->size; pos[0]++, pos[1] = 0) {
+		i = 0;
+		hlist_for_each_entry_rcu(e, n, &t->bucket[pos[0]], node) {
+			if (i++ < pos[1])
+				continue;
+			if (hash_list_elem(h, skb, &e->key) < 0)
+				return -EMSGSIZE;
+			pos[1]++;
+		}
+	}
+	return 0;
+}
+
+static const struct ip_set_type_variant hash_ip_variant = {
+	.kadt		= hash_ip_kadt,
+	.uadt		= hash_ip_uadt,
+	.flush		= hash_flush,
+	.destroy	= hash_destroy,
+	.head		= hash_head,
+	.list		= hash_list,
+};
+
+static const struct ip_set_type_variant hash_net_variant = {
+	.kadt		= hash_net_kadt,
+	.uadt		= hash_net_uadt,
+	.flush		= hash_flush,
+	.destroy	= hash_destroy,
+	.head		= hash_head,
+	.list		= hash_list,
+};
+
+static const struct ip_set_type_variant hash_ipport_variant = {
+	.kadt		= hash_ipport_kadt,
+	.uadt		= hash_ipport_uadt,
+	.flush		= hash_flush,
+	.destroy	= hash_destroy,
+	.head		= hash_head,
+	.list		= hash_list,
+};
+
+static int hash_create(struct ip_set *set, struct nlattr *tb[],
+		       enum hash_kind kind)
+{
+	u32 size = HASH_DEFAULT_SIZE, maxelem = HASH_DEFAULT_MAXELEM;
+	struct ip_set_hash *h;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		size = ntohl(nla_get_be32(tb[IPSET_ATTR_HASHSIZE]));
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ntohl(nla_get_be32(tb[IPSET_ATTR_MAXELEM]));
+	if (!maxelem)
+		return -EINVAL;
+	size = clamp_t(u32, size, HASH_MIN_SIZE, 1U << 24);
+	size = roundup_pow_of_two(size);
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+	h->table = hash_table_alloc(size);
+	if (!h->table) {
+		kfree(h);
+		return -ENOMEM;
+	}
+	h->kind = kind;
+	h->maxelem = maxelem;
+	get_random_bytes(&h->initval, sizeof(h->initval));
+
+	set->data = h;
+	switch (kind) {
+	case HASH_IP:
+		set->variant = &hash_ip_variant;
+		break;
+	case HASH_NET:
+		set->variant = &hash_net_variant;
+		break;
+	case HASH_IPPORT:
+		set->variant = &hash_ipport_variant;
+		break;
+	}
+	return 0;
+}
+
+static int hash_ip_create(struct ip_set *set, struct nlattr *tb[])
+{
+	return hash_create(set, tb, HASH_IP);
+}
+
+static int hash_net_create(struct ip_set *set, struct nlattr *tb[])
+{
+	return hash_create(set, tb, HASH_NET);
+}
+
+static int hash_ipport_create(struct ip_set *set, struct nlattr *tb[])
+{
+	return hash_create(set, tb, HASH_IPPORT);
+}
+
+static struct ip_set_type hash_types[] __read_mostly = {
+	{
+		.name		= "hash:ip",
+		.family		= NFPROTO_IPV4,
+		.dimension	= 1,
+		.create		= hash_ip_create,
+		.me		= THIS_MODULE,
+	},
+	{
+		.name		= "hash:net",
+		.family		= NFPROTO_IPV4,
+		.dimension	= 1,
+		.create		= hash_net_create,
+		.me		= THIS_MODULE,
+	},
+	{
+		.name		= "hash:ip,port",
+		.family		= NFPROTO_IPV4,
+		.dimension	= 2,
+		.create		= hash_ipport_create,
+		.me		= THIS_MODULE,
+	},
+};
+
+static int __init ip_set_hash_init(void)
+{
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(hash_types); i++) {
+		ret = ip_set_type_register(&hash_types[i]);
+		if (ret < 0)
+			goto err;
+	}
+	return 0;
+
+err:
+	while (--i >= 0)
+		ip_set_type_unregister(&hash_types[i]);
+	return ret;
+}
+
+static void __exit ip_set_hash_fini(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hash_types); i++)
+		ip_set_type_unregister(&hash_types[i]);
+}
+
+module_init(ip_set_hash_init);
+module_exit(ip_set_hash_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("hash:ip, hash:net and hash:ip,port IP set types");
+MODULE_ALIAS("ip_set_hash:ip");
+MODULE_ALIAS("ip_set_hash:net");
+MODULE_ALIAS("ip_set_hash:ip,port");
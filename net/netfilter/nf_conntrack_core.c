@@ -32,6 +32,7 @@
 #include <linux/mm.h>
 #include <linux/nsproxy.h>
 #include <linux/rculist_nulls.h>
+#include <linux/seqlock.h>
 
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
@@ -56,6 +57,96 @@ EXPORT_SYMBOL_GPL(nfnetlink_parse_nat_setup_hook);
 DEFINE_SPINLOCK(nf_conntrack_lock);
 EXPORT_SYMBOL_GPL(nf_conntrack_lock);
 
+spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS] __cacheline_aligned_in_smp;
+EXPORT_SYMBOL_GPL(nf_conntrack_locks);
+
+/* Set while the hash is resized, see nf_conntrack_all_lock() */
+static DEFINE_SPINLOCK(nf_conntrack_locks_all_lock);
+static bool nf_conntrack_locks_all;
+
+/*
+ * Bumped when the hash is switched to another table and while entries
+ * move between the tables, lockless lookups that miss then try again.
+ */
+seqcount_t nf_conntrack_generation;
+EXPORT_SYMBOL_GPL(nf_conntrack_generation);
+
+DEFINE_MUTEX(nf_conntrack_hash_mutex);
+
+/* Resize the hash as the number of conntracks changes */
+static int nf_conntrack_hash_autosize __read_mostly = 1;
+module_param_named(hash_autosize, nf_conntrack_hash_autosize, bool, 0644);
+MODULE_PARM_DESC(hash_autosize, "Grow and shrink the hash with the load");
+
+/* Smallest size for the automatic resize, set by the hashsize parameter */
+static unsigned int nf_conntrack_hash_min __read_mostly = CONNTRACK_LOCKS;
+
+static inline unsigned int hash_bucket(u_int32_t hash, unsigned int size)
+{
+	return ((u64)hash * size) >> 32;
+}
+
+/* Take a hash lock, BH must be disabled. */
+void nf_conntrack_bucket_lock(spinlock_t *lock)
+{
+	spin_lock(lock);
+	while (unlikely(ACCESS_ONCE(nf_conntrack_locks_all))) {
+		spin_unlock(lock);
+		spin_lock(&nf_conntrack_locks_all_lock);
+		spin_unlock(&nf_conntrack_locks_all_lock);
+		spin_lock(lock);
+	}
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_bucket_lock);
+
+static void nf_conntrack_double_unlock(u_int32_t h1, u_int32_t h2)
+{
+	unsigned int l1 = hash_bucket(h1, CONNTRACK_LOCKS);
+	unsigned int l2 = hash_bucket(h2, CONNTRACK_LOCKS);
+
+	spin_unlock(&nf_conntrack_locks[l1]);
+	if (l1 != l2)
+		spin_unlock(&nf_conntrack_locks[l2]);
+}
+
+/* Lock the buckets of both directions, given their full hashes. */
+static void nf_conntrack_double_lock(u_int32_t h1, u_int32_t h2)
+{
+	unsigned int l1 = hash_bucket(h1, CONNTRACK_LOCKS);
+	unsigned int l2 = hash_bucket(h2, CONNTRACK_LOCKS);
+
+	if (l1 > l2)
+		swap(l1, l2);
+	/* once the first lock is held a table switch waits for us */
+	nf_conntrack_bucket_lock(&nf_conntrack_locks[l1]);
+	if (l1 != l2)
+		spin_lock_nested(&nf_conntrack_locks[l2], SINGLE_DEPTH_NESTING);
+}
+
+/*
+ * Stop every hash writer: after the flag is set each lock is taken once,
+ * so whoever held it is done and whoever takes it next sees the flag.
+ */
+static void nf_conntrack_all_lock(void)
+{
+	int i;
+
+	spin_lock(&nf_conntrack_locks_all_lock);
+	nf_conntrack_locks_all = true;
+
+	for (i = 0; i < CONNTRACK_LOCKS; i++) {
+		spin_lock(&nf_conntrack_locks[i]);
+		spin_unlock(&nf_conntrack_locks[i]);
+	}
+}
+
+static void nf_conntrack_all_unlock(void)
+{
+	smp_wmb();
+	nf_conntrack_locks_all = false;
+	spin_unlock(&nf_conntrack_locks_all_lock);
+}
+
 unsigned int nf_conntrack_htable_size __read_mostly;
 EXPORT_SYMBOL_GPL(nf_conntrack_htable_size);
 
@@ -68,8 +159,8 @@ EXPORT_SYMBOL_GPL(nf_conntrack_untracked);
 static int nf_conntrack_hash_rnd_initted;
 static unsigned int nf_conntrack_hash_rnd;
 
-static u_int32_t __hash_conntrack(const struct nf_conntrack_tuple *tuple,
-				  u16 zone, unsigned int size, unsigned int rnd)
+static u_int32_t hash_conntrack_raw(const struct nf_conntrack_tuple *tuple,
+				    u16 zone)
 {
 	unsigned int n;
 	u_int32_t h;
@@ -80,17 +171,11 @@ static u_int32_t __hash_conntrack(const struct nf_conntrack_tuple *tuple,
 	 */
 	n = (sizeof(tuple->src) + sizeof(tuple->dst.u3)) / sizeof(u32);
 	h = jhash2((u32 *)tuple, n,
-		   zone ^ rnd ^ (((__force __u16)tuple->dst.u.all << 16) |
-				 tuple->dst.protonum));
+		   zone ^ nf_conntrack_hash_rnd ^
+		   (((__force __u16)tuple->dst.u.all << 16) |
+		    tuple->dst.protonum));
 
-	return ((u64)h * size) >> 32;
-}
-
-static inline u_int32_t hash_conntrack(const struct net *net, u16 zone,
-				       const struct nf_conntrack_tuple *tuple)
-{
-	return __hash_conntrack(tuple, zone, net->ct.htable_size,
-				nf_conntrack_hash_rnd);
+	return h;
 }
 
 bool
@@ -163,6 +248,61 @@ nf_ct_invert_tuple(struct nf_conntrack_tuple *inverse,
 }
 EXPORT_SYMBOL_GPL(nf_ct_invert_tuple);
 
+/* The per cpu lists, BH must be disabled. */
+static void nf_ct_add_to_unconfirmed_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	ct->cpu = smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
+				 &pcpu->unconfirmed);
+	spin_unlock(&pcpu->lock);
+}
+
+static void nf_ct_add_to_dying_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	ct->cpu = smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	hlist_nulls_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
+			     &pcpu->dying);
+	spin_unlock(&pcpu->lock);
+}
+
+static void nf_ct_del_from_dying_or_unconfirmed_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
+	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	spin_unlock(&pcpu->lock);
+}
+
+/*
+ * Schedule a resize when the load leaves its range: the hash grows once
+ * there are more conntracks than buckets and shrinks below one per eight.
+ */
+static void nf_conntrack_check_load(struct net *net)
+{
+	unsigned int count = atomic_read(&net->ct.count);
+	unsigned int size = net->ct.htable_size;
+
+	if (!nf_conntrack_hash_autosize)
+		return;
+	if (unlikely(count > size) ||
+	    unlikely(count < size / 8 && size > nf_conntrack_hash_min))
+		schedule_work(&net->ct.resize_work);
+}
+
 static void
 clean_from_lists(struct nf_conn *ct)
 {
@@ -195,7 +335,6 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	rcu_read_unlock();
 
-	spin_lock_bh(&nf_conntrack_lock);
 	/* Expectations will have been removed in clean_from_lists,
 	 * except TFTP can create an expectation on the first packet,
 	 * before connection is in the list, so we need to clean here,
@@ -205,19 +344,18 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	#if defined(CONFIG_NETFILTER_XT_MATCH_LAYER7) || defined(CONFIG_NETFILTER_XT_MATCH_LAYER7_MODULE)
 	if(ct->layer7.app_proto)
 		kfree(ct->layer7.app_proto);
-	if(ct->layer7.app_data)
-	kfree(ct->layer7.app_data);
+	if(ct->layer7.scan)
+		kfree(ct->layer7.scan);
 	#endif
 
 
+	local_bh_disable();
 	/* We overload first tuple to link into unconfirmed list. */
-	if (!nf_ct_is_confirmed(ct)) {
-		BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
-		hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	}
+	if (!nf_ct_is_confirmed(ct))
+		nf_ct_del_from_dying_or_unconfirmed_list(ct);
 
 	NF_CT_STAT_INC(net, delete);
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 
 	if (ct->master)
 		nf_ct_put(ct->master);
@@ -229,14 +367,25 @@ destroy_conntrack(struct nf_conntrack *nfct)
 void nf_ct_delete_from_lists(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
+	u_int32_t hash, repl_hash;
+	u16 zone = nf_ct_zone(ct);
 
 	nf_ct_helper_destroy(ct);
-	spin_lock_bh(&nf_conntrack_lock);
+
+	hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, zone);
+	repl_hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
+				       zone);
+	local_bh_disable();
+	nf_conntrack_double_lock(hash, repl_hash);
+
 	/* Inside lock so preempt is disabled on module removal path.
 	 * Otherwise we can get spurious warnings. */
 	NF_CT_STAT_INC(net, delete_list);
 	clean_from_lists(ct);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
+
+	nf_conntrack_check_load(net);
 }
 EXPORT_SYMBOL_GPL(nf_ct_delete_from_lists);
 
@@ -254,9 +403,7 @@ static void death_by_event(unsigned long ul_conntrack)
 	}
 	/* we've got the event delivered, now it's dying */
 	set_bit(IPS_DYING_BIT, &ct->status);
-	spin_lock(&nf_conntrack_lock);
-	hlist_nulls_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	spin_unlock(&nf_conntrack_lock);
+	nf_ct_del_from_dying_or_unconfirmed_list(ct);
 	nf_ct_put(ct);
 }
 
@@ -265,10 +412,9 @@ void nf_ct_insert_dying_list(struct nf_conn *ct)
 	struct net *net = nf_ct_net(ct);
 
 	/* add this conntrack to the dying list */
-	spin_lock_bh(&nf_conntrack_lock);
-	hlist_nulls_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-			     &net->ct.dying);
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_disable();
+	nf_ct_add_to_dying_list(ct);
+	local_bh_enable();
 	/* set a new timer to retry event delivery */
 	setup_timer(&ct->timeout, death_by_event, (unsigned long)ct);
 	ct->timeout.expires = jiffies +
@@ -293,31 +439,20 @@ static void death_by_timeout(unsigned long ul_conntrack)
 	nf_ct_put(ct);
 }
 
-/*
- * Warning :
- * - Caller must take a reference on returned object
- *   and recheck nf_ct_tuple_equal(tuple, &h->tuple)
- * OR
- * - Caller must lock nf_conntrack_lock before calling this function
- */
-struct nf_conntrack_tuple_hash *
-__nf_conntrack_find(struct net *net, u16 zone,
-		    const struct nf_conntrack_tuple *tuple)
+/* Look for @tuple in bucket @bucket of @hash, BH disabled. */
+static struct nf_conntrack_tuple_hash *
+____nf_conntrack_find(struct net *net, struct hlist_nulls_head *hash,
+		      unsigned int bucket, u16 zone,
+		      const struct nf_conntrack_tuple *tuple)
 {
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
-	unsigned int hash = hash_conntrack(net, zone, tuple);
 
-	/* Disable BHs the entire time since we normally need to disable them
-	 * at least once for the stats anyway.
-	 */
-	local_bh_disable();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
+	hlist_nulls_for_each_entry_rcu(h, n, &hash[bucket], hnnode) {
 		if (nf_ct_tuple_equal(tuple, &h->tuple) &&
 		    nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) == zone) {
 			NF_CT_STAT_INC(net, found);
-			local_bh_enable();
 			return h;
 		}
 		NF_CT_STAT_INC(net, searched);
@@ -327,13 +462,55 @@ begin:
 	 * not the expected one, we must restart lookup.
 	 * We probably met an item that was moved to another chain.
 	 */
-	if (get_nulls_value(n) != hash) {
+	if (get_nulls_value(n) != bucket) {
 		NF_CT_STAT_INC(net, search_restart);
 		goto begin;
 	}
+	return NULL;
+}
+
+/*
+ * Warning :
+ * - Caller must take a reference on returned object
+ *   and recheck nf_ct_tuple_equal(tuple, &h->tuple)
+ * OR
+ * - Caller must hold the lock of the tuple's bucket
+ */
+struct nf_conntrack_tuple_hash *
+__nf_conntrack_find(struct net *net, u16 zone,
+		    const struct nf_conntrack_tuple *tuple)
+{
+	struct nf_conntrack_tuple_hash *h = NULL;
+	struct hlist_nulls_head *hash, *old_hash;
+	unsigned int size, old_size, sequence;
+	u_int32_t raw = hash_conntrack_raw(tuple, zone);
+
+	/* Disable BHs the entire time since we normally need to disable them
+	 * at least once for the stats anyway.
+	 */
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		hash = rcu_dereference(net->ct.hash);
+		size = net->ct.htable_size;
+		old_hash = rcu_dereference(net->ct.old_hash);
+		old_size = net->ct.old_htable_size;
+		if (read_seqcount_retry(&nf_conntrack_generation, sequence))
+			continue;
+
+		h = ____nf_conntrack_find(net, hash, hash_bucket(raw, size),
+					  zone, tuple);
+		/* while resizing, entries not moved yet are in the old table */
+		if (!h && unlikely(old_hash))
+			h = ____nf_conntrack_find(net, old_hash,
+						  hash_bucket(raw, old_size),
+						  zone, tuple);
+		if (h)
+			break;
+	} while (read_seqcount_retry(&nf_conntrack_generation, sequence));
 	local_bh_enable();
 
-	return NULL;
+	return h;
 }
 EXPORT_SYMBOL_GPL(__nf_conntrack_find);
 
@@ -367,41 +544,98 @@ begin:
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_find_get);
 
+/* Insertions always go to the current table, under the bucket locks. */
 static void __nf_conntrack_hash_insert(struct nf_conn *ct,
-				       unsigned int hash,
-				       unsigned int repl_hash)
+				       u_int32_t hash,
+				       u_int32_t repl_hash)
 {
 	struct net *net = nf_ct_net(ct);
+	unsigned int size = net->ct.htable_size;
 
 	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-			   &net->ct.hash[hash]);
+			   &net->ct.hash[hash_bucket(hash, size)]);
 	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode,
-			   &net->ct.hash[repl_hash]);
+			   &net->ct.hash[hash_bucket(repl_hash, size)]);
+}
+
+/* Is @tuple in bucket @bucket of @hash?  Call with the bucket locked. */
+static bool nf_conntrack_in_bucket(struct hlist_nulls_head *hash,
+				   unsigned int bucket, u16 zone,
+				   const struct nf_conntrack_tuple *tuple)
+{
+	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_node *n;
+
+	hlist_nulls_for_each_entry(h, n, &hash[bucket], hnnode)
+		if (nf_ct_tuple_equal(tuple, &h->tuple) &&
+		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
+			return true;
+	return false;
 }
 
-void nf_conntrack_hash_insert(struct nf_conn *ct)
+/* Look in both tables while resizing, the bucket lock must be held. */
+static bool nf_conntrack_hashed(struct net *net, u_int32_t hash, u16 zone,
+				const struct nf_conntrack_tuple *tuple)
+{
+	struct hlist_nulls_head *old_hash = net->ct.old_hash;
+
+	if (nf_conntrack_in_bucket(net->ct.hash,
+				   hash_bucket(hash, net->ct.htable_size),
+				   zone, tuple))
+		return true;
+	return unlikely(old_hash) &&
+	       nf_conntrack_in_bucket(old_hash,
+				      hash_bucket(hash, net->ct.old_htable_size),
+				      zone, tuple);
+}
+
+/*
+ * Insert a conntrack built by ctnetlink and start its timer, unless a
+ * packet confirmed one with the same tuples first.
+ */
+int nf_conntrack_hash_check_insert(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
-	unsigned int hash, repl_hash;
+	u_int32_t hash, repl_hash;
 	u16 zone;
 
 	zone = nf_ct_zone(ct);
-	hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, zone);
+	repl_hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
+				       zone);
 
+	local_bh_disable();
+	nf_conntrack_double_lock(hash, repl_hash);
+
+	if (nf_conntrack_hashed(net, hash, zone,
+				&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple) ||
+	    nf_conntrack_hashed(net, repl_hash, zone,
+				&ct->tuplehash[IP_CT_DIR_REPLY].tuple)) {
+		NF_CT_STAT_INC(net, insert_failed);
+		nf_conntrack_double_unlock(hash, repl_hash);
+		local_bh_enable();
+		return -EEXIST;
+	}
+
+	add_timer(&ct->timeout);
 	__nf_conntrack_hash_insert(ct, hash, repl_hash);
+	NF_CT_STAT_INC(net, insert);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
+
+	nf_conntrack_check_load(net);
+	return 0;
 }
-EXPORT_SYMBOL_GPL(nf_conntrack_hash_insert);
+EXPORT_SYMBOL_GPL(nf_conntrack_hash_check_insert);
 
 /* Confirm a connection given skb; places it in hash table */
 int
 __nf_conntrack_confirm(struct sk_buff *skb)
 {
-	unsigned int hash, repl_hash;
-	struct nf_conntrack_tuple_hash *h;
+	u_int32_t hash, repl_hash;
+	struct ct_pcpu *pcpu;
 	struct nf_conn *ct;
 	struct nf_conn_help *help;
-	struct hlist_nulls_node *n;
 	enum ip_conntrack_info ctinfo;
 	struct net *net;
 	u16 zone;
@@ -417,8 +651,6 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		return NF_ACCEPT;
 
 	zone = nf_ct_zone(ct);
-	hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(net, zone, &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
 
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
@@ -430,34 +662,40 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	NF_CT_ASSERT(!nf_ct_is_confirmed(ct));
 	pr_debug("Confirming conntrack %p\n", ct);
 
-	spin_lock_bh(&nf_conntrack_lock);
+	/* Only the two buckets the conntrack goes to are locked, the
+	   lookups are lockless anyway. */
+	hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, zone);
+	repl_hash = hash_conntrack_raw(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
+				       zone);
+	local_bh_disable();
+	nf_conntrack_double_lock(hash, repl_hash);
 
-	/* We have to check the DYING flag inside the lock to prevent
-	   a race against nf_ct_get_next_corpse() possibly called from
-	   user context, else we insert an already 'dead' hash, blocking
-	   further use of that particular connection -JM */
+	/* See if there's one in the list already, including reverse:
+	   NAT could have grabbed it without realizing, since we're
+	   not in the hash.  If there is, we lost race. */
+	if (nf_conntrack_hashed(net, hash, zone,
+				&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple) ||
+	    nf_conntrack_hashed(net, repl_hash, zone,
+				&ct->tuplehash[IP_CT_DIR_REPLY].tuple))
+		goto out;
 
+	/* We have to check the DYING flag under the lock of the
+	   unconfirmed list to prevent a race against get_next_corpse()
+	   possibly called from user context, else we insert an already
+	   'dead' hash, blocking further use of that particular
+	   connection -JM */
+	pcpu = per_cpu_ptr(net->ct.pcpu_lists, ct->cpu);
+	spin_lock(&pcpu->lock);
 	if (unlikely(nf_ct_is_dying(ct))) {
-		spin_unlock_bh(&nf_conntrack_lock);
+		spin_unlock(&pcpu->lock);
+		nf_conntrack_double_unlock(hash, repl_hash);
+		local_bh_enable();
 		return NF_ACCEPT;
 	}
 
-	/* See if there's one in the list already, including reverse:
-	   NAT could have grabbed it without realizing, since we're
-	   not in the hash.  If there is, we lost race. */
-	hlist_nulls_for_each_entry(h, n, &net->ct.hash[hash], hnnode)
-		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple,
-				      &h->tuple) &&
-		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
-			goto out;
-	hlist_nulls_for_each_entry(h, n, &net->ct.hash[repl_hash], hnnode)
-		if (nf_ct_tuple_equal(&ct->tuplehash[IP_CT_DIR_REPLY].tuple,
-				      &h->tuple) &&
-		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
-			goto out;
-
 	/* Remove from unconfirmed list */
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	spin_unlock(&pcpu->lock);
 
 	/* Timer relative to confirmation time, not original
 	   setting time, otherwise we'd get timer wrap in
@@ -474,7 +712,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	 */
 	__nf_conntrack_hash_insert(ct, hash, repl_hash);
 	NF_CT_STAT_INC(net, insert);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
+
+	nf_conntrack_check_load(net);
 
 	help = nfct_help(ct);
 	if (help && help->helper)
@@ -486,7 +727,8 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 
 out:
 	NF_CT_STAT_INC(net, insert_failed);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 	return NF_DROP;
 }
 EXPORT_SYMBOL_GPL(__nf_conntrack_confirm);
@@ -500,25 +742,47 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 	struct net *net = nf_ct_net(ignored_conntrack);
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
+	struct hlist_nulls_head *hash;
 	struct nf_conn *ct;
 	u16 zone = nf_ct_zone(ignored_conntrack);
-	unsigned int hash = hash_conntrack(net, zone, tuple);
+	u_int32_t raw = hash_conntrack_raw(tuple, zone);
+	unsigned int sequence, size, pass;
 
 	/* Disable BHs the entire time since we need to disable them at
 	 * least once for the stats anyway.
 	 */
 	rcu_read_lock_bh();
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		if (ct != ignored_conntrack &&
-		    nf_ct_tuple_equal(tuple, &h->tuple) &&
-		    nf_ct_zone(ct) == zone) {
-			NF_CT_STAT_INC(net, found);
-			rcu_read_unlock_bh();
-			return 1;
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		/* the current table, then the old one while resizing */
+		for (pass = 0; pass < 2; pass++) {
+			if (!pass) {
+				hash = rcu_dereference(net->ct.hash);
+				size = net->ct.htable_size;
+			} else {
+				hash = rcu_dereference(net->ct.old_hash);
+				size = net->ct.old_htable_size;
+			}
+			if (read_seqcount_retry(&nf_conntrack_generation,
+						sequence))
+				break;
+			if (!hash)
+				continue;
+
+			hlist_nulls_for_each_entry_rcu(h, n,
+					&hash[hash_bucket(raw, size)], hnnode) {
+				ct = nf_ct_tuplehash_to_ctrack(h);
+				if (ct != ignored_conntrack &&
+				    nf_ct_tuple_equal(tuple, &h->tuple) &&
+				    nf_ct_zone(ct) == zone) {
+					NF_CT_STAT_INC(net, found);
+					rcu_read_unlock_bh();
+					return 1;
+				}
+				NF_CT_STAT_INC(net, searched);
+			}
 		}
-		NF_CT_STAT_INC(net, searched);
-	}
+	} while (read_seqcount_retry(&nf_conntrack_generation, sequence));
 	rcu_read_unlock_bh();
 
 	return 0;
@@ -529,19 +793,21 @@ EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 
 /* There's a small race here where we may free a just-assured
    connection.  Too bad: we're in trouble anyway. */
-static noinline int early_drop(struct net *net, unsigned int hash)
+static noinline int early_drop(struct net *net, u_int32_t raw)
 {
 	/* Use oldest entry, which is roughly LRU */
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct = NULL, *tmp;
 	struct hlist_nulls_node *n;
-	unsigned int i, cnt = 0;
+	struct hlist_nulls_head *ht;
+	unsigned int i, hash, size, cnt = 0;
 	int dropped = 0;
 
 	rcu_read_lock();
-	for (i = 0; i < net->ct.htable_size; i++) {
-		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
-					 hnnode) {
+	ht = nf_conntrack_get_ht(net, &size);
+	hash = hash_bucket(raw, size);
+	for (i = 0; i < size; i++) {
+		hlist_nulls_for_each_entry_rcu(h, n, &ht[hash], hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
 			if (!test_bit(IPS_ASSURED_BIT, &tmp->status))
 				ct = tmp;
@@ -559,7 +825,7 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 		if (cnt >= NF_CT_EVICTION_RANGE)
 			break;
 
-		hash = (hash + 1) % net->ct.htable_size;
+		hash = (hash + 1) % size;
 	}
 	rcu_read_unlock();
 
@@ -593,8 +859,7 @@ struct nf_conn *nf_conntrack_alloc(struct net *net, u16 zone,
 
 	if (nf_conntrack_max &&
 	    unlikely(atomic_read(&net->ct.count) > nf_conntrack_max)) {
-		unsigned int hash = hash_conntrack(net, zone, orig);
-		if (!early_drop(net, hash)) {
+		if (!early_drop(net, hash_conntrack_raw(orig, zone))) {
 			atomic_dec(&net->ct.count);
 			if (net_ratelimit())
 				printk(KERN_WARNING
@@ -707,7 +972,7 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 				 ecache ? ecache->expmask : 0,
 			     GFP_ATOMIC);
 
-	spin_lock_bh(&nf_conntrack_lock);
+	local_bh_disable();
 	exp = nf_ct_find_expectation(net, zone, tuple);
 	if (exp) {
 		pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
@@ -727,7 +992,6 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 #ifdef CONFIG_NF_CONNTRACK_SECMARK
 		ct->secmark = exp->master->secmark;
 #endif
-		nf_conntrack_get(&ct->master->ct_general);
 		NF_CT_STAT_INC(net, expect_new);
 	} else {
 		__nf_ct_try_assign_helper(ct, tmpl, GFP_ATOMIC);
@@ -735,10 +999,9 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 	}
 
 	/* Overload tuple linked list to put us in unconfirmed list. */
-	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-		       &net->ct.unconfirmed);
+	nf_ct_add_to_unconfirmed_list(ct);
 
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 
 	if (exp) {
 		if (exp->expectfn)
@@ -1084,7 +1347,7 @@ static void nf_conntrack_attach(struct sk_buff *nskb, struct sk_buff *skb)
 	nf_conntrack_get(nskb->nfct);
 }
 
-/* Bring out ya dead! */
+/* Bring out ya dead!  Called with nf_conntrack_hash_mutex held. */
 static struct nf_conn *
 get_next_corpse(struct net *net, int (*iter)(struct nf_conn *i, void *data),
 		void *data, unsigned int *bucket)
@@ -1092,25 +1355,39 @@ get_next_corpse(struct net *net, int (*iter)(struct nf_conn *i, void *data),
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	struct ct_pcpu *pcpu;
+	spinlock_t *lockp;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
 	for (; *bucket < net->ct.htable_size; (*bucket)++) {
+		lockp = nf_conntrack_bucket_lockp(*bucket, net->ct.htable_size);
+		local_bh_disable();
+		nf_conntrack_bucket_lock(lockp);
 		hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket], hnnode) {
 			ct = nf_ct_tuplehash_to_ctrack(h);
 			if (iter(ct, data))
 				goto found;
 		}
+		spin_unlock(lockp);
+		local_bh_enable();
 	}
-	hlist_nulls_for_each_entry(h, n, &net->ct.unconfirmed, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		if (iter(ct, data))
-			set_bit(IPS_DYING_BIT, &ct->status);
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, &pcpu->unconfirmed, hnnode) {
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			if (iter(ct, data))
+				set_bit(IPS_DYING_BIT, &ct->status);
+		}
+		spin_unlock_bh(&pcpu->lock);
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
 	return NULL;
 found:
 	atomic_inc(&ct->ct_general.use);
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_unlock(lockp);
+	local_bh_enable();
 	return ct;
 }
 
@@ -1121,6 +1398,8 @@ void nf_ct_iterate_cleanup(struct net *net,
 	struct nf_conn *ct;
 	unsigned int bucket = 0;
 
+	/* no resize while we walk the buckets */
+	mutex_lock(&nf_conntrack_hash_mutex);
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
 		if (del_timer(&ct->timeout))
@@ -1129,6 +1408,7 @@ void nf_ct_iterate_cleanup(struct net *net,
 
 		nf_ct_put(ct);
 	}
+	mutex_unlock(&nf_conntrack_hash_mutex);
 }
 EXPORT_SYMBOL_GPL(nf_ct_iterate_cleanup);
 
@@ -1181,14 +1461,21 @@ static void nf_ct_release_dying_list(struct net *net)
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	struct ct_pcpu *pcpu;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
-	hlist_nulls_for_each_entry(h, n, &net->ct.dying, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		/* never fails to remove them, no listeners at this point */
-		nf_ct_kill(ct);
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, &pcpu->dying, hnnode) {
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			/* never fails to remove them, no listeners at
+			 * this point */
+			nf_ct_kill(ct);
+		}
+		spin_unlock_bh(&pcpu->lock);
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
 }
 
 static void nf_conntrack_cleanup_init_net(void)
@@ -1213,6 +1500,8 @@ static void nf_conntrack_cleanup_net(struct net *net)
 		schedule();
 		goto i_see_dead_people;
 	}
+	/* the last conntracks gone may have asked for a shrink */
+	cancel_work_sync(&net->ct.resize_work);
 
 	nf_ct_free_hashtable(net->ct.hash, net->ct.hash_vmalloc,
 			     net->ct.htable_size);
@@ -1222,6 +1511,7 @@ static void nf_conntrack_cleanup_net(struct net *net)
 	kmem_cache_destroy(net->ct.nf_conntrack_cachep);
 	kfree(net->ct.slabname);
 	free_percpu(net->ct.stat);
+	free_percpu(net->ct.pcpu_lists);
 }
 
 /* Mishearing the voices in his head, our hero wonders how he's
@@ -1271,59 +1561,146 @@ void *nf_ct_alloc_hashtable(unsigned int *sizep, int *vmalloced, int nulls)
 }
 EXPORT_SYMBOL_GPL(nf_ct_alloc_hashtable);
 
-int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+/* Table sizes are powers of two, see nf_conntrack_bucket_lockp() */
+static unsigned int nf_conntrack_hash_round(unsigned int size)
+{
+	if (size <= CONNTRACK_LOCKS)
+		return CONNTRACK_LOCKS;
+	if (size > 1U << 30)
+		return 1U << 30;
+	return roundup_pow_of_two(size);
+}
+
+/* The size the hash should have for the current number of conntracks */
+static unsigned int nf_conntrack_hash_target(struct net *net)
+{
+	unsigned int count = atomic_read(&net->ct.count);
+	unsigned int size = net->ct.htable_size;
+	unsigned int min, max;
+
+	min = nf_conntrack_hash_round(nf_conntrack_hash_min);
+	max = nf_conntrack_hash_round(nf_conntrack_max ? : UINT_MAX);
+	if (count > size || count < size / 8)
+		size = nf_conntrack_hash_round(count * 2);
+	return clamp(size, min, max(min, max));
+}
+
+/*
+ * Replace the hash by a table of @hashsize buckets, with
+ * nf_conntrack_hash_mutex held.  The tables are switched at once, then
+ * the entries move over a lock at a time: lookups search both tables
+ * meanwhile and never wait for more than a few buckets to move.
+ */
+static int nf_conntrack_hash_resize(struct net *net, unsigned int hashsize)
 {
-	int i, bucket, vmalloced, old_vmalloced;
-	unsigned int hashsize, old_size;
 	struct hlist_nulls_head *hash, *old_hash;
 	struct nf_conntrack_tuple_hash *h;
+	unsigned int i, j, old_size, per_lock;
+	int vmalloced, old_vmalloced;
+	spinlock_t *lockp;
 	struct nf_conn *ct;
-
-	if (current->nsproxy->net_ns != &init_net)
-		return -EOPNOTSUPP;
-
-	/* On boot, we can set this without any fancy locking. */
-	if (!nf_conntrack_htable_size)
-		return param_set_uint(val, kp);
-
-	hashsize = simple_strtoul(val, NULL, 0);
-	if (!hashsize)
-		return -EINVAL;
+	u_int32_t raw;
 
 	hash = nf_ct_alloc_hashtable(&hashsize, &vmalloced, 1);
 	if (!hash)
 		return -ENOMEM;
 
-	/* Lookups in the old hash might happen in parallel, which means we
-	 * might get false negatives during connection lookup. New connections
-	 * created because of a false negative won't make it into the hash
-	 * though since that required taking the lock.
-	 */
-	spin_lock_bh(&nf_conntrack_lock);
-	for (i = 0; i < init_net.ct.htable_size; i++) {
-		while (!hlist_nulls_empty(&init_net.ct.hash[i])) {
-			h = hlist_nulls_entry(init_net.ct.hash[i].first,
-					struct nf_conntrack_tuple_hash, hnnode);
-			ct = nf_ct_tuplehash_to_ctrack(h);
-			hlist_nulls_del_rcu(&h->hnnode);
-			bucket = __hash_conntrack(&h->tuple, nf_ct_zone(ct),
-						  hashsize,
-						  nf_conntrack_hash_rnd);
-			hlist_nulls_add_head_rcu(&h->hnnode, &hash[bucket]);
+	/* New connections go to the new table from now on.  Writers hold
+	 * a bucket lock while they use the table, so all of them are
+	 * stopped for the switch. */
+	local_bh_disable();
+	nf_conntrack_all_lock();
+	write_seqcount_begin(&nf_conntrack_generation);
+	old_hash = net->ct.hash;
+	old_size = net->ct.htable_size;
+	old_vmalloced = net->ct.hash_vmalloc;
+	net->ct.old_hash = old_hash;
+	net->ct.old_htable_size = old_size;
+	net->ct.hash = hash;
+	net->ct.htable_size = hashsize;
+	net->ct.hash_vmalloc = vmalloced;
+	write_seqcount_end(&nf_conntrack_generation);
+	nf_conntrack_all_unlock();
+	local_bh_enable();
+
+	/* The buckets of one lock keep their lock in the new table. */
+	per_lock = old_size / CONNTRACK_LOCKS;
+	for (i = 0; i < CONNTRACK_LOCKS; i++) {
+		lockp = &nf_conntrack_locks[i];
+		local_bh_disable();
+		nf_conntrack_bucket_lock(lockp);
+		write_seqcount_begin(&nf_conntrack_generation);
+		for (j = i * per_lock; j < (i + 1) * per_lock; j++) {
+			while (!hlist_nulls_empty(&old_hash[j])) {
+				h = hlist_nulls_entry(old_hash[j].first,
+						struct nf_conntrack_tuple_hash,
+						hnnode);
+				ct = nf_ct_tuplehash_to_ctrack(h);
+				raw = hash_conntrack_raw(&h->tuple,
+							 nf_ct_zone(ct));
+				hlist_nulls_del_rcu(&h->hnnode);
+				hlist_nulls_add_head_rcu(&h->hnnode,
+					&hash[hash_bucket(raw, hashsize)]);
+			}
 		}
+		write_seqcount_end(&nf_conntrack_generation);
+		spin_unlock(lockp);
+		local_bh_enable();
+		cond_resched();
 	}
-	old_size = init_net.ct.htable_size;
-	old_vmalloced = init_net.ct.hash_vmalloc;
-	old_hash = init_net.ct.hash;
 
-	init_net.ct.htable_size = nf_conntrack_htable_size = hashsize;
-	init_net.ct.hash_vmalloc = vmalloced;
-	init_net.ct.hash = hash;
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_disable();
+	write_seqcount_begin(&nf_conntrack_generation);
+	net->ct.old_hash = NULL;
+	write_seqcount_end(&nf_conntrack_generation);
+	local_bh_enable();
 
+	if (net_eq(net, &init_net))
+		nf_conntrack_htable_size = hashsize;
+
+	synchronize_rcu();
 	nf_ct_free_hashtable(old_hash, old_vmalloced, old_size);
 	return 0;
 }
+
+static void nf_conntrack_hash_resize_work(struct work_struct *work)
+{
+	struct net *net = container_of(work, struct net, ct.resize_work);
+	unsigned int hashsize;
+
+	mutex_lock(&nf_conntrack_hash_mutex);
+	hashsize = nf_conntrack_hash_target(net);
+	if (nf_conntrack_hash_autosize && hashsize != net->ct.htable_size)
+		nf_conntrack_hash_resize(net, hashsize);
+	mutex_unlock(&nf_conntrack_hash_mutex);
+}
+
+/* The size given is also the smallest the automatic resize goes to. */
+int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+{
+	unsigned int hashsize;
+	int ret;
+
+	if (current->nsproxy->net_ns != &init_net)
+		return -EOPNOTSUPP;
+
+	/* On boot, we can set this without any fancy locking. */
+	if (!nf_conntrack_htable_size)
+		return param_set_uint(val, kp);
+
+	hashsize = simple_strtoul(val, NULL, 0);
+	if (!hashsize)
+		return -EINVAL;
+	hashsize = nf_conntrack_hash_round(hashsize);
+
+	mutex_lock(&nf_conntrack_hash_mutex);
+	nf_conntrack_hash_min = hashsize;
+	ret = 0;
+	if (hashsize != init_net.ct.htable_size)
+		ret = nf_conntrack_hash_resize(&init_net, hashsize);
+	mutex_unlock(&nf_conntrack_hash_mutex);
+	return ret;
+}
 EXPORT_SYMBOL_GPL(nf_conntrack_set_hashsize);
 
 module_param_call(hashsize, nf_conntrack_set_hashsize, param_get_uint,
@@ -1332,7 +1709,16 @@ module_param_call(hashsize, nf_conntrack_set_hashsize, param_get_uint,
 static int nf_conntrack_init_init_net(void)
 {
 	int max_factor = 8;
-	int ret;
+	int ret, i;
+
+	for (i = 0; i < CONNTRACK_LOCKS; i++)
+		spin_lock_init(&nf_conntrack_locks[i]);
+	seqcount_init(&nf_conntrack_generation);
+
+	/* A size given at boot is also the floor of the automatic resize */
+	if (nf_conntrack_htable_size)
+		nf_conntrack_hash_min =
+			nf_conntrack_hash_round(nf_conntrack_htable_size);
 
 	/* Idea from tcp.c: use 1/16384 of memory.  On i386: 32MB
 	 * machine has 512 buckets. >= 1GB machines have 16384 buckets. */
@@ -1352,6 +1738,7 @@ static int nf_conntrack_init_init_net(void)
 		max_factor = 4;
 	}
 	nf_conntrack_max = max_factor * nf_conntrack_htable_size;
+	nf_conntrack_htable_size = nf_conntrack_hash_round(nf_conntrack_htable_size);
 
 	printk(KERN_INFO "nf_conntrack version %s (%u buckets, %d max)\n",
 	       NF_CONNTRACK_VERSION, nf_conntrack_htable_size,
@@ -1398,11 +1785,25 @@ err_proto:
 
 static int nf_conntrack_init_net(struct net *net)
 {
-	int ret;
+	int ret, cpu;
 
 	atomic_set(&net->ct.count, 0);
-	INIT_HLIST_NULLS_HEAD(&net->ct.unconfirmed, UNCONFIRMED_NULLS_VAL);
-	INIT_HLIST_NULLS_HEAD(&net->ct.dying, DYING_NULLS_VAL);
+	net->ct.old_hash = NULL;
+	INIT_WORK(&net->ct.resize_work, nf_conntrack_hash_resize_work);
+
+	net->ct.pcpu_lists = alloc_percpu(struct ct_pcpu);
+	if (!net->ct.pcpu_lists) {
+		ret = -ENOMEM;
+		goto err_pcpu_lists;
+	}
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_init(&pcpu->lock);
+		INIT_HLIST_NULLS_HEAD(&pcpu->unconfirmed, UNCONFIRMED_NULLS_VAL);
+		INIT_HLIST_NULLS_HEAD(&pcpu->dying, DYING_NULLS_VAL);
+	}
+
 	net->ct.stat = alloc_percpu(struct ip_conntrack_stat);
 	if (!net->ct.stat) {
 		ret = -ENOMEM;
@@ -1458,6 +1859,8 @@ err_cache:
 err_slabname:
 	free_percpu(net->ct.stat);
 err_stat:
+	free_percpu(net->ct.pcpu_lists);
+err_pcpu_lists:
 	return ret;
 }
 
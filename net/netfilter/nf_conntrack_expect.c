@@ -38,19 +38,47 @@ static int nf_ct_expect_hash_rnd_initted __read_mostly;
 
 static struct kmem_cache *nf_ct_expect_cachep __read_mostly;
 
+/*
+ * Expectations are found by lockless lookups in the hash, changes are
+ * serialized by two sets of locks instead of nf_conntrack_lock: the lock
+ * of the master (see nf_ct_expect_master_lock()) and the lock of the hash
+ * bucket, taken in that order and after any conntrack hash lock.
+ *
+ * An expectation holds one reference for being linked and one for its
+ * timer.  Whoever deletes the timer unlinks the expectation and puts the
+ * timer reference; when the timer fires first, the callback unlinks the
+ * expectation unless nf_ct_remove_expectations() already did.
+ */
+spinlock_t nf_ct_expect_master_locks[NF_CT_EXPECT_LOCKS] __cacheline_aligned_in_smp;
+EXPORT_SYMBOL_GPL(nf_ct_expect_master_locks);
+
+static spinlock_t nf_ct_expect_hash_locks[NF_CT_EXPECT_LOCKS];
+
+static unsigned int nf_ct_expect_dst_hash(const struct nf_conntrack_tuple *tuple);
+
+static spinlock_t *nf_ct_expect_hash_lock(unsigned int h)
+{
+	return &nf_ct_expect_hash_locks[h % NF_CT_EXPECT_LOCKS];
+}
+
 /* nf_conntrack_expect helper functions */
+
+/* Call with the master lock held. */
 void nf_ct_unlink_expect(struct nf_conntrack_expect *exp)
 {
 	struct nf_conn_help *master_help = nfct_help(exp->master);
 	struct net *net = nf_ct_exp_net(exp);
+	spinlock_t *lock = nf_ct_expect_hash_lock(nf_ct_expect_dst_hash(&exp->tuple));
 
 	NF_CT_ASSERT(master_help);
 	NF_CT_ASSERT(!timer_pending(&exp->timeout));
 
+	spin_lock(lock);
 	hlist_del_rcu(&exp->hnode);
-	net->ct.expect_count--;
+	spin_unlock(lock);
+	atomic_dec(&net->ct.expect_count);
 
-	hlist_del(&exp->lnode);
+	hlist_del_init(&exp->lnode);
 	master_help->expecting[exp->class]--;
 	nf_ct_expect_put(exp);
 
@@ -61,10 +89,12 @@ EXPORT_SYMBOL_GPL(nf_ct_unlink_expect);
 static void nf_ct_expectation_timed_out(unsigned long ul_expect)
 {
 	struct nf_conntrack_expect *exp = (void *)ul_expect;
+	spinlock_t *lock = nf_ct_expect_master_lock(exp->master);
 
-	spin_lock_bh(&nf_conntrack_lock);
-	nf_ct_unlink_expect(exp);
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_lock_bh(lock);
+	if (nf_ct_expect_linked(exp))
+		nf_ct_unlink_expect(exp);
+	spin_unlock_bh(lock);
 	nf_ct_expect_put(exp);
 }
 
@@ -92,7 +122,7 @@ __nf_ct_expect_find(struct net *net, u16 zone,
 	struct hlist_node *n;
 	unsigned int h;
 
-	if (!net->ct.expect_count)
+	if (!atomic_read(&net->ct.expect_count))
 		return NULL;
 
 	h = nf_ct_expect_dst_hash(tuple);
@@ -123,20 +153,23 @@ nf_ct_expect_find_get(struct net *net, u16 zone,
 EXPORT_SYMBOL_GPL(nf_ct_expect_find_get);
 
 /* If an expectation for this connection is found, it gets delete from
- * global list then returned. */
+ * global list then returned, with a reference to its master held. */
 struct nf_conntrack_expect *
 nf_ct_find_expectation(struct net *net, u16 zone,
 		       const struct nf_conntrack_tuple *tuple)
 {
 	struct nf_conntrack_expect *i, *exp = NULL;
 	struct hlist_node *n;
+	struct nf_conn *master;
+	spinlock_t *lock;
 	unsigned int h;
 
-	if (!net->ct.expect_count)
+	if (!atomic_read(&net->ct.expect_count))
 		return NULL;
 
+	rcu_read_lock();
 	h = nf_ct_expect_dst_hash(tuple);
-	hlist_for_each_entry(i, n, &net->ct.expect_hash[h], hnode) {
+	hlist_for_each_entry_rcu(i, n, &net->ct.expect_hash[h], hnode) {
 		if (!(i->flags & NF_CT_EXPECT_INACTIVE) &&
 		    nf_ct_tuple_mask_cmp(tuple, &i->tuple, &i->mask) &&
 		    nf_ct_zone(i->master) == zone) {
@@ -145,25 +178,42 @@ nf_ct_find_expectation(struct net *net, u16 zone,
 		}
 	}
 	if (!exp)
-		return NULL;
+		goto out;
 
 	/* If master is not in hash table yet (ie. packet hasn't left
 	   this machine yet), how can other end know about expected?
 	   Hence these are not the droids you are looking for (if
 	   master ct never got confirmed, we'd hold a reference to it
-	   and weird things would happen to future packets). */
-	if (!nf_ct_is_confirmed(exp->master))
-		return NULL;
+	   and weird things would happen to future packets).
+
+	   The master removes its expectations under the master lock
+	   before it goes away, so the reference to it has to be taken
+	   there, while the expectation is still linked. */
+	master = exp->master;
+	lock = nf_ct_expect_master_lock(master);
+	spin_lock_bh(lock);
+	if (!nf_ct_expect_linked(exp) || !nf_ct_is_confirmed(master) ||
+	    !atomic_inc_not_zero(&master->ct_general.use)) {
+		spin_unlock_bh(lock);
+		exp = NULL;
+		goto out;
+	}
 
 	if (exp->flags & NF_CT_EXPECT_PERMANENT) {
-		atomic_inc(&exp->use);
-		return exp;
+		if (!atomic_inc_not_zero(&exp->use))
+			exp = NULL;
 	} else if (del_timer(&exp->timeout)) {
+		/* Only one packet may claim it: the one deleting its timer. */
 		nf_ct_unlink_expect(exp);
-		return exp;
-	}
+	} else
+		exp = NULL;
+	spin_unlock_bh(lock);
 
-	return NULL;
+	if (!exp)
+		nf_ct_put(master);
+out:
+	rcu_read_unlock();
+	return exp;
 }
 
 /* delete all expectations for this conntrack */
@@ -172,20 +222,54 @@ void nf_ct_remove_expectations(struct nf_conn *ct)
 	struct nf_conn_help *help = nfct_help(ct);
 	struct nf_conntrack_expect *exp;
 	struct hlist_node *n, *next;
+	spinlock_t *lock;
 
 	/* Optimization: most connection never expect any others. */
 	if (!help)
 		return;
 
+	/* Nothing may point to the master once it is gone, so expectations
+	 * whose timer is running are unlinked here, not by the timer. */
+	lock = nf_ct_expect_master_lock(ct);
+	spin_lock_bh(lock);
 	hlist_for_each_entry_safe(exp, n, next, &help->expectations, lnode) {
-		if (del_timer(&exp->timeout)) {
-			nf_ct_unlink_expect(exp);
+		if (del_timer(&exp->timeout))
 			nf_ct_expect_put(exp);
-		}
+		nf_ct_unlink_expect(exp);
 	}
+	spin_unlock_bh(lock);
 }
 EXPORT_SYMBOL_GPL(nf_ct_remove_expectations);
 
+/* Destroy the expectations @iter returns true for. */
+void nf_ct_expect_iterate_destroy(struct net *net,
+				  int (*iter)(struct nf_conntrack_expect *exp,
+					      void *data),
+				  void *data)
+{
+	struct nf_conntrack_expect *exp;
+	struct hlist_node *n;
+	spinlock_t *lock;
+	unsigned int i;
+
+	for (i = 0; i < nf_ct_expect_hsize; i++) {
+		rcu_read_lock();
+		hlist_for_each_entry_rcu(exp, n, &net->ct.expect_hash[i],
+					 hnode) {
+			lock = nf_ct_expect_master_lock(exp->master);
+			spin_lock_bh(lock);
+			if (nf_ct_expect_linked(exp) && iter(exp, data) &&
+			    del_timer(&exp->timeout)) {
+				nf_ct_unlink_expect(exp);
+				nf_ct_expect_put(exp);
+			}
+			spin_unlock_bh(lock);
+		}
+		rcu_read_unlock();
+	}
+}
+EXPORT_SYMBOL_GPL(nf_ct_expect_iterate_destroy);
+
 /* Would two expected things clash? */
 static inline int expect_clash(const struct nf_conntrack_expect *a,
 			       const struct nf_conntrack_expect *b)
@@ -217,12 +301,14 @@ static inline int expect_matches(const struct nf_conntrack_expect *a,
 /* Generally a bad idea to call this: could have matched already. */
 void nf_ct_unexpect_related(struct nf_conntrack_expect *exp)
 {
-	spin_lock_bh(&nf_conntrack_lock);
-	if (del_timer(&exp->timeout)) {
+	spinlock_t *lock = nf_ct_expect_master_lock(exp->master);
+
+	spin_lock_bh(lock);
+	if (nf_ct_expect_linked(exp) && del_timer(&exp->timeout)) {
 		nf_ct_unlink_expect(exp);
 		nf_ct_expect_put(exp);
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_unlock_bh(lock);
 }
 EXPORT_SYMBOL_GPL(nf_ct_unexpect_related);
 
@@ -238,6 +324,7 @@ struct nf_conntrack_expect *nf_ct_expect_alloc(struct nf_conn *me)
 		return NULL;
 
 	new->master = me;
+	INIT_HLIST_NODE(&new->lnode);
 	atomic_set(&new->use, 1);
 	return new;
 }
@@ -311,12 +398,13 @@ void nf_ct_expect_put(struct nf_conntrack_expect *exp)
 }
 EXPORT_SYMBOL_GPL(nf_ct_expect_put);
 
-static void nf_ct_expect_insert(struct nf_conntrack_expect *exp)
+/* Call with the master lock and the lock of bucket @h held. */
+static void nf_ct_expect_insert(struct nf_conntrack_expect *exp,
+				unsigned int h)
 {
 	struct nf_conn_help *master_help = nfct_help(exp->master);
 	struct net *net = nf_ct_exp_net(exp);
 	const struct nf_conntrack_expect_policy *p;
-	unsigned int h = nf_ct_expect_dst_hash(&exp->tuple);
 
 	atomic_inc(&exp->use);
 
@@ -324,7 +412,7 @@ static void nf_ct_expect_insert(struct nf_conntrack_expect *exp)
 	master_help->expecting[exp->class]++;
 
 	hlist_add_head_rcu(&exp->hnode, &net->ct.expect_hash[h]);
-	net->ct.expect_count++;
+	atomic_inc(&net->ct.expect_count);
 
 	setup_timer(&exp->timeout, nf_ct_expectation_timed_out,
 		    (unsigned long)exp);
@@ -369,34 +457,50 @@ static inline int refresh_timer(struct nf_conntrack_expect *i)
 	return 1;
 }
 
-static inline int __nf_ct_expect_check(struct nf_conntrack_expect *expect)
+/*
+ * Look for an expectation equal to or clashing with @expect in bucket @h,
+ * whose lock is held.  Equal ones that belong to the same master are
+ * refreshed, which is only safe under the master lock.
+ */
+static int nf_ct_expect_scan(struct nf_conntrack_expect *expect,
+			     unsigned int h)
 {
-	const struct nf_conntrack_expect_policy *p;
+	struct net *net = nf_ct_exp_net(expect);
 	struct nf_conntrack_expect *i;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(i, n, &net->ct.expect_hash[h], hnode) {
+		if (expect_matches(i, expect)) {
+			/* Refresh timer: if it's dying, ignore.. */
+			if (refresh_timer(i))
+				return 0;
+		} else if (expect_clash(i, expect))
+			return -EBUSY;
+	}
+	return 1;
+}
+
+/* Call with the master lock held. */
+static inline int __nf_ct_expect_check(struct nf_conntrack_expect *expect,
+				       unsigned int h)
+{
+	const struct nf_conntrack_expect_policy *p;
 	struct nf_conn *master = expect->master;
 	struct nf_conn_help *master_help = nfct_help(master);
 	struct net *net = nf_ct_exp_net(expect);
-	struct hlist_node *n;
-	unsigned int h;
+	spinlock_t *lock = nf_ct_expect_hash_lock(h);
 	int ret = 1;
 
 	if (!master_help->helper) {
 		ret = -ESHUTDOWN;
 		goto out;
 	}
-	h = nf_ct_expect_dst_hash(&expect->tuple);
-	hlist_for_each_entry(i, n, &net->ct.expect_hash[h], hnode) {
-		if (expect_matches(i, expect)) {
-			/* Refresh timer: if it's dying, ignore.. */
-			if (refresh_timer(i)) {
-				ret = 0;
-				goto out;
-			}
-		} else if (expect_clash(i, expect)) {
-			ret = -EBUSY;
-			goto out;
-		}
-	}
+	spin_lock(lock);
+	ret = nf_ct_expect_scan(expect, h);
+	spin_unlock(lock);
+	if (ret <= 0)
+		goto out;
+
 	/* Will be over limit? */
 	p = &master_help->helper->expect_policy[expect->class];
 	if (p->max_expected &&
@@ -408,7 +512,7 @@ static inline int __nf_ct_expect_check(struct nf_conntrack_expect *expect)
 		}
 	}
 
-	if (net->ct.expect_count >= nf_ct_expect_max) {
+	if (atomic_read(&net->ct.expect_count) >= nf_ct_expect_max) {
 		if (net_ratelimit())
 			printk(KERN_WARNING
 			       "nf_conntrack: expectation table full\n");
@@ -421,20 +525,30 @@ out:
 int nf_ct_expect_related_report(struct nf_conntrack_expect *expect, 
 				u32 pid, int report)
 {
+	spinlock_t *lock = nf_ct_expect_master_lock(expect->master);
+	unsigned int h = nf_ct_expect_dst_hash(&expect->tuple);
 	int ret;
 
-	spin_lock_bh(&nf_conntrack_lock);
-	ret = __nf_ct_expect_check(expect);
+	spin_lock_bh(lock);
+	ret = __nf_ct_expect_check(expect, h);
 	if (ret <= 0)
 		goto out;
 
+	/* the bucket was unlocked for the eviction, another master may
+	 * have inserted a clashing expectation meanwhile */
+	spin_lock(nf_ct_expect_hash_lock(h));
+	ret = nf_ct_expect_scan(expect, h);
+	if (ret > 0)
+		nf_ct_expect_insert(expect, h);
+	spin_unlock(nf_ct_expect_hash_lock(h));
+	if (ret <= 0)
+		goto out;
 	ret = 0;
-	nf_ct_expect_insert(expect);
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_unlock_bh(lock);
 	nf_ct_expect_event_report(IPEXP_NEW, expect, pid, report);
 	return ret;
 out:
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_unlock_bh(lock);
 	return ret;
 }
 EXPORT_SYMBOL_GPL(nf_ct_expect_related_report);
@@ -589,8 +703,13 @@ module_param_named(expect_hashsize, nf_ct_expect_hsize, uint, 0400);
 int nf_conntrack_expect_init(struct net *net)
 {
 	int err = -ENOMEM;
+	int i;
 
 	if (net_eq(net, &init_net)) {
+		for (i = 0; i < NF_CT_EXPECT_LOCKS; i++) {
+			spin_lock_init(&nf_ct_expect_master_locks[i]);
+			spin_lock_init(&nf_ct_expect_hash_locks[i]);
+		}
 		if (!nf_ct_expect_hsize) {
 			nf_ct_expect_hsize = net->ct.htable_size / 256;
 			if (!nf_ct_expect_hsize)
@@ -599,7 +718,7 @@ int nf_conntrack_expect_init(struct net *net)
 		nf_ct_expect_max = nf_ct_expect_hsize * 4;
 	}
 
-	net->ct.expect_count = 0;
+	atomic_set(&net->ct.expect_count, 0);
 	net->ct.expect_hash = nf_ct_alloc_hashtable(&nf_ct_expect_hsize,
 						  &net->ct.expect_vmalloc, 0);
 	if (net->ct.expect_hash == NULL)
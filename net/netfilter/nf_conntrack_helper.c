@@ -196,35 +196,44 @@ int nf_conntrack_helper_register(struct nf_conntrack_helper *me)
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_helper_register);
 
-static void __nf_conntrack_helper_unregister(struct nf_conntrack_helper *me,
-					     struct net *net)
+static void __nf_conntrack_helper_unhelp(struct nf_conntrack_helper *me,
+					 struct net *net)
 {
 	struct nf_conntrack_tuple_hash *h;
-	struct nf_conntrack_expect *exp;
-	const struct hlist_node *n, *next;
 	const struct hlist_nulls_node *nn;
+	struct ct_pcpu *pcpu;
+	spinlock_t *lockp;
 	unsigned int i;
+	int cpu;
 
-	/* Get rid of expectations */
-	for (i = 0; i < nf_ct_expect_hsize; i++) {
-		hlist_for_each_entry_safe(exp, n, next,
-					  &net->ct.expect_hash[i], hnode) {
-			struct nf_conn_help *help = nfct_help(exp->master);
-			if ((help->helper == me || exp->helper == me) &&
-			    del_timer(&exp->timeout)) {
-				nf_ct_unlink_expect(exp);
-				nf_ct_expect_put(exp);
-			}
-		}
-	}
+	/* Set helpers to NULL. */
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
 
-	/* Get rid of expecteds, set helpers to NULL. */
-	hlist_nulls_for_each_entry(h, nn, &net->ct.unconfirmed, hnnode)
-		unhelp(h, me);
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, nn, &pcpu->unconfirmed, hnnode)
+			unhelp(h, me);
+		spin_unlock_bh(&pcpu->lock);
+	}
+	mutex_lock(&nf_conntrack_hash_mutex);
 	for (i = 0; i < net->ct.htable_size; i++) {
+		lockp = nf_conntrack_bucket_lockp(i, net->ct.htable_size);
+		local_bh_disable();
+		nf_conntrack_bucket_lock(lockp);
 		hlist_nulls_for_each_entry(h, nn, &net->ct.hash[i], hnnode)
 			unhelp(h, me);
+		spin_unlock(lockp);
+		local_bh_enable();
 	}
+	mutex_unlock(&nf_conntrack_hash_mutex);
+}
+
+static int expect_iter_me(struct nf_conntrack_expect *exp, void *data)
+{
+	struct nf_conn_help *help = nfct_help(exp->master);
+	const struct nf_conntrack_helper *me = data;
+
+	return help->helper == me || exp->helper == me;
 }
 
 void nf_conntrack_helper_unregister(struct nf_conntrack_helper *me)
@@ -242,10 +251,16 @@ void nf_conntrack_helper_unregister(struct nf_conntrack_helper *me)
 	synchronize_rcu();
 
 	rtnl_lock();
-	spin_lock_bh(&nf_conntrack_lock);
 	for_each_net(net)
-		__nf_conntrack_helper_unregister(me, net);
-	spin_unlock_bh(&nf_conntrack_lock);
+		__nf_conntrack_helper_unhelp(me, net);
+
+	/* Expectations are created by the helpers under rcu_read_lock(),
+	 * once all of them saw the NULL helper no new ones show up. */
+	synchronize_rcu();
+
+	/* Get rid of expectations */
+	for_each_net(net)
+		nf_ct_expect_iterate_destroy(net, expect_iter_me, me);
 	rtnl_unlock();
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_helper_unregister);
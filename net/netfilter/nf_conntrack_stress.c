@@ -0,0 +1,281 @@
+/*
+ * Connection tracking setup benchmark.
+ *
+ * One thread per online cpu sets up connections the way a SIP or FTP
+ * helper does: a UDP master is tracked and gets an expectation, then the
+ * expected connection arrives, both are confirmed and torn down again.
+ * The number of setups per second is printed when the run is over.
+ * Like tcrypt, loading always fails once the test is done.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/udp.h>
+#include <linux/netfilter.h>
+#include <net/net_namespace.h>
+#include <net/ip.h>
+
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_tuple.h>
+#include <net/netfilter/nf_conntrack_expect.h>
+#include <net/netfilter/nf_conntrack_helper.h>
+#include <net/netfilter/ipv4/nf_conntrack_ipv4.h>
+
+MODULE_DESCRIPTION("connection tracking setup benchmark");
+MODULE_LICENSE("GPL");
+
+static unsigned int secs = 5;
+module_param(secs, uint, 0400);
+MODULE_PARM_DESC(secs, "Length of the run in seconds");
+
+static unsigned short port = 5099;
+module_param(port, ushort, 0400);
+MODULE_PARM_DESC(port, "UDP port of the fake signalling server");
+
+#define STRESS_SERVER	0x0afe0001	/* 10.254.0.1 */
+#define STRESS_PORTS	32256		/* source ports 1024-65534, even */
+
+struct stress_thread {
+	struct task_struct	*task;
+	unsigned int		cpu;
+	unsigned long		setups;
+	unsigned long		failed;
+};
+
+static int stress_help(struct sk_buff *skb, unsigned int protoff,
+		       struct nf_conn *ct, enum ip_conntrack_info ctinfo)
+{
+	/* expectations are set up by the threads themselves */
+	return NF_ACCEPT;
+}
+
+static const struct nf_conntrack_expect_policy stress_exp_policy = {
+	.max_expected	= 1,
+	.timeout	= 30,
+};
+
+static struct nf_conntrack_helper stress_helper __read_mostly = {
+	.name			= "ct-stress",
+	.me			= THIS_MODULE,
+	.tuple.src.l3num	= AF_INET,
+	.tuple.dst.protonum	= IPPROTO_UDP,
+	.help			= stress_help,
+	.expect_policy		= &stress_exp_policy,
+};
+
+static struct sk_buff *stress_skb(__be32 saddr, __be16 sport,
+				  __be32 daddr, __be16 dport)
+{
+	struct sk_buff *skb;
+	struct iphdr *iph;
+	struct udphdr *uh;
+
+	skb = alloc_skb(sizeof(*iph) + sizeof(*uh), GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	skb_reset_network_header(skb);
+	iph = (struct iphdr *)skb_put(skb, sizeof(*iph));
+	memset(iph, 0, sizeof(*iph));
+	iph->version	= 4;
+	iph->ihl	= sizeof(*iph) / 4;
+	iph->ttl	= 64;
+	iph->protocol	= IPPROTO_UDP;
+	iph->tot_len	= htons(sizeof(*iph) + sizeof(*uh));
+	iph->saddr	= saddr;
+	iph->daddr	= daddr;
+	iph->check	= ip_fast_csum((unsigned char *)iph, iph->ihl);
+
+	skb_set_transport_header(skb, sizeof(*iph));
+	uh = (struct udphdr *)skb_put(skb, sizeof(*uh));
+	uh->source	= sport;
+	uh->dest	= dport;
+	uh->len		= htons(sizeof(*uh));
+	uh->check	= 0;
+
+	skb->protocol	= htons(ETH_P_IP);
+	skb->ip_summed	= CHECKSUM_UNNECESSARY;
+	return skb;
+}
+
+/* Track and confirm the packet, as the PRE_ROUTING and INPUT hooks do. */
+static struct nf_conn *stress_track(struct sk_buff *skb)
+{
+	struct nf_conn *ct = NULL;
+	enum ip_conntrack_info ctinfo;
+	unsigned int verdict;
+
+	rcu_read_lock();
+	local_bh_disable();
+	verdict = nf_conntrack_in(&init_net, PF_INET, NF_INET_PRE_ROUTING, skb);
+	if (verdict != NF_ACCEPT)
+		goto out;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (!ct || ct == &nf_conntrack_untracked)
+		goto out;
+
+	if (nf_conntrack_confirm(skb) != NF_ACCEPT)
+		ct = NULL;
+out:
+	local_bh_enable();
+	rcu_read_unlock();
+	return ct;
+}
+
+static bool stress_setup(struct stress_thread *t, unsigned long n)
+{
+	__be32 client = htonl(0x0a000000 | (t->cpu & 0xff) << 16 |
+			      ((n / STRESS_PORTS) & 0xffff));
+	__be32 server = htonl(STRESS_SERVER);
+	__be16 sport = htons(1024 + (n % STRESS_PORTS) * 2);
+	__be16 rtp = htons(ntohs(sport) + 1);
+	struct sk_buff *skb, *eskb = NULL;
+	struct nf_conntrack_expect *exp;
+	struct nf_conn *ct, *ect = NULL;
+	bool ok = false;
+
+	skb = stress_skb(client, sport, server, htons(port));
+	if (!skb)
+		return false;
+
+	exp = NULL;
+	ct = stress_track(skb);
+	if (!ct || !nfct_help(ct))
+		goto out;
+
+	/* what the helper does once the master is confirmed and the
+	 * signalling announced the media stream */
+	exp = nf_ct_expect_alloc(ct);
+	if (!exp)
+		goto out;
+	nf_ct_expect_init(exp, NF_CT_EXPECT_CLASS_DEFAULT, AF_INET,
+			  (union nf_inet_addr *)&server,
+			  (union nf_inet_addr *)&client,
+			  IPPROTO_UDP, NULL, &rtp);
+	rcu_read_lock();
+	local_bh_disable();
+	if (nf_ct_expect_related(exp) < 0) {
+		local_bh_enable();
+		rcu_read_unlock();
+		goto out;
+	}
+	local_bh_enable();
+	rcu_read_unlock();
+
+	eskb = stress_skb(server, htons(port + 1), client, rtp);
+	if (!eskb)
+		goto out;
+	ect = stress_track(eskb);
+	ok = ect && test_bit(IPS_EXPECTED_BIT, &ect->status);
+out:
+	if (exp)
+		nf_ct_expect_put(exp);
+	if (ect)
+		nf_ct_kill(ect);
+	if (ct)
+		nf_ct_kill(ct);
+	kfree_skb(eskb);
+	kfree_skb(skb);
+	return ok;
+}
+
+static int stress_thread_fn(void *data)
+{
+	struct stress_thread *t = data;
+	unsigned long n = 0;
+
+	while (!kthread_should_stop()) {
+		if (stress_setup(t, n++))
+			t->setups++;
+		else
+			t->failed++;
+		cond_resched();
+	}
+	return 0;
+}
+
+static int __init nf_conntrack_stress_init(void)
+{
+	struct stress_thread *threads;
+	unsigned long setups = 0, failed = 0;
+	unsigned int cpu, nthreads = 0;
+	ktime_t start;
+	s64 us;
+	int ret;
+
+	need_ipv4_conntrack();
+
+	threads = kcalloc(nr_cpu_ids, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	stress_helper.tuple.src.u.udp.port = htons(port);
+	ret = nf_conntrack_helper_register(&stress_helper);
+	if (ret < 0)
+		goto out_free;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		struct stress_thread *t = &threads[cpu];
+
+		t->cpu = cpu;
+		t->task = kthread_create(stress_thread_fn, t,
+					 "ct_stress/%u", cpu);
+		if (IS_ERR(t->task)) {
+			t->task = NULL;
+			continue;
+		}
+		kthread_bind(t->task, cpu);
+		nthreads++;
+	}
+	put_online_cpus();
+
+	start = ktime_get();
+	for_each_possible_cpu(cpu)
+		if (threads[cpu].task)
+			wake_up_process(threads[cpu].task);
+
+	msleep_interruptible(secs * 1000);
+
+	for_each_possible_cpu(cpu) {
+		if (!threads[cpu].task)
+			continue;
+		kthread_stop(threads[cpu].task);
+		setups += threads[cpu].setups;
+		failed += threads[cpu].failed;
+	}
+	us = ktime_us_delta(ktime_get(), start);
+
+	printk(KERN_INFO "nf_conntrack_stress: %u threads, %lu setups "
+	       "(%lu failed) in %lld ms, %llu setups/s\n",
+	       nthreads, setups, failed, us / 1000,
+	       us ? div64_u64((u64)setups * USEC_PER_SEC, us) : 0);
+
+	nf_conntrack_helper_unregister(&stress_helper);
+	ret = -EAGAIN;
+out_free:
+	kfree(threads);
+	return ret;
+}
+
+static void __exit nf_conntrack_stress_fini(void) { }
+
+module_init(nf_conntrack_stress_init);
+module_exit(nf_conntrack_stress_fini);
@@ -0,0 +1,795 @@
+/*
+ * Pattern compiler for the layer7 match: Spencer syntax -> Thompson NFA,
+ * groups of NFAs -> one DFA.  See dfa.h.
+ *
+ * Everything here runs in process context when a rule is loaded; only
+ * l7_dfa_scan() is used on packets.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/bitops.h>
+#include <linux/bitmap.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/log2.h>
+#include <linux/err.h>
+
+#include "dfa.h"
+
+enum {
+	L7_OP_CHAR,	/* consume the byte c */
+	L7_OP_SET,	/* consume a byte of cset */
+	L7_OP_SPLIT,	/* go on to out and out1 */
+	L7_OP_EMPTY,	/* go on to out */
+	L7_OP_BOL,	/* go on to out at the start of the data */
+	L7_OP_EOL,	/* go on to out at the end of the data */
+	L7_OP_MATCH,	/* pattern c matched */
+};
+
+struct l7_nstate {
+	u8 op;
+	u8 c;
+	u16 cset;
+	int out;
+	int out1;
+};
+
+struct l7_cset {
+	DECLARE_BITMAP(map, 256);
+};
+
+struct l7_nfa {
+	int start;
+	unsigned int nst;
+	unsigned int ncset;
+	struct l7_nstate *st;
+	struct l7_cset *cset;
+};
+
+/*
+ * Parser.  A fragment is a piece of NFA with one entry and a list of
+ * out slots still to be patched.  The list is threaded through the slots
+ * themselves: slot 2n is st[n].out and 2n+1 is st[n].out1, -1 ends it.
+ */
+struct l7_frag {
+	int start;
+	int dangling;
+	bool width;	/* cannot match the empty string */
+};
+
+struct l7_parse {
+	const unsigned char *p;
+	struct l7_nfa *nfa;
+	unsigned int max_st;
+	int depth;
+	const char *err;
+};
+
+#define L7_PARSE_DEPTH	32
+
+static const struct l7_frag l7_bad = { .start = -1 };
+
+static int *l7_slot(struct l7_nfa *nfa, int slot)
+{
+	struct l7_nstate *s = &nfa->st[slot >> 1];
+
+	return slot & 1 ? &s->out1 : &s->out;
+}
+
+static void l7_patch(struct l7_nfa *nfa, int list, int to)
+{
+	int *p;
+
+	while (list >= 0) {
+		p = l7_slot(nfa, list);
+		list = *p;
+		*p = to;
+	}
+}
+
+static int l7_append(struct l7_nfa *nfa, int l1, int l2)
+{
+	int s = l1;
+
+	if (l1 < 0)
+		return l2;
+	while (*l7_slot(nfa, s) >= 0)
+		s = *l7_slot(nfa, s);
+	*l7_slot(nfa, s) = l2;
+	return l1;
+}
+
+static int l7_new(struct l7_parse *ps, u8 op, int out, int out1)
+{
+	struct l7_nstate *s;
+
+	if (ps->nfa->nst >= ps->max_st) {
+		ps->err = "internal error";
+		return -1;
+	}
+	s = &ps->nfa->st[ps->nfa->nst];
+	s->op = op;
+	s->c = 0;
+	s->cset = 0;
+	s->out = out;
+	s->out1 = out1;
+	return ps->nfa->nst++;
+}
+
+static struct l7_frag l7_fail(struct l7_parse *ps, const char *err)
+{
+	if (!ps->err)
+		ps->err = err;
+	return l7_bad;
+}
+
+static struct l7_frag l7_single(struct l7_parse *ps, u8 op, bool width)
+{
+	struct l7_frag f;
+
+	f.start = l7_new(ps, op, -1, -1);
+	if (f.start < 0)
+		return l7_bad;
+	f.dangling = f.start << 1;
+	f.width = width;
+	return f;
+}
+
+static struct l7_frag l7_parse_class(struct l7_parse *ps)
+{
+	struct l7_nfa *nfa = ps->nfa;
+	struct l7_cset *cs = &nfa->cset[nfa->ncset];
+	struct l7_frag f;
+	bool negate = false;
+	int c, end;
+
+	bitmap_zero(cs->map, 256);
+	if (*ps->p == '^') {
+		negate = true;
+		ps->p++;
+	}
+	if (*ps->p == ']' || *ps->p == '-')
+		set_bit(*ps->p++, cs->map);
+	while (*ps->p != '\0' && *ps->p != ']') {
+		if (*ps->p != '-') {
+			set_bit(*ps->p++, cs->map);
+			continue;
+		}
+		ps->p++;
+		if (*ps->p == ']' || *ps->p == '\0') {
+			set_bit('-', cs->map);
+			continue;
+		}
+		c = ps->p[-2] + 1;
+		end = *ps->p++;
+		if (c > end + 1)
+			return l7_fail(ps, "invalid [] range");
+		for (; c <= end; c++)
+			set_bit(c, cs->map);
+	}
+	if (*ps->p != ']')
+		return l7_fail(ps, "unmatched []");
+	ps->p++;
+
+	if (negate)
+		bitmap_complement(cs->map, cs->map, 256);
+	clear_bit(0, cs->map);
+
+	f = l7_single(ps, L7_OP_SET, true);
+	if (f.start >= 0)
+		nfa->st[f.start].cset = nfa->ncset++;
+	return f;
+}
+
+static struct l7_frag l7_parse_reg(struct l7_parse *ps);
+
+static struct l7_frag l7_parse_atom(struct l7_parse *ps)
+{
+	struct l7_nfa *nfa = ps->nfa;
+	struct l7_frag f;
+	unsigned char c = *ps->p++;
+
+	switch (c) {
+	case '^':
+		return l7_single(ps, L7_OP_BOL, false);
+	case '$':
+		return l7_single(ps, L7_OP_EOL, false);
+	case '.':
+		f = l7_single(ps, L7_OP_SET, true);
+		if (f.start >= 0) {
+			bitmap_fill(nfa->cset[nfa->ncset].map, 256);
+			clear_bit(0, nfa->cset[nfa->ncset].map);
+			nfa->st[f.start].cset = nfa->ncset++;
+		}
+		return f;
+	case '[':
+		return l7_parse_class(ps);
+	case '(':
+		if (++ps->depth > L7_PARSE_DEPTH)
+			return l7_fail(ps, "() nested too deep");
+		f = l7_parse_reg(ps);
+		ps->depth--;
+		if (f.start < 0)
+			return f;
+		if (*ps->p != ')')
+			return l7_fail(ps, "unmatched ()");
+		ps->p++;
+		return f;
+	case '\0':
+	case '|':
+	case ')':
+		return l7_fail(ps, "internal urp");
+	case '?':
+	case '+':
+	case '*':
+		return l7_fail(ps, "?+* follows nothing");
+	case '\\':
+		if (*ps->p == '\0')
+			return l7_fail(ps, "trailing \\");
+		c = *ps->p++;
+		/* fall through */
+	default:
+		f = l7_single(ps, L7_OP_CHAR, true);
+		if (f.start >= 0)
+			nfa->st[f.start].c = c;
+		return f;
+	}
+}
+
+#define L7_ISMULT(c)	((c) == '*' || (c) == '+' || (c) == '?')
+
+static struct l7_frag l7_parse_piece(struct l7_parse *ps)
+{
+	struct l7_frag a, f;
+	unsigned char op;
+	int s;
+
+	a = l7_parse_atom(ps);
+	if (a.start < 0 || !L7_ISMULT(*ps->p))
+		return a;
+
+	op = *ps->p++;
+	if (L7_ISMULT(*ps->p))
+		return l7_fail(ps, "nested *?+");
+	if (!a.width && op != '?')
+		return l7_fail(ps, "*+ operand could be empty");
+
+	s = l7_new(ps, L7_OP_SPLIT, a.start, -1);
+	if (s < 0)
+		return l7_bad;
+
+	switch (op) {
+	case '*':
+		l7_patch(ps->nfa, a.dangling, s);
+		f.start = s;
+		f.dangling = (s << 1) | 1;
+		f.width = false;
+		break;
+	case '+':
+		l7_patch(ps->nfa, a.dangling, s);
+		f.start = a.start;
+		f.dangling = (s << 1) | 1;
+		f.width = true;
+		break;
+	default:
+		f.start = s;
+		f.dangling = l7_append(ps->nfa, a.dangling, (s << 1) | 1);
+		f.width = false;
+		break;
+	}
+	return f;
+}
+
+static struct l7_frag l7_parse_branch(struct l7_parse *ps)
+{
+	struct l7_frag f, g;
+
+	if (*ps->p == '\0' || *ps->p == '|' || *ps->p == ')')
+		return l7_single(ps, L7_OP_EMPTY, false);
+
+	f = l7_parse_piece(ps);
+	while (f.start >= 0 &&
+	       *ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+		g = l7_parse_piece(ps);
+		if (g.start < 0)
+			return g;
+		l7_patch(ps->nfa, f.dangling, g.start);
+		f.dangling = g.dangling;
+		f.width |= g.width;
+	}
+	return f;
+}
+
+static struct l7_frag l7_parse_reg(struct l7_parse *ps)
+{
+	struct l7_frag f, g;
+	int s;
+
+	f = l7_parse_branch(ps);
+	while (f.start >= 0 && *ps->p == '|') {
+		ps->p++;
+		g = l7_parse_branch(ps);
+		if (g.start < 0)
+			return g;
+		s = l7_new(ps, L7_OP_SPLIT, f.start, g.start);
+		if (s < 0)
+			return l7_bad;
+		f.start = s;
+		f.dangling = l7_append(ps->nfa, f.dangling, g.dangling);
+		f.width &= g.width;
+	}
+	return f;
+}
+
+static void l7_nfa_free(struct l7_nfa *nfa)
+{
+	if (nfa) {
+		kfree(nfa->st);
+		kfree(nfa->cset);
+		kfree(nfa);
+	}
+}
+
+/*
+ * Compile one pattern.  Returns ERR_PTR(-EINVAL) with *err set if the
+ * pattern is not valid.
+ */
+static struct l7_nfa *l7_nfa_compile(const char *re, const char **err)
+{
+	struct l7_parse ps;
+	struct l7_nfa *nfa;
+	struct l7_frag f;
+	size_t len = strlen(re);
+	int m;
+
+	*err = NULL;
+	nfa = kzalloc(sizeof(*nfa), GFP_KERNEL);
+	if (!nfa)
+		return ERR_PTR(-ENOMEM);
+
+	/*
+	 * Every byte makes at most one state and one empty branch, plus the
+	 * empty branch at the start and the final match state.
+	 */
+	ps.max_st = 2 * len + 2;
+	nfa->st = kmalloc(ps.max_st * sizeof(*nfa->st), GFP_KERNEL);
+	nfa->cset = kmalloc((len + 1) * sizeof(*nfa->cset), GFP_KERNEL);
+	if (!nfa->st || !nfa->cset) {
+		l7_nfa_free(nfa);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	ps.p = (const unsigned char *)re;
+	ps.nfa = nfa;
+	ps.depth = 0;
+	ps.err = NULL;
+
+	f = l7_parse_reg(&ps);
+	if (f.start >= 0 && *ps.p != '\0')
+		l7_fail(&ps, *ps.p == ')' ? "unmatched ()" : "junk on end");
+	if (f.start >= 0 && !ps.err) {
+		m = l7_new(&ps, L7_OP_MATCH, -1, -1);
+		if (m >= 0) {
+			l7_patch(nfa, f.dangling, m);
+			nfa->start = f.start;
+		}
+	}
+	if (ps.err) {
+		*err = ps.err;
+		l7_nfa_free(nfa);
+		return ERR_PTR(-EINVAL);
+	}
+	return nfa;
+}
+
+/*
+ * Subset construction.  A DFA state is the sorted set of NFA states that
+ * matter after the epsilon closure: the ones that consume a byte, the
+ * EOL ones and the match ones.
+ */
+struct l7_build {
+	struct l7_nstate *st;
+	struct l7_cset *cset;
+	unsigned int nst;
+	int *start;
+	unsigned int nstart;
+
+	u32 *mark;
+	u32 stamp;
+	int *stack;
+	u32 *tmp;
+	unsigned int ntmp;
+
+	u32 **set;
+	unsigned int *setlen;
+	unsigned int nstates;
+	unsigned int max_states;
+	int *bucket;
+	int *chain;
+	unsigned int hmask;
+
+	u8 cls[256];
+	u8 rep[256];
+	unsigned int ncls;
+	u16 *next;
+	unsigned long *acc;
+	unsigned long *eol;
+};
+
+static bool l7_consumes(const struct l7_build *b, const struct l7_nstate *s,
+		unsigned int c)
+{
+	if (s->op == L7_OP_CHAR)
+		return s->c == c;
+	return s->op == L7_OP_SET && test_bit(c, b->cset[s->cset].map);
+}
+
+/* Add the closure of @s to b->tmp, skipping states marked in this round */
+static void l7_closure(struct l7_build *b, int s, bool bol)
+{
+	struct l7_nstate *n;
+	int sp = 0;
+
+	b->stack[sp++] = s;
+	while (sp) {
+		s = b->stack[--sp];
+		if (b->mark[s] == b->stamp)
+			continue;
+		b->mark[s] = b->stamp;
+		n = &b->st[s];
+		switch (n->op) {
+		case L7_OP_SPLIT:
+			b->stack[sp++] = n->out1;
+			b->stack[sp++] = n->out;
+			break;
+		case L7_OP_EMPTY:
+			b->stack[sp++] = n->out;
+			break;
+		case L7_OP_BOL:
+			if (bol)
+				b->stack[sp++] = n->out;
+			break;
+		default:
+			b->tmp[b->ntmp++] = s;
+			break;
+		}
+	}
+}
+
+/* Patterns that match if the data ends in the state made of @set */
+static unsigned long l7_eol_bits(struct l7_build *b, const u32 *set,
+		unsigned int n)
+{
+	unsigned long bits = 0;
+	unsigned int i, j, from;
+
+	b->stamp++;
+	b->ntmp = 0;
+	for (i = 0; i < n; i++) {
+		if (b->st[set[i]].op != L7_OP_EOL)
+			continue;
+		/* follow $ as an empty move, and any $ behind it */
+		from = b->ntmp;
+		l7_closure(b, b->st[set[i]].out, false);
+		for (j = from; j < b->ntmp; j++)
+			if (b->st[b->tmp[j]].op == L7_OP_EOL)
+				l7_closure(b, b->st[b->tmp[j]].out, false);
+	}
+	for (j = 0; j < b->ntmp; j++)
+		if (b->st[b->tmp[j]].op == L7_OP_MATCH)
+			bits |= 1UL << b->st[b->tmp[j]].c;
+	return bits;
+}
+
+static int l7_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Find or add the DFA state for the set in b->tmp */
+static int l7_state(struct l7_build *b)
+{
+	unsigned int n = b->ntmp, i, h;
+	unsigned long acc = 0;
+	u32 *set;
+	int s;
+
+	sort(b->tmp, n, sizeof(u32), l7_cmp_u32, NULL);
+	h = jhash2(b->tmp, n, n) & b->hmask;
+	for (s = b->bucket[h]; s >= 0; s = b->chain[s])
+		if (b->setlen[s] == n &&
+		    !memcmp(b->set[s], b->tmp, n * sizeof(u32)))
+			return s;
+
+	if (b->nstates == b->max_states)
+		return -E2BIG;
+	set = kmalloc(n * sizeof(u32) + 1, GFP_KERNEL);
+	if (!set)
+		return -ENOMEM;
+	memcpy(set, b->tmp, n * sizeof(u32));
+
+	s = b->nstates++;
+	b->set[s] = set;
+	b->setlen[s] = n;
+	b->chain[s] = b->bucket[h];
+	b->bucket[h] = s;
+
+	for (i = 0; i < n; i++)
+		if (b->st[set[i]].op == L7_OP_MATCH)
+			acc |= 1UL << b->st[set[i]].c;
+	b->acc[s] = acc;
+	b->eol[s] = acc | l7_eol_bits(b, set, n);
+	return s;
+}
+
+/*
+ * Split the bytes into classes that no pattern tells apart.  NUL is a
+ * class of its own and upper case letters share the class of their
+ * lower case letter.
+ */
+static int l7_classes(struct l7_build *b)
+{
+	u16 cls[256];
+	s16 *split, *map;
+	unsigned int n = 2, i, c, k;
+
+	/* a pass can at most double the classes before they are renumbered */
+	split = kmalloc(2 * 512 * sizeof(s16), GFP_KERNEL);
+	if (!split)
+		return -ENOMEM;
+	map = split + 512;
+
+	cls[0] = 0;
+	for (c = 1; c < 256; c++)
+		cls[c] = 1;
+
+	for (i = 0; i < b->nst; i++) {
+		if (b->st[i].op != L7_OP_CHAR && b->st[i].op != L7_OP_SET)
+			continue;
+		for (k = 0; k < n; k++)
+			split[k] = -1;
+		for (c = 1; c < 256; c++) {
+			if (c >= 'A' && c <= 'Z')
+				continue;
+			if (!l7_consumes(b, &b->st[i], c))
+				continue;
+			k = cls[c];
+			if (split[k] < 0)
+				split[k] = n++;
+			cls[c] = split[k];
+		}
+		/* renumber densely in byte order */
+		for (k = 0; k < n; k++)
+			map[k] = -1;
+		for (c = 0, k = 0; c < 256; c++) {
+			if (c >= 'A' && c <= 'Z')
+				continue;
+			if (map[cls[c]] < 0)
+				map[cls[c]] = k++;
+			cls[c] = map[cls[c]];
+		}
+		n = k;
+	}
+
+	for (c = 0; c < 256; c++) {
+		if (c >= 'A' && c <= 'Z')
+			cls[c] = cls[c - 'A' + 'a'];
+		b->cls[c] = cls[c];
+	}
+	for (c = 255; c < 256; c--)
+		if (c < 'A' || c > 'Z')
+			b->rep[cls[c]] = c;
+	b->ncls = n;
+	kfree(split);
+	return 0;
+}
+
+static void l7_build_free(struct l7_build *b)
+{
+	unsigned int i;
+
+	if (b->set)
+		for (i = 0; i < b->nstates; i++)
+			kfree(b->set[i]);
+	vfree(b->set);
+	vfree(b->setlen);
+	vfree(b->bucket);
+	vfree(b->chain);
+	vfree(b->st);
+	vfree(b->cset);
+	kfree(b->start);
+	vfree(b->mark);
+	vfree(b->stack);
+	vfree(b->tmp);
+	vfree(b->next);
+	vfree(b->acc);
+	vfree(b->eol);
+}
+
+static void l7_dfa_free(struct l7_dfa *dfa)
+{
+	if (dfa) {
+		vfree(dfa->next);
+		vfree(dfa->acc);
+		vfree(dfa->eol);
+		kfree(dfa);
+	}
+}
+
+/* Copy the NFAs into one array; match states carry their pattern index */
+static int l7_build_nfa(struct l7_build *b, struct l7_nfa **nfa,
+		unsigned int n)
+{
+	unsigned int i, j, base = 0, cbase = 0, ncset = 0;
+	struct l7_nstate *s;
+
+	for (i = 0; i < n; i++) {
+		b->nst += nfa[i]->nst;
+		ncset += nfa[i]->ncset;
+	}
+	b->st = vmalloc(b->nst * sizeof(*b->st));
+	b->cset = vmalloc((ncset + 1) * sizeof(*b->cset));
+	b->start = kmalloc(n * sizeof(int), GFP_KERNEL);
+	if (!b->st || !b->cset || !b->start)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		memcpy(b->cset + cbase, nfa[i]->cset,
+				nfa[i]->ncset * sizeof(*b->cset));
+		for (j = 0; j < nfa[i]->nst; j++) {
+			s = &b->st[base + j];
+			*s = nfa[i]->st[j];
+			if (s->out >= 0)
+				s->out += base;
+			if (s->out1 >= 0)
+				s->out1 += base;
+			if (s->op == L7_OP_SET)
+				s->cset += cbase;
+			if (s->op == L7_OP_MATCH)
+				s->c = i;
+		}
+		b->start[i] = nfa[i]->start + base;
+		base += nfa[i]->nst;
+		cbase += nfa[i]->ncset;
+	}
+	b->nstart = n;
+	return 0;
+}
+
+/*
+ * Build the DFA tracking @n patterns at once.  Returns ERR_PTR(-E2BIG)
+ * if it would need more than @max_states states.
+ */
+static struct l7_dfa *l7_dfa_build(struct l7_nfa **nfa, unsigned int n,
+		unsigned int max_states)
+{
+	struct l7_build b;
+	struct l7_dfa *dfa = NULL;
+	unsigned int i, j, k, hsize;
+	u32 *restart = NULL;
+	unsigned int nrestart, restart_state;
+	int s, err;
+
+	if (n == 0 || n > L7_DFA_GROUP_MAX)
+		return ERR_PTR(-EINVAL);
+	max_states = clamp_t(unsigned int, max_states, 2, L7_DFA_STATES_MAX);
+
+	memset(&b, 0, sizeof(b));
+	err = l7_build_nfa(&b, nfa, n);
+	if (!err)
+		err = l7_classes(&b);
+	if (err)
+		goto out;
+
+	hsize = roundup_pow_of_two(2 * max_states);
+	b.hmask = hsize - 1;
+	b.max_states = max_states;
+	b.mark = vmalloc(b.nst * sizeof(u32));
+	b.stack = vmalloc((2 * b.nst + 1) * sizeof(int));
+	b.tmp = vmalloc(b.nst * sizeof(u32));
+	b.set = vmalloc(max_states * sizeof(u32 *));
+	b.setlen = vmalloc(max_states * sizeof(unsigned int));
+	b.bucket = vmalloc(hsize * sizeof(int));
+	b.chain = vmalloc(max_states * sizeof(int));
+	b.next = vmalloc(max_states * b.ncls * sizeof(u16));
+	b.acc = vmalloc(max_states * sizeof(unsigned long));
+	b.eol = vmalloc(max_states * sizeof(unsigned long));
+	restart = kmalloc(b.nst * sizeof(u32) + 1, GFP_KERNEL);
+	err = -ENOMEM;
+	if (!b.mark || !b.stack || !b.tmp || !b.set || !b.setlen ||
+	    !b.bucket || !b.chain || !b.next || !b.acc || !b.eol || !restart)
+		goto out;
+	memset(b.mark, 0, b.nst * sizeof(u32));
+	memset(b.bucket, 0xff, hsize * sizeof(int));
+
+	/* the start of the data, where ^ matches */
+	b.stamp++;
+	b.ntmp = 0;
+	for (i = 0; i < n; i++)
+		l7_closure(&b, b.start[i], true);
+	s = l7_state(&b);
+	if (s < 0) {
+		err = s;
+		goto out;
+	}
+
+	/*
+	 * Every pattern may also start at any later byte: that set is
+	 * added to the states reached by each byte.
+	 */
+	b.stamp++;
+	b.ntmp = 0;
+	for (i = 0; i < n; i++)
+		l7_closure(&b, b.start[i], false);
+	nrestart = b.ntmp;
+	memcpy(restart, b.tmp, nrestart * sizeof(u32));
+	s = l7_state(&b);
+	if (s < 0) {
+		err = s;
+		goto out;
+	}
+	restart_state = s;
+
+	for (i = 0; i < b.nstates; i++) {
+		for (k = 0; k < b.ncls; k++) {
+			if (k == b.cls[0]) {
+				/* NUL is skipped */
+				b.next[i * b.ncls + k] = i;
+				continue;
+			}
+			b.stamp++;
+			b.ntmp = 0;
+			for (j = 0; j < nrestart; j++) {
+				b.mark[restart[j]] = b.stamp;
+				b.tmp[b.ntmp++] = restart[j];
+			}
+			for (j = 0; j < b.setlen[i]; j++) {
+				struct l7_nstate *ns = &b.st[b.set[i][j]];
+
+				if (l7_consumes(&b, ns, b.rep[k]))
+					l7_closure(&b, ns->out, false);
+			}
+			s = l7_state(&b);
+			if (s < 0) {
+				err = s;
+				goto out;
+			}
+			b.next[i * b.ncls + k] = s;
+		}
+	}
+
+	err = -ENOMEM;
+	dfa = kzalloc(sizeof(*dfa), GFP_KERNEL);
+	if (!dfa)
+		goto out;
+	dfa->nstates = b.nstates;
+	dfa->ncls = b.ncls;
+	dfa->start = 0;
+	dfa->restart = restart_state;
+	memcpy(dfa->cls, b.cls, sizeof(dfa->cls));
+	dfa->next = vmalloc(b.nstates * b.ncls * sizeof(u16));
+	dfa->acc = vmalloc(b.nstates * sizeof(unsigned long));
+	dfa->eol = vmalloc(b.nstates * sizeof(unsigned long));
+	if (!dfa->next || !dfa->acc || !dfa->eol) {
+		l7_dfa_free(dfa);
+		dfa = NULL;
+		goto out;
+	}
+	memcpy(dfa->next, b.next, b.nstates * b.ncls * sizeof(u16));
+	memcpy(dfa->acc, b.acc, b.nstates * sizeof(unsigned long));
+	memcpy(dfa->eol, b.eol, b.nstates * sizeof(unsigned long));
+	err = 0;
+out:
+	kfree(restart);
+	l7_build_free(&b);
+	return err ? ERR_PTR(err) : dfa;
+}
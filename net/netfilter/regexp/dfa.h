@@ -0,0 +1,66 @@
+/*
+ * Multi-pattern DFA for the layer7 match.
+ *
+ * Patterns use the Henry Spencer regexp syntax l7-filter has always
+ * accepted: ^ $ . [] [^] () | ? * + and \c.  Each pattern is parsed once
+ * into a Thompson NFA, and a group of NFAs is turned into one DFA by
+ * subset construction, so a single pass over the data tracks every
+ * pattern of the group.  Like regexec() on the stored application data,
+ * a pattern matches anywhere in the data unless it starts with ^, and
+ * $ matches at the end of the data seen so far.
+ *
+ * The input is folded into byte classes.  Upper case ASCII goes to the
+ * class of its lower case letter and NUL never changes the state, which
+ * is what the match used to do when it copied packet data into the
+ * conntrack.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _L7_DFA_H
+#define _L7_DFA_H
+
+/* patterns tracked by one DFA, one bit of an unsigned long each */
+#define L7_DFA_GROUP_MAX	BITS_PER_LONG
+
+/* state numbers are u16 */
+#define L7_DFA_STATES_MAX	65535
+
+struct l7_nfa;
+
+struct l7_dfa {
+	unsigned int nstates;
+	unsigned int ncls;
+	unsigned int start;	/* state at the start of the data */
+	unsigned int restart;	/* state to resume from the middle of it */
+	u8 cls[256];		/* byte -> class */
+	unsigned long *acc;	/* per state: patterns matched on entering it */
+	unsigned long *eol;	/* per state: patterns matched if data ends */
+	u16 *next;		/* nstates x ncls transitions */
+};
+
+/*
+ * Run @len bytes through @dfa from state @s.  Every pattern matched on
+ * the way is or'ed into @acc; the new state is returned.
+ */
+static inline unsigned int l7_dfa_scan(const struct l7_dfa *dfa,
+		unsigned int s, const unsigned char *p, unsigned int len,
+		unsigned long *acc)
+{
+	const u16 *next = dfa->next;
+	const unsigned long *sacc = dfa->acc;
+	unsigned int ncls = dfa->ncls;
+	unsigned long a = *acc;
+
+	while (len--) {
+		s = next[s * ncls + dfa->cls[*p++]];
+		a |= sacc[s];
+	}
+	*acc = a;
+	return s;
+}
+
+#endif /* _L7_DFA_H */
@@ -701,6 +701,7 @@ void xt_free_table_info(struct xt_table_info *info)
 		kfree(info->jumpstack);
 
 	free_percpu(info->stackptr);
+	vfree(info->classifier);
 
 	kfree(info);
 }
@@ -33,8 +33,11 @@
 #include <linux/netfilter/xt_layer7.h>
 #include <linux/ctype.h>
 #include <linux/proc_fs.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/jhash.h>
 
-#include "regexp/regexp.c"
+#include "regexp/dfa.c"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Matthew Strait <quadong@users.sf.net>, Ethan Sommer <sommere@users.sf.net>");
@@ -45,6 +48,9 @@ MODULE_VERSION("2.21");
 static int maxdatalen = 2048; // this is the default
 module_param(maxdatalen, int, 0444);
 MODULE_PARM_DESC(maxdatalen, "maximum bytes of data looked at by l7-filter");
+static int dfa_states = 2048;
+module_param(dfa_states, int, 0444);
+MODULE_PARM_DESC(dfa_states, "maximum states of one pattern group DFA");
 #ifdef CONFIG_NETFILTER_XT_MATCH_LAYER7_DEBUG
 	#define DPRINTK(format,args...) printk(format,##args)
 #else
@@ -55,13 +61,77 @@ MODULE_PARM_DESC(maxdatalen, "maximum bytes of data looked at by l7-filter");
 This can be modified through /proc/net/layer7_numpackets */
 static int num_packets = 10;
 
-static struct pattern_cache {
-	char * regex_string;
-	regexp * pattern;
-	struct pattern_cache * next;
-} * first_pattern_cache = NULL;
+/*
+ * Patterns are compiled once, when the first rule using them is loaded,
+ * and packed into groups of up to L7_DFA_GROUP_MAX patterns that share
+ * one DFA.  A connection keeps one DFA state per group in its conntrack,
+ * so each byte of application data is looked at once per group, however
+ * many layer7 rules there are, and never again on later packets.
+ *
+ * What the packet path sees is an l7_engine: a read-only snapshot of the
+ * groups and of a table from protocol name to (group, bit).  Loading or
+ * unloading a pattern builds a new snapshot under l7_mutex and swaps it
+ * in with RCU.  Nothing is locked per packet except the conntrack.
+ */
+struct l7_group;
+
+/* one protocol/pattern pair, shared by the rules that use it */
+struct l7_pattern {
+	struct list_head list;
+	unsigned int users;
+	u32 hash;			/* of protocol */
+	struct l7_nfa *nfa;		/* NULL if the pattern does not compile */
+	struct l7_group *group;		/* NULL if not in any DFA */
+	unsigned int bit;
+	char *protocol;
+	char *regex;
+};
 
-DEFINE_SPINLOCK(l7_lock);
+struct l7_group {
+	struct list_head list;		/* on l7_groups while current */
+	unsigned int refs;		/* l7_groups and engines using it */
+	unsigned int live;
+	/* pat[bit], NULL once unloaded; the DFA keeps tracking the bit */
+	struct l7_pattern *pat[L7_DFA_GROUP_MAX];
+	unsigned int npat;
+	struct l7_dfa *dfa;
+};
+
+struct l7_entry {
+	struct l7_pattern *pat;
+	u32 hash;
+	u16 group;
+	u8 bit;
+	u8 unique;			/* no other pattern for the protocol */
+	int next;
+};
+
+#define L7_HASH_SIZE	64
+
+struct l7_engine {
+	unsigned int gen;
+	unsigned int ngroups;
+	struct l7_group **group;
+	struct l7_entry *entry;
+	int hash[L7_HASH_SIZE];
+};
+
+/* Per connection scanner state, ct->layer7.scan */
+struct xt_layer7_scan {
+	unsigned int gen;		/* engine the states belong to */
+	unsigned int len;		/* bytes looked at */
+	unsigned int ngroups;
+	struct {
+		unsigned long acc;	/* patterns matched so far */
+		unsigned int state;
+	} g[0];
+};
+
+static DEFINE_MUTEX(l7_mutex);
+static LIST_HEAD(l7_patterns);
+static LIST_HEAD(l7_groups);
+static unsigned int l7_gen;
+static struct l7_engine *l7_engine;
 
 static int total_acct_packets(struct nf_conn *ct)
 {
@@ -79,135 +149,367 @@ static int total_acct_packets(struct nf_conn *ct)
 #endif
 }
 
-#ifdef CONFIG_IP_NF_MATCH_LAYER7_DEBUG
-/* Converts an unfriendly string into a friendly one by
-replacing unprintables with periods and all whitespace with " ". */
-static char * friendly_print(unsigned char * s)
+
+static void l7_group_put(struct l7_group *g)
 {
-	char * f = kmalloc(strlen(s) + 1, GFP_ATOMIC);
-	int i;
+	if (--g->refs == 0) {
+		l7_dfa_free(g->dfa);
+		kfree(g);
+	}
+}
 
-	if(!f) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in "
-					"friendly_print, bailing.\n");
+static void l7_engine_free(struct l7_engine *eng)
+{
+	unsigned int i;
+
+	if (!eng)
+		return;
+	for (i = 0; i < eng->ngroups; i++)
+		l7_group_put(eng->group[i]);
+	kfree(eng);
+}
+
+/*
+ * Snapshot l7_groups and l7_patterns.  In the unload path this must not
+ * fail, so the caller passes __GFP_NOFAIL; the snapshot is small.
+ */
+static struct l7_engine *l7_engine_build(gfp_t gfp)
+{
+	struct l7_engine *eng;
+	struct l7_pattern *pat, *other;
+	struct l7_group *g;
+	struct l7_entry *e;
+	unsigned int ngroups = 0, npat = 0, i = 0, n = 0;
+
+	list_for_each_entry(g, &l7_groups, list)
+		ngroups++;
+	list_for_each_entry(pat, &l7_patterns, list)
+		npat++;
+
+	eng = kzalloc(sizeof(*eng) + ngroups * sizeof(*eng->group) +
+			npat * sizeof(*eng->entry), gfp);
+	if (!eng)
 		return NULL;
-	}
+	eng->group = (struct l7_group **)(eng + 1);
+	eng->entry = (struct l7_entry *)(eng->group + ngroups);
+	memset(eng->hash, 0xff, sizeof(eng->hash));
 
-	for(i = 0; i < strlen(s); i++){
-		if(isprint(s[i]) && s[i] < 128)	f[i] = s[i];
-		else if(isspace(s[i]))		f[i] = ' ';
-		else 				f[i] = '.';
+	list_for_each_entry(g, &l7_groups, list) {
+		g->refs++;
+		eng->group[i++] = g;
+	}
+	eng->ngroups = ngroups;
+
+	list_for_each_entry(pat, &l7_patterns, list) {
+		if (!pat->group)
+			continue;
+		e = &eng->entry[n];
+		e->pat = pat;
+		e->hash = pat->hash;
+		e->bit = pat->bit;
+		for (i = 0; eng->group[i] != pat->group; i++)
+			;
+		e->group = i;
+		e->unique = 1;
+		list_for_each_entry(other, &l7_patterns, list)
+			if (other != pat && other->hash == pat->hash &&
+			    !strcmp(other->protocol, pat->protocol))
+				e->unique = 0;
+		e->next = eng->hash[pat->hash % L7_HASH_SIZE];
+		eng->hash[pat->hash % L7_HASH_SIZE] = n++;
 	}
-	f[i] = '\0';
-	return f;
+	eng->gen = ++l7_gen;
+	return eng;
 }
 
-static char dec2hex(int i)
+static void l7_engine_publish(struct l7_engine *eng)
 {
-	switch (i) {
-		case 0 ... 9:
-			return (i + '0');
-			break;
-		case 10 ... 15:
-			return (i - 10 + 'a');
-			break;
-		default:
-			if (net_ratelimit())
-				printk("layer7: Problem in dec2hex\n");
-			return '\0';
+	struct l7_engine *old = l7_engine;
+
+	rcu_assign_pointer(l7_engine, eng);
+	synchronize_rcu();
+	l7_engine_free(old);
+}
+
+/* Build a group from @g's live patterns plus @pat */
+static struct l7_group *l7_group_new(struct l7_group *g,
+		struct l7_pattern *pat)
+{
+	struct l7_nfa *nfa[L7_DFA_GROUP_MAX];
+	struct l7_group *ng;
+	unsigned int i, n = 0;
+
+	ng = kzalloc(sizeof(*ng), GFP_KERNEL);
+	if (!ng)
+		return ERR_PTR(-ENOMEM);
+	for (i = 0; g && i < g->npat; i++)
+		if (g->pat[i])
+			ng->pat[n++] = g->pat[i];
+	ng->pat[n++] = pat;
+	for (i = 0; i < n; i++)
+		nfa[i] = ng->pat[i]->nfa;
+
+	ng->dfa = l7_dfa_build(nfa, n, dfa_states);
+	if (IS_ERR(ng->dfa)) {
+		int err = PTR_ERR(ng->dfa);
+
+		kfree(ng);
+		return ERR_PTR(err);
 	}
+	ng->npat = ng->live = n;
+	ng->refs = 1;
+	return ng;
 }
 
-static char * hex_print(unsigned char * s)
+/*
+ * Put a newly compiled pattern into the last group, or into a new one
+ * when the last group is full or its DFA would grow too large.
+ */
+static int l7_group_add(struct l7_pattern *pat)
 {
-	char * g = kmalloc(strlen(s)*3 + 1, GFP_ATOMIC);
-	int i;
+	struct l7_group *last = NULL, *g = ERR_PTR(-E2BIG);
+	unsigned int i;
 
-	if(!g) {
-	       if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in hex_print, "
-					"bailing.\n");
-	       return NULL;
+	if (!list_empty(&l7_groups)) {
+		last = list_entry(l7_groups.prev, struct l7_group, list);
+		if (last->live < L7_DFA_GROUP_MAX)
+			g = l7_group_new(last, pat);
 	}
+	if (PTR_ERR(g) == -E2BIG) {
+		last = NULL;
+		g = l7_group_new(NULL, pat);
+	}
+	if (IS_ERR(g))
+		return PTR_ERR(g);
 
-	for(i = 0; i < strlen(s); i++) {
-		g[i*3    ] = dec2hex(s[i]/16);
-		g[i*3 + 1] = dec2hex(s[i]%16);
-		g[i*3 + 2] = ' ';
+	for (i = 0; i < g->npat; i++) {
+		g->pat[i]->group = g;
+		g->pat[i]->bit = i;
 	}
-	g[i*3] = '\0';
+	if (last) {
+		list_replace(&last->list, &g->list);
+		l7_group_put(last);
+	} else
+		list_add_tail(&g->list, &l7_groups);
+	return 0;
+}
+
+static struct l7_pattern *l7_pattern_find(const struct xt_layer7_info *info)
+{
+	struct l7_pattern *pat;
+
+	list_for_each_entry(pat, &l7_patterns, list)
+		if (!strcmp(pat->protocol, info->protocol) &&
+		    !strcmp(pat->regex, info->pattern))
+			return pat;
+	return NULL;
+}
+
+/* "unknown" and "unset" are states of the classification, not patterns */
+static bool l7_pseudo_protocol(const struct xt_layer7_info *info)
+{
+	return !strcmp(info->protocol, "unknown") ||
+	       !strcmp(info->protocol, "unset");
+}
 
-	return g;
+static void l7_pattern_free(struct l7_pattern *pat)
+{
+	if (!IS_ERR_OR_NULL(pat->nfa))
+		l7_nfa_free(pat->nfa);
+	kfree(pat->protocol);
+	kfree(pat->regex);
+	kfree(pat);
 }
-#endif // DEBUG
 
-/* Use instead of regcomp.  As we expect to be seeing the same regexps over and
-over again, it make sense to cache the results. */
-static regexp * compile_and_cache(const char * regex_string,
-                                  const char * protocol)
+/*
+ * Replaces compile_and_cache(): called from checkentry, so patterns are
+ * compiled when rules are loaded instead of on the first packet.  A
+ * pattern that does not compile is still accepted, as before, and never
+ * matches.
+ */
+static int l7_pattern_get(const struct xt_layer7_info *info)
 {
-	struct pattern_cache * node               = first_pattern_cache;
-	struct pattern_cache * last_pattern_cache = first_pattern_cache;
-	struct pattern_cache * tmp;
-	unsigned int len;
+	struct l7_pattern *pat;
+	struct l7_engine *eng;
+	const char *err;
+	int ret = 0;
+
+	if (l7_pseudo_protocol(info))
+		return 0;
 
-	while (node != NULL) {
-		if (!strcmp(node->regex_string, regex_string))
-		return node->pattern;
+	mutex_lock(&l7_mutex);
+	pat = l7_pattern_find(info);
+	if (pat) {
+		pat->users++;
+		goto out;
+	}
 
-		last_pattern_cache = node;/* points at the last non-NULL node */
-		node = node->next;
+	ret = -ENOMEM;
+	pat = kzalloc(sizeof(*pat), GFP_KERNEL);
+	if (!pat)
+		goto out;
+	pat->users = 1;
+	pat->protocol = kstrdup(info->protocol, GFP_KERNEL);
+	pat->regex = kstrdup(info->pattern, GFP_KERNEL);
+	if (!pat->protocol || !pat->regex)
+		goto free;
+	pat->hash = jhash(pat->protocol, strlen(pat->protocol), 0);
+
+	DPRINTK("About to compile this: \"%s\"\n", pat->regex);
+	pat->nfa = l7_nfa_compile(pat->regex, &err);
+	if (PTR_ERR(pat->nfa) == -ENOMEM)
+		goto free;
+	if (IS_ERR(pat->nfa)) {
+		printk(KERN_ERR "layer7: Error compiling regexp \"%s\" "
+				"(%s): %s\n", pat->regex, pat->protocol, err);
+		pat->nfa = NULL;
+	} else {
+		ret = l7_group_add(pat);
+		if (ret == -E2BIG) {
+			printk(KERN_ERR "layer7: regexp for %s needs more "
+					"than %d DFA states, raise dfa_states\n",
+					pat->protocol, dfa_states);
+		} else if (ret)
+			goto free;
 	}
 
-	/* If we reach the end of the list, then we have not yet cached
-	   the pattern for this regex. Let's do that now.
-	   Be paranoid about running out of memory to avoid list corruption. */
-	tmp = kmalloc(sizeof(struct pattern_cache), GFP_ATOMIC);
+	/* the new pattern is in the engine only if it is in a group */
+	list_add_tail(&pat->list, &l7_patterns);
+	eng = l7_engine_build(GFP_KERNEL | __GFP_NOFAIL);
+	l7_engine_publish(eng);
+	ret = 0;
+	goto out;
+free:
+	l7_pattern_free(pat);
+out:
+	mutex_unlock(&l7_mutex);
+	return ret;
+}
 
-	if(!tmp) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in "
-					"compile_and_cache, bailing.\n");
-		return NULL;
+static void l7_pattern_put(const struct xt_layer7_info *info)
+{
+	struct l7_pattern *pat;
+	struct l7_group *g;
+
+	if (l7_pseudo_protocol(info))
+		return;
+
+	mutex_lock(&l7_mutex);
+	pat = l7_pattern_find(info);
+	if (!pat || --pat->users)
+		goto out;
+
+	list_del(&pat->list);
+	g = pat->group;
+	if (g) {
+		g->pat[pat->bit] = NULL;
+		if (--g->live == 0) {
+			list_del(&g->list);
+			l7_group_put(g);
+		}
 	}
+	l7_engine_publish(l7_engine_build(GFP_KERNEL | __GFP_NOFAIL));
+	l7_pattern_free(pat);
+out:
+	mutex_unlock(&l7_mutex);
+}
 
-	tmp->regex_string  = kmalloc(strlen(regex_string) + 1, GFP_ATOMIC);
-	tmp->pattern       = kmalloc(sizeof(struct regexp),    GFP_ATOMIC);
-	tmp->next = NULL;
+/* Find the (group, bit) of a rule's pattern.  Called under RCU. */
+static const struct l7_entry *l7_lookup(const struct l7_engine *eng,
+		const struct xt_layer7_info *info)
+{
+	const struct l7_entry *e;
+	u32 hash = jhash(info->protocol, strlen(info->protocol), 0);
+	int i;
 
-	if(!tmp->regex_string || !tmp->pattern) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in "
-					"compile_and_cache, bailing.\n");
-		kfree(tmp->regex_string);
-		kfree(tmp->pattern);
-		kfree(tmp);
-		return NULL;
+	for (i = eng->hash[hash % L7_HASH_SIZE]; i >= 0; i = e->next) {
+		e = &eng->entry[i];
+		if (e->hash == hash && !strcmp(e->pat->protocol, info->protocol)
+		    && (e->unique || !strcmp(e->pat->regex, info->pattern)))
+			return e;
 	}
+	return NULL;
+}
 
-	/* Ok.  The new node is all ready now. */
-	node = tmp;
+/*
+ * Start scanning with the groups of @eng, reusing @scan if it is big
+ * enough.  A connection that was being scanned when the patterns changed
+ * resumes from the middle of the stream: the new DFAs cannot know what
+ * the old ones had seen, so ^ patterns cannot match on it any more.
+ */
+static struct xt_layer7_scan *l7_scan_init(const struct l7_engine *eng,
+		struct xt_layer7_scan *scan)
+{
+	const struct l7_dfa *dfa;
+	bool resume = scan != NULL;
+	unsigned int i, len = scan ? scan->len : 0;
 
-	if(first_pattern_cache == NULL) /* list is empty */
-		first_pattern_cache = node; /* make node the beginning */
-	else
-		last_pattern_cache->next = node; /* attach node to the end */
+	if (scan && scan->ngroups < eng->ngroups) {
+		kfree(scan);
+		scan = NULL;
+	}
+	if (!scan) {
+		scan = kmalloc(sizeof(*scan) + eng->ngroups * sizeof(scan->g[0]),
+				GFP_ATOMIC);
+		if (!scan)
+			return NULL;
+	}
 
-	/* copy the string and compile the regex */
-	len = strlen(regex_string);
-	DPRINTK("About to compile this: \"%s\"\n", regex_string);
-	node->pattern = regcomp((char *)regex_string, &len);
-	if ( !node->pattern ) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: Error compiling regexp "
-					"\"%s\" (%s)\n",
-					regex_string, protocol);
-		/* pattern is now cached as NULL, so we won't try again. */
+	scan->gen = eng->gen;
+	scan->len = len;
+	scan->ngroups = eng->ngroups;
+	for (i = 0; i < eng->ngroups; i++) {
+		dfa = eng->group[i]->dfa;
+		scan->g[i].state = resume ? dfa->restart : dfa->start;
+		scan->g[i].acc = dfa->acc[scan->g[i].state];
 	}
+	return scan;
+}
+
+/* Run new application data through every group.  Returns bytes used. */
+static unsigned int l7_scan_feed(const struct l7_engine *eng,
+		struct xt_layer7_scan *scan, const unsigned char *data,
+		unsigned int len)
+{
+	unsigned int i;
+
+	if (scan->len >= maxdatalen - 1)
+		return 0;
+	len = min(len, maxdatalen - 1 - scan->len);
+	for (i = 0; i < scan->ngroups; i++)
+		scan->g[i].state = l7_dfa_scan(eng->group[i]->dfa,
+				scan->g[i].state, data, len, &scan->g[i].acc);
+	scan->len += len;
+	return len;
+}
+
+static bool l7_scan_matched(const struct l7_engine *eng,
+		const struct xt_layer7_scan *scan, const struct l7_entry *e)
+{
+	const struct l7_dfa *dfa = eng->group[e->group]->dfa;
+	unsigned long bits = scan->g[e->group].acc |
+			     dfa->eol[scan->g[e->group].state];
+
+	return bits & (1UL << e->bit);
+}
+
+/* Classify @ct; called with ct->lock held */
+static void l7_set_proto(struct nf_conn *ct, const char *protocol)
+{
+	char *p;
 
-	strcpy(node->regex_string, regex_string);
-	return node->pattern;
+	if (ct->layer7.app_proto)
+		return;
+	p = kstrdup(protocol, GFP_ATOMIC);
+	if (!p) {
+		if (net_ratelimit())
+			printk(KERN_ERR "layer7: out of memory in "
+					"l7_set_proto, bailing.\n");
+		return;
+	}
+	/* lockless readers see the string before the pointer */
+	smp_wmb();
+	ct->layer7.app_proto = p;
 }
 
 static int can_handle(const struct sk_buff *skb)
@@ -255,94 +557,36 @@ static int match_no_append(struct nf_conn * conntrack,
                            enum ip_conntrack_info master_ctinfo,
                            const struct xt_layer7_info * info)
 {
-	/* If we're in here, throw the app data away */
-	if(master_conntrack->layer7.app_data != NULL) {
-
-	#ifdef CONFIG_IP_NF_MATCH_LAYER7_DEBUG
-		if(!master_conntrack->layer7.app_proto) {
-			char * f =
-			  friendly_print(master_conntrack->layer7.app_data);
-			char * g =
-			  hex_print(master_conntrack->layer7.app_data);
-			DPRINTK("\nl7-filter gave up after %d bytes "
-				"(%d packets):\n%s\n",
-				strlen(f), total_acct_packets(master_conntrack), f);
-			kfree(f);
-			DPRINTK("In hex: %s\n", g);
-			kfree(g);
-		}
-	#endif
+	const char *app_proto;
+
+	spin_lock_bh(&master_conntrack->lock);
+	/* If we're in here, throw the scanner state away */
+	if(master_conntrack->layer7.scan != NULL) {
+		DPRINTK("\nl7-filter gave up after %u bytes (%d packets)\n",
+			master_conntrack->layer7.scan->len,
+			total_acct_packets(master_conntrack));
+		kfree(master_conntrack->layer7.scan);
+		master_conntrack->layer7.scan = NULL; /* don't free again */
+	}
 
-		kfree(master_conntrack->layer7.app_data);
-		master_conntrack->layer7.app_data = NULL; /* don't free again */
-	}
-
-	if(master_conntrack->layer7.app_proto){
-		/* Here child connections set their .app_proto (for /proc) */
-		if(!conntrack->layer7.app_proto) {
-			conntrack->layer7.app_proto =
-			  kmalloc(strlen(master_conntrack->layer7.app_proto)+1,
-			    GFP_ATOMIC);
-			if(!conntrack->layer7.app_proto){
-				if (net_ratelimit())
-					printk(KERN_ERR "layer7: out of memory "
-							"in match_no_append, "
-							"bailing.\n");
-				return 1;
-			}
-			strcpy(conntrack->layer7.app_proto,
-				master_conntrack->layer7.app_proto);
-		}
+	/* If not classified, set to "unknown" to distinguish from
+	connections that are still being tested. */
+	app_proto = master_conntrack->layer7.app_proto;
+	if(!app_proto)
+		l7_set_proto(master_conntrack, "unknown");
+	spin_unlock_bh(&master_conntrack->lock);
 
-		return (!strcmp(master_conntrack->layer7.app_proto,
-				info->protocol));
-	}
-	else {
-		/* If not classified, set to "unknown" to distinguish from
-		connections that are still being tested. */
-		master_conntrack->layer7.app_proto =
-			kmalloc(strlen("unknown")+1, GFP_ATOMIC);
-		if(!master_conntrack->layer7.app_proto){
-			if (net_ratelimit())
-				printk(KERN_ERR "layer7: out of memory in "
-						"match_no_append, bailing.\n");
-			return 1;
-		}
-		strcpy(master_conntrack->layer7.app_proto, "unknown");
+	if(!app_proto)
 		return 0;
-	}
-}
 
-/* add the new app data to the conntrack.  Return number of bytes added. */
-static int add_data(struct nf_conn * master_conntrack,
-                    char * app_data, int appdatalen)
-{
-	int length = 0, i;
-	int oldlength = master_conntrack->layer7.app_data_len;
-
-	/* This is a fix for a race condition by Deti Fliegl. However, I'm not
-	   clear on whether the race condition exists or whether this really
-	   fixes it.  I might just be being dense... Anyway, if it's not really
-	   a fix, all it does is waste a very small amount of time. */
-	if(!master_conntrack->layer7.app_data) return 0;
-
-	/* Strip nulls. Make everything lower case (our regex lib doesn't
-	do case insensitivity).  Add it to the end of the current data. */
-	for(i = 0; i < maxdatalen-oldlength-1 &&
-		   i < appdatalen; i++) {
-		if(app_data[i] != '\0') {
-			/* the kernel version of tolower mungs 'upper ascii' */
-			master_conntrack->layer7.app_data[length+oldlength] =
-				isascii(app_data[i])?
-					tolower(app_data[i]) : app_data[i];
-			length++;
-		}
+	/* Here child connections set their .app_proto (for /proc) */
+	if(conntrack != master_conntrack && !conntrack->layer7.app_proto) {
+		spin_lock_bh(&conntrack->lock);
+		l7_set_proto(conntrack, app_proto);
+		spin_unlock_bh(&conntrack->lock);
 	}
 
-	master_conntrack->layer7.app_data[length+oldlength] = '\0';
-	master_conntrack->layer7.app_data_len = length + oldlength;
-
-	return length;
+	return (!strcmp(app_proto, info->protocol));
 }
 
 /* taken from drivers/video/modedb.c */
@@ -412,6 +656,31 @@ static int layer7_write_proc(struct file* file, const char* buffer,
 	return count;
 }
 
+/* write out the pattern groups: one line per DFA and its protocols */
+static int layer7_dfa_read_proc(char* page, char ** start, off_t off,
+                                int count, int* eof, void * data)
+{
+	struct l7_group *g;
+	unsigned int i, n = 0, len = 0;
+
+	mutex_lock(&l7_mutex);
+	list_for_each_entry(g, &l7_groups, list) {
+		len += scnprintf(page + len, count - len,
+				"group %u: %u states %u classes:", n++,
+				g->dfa->nstates, g->dfa->ncls);
+		for (i = 0; i < g->npat; i++)
+			if (g->pat[i])
+				len += scnprintf(page + len, count - len,
+						" %s", g->pat[i]->protocol);
+		len += scnprintf(page + len, count - len, "\n");
+	}
+	mutex_unlock(&l7_mutex);
+
+	*eof=1;
+
+	return len;
+}
+
 static bool
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35)
 match(const struct sk_buff *skbin, struct xt_action_param *par)
@@ -442,14 +711,12 @@ match(const struct sk_buff *skbin,
 	struct nf_conn *master_conntrack, *conntrack;
 	unsigned char * app_data;
 	unsigned int pattern_result, appdatalen;
-	regexp * comppattern;
-
-	/* Be paranoid/incompetent - lock the entire match function. */
-	spin_lock_bh(&l7_lock);
+	const struct l7_engine *eng;
+	const struct l7_entry *entry;
+	struct xt_layer7_scan *scan;
 
 	if(!can_handle(skb)){
 		DPRINTK("layer7: This is some protocol I can't handle.\n");
-		spin_unlock_bh(&l7_lock);
 		return info->invert;
 	}
 
@@ -459,7 +726,6 @@ match(const struct sk_buff *skbin,
 	if(!(conntrack = nf_ct_get(skb, &ctinfo)) ||
 	   !(master_conntrack=nf_ct_get(skb,&master_ctinfo))){
 		DPRINTK("layer7: couldn't get conntrack.\n");
-		spin_unlock_bh(&l7_lock);
 		return info->invert;
 	}
 
@@ -470,7 +736,7 @@ match(const struct sk_buff *skbin,
 	/* if we've classified it or seen too many packets */
 	if(total_acct_packets(master_conntrack) > num_packets ||
 	   master_conntrack->layer7.app_proto) {
-
+no_append:
 		pattern_result = match_no_append(conntrack, master_conntrack,
 						 ctinfo, master_ctinfo, info);
 
@@ -481,7 +747,6 @@ match(const struct sk_buff *skbin,
 		else in the skbs that make it here. */
 		skb->cb[0] = 1; /* marking it seen here's probably irrelevant */
 
-		spin_unlock_bh(&l7_lock);
 		return (pattern_result ^ info->invert);
 	}
 
@@ -490,7 +755,6 @@ match(const struct sk_buff *skbin,
 			if (net_ratelimit())
 				printk(KERN_ERR "layer7: failed to linearize "
 						"packet, bailing.\n");
-			spin_unlock_bh(&l7_lock);
 			return info->invert;
 		}
 	}
@@ -499,41 +763,48 @@ match(const struct sk_buff *skbin,
 	app_data = skb->data + app_data_offset(skb);
 	appdatalen = skb_tail_pointer(skb) - app_data;
 
-	/* the return value gets checked later, when we're ready to use it */
-	comppattern = compile_and_cache(info->pattern, info->protocol);
+	/* Per connection lock: the two directions of a connection may be
+	being handled on different CPUs. */
+	rcu_read_lock();
+	eng = rcu_dereference(l7_engine);
+	spin_lock_bh(&master_conntrack->lock);
+
+	if(master_conntrack->layer7.app_proto) {
+		/* classified on another CPU meanwhile */
+		spin_unlock_bh(&master_conntrack->lock);
+		rcu_read_unlock();
+		goto no_append;
+	}
 
-	/* On the first packet of a connection, allocate space for app data */
+	/* On the first packet of a connection, set up the scanner */
+	scan = master_conntrack->layer7.scan;
 	if(total_acct_packets(master_conntrack) == 1 && !skb->cb[0] &&
-	   !master_conntrack->layer7.app_data){
-		master_conntrack->layer7.app_data =
-			kmalloc(maxdatalen, GFP_ATOMIC);
-		if(!master_conntrack->layer7.app_data){
+	   !scan){
+		scan = l7_scan_init(eng, NULL);
+		master_conntrack->layer7.scan = scan;
+		if(!scan){
 			if (net_ratelimit())
 				printk(KERN_ERR "layer7: out of memory in "
 						"match, bailing.\n");
-			spin_unlock_bh(&l7_lock);
-			return info->invert;
+			goto out_invert;
 		}
-
-		master_conntrack->layer7.app_data[0] = '\0';
+	} else if(scan && scan->gen != eng->gen) {
+		/* the patterns changed under this connection */
+		scan = l7_scan_init(eng, scan);
+		master_conntrack->layer7.scan = scan;
 	}
 
 	/* Can be here, but unallocated, if numpackets is increased near
 	the beginning of a connection */
-	if(master_conntrack->layer7.app_data == NULL){
-		spin_unlock_bh(&l7_lock);
-		return info->invert; /* unmatched */
-	}
+	if(scan == NULL)
+		goto out_invert; /* unmatched */
 
 	if(!skb->cb[0]){
-		int newbytes;
-		newbytes = add_data(master_conntrack, app_data, appdatalen);
-
-		if(newbytes == 0) { /* didn't add any data */
+		if(!l7_scan_feed(eng, scan, app_data, appdatalen)) {
+			/* didn't add any data */
 			skb->cb[0] = 1;
 			/* Didn't match before, not going to match now */
-			spin_unlock_bh(&l7_lock);
-			return info->invert;
+			goto out_invert;
 		}
 	}
 
@@ -548,24 +819,15 @@ match(const struct sk_buff *skbin,
 		DPRINTK("layer7: matched unset: not yet classified "
 			"(%d/%d packets)\n",
                         total_acct_packets(master_conntrack), num_packets);
-	/* If the regexp failed to compile, don't bother running it */
-	} else if(comppattern &&
-		  regexec(comppattern, master_conntrack->layer7.app_data)){
+	/* If the regexp failed to compile, it is not in the engine */
+	} else if((entry = l7_lookup(eng, info)) &&
+		  l7_scan_matched(eng, scan, entry)){
 		DPRINTK("layer7: matched %s\n", info->protocol);
 		pattern_result = 1;
 	} else pattern_result = 0;
 
 	if(pattern_result == 1) {
-		master_conntrack->layer7.app_proto =
-			kmalloc(strlen(info->protocol)+1, GFP_ATOMIC);
-		if(!master_conntrack->layer7.app_proto){
-			if (net_ratelimit())
-				printk(KERN_ERR "layer7: out of memory in "
-						"match, bailing.\n");
-			spin_unlock_bh(&l7_lock);
-			return (pattern_result ^ info->invert);
-		}
-		strcpy(master_conntrack->layer7.app_proto, info->protocol);
+		l7_set_proto(master_conntrack, info->protocol);
 	} else if(pattern_result > 1) { /* cleanup from "unset" */
 		pattern_result = 1;
 	}
@@ -573,8 +835,14 @@ match(const struct sk_buff *skbin,
 	/* mark the packet seen */
 	skb->cb[0] = 1;
 
-	spin_unlock_bh(&l7_lock);
+	spin_unlock_bh(&master_conntrack->lock);
+	rcu_read_unlock();
 	return (pattern_result ^ info->invert);
+
+out_invert:
+	spin_unlock_bh(&master_conntrack->lock);
+	rcu_read_unlock();
+	return info->invert;
 }
 
 // load nf_conntrack_ipv4
@@ -586,26 +854,31 @@ static bool
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 28)
 check(const struct xt_mtchk_param *par)
 {
-        if (nf_ct_l3proto_try_module_get(par->match->family) < 0) {
-                printk(KERN_WARNING "can't load conntrack support for "
-                                    "proto=%d\n", par->match->family);
+	const struct xt_layer7_info *info = par->matchinfo;
+	u_int8_t family = par->match->family;
 #else
 check(const char *tablename, const void *inf,
 		 const struct xt_match *match, void *matchinfo,
 		 unsigned int hook_mask)
 {
-        if (nf_ct_l3proto_try_module_get(match->family) < 0) {
-                printk(KERN_WARNING "can't load conntrack support for "
-                                    "proto=%d\n", match->family);
+	const struct xt_layer7_info *info = matchinfo;
+	u_int8_t family = match->family;
 #endif
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35)
-		return -EINVAL;
+	int err;
+
+        if (nf_ct_l3proto_try_module_get(family) < 0) {
+                printk(KERN_WARNING "can't load conntrack support for "
+                                    "proto=%d\n", family);
+		err = -EINVAL;
+	} else {
+		err = l7_pattern_get(info);
+		if (err)
+			nf_ct_l3proto_module_put(family);
 	}
-	return 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35)
+	return err;
 #else
-                return 0;
-        }
-	return 1;
+	return err == 0;
 #endif
 }
 
@@ -613,11 +886,13 @@ check(const char *tablename, const void *inf,
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 28)
 	static void destroy(const struct xt_mtdtor_param *par)
 	{
+		l7_pattern_put(par->matchinfo);
 		nf_ct_l3proto_module_put(par->match->family);
 	}
 #else
 	static void destroy(const struct xt_match *match, void *matchinfo)
 	{
+		l7_pattern_put(matchinfo);
 		nf_ct_l3proto_module_put(match->family);
 	}
 #endif
@@ -637,21 +912,35 @@ static struct xt_match xt_layer7_match[] __read_mostly = {
 static void layer7_cleanup_proc(void)
 {
 	remove_proc_entry("layer7_numpackets", init_net.proc_net);
+	remove_proc_entry("layer7_dfa", init_net.proc_net);
 }
 
-/* register the proc file */
+/* register the proc files */
 static void layer7_init_proc(void)
 {
 	struct proc_dir_entry* entry;
 	entry = create_proc_entry("layer7_numpackets", 0644, init_net.proc_net);
 	entry->read_proc = layer7_read_proc;
 	entry->write_proc = layer7_write_proc;
+	create_proc_read_entry("layer7_dfa", 0444, init_net.proc_net,
+			       layer7_dfa_read_proc, NULL);
 }
 
 static int __init xt_layer7_init(void)
 {
+	int err;
+
 	need_conntrack();
 
+	if(dfa_states < 16 || dfa_states > L7_DFA_STATES_MAX) {
+		dfa_states = clamp(dfa_states, 16, L7_DFA_STATES_MAX);
+		printk(KERN_WARNING "layer7: dfa_states must be 16-%d, "
+			"using %d\n", L7_DFA_STATES_MAX, dfa_states);
+	}
+	l7_engine = l7_engine_build(GFP_KERNEL);
+	if(!l7_engine)
+		return -ENOMEM;
+
 	layer7_init_proc();
 	if(maxdatalen < 1) {
 		printk(KERN_WARNING "layer7: maxdatalen can't be < 1, "
@@ -665,14 +954,21 @@ static int __init xt_layer7_init(void)
 			"using 65536\n");
 		maxdatalen = 65536;
 	}
-	return xt_register_matches(xt_layer7_match,
-				   ARRAY_SIZE(xt_layer7_match));
+	err = xt_register_matches(xt_layer7_match,
+				  ARRAY_SIZE(xt_layer7_match));
+	if(err) {
+		layer7_cleanup_proc();
+		l7_engine_free(l7_engine);
+	}
+	return err;
 }
 
 static void __exit xt_layer7_fini(void)
 {
 	layer7_cleanup_proc();
 	xt_unregister_matches(xt_layer7_match, ARRAY_SIZE(xt_layer7_match));
+	/* no rules left, so no patterns and no groups */
+	l7_engine_free(l7_engine);
 }
 
 module_init(xt_layer7_init);
@@ -0,0 +1,81 @@
+/*
+ *	xt_set - Netfilter module to match packets against an IP set
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_set.h>
+
+static bool set_mt(const struct sk_buff *skb, struct xt_action_param *par)
+{
+	const struct xt_set_info_match *info = par->matchinfo;
+
+	return !!ip_set_test(info->index, skb, info->dim_flags) ^
+	       !!(info->flags & XT_SET_INVERT);
+}
+
+static int set_mt_check(const struct xt_mtchk_param *par)
+{
+	struct xt_set_info_match *info = par->matchinfo;
+	u8 dimension;
+
+	if (info->flags & ~XT_SET_INVERT)
+		return -EINVAL;
+	if (strnlen(info->name, IPSET_MAXNAMELEN) == IPSET_MAXNAMELEN)
+		return -EINVAL;
+
+	info->index = ip_set_get_byname(info->name, &dimension);
+	if (info->index == IPSET_INVALID_ID) {
+		pr_info("cannot find set \"%.*s\"\n",
+			IPSET_MAXNAMELEN, info->name);
+		return -ENOENT;
+	}
+	/* no direction given for a dimension the set does not have */
+	if (info->dim_flags & ~((1 << dimension) - 1)) {
+		pr_info("set \"%s\" has only %u dimensions\n",
+			info->name, dimension);
+		ip_set_put_byindex(info->index);
+		return -ERANGE;
+	}
+	return 0;
+}
+
+static void set_mt_destroy(const struct xt_mtdtor_param *par)
+{
+	const struct xt_set_info_match *info = par->matchinfo;
+
+	ip_set_put_byindex(info->index);
+}
+
+static struct xt_match set_mt_reg __read_mostly = {
+	.name		= "set",
+	.revision	= 0,
+	.family		= NFPROTO_IPV4,
+	.match		= set_mt,
+	.matchsize	= sizeof(struct xt_set_info_match),
+	.checkentry	= set_mt_check,
+	.destroy	= set_mt_destroy,
+	.me		= THIS_MODULE,
+};
+
+static int __init set_mt_init(void)
+{
+	return xt_register_match(&set_mt_reg);
+}
+
+static void __exit set_mt_exit(void)
+{
+	xt_unregister_match(&set_mt_reg);
+}
+
+module_init(set_mt_init);
+module_exit(set_mt_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Xtables: IP set match");
+MODULE_ALIAS("ipt_set");
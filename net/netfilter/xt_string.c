@@ -12,6 +12,10 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/skbuff.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter/xt_string.h>
 #include <linux/textsearch.h>
@@ -22,6 +26,111 @@ MODULE_LICENSE("GPL");
 MODULE_ALIAS("ipt_string");
 MODULE_ALIAS("ip6t_string");
 
+/*
+ * Rules using the "ac" algorithm are pooled into groups by offsets and
+ * case flag. The patterns of a group are compiled into one Aho-Corasick
+ * automaton, which is run once per packet and table traversal; each
+ * rule then only tests its own bit in the result cached on the cpu.
+ *
+ * Compiling is left to a work item so that loading a whole ruleset
+ * builds each group once. A rule whose pattern is not in the published
+ * set yet searches on its own, with its private configuration.
+ */
+#define STRING_GROUP_ALGO	"ac"
+
+struct string_cache {
+	const struct sk_buff	*skb;
+	unsigned int		seq;	/* xt_info_seq() of the traversal */
+	unsigned long		found[0];
+};
+
+struct string_set {
+	struct string_set	*next;	/* on the list of sets to free */
+	struct ts_config	*ts;
+	struct string_cache	*cache;	/* per cpu */
+	unsigned int		npat;
+	u32			tag[0];	/* per pattern, tag of its rule */
+};
+
+struct string_member;
+
+struct string_group {
+	struct list_head	list;
+	unsigned int		refcnt;
+	u_int16_t		from_offset;
+	u_int16_t		to_offset;
+	int			flags;
+	bool			dirty;
+	unsigned int		nslots;
+	struct string_member	**slot;
+	struct string_set	*set;
+};
+
+struct string_member {
+	struct string_group	*group;
+	struct ts_config	*ts;
+	unsigned int		id;
+	u32			tag;
+	u_int8_t		patlen;
+	char			pattern[XT_STRING_MAX_PATTERN_SIZE];
+};
+
+static DEFINE_MUTEX(string_mutex);
+static LIST_HEAD(string_groups);
+static u32 string_tag;
+
+static void string_rebuild(struct work_struct *work);
+static DECLARE_WORK(string_work, string_rebuild);
+
+/* Grouped rules keep their membership where the others keep their
+ * textsearch configuration. */
+static inline struct string_member *
+string_member(const struct xt_string_info *conf)
+{
+	return (struct string_member *)conf->config;
+}
+
+static inline bool string_grouped(const struct xt_string_info *conf)
+{
+	return !strcmp(conf->algo, STRING_GROUP_ALGO);
+}
+
+static bool string_mt_group(const struct sk_buff *skb,
+			    const struct string_member *m)
+{
+	const struct string_group *g = m->group;
+	const struct string_set *set;
+	struct string_cache *c;
+	struct ts_state state;
+	unsigned int seq;
+	bool ret;
+
+	memset(&state, 0, sizeof(struct ts_state));
+
+	rcu_read_lock();
+	set = rcu_dereference(g->set);
+	if (set && m->id < set->npat && set->tag[m->id] == m->tag) {
+		c = per_cpu_ptr(set->cache, smp_processor_id());
+		seq = xt_info_seq();
+		if (c->skb != skb || c->seq != seq) {
+			memset(c->found, 0,
+			       BITS_TO_LONGS(set->npat) * sizeof(long));
+			skb_find_text_set((struct sk_buff *)skb, g->from_offset,
+					  g->to_offset, set->ts, &state,
+					  c->found);
+			c->skb = skb;
+			c->seq = seq;
+		}
+		ret = test_bit(m->id, c->found);
+	} else {
+		ret = skb_find_text((struct sk_buff *)skb, g->from_offset,
+				    g->to_offset, m->ts, &state) != UINT_MAX;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
 static bool
 string_mt(const struct sk_buff *skb, struct xt_action_param *par)
 {
@@ -29,9 +138,13 @@ string_mt(const struct sk_buff *skb, struct xt_action_param *par)
 	struct ts_state state;
 	bool invert;
 
-	memset(&state, 0, sizeof(struct ts_state));
 	invert = conf->u.v1.flags & XT_STRING_FLAG_INVERT;
 
+	if (string_grouped(conf))
+		return string_mt_group(skb, string_member(conf)) ^ invert;
+
+	memset(&state, 0, sizeof(struct ts_state));
+
 	return (skb_find_text((struct sk_buff *)skb, conf->from_offset,
 			     conf->to_offset, conf->config, &state)
 			     != UINT_MAX) ^ invert;
@@ -39,6 +152,201 @@ string_mt(const struct sk_buff *skb, struct xt_action_param *par)
 
 #define STRING_TEXT_PRIV(m) ((struct xt_string_info *)(m))
 
+static void string_set_free(struct string_set *set)
+{
+	if (set->cache)
+		free_percpu(set->cache);
+	if (set->ts && !IS_ERR(set->ts))
+		textsearch_destroy(set->ts);
+	kfree(set);
+}
+
+static struct string_set *string_set_build(const struct string_group *g)
+{
+	struct string_set *set;
+	struct ts_pattern *pat;
+	unsigned int i, n = g->nslots;
+	int err = -ENOMEM;
+
+	while (n > 0 && !g->slot[n - 1])
+		n--;
+
+	pat = kcalloc(n, sizeof(*pat), GFP_KERNEL);
+	set = kzalloc(sizeof(*set) + n * sizeof(u32), GFP_KERNEL);
+	if (!pat || !set)
+		goto err;
+
+	set->npat = n;
+	for (i = 0; i < n; i++) {
+		if (!g->slot[i])
+			continue;
+		pat[i].data = g->slot[i]->pattern;
+		pat[i].len = g->slot[i]->patlen;
+		set->tag[i] = g->slot[i]->tag;
+	}
+
+	set->cache = __alloc_percpu(sizeof(struct string_cache) +
+				    BITS_TO_LONGS(n) * sizeof(long),
+				    __alignof__(struct string_cache));
+	if (!set->cache)
+		goto err;
+
+	set->ts = textsearch_prepare_set(STRING_GROUP_ALGO, pat, n,
+					 GFP_KERNEL, g->flags);
+	if (IS_ERR(set->ts)) {
+		err = PTR_ERR(set->ts);
+		goto err;
+	}
+
+	kfree(pat);
+	return set;
+
+err:
+	if (set)
+		string_set_free(set);
+	kfree(pat);
+	return ERR_PTR(err);
+}
+
+static void string_rebuild(struct work_struct *work)
+{
+	struct string_set *set, *old = NULL;
+	struct string_group *g;
+
+	mutex_lock(&string_mutex);
+	list_for_each_entry(g, &string_groups, list) {
+		if (!g->dirty)
+			continue;
+		g->dirty = false;
+
+		set = string_set_build(g);
+		if (IS_ERR(set)) {
+			pr_warning("xt_string: cannot build pattern group "
+				   "(%ld), rules keep searching one by one\n",
+				   PTR_ERR(set));
+			continue;
+		}
+
+		if (g->set) {
+			g->set->next = old;
+			old = g->set;
+		}
+		rcu_assign_pointer(g->set, set);
+	}
+	mutex_unlock(&string_mutex);
+
+	if (old == NULL)
+		return;
+
+	synchronize_rcu();
+	while (old) {
+		set = old->next;
+		string_set_free(old);
+		old = set;
+	}
+}
+
+static int string_group_join(struct xt_string_info *conf, int flags)
+{
+	struct string_member *m, **slot;
+	struct string_group *g;
+	unsigned int id;
+
+	m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (m == NULL)
+		return -ENOMEM;
+
+	m->ts = textsearch_prepare(STRING_GROUP_ALGO, conf->pattern,
+				   conf->patlen, GFP_KERNEL, flags);
+	if (IS_ERR(m->ts)) {
+		int err = PTR_ERR(m->ts);
+
+		kfree(m);
+		return err;
+	}
+	m->patlen = conf->patlen;
+	memcpy(m->pattern, conf->pattern, conf->patlen);
+
+	mutex_lock(&string_mutex);
+	list_for_each_entry(g, &string_groups, list)
+		if (g->from_offset == conf->from_offset &&
+		    g->to_offset == conf->to_offset && g->flags == flags)
+			goto found;
+
+	g = kzalloc(sizeof(*g), GFP_KERNEL);
+	if (g == NULL)
+		goto nomem;
+	g->from_offset = conf->from_offset;
+	g->to_offset = conf->to_offset;
+	g->flags = flags;
+	list_add(&g->list, &string_groups);
+found:
+	for (id = 0; id < g->nslots; id++)
+		if (!g->slot[id])
+			break;
+	if (id == g->nslots) {
+		slot = krealloc(g->slot, (g->nslots + 16) * sizeof(*slot),
+				GFP_KERNEL);
+		if (slot == NULL) {
+			if (!g->refcnt) {
+				list_del(&g->list);
+				kfree(g);
+			}
+			goto nomem;
+		}
+		memset(slot + g->nslots, 0, 16 * sizeof(*slot));
+		g->slot = slot;
+		g->nslots += 16;
+	}
+
+	g->slot[id] = m;
+	g->refcnt++;
+	g->dirty = true;
+	m->group = g;
+	m->id = id;
+	/* 0 marks a hole in the published sets */
+	if (++string_tag == 0)
+		++string_tag;
+	m->tag = string_tag;
+	mutex_unlock(&string_mutex);
+
+	schedule_work(&string_work);
+	conf->config = (struct ts_config *)m;
+	return 0;
+
+nomem:
+	mutex_unlock(&string_mutex);
+	textsearch_destroy(m->ts);
+	kfree(m);
+	return -ENOMEM;
+}
+
+static void string_group_leave(struct string_member *m)
+{
+	struct string_group *g = m->group;
+
+	mutex_lock(&string_mutex);
+	g->slot[m->id] = NULL;
+	if (--g->refcnt == 0) {
+		/*
+		 * x_tables has waited for the traversals of the old table,
+		 * nothing can be running on the set of a group without rules.
+		 */
+		list_del(&g->list);
+		if (g->set)
+			string_set_free(g->set);
+		kfree(g->slot);
+		kfree(g);
+	} else {
+		g->dirty = true;
+		schedule_work(&string_work);
+	}
+	mutex_unlock(&string_mutex);
+
+	textsearch_destroy(m->ts);
+	kfree(m);
+}
+
 static int string_mt_check(const struct xt_mtchk_param *par)
 {
 	struct xt_string_info *conf = par->matchinfo;
@@ -57,6 +365,8 @@ static int string_mt_check(const struct xt_mtchk_param *par)
 		return -EINVAL;
 	if (conf->u.v1.flags & XT_STRING_FLAG_IGNORECASE)
 		flags |= TS_IGNORECASE;
+	if (string_grouped(conf))
+		return string_group_join(conf, flags);
 	ts_conf = textsearch_prepare(conf->algo, conf->pattern, conf->patlen,
 				     GFP_KERNEL, flags);
 	if (IS_ERR(ts_conf))
@@ -68,7 +378,12 @@ static int string_mt_check(const struct xt_mtchk_param *par)
 
 static void string_mt_destroy(const struct xt_mtdtor_param *par)
 {
-	textsearch_destroy(STRING_TEXT_PRIV(par->matchinfo)->config);
+	const struct xt_string_info *conf = par->matchinfo;
+
+	if (string_grouped(conf))
+		string_group_leave(string_member(conf));
+	else
+		textsearch_destroy(STRING_TEXT_PRIV(par->matchinfo)->config);
 }
 
 static struct xt_match xt_string_mt_reg __read_mostly = {
@@ -90,6 +405,7 @@ static int __init string_mt_init(void)
 static void __exit string_mt_exit(void)
 {
 	xt_unregister_match(&xt_string_mt_reg);
+	cancel_work_sync(&string_work);
 }
 
 module_init(string_mt_init);
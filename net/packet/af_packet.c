@@ -83,6 +83,9 @@
 #include <linux/if_vlan.h>
 #include <linux/virtio_net.h>
 #include <linux/errqueue.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/ipv6.h>
 
 #ifdef CONFIG_INET
 #include <net/inet_common.h>
@@ -159,9 +162,41 @@ struct packet_mreq_max {
 	unsigned char	mr_address[MAX_ADDR_LEN];
 };
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
+/*
+ * TPACKET_V3 receive ring: packets are packed into blocks, and a block
+ * goes to user space as a whole once it is full or has been open for
+ * the retire timeout.  If user space still owns the next block the
+ * queue freezes on it, dropping packets, until it is released.
+ */
+#define V3_ALIGNMENT		8
+#define BLK_HDR_LEN		ALIGN(sizeof(struct tpacket_block_desc), \
+				      V3_ALIGNMENT)
+#define BLK_PLUS_PRIV(sz)	(BLK_HDR_LEN + ALIGN((sz), V3_ALIGNMENT))
+
+/* Block retire timeout used when none is given, in msecs */
+#define DEFAULT_PRB_RETIRE_TOV	8
+
+struct tpacket_kbdq_core {
+	char			**pkbdq;
+	unsigned int		knum_blocks;
+	unsigned int		kblk_size;
+	unsigned int		blk_sizeof_priv;
+	unsigned int		feature_req_word;
+	unsigned int		kactive_blk_num;	/* being filled */
+	unsigned int		last_kactive_blk_num;	/* when timer armed */
+	unsigned char		reset_pending_on_curr_blk; /* frozen */
+	unsigned char		delete_blk_timer;
+	u64			knxt_seq_num;
+	char			*prev;		/* last packet in the block */
+	char			*nxt_offset;	/* where the next one goes */
+	atomic_t		blk_fill_in_prog; /* packets being copied */
+	unsigned long		tov_in_jiffies;
+	struct timer_list	retire_blk_timer;
+};
+
 struct packet_ring_buffer {
 	char			**pg_vec;
 	unsigned int		head;
@@ -173,9 +208,31 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_pages;
 	unsigned int		pg_vec_len;
 
+	struct tpacket_kbdq_core	prb_bdqc;
 	atomic_t		pending;
 };
 
+#define PACKET_FANOUT_MAX	256
+
+/*
+ * A fanout group owns the protocol hook of its members and hands each
+ * packet to one of them.
+ */
+struct packet_fanout {
+#ifdef CONFIG_NET_NS
+	struct net		*net;
+#endif
+	unsigned int		num_members;
+	u16			id;
+	u8			type;
+	atomic_t		rr_cur;
+	struct list_head	list;
+	struct sock		*arr[PACKET_FANOUT_MAX];
+	spinlock_t		lock;
+	atomic_t		sk_ref;
+	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
+};
+
 struct packet_sock;
 static int tpacket_snd(struct packet_sock *po, struct msghdr *msg);
 
@@ -184,7 +241,8 @@ static void packet_flush_mclist(struct sock *sk);
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	struct packet_fanout	*fanout;
+	struct tpacket_stats_v3	stats;
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
@@ -314,6 +372,252 @@ static inline struct packet_sock *pkt_sk(struct sock *sk)
 	return (struct packet_sock *)sk;
 }
 
+static inline struct tpacket_block_desc *prb_block(
+		struct tpacket_kbdq_core *pkc, unsigned int n)
+{
+	return (struct tpacket_block_desc *)pkc->pkbdq[n];
+}
+
+static inline struct tpacket_block_desc *prb_curr_block(
+		struct tpacket_kbdq_core *pkc)
+{
+	return prb_block(pkc, pkc->kactive_blk_num);
+}
+
+static int prb_block_in_use(struct tpacket_block_desc *pbd)
+{
+	flush_dcache_page(virt_to_page(&pbd->hdr.bh1.block_status));
+	smp_rmb();
+	return pbd->hdr.bh1.block_status & TP_STATUS_USER;
+}
+
+static void prb_flush_block(struct tpacket_block_desc *pbd)
+{
+	struct page *p_start, *p_end;
+
+	p_start = virt_to_page(pbd);
+	p_end = virt_to_page((char *)pbd + pbd->hdr.bh1.blk_len - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+}
+
+static void prb_refresh_timer(struct tpacket_kbdq_core *pkc)
+{
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
+}
+
+/* Start filling a block released by user space; thaws the queue */
+static void prb_open_block(struct tpacket_kbdq_core *pkc,
+			   struct tpacket_block_desc *pbd)
+{
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = BLK_HDR_LEN;
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	h1->blk_len = h1->offset_to_first_pkt;
+	h1->seq_num = pkc->knxt_seq_num++;
+	h1->ts_first_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = ts.tv_nsec;
+	h1->ts_last_pkt = h1->ts_first_pkt;
+
+	pkc->nxt_offset = (char *)pbd + h1->offset_to_first_pkt;
+	pkc->prev = pkc->nxt_offset;
+	pkc->reset_pending_on_curr_blk = 0;
+
+	prb_refresh_timer(pkc);
+}
+
+/*
+ * Hand the current block to user space, waking it up, and move on to
+ * the next one.  Called with the receive queue lock held.
+ */
+static void prb_close_block(struct packet_sock *po, unsigned int status)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd = prb_curr_block(pkc);
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct sock *sk = &po->sk;
+
+	/* packets that got room in it may still be being copied */
+	while (atomic_read(&pkc->blk_fill_in_prog))
+		cpu_relax();
+	smp_rmb();
+
+	if (h1->num_pkts) {
+		struct tpacket3_hdr *last = (struct tpacket3_hdr *)pkc->prev;
+
+		last->tp_next_offset = 0;
+		h1->ts_last_pkt.ts_sec = last->tp_sec;
+		h1->ts_last_pkt.ts_nsec = last->tp_nsec;
+	} else {
+		struct timespec ts;
+
+		getnstimeofday(&ts);
+		h1->ts_last_pkt.ts_sec = ts.tv_sec;
+		h1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+	}
+
+	if (po->stats.tp_drops)
+		status |= TP_STATUS_LOSING;
+
+	smp_wmb();
+	h1->block_status = TP_STATUS_USER | status;
+	prb_flush_block(pbd);
+
+	sk->sk_data_ready(sk, 0);
+
+	if (++pkc->kactive_blk_num == pkc->knum_blocks)
+		pkc->kactive_blk_num = 0;
+}
+
+/*
+ * Open the next block, or freeze the queue on it while user space
+ * still owns it.  Returns where the next packet goes.
+ */
+static char *prb_dispatch_next_block(struct packet_sock *po)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd = prb_curr_block(pkc);
+
+	if (prb_block_in_use(pbd)) {
+		pkc->reset_pending_on_curr_blk = 1;
+		po->stats.tp_freeze_q_cnt++;
+		return NULL;
+	}
+
+	prb_open_block(pkc, pbd);
+	return pkc->nxt_offset;
+}
+
+/*
+ * Reserve @len bytes for a packet in the current block, retiring it
+ * for the next one when it is full.  Called with the receive queue lock
+ * held; the copy into the returned room is tracked by blk_fill_in_prog
+ * until prb_clear_blk_fill_status().
+ */
+static void *prb_lookup_frame(struct packet_sock *po, unsigned int len)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd = prb_curr_block(pkc);
+	struct tpacket3_hdr *ppd;
+	char *curr;
+
+	len = ALIGN(len, V3_ALIGNMENT);
+
+	if (pkc->reset_pending_on_curr_blk) {
+		if (prb_block_in_use(pbd))
+			return NULL;
+		prb_open_block(pkc, pbd);
+	}
+
+	curr = pkc->nxt_offset;
+	if (curr + len > (char *)pbd + pkc->kblk_size) {
+		prb_close_block(po, 0);
+		curr = prb_dispatch_next_block(po);
+		if (!curr)
+			return NULL;
+		pbd = prb_curr_block(pkc);
+	}
+
+	ppd = (struct tpacket3_hdr *)curr;
+	ppd->tp_next_offset = len;
+	pkc->prev = curr;
+	pkc->nxt_offset += len;
+	pbd->hdr.bh1.blk_len += len;
+	pbd->hdr.bh1.num_pkts++;
+	atomic_inc(&pkc->blk_fill_in_prog);
+
+	return curr;
+}
+
+static inline void prb_clear_blk_fill_status(struct packet_ring_buffer *rb)
+{
+	smp_mb__before_atomic_dec();
+	atomic_dec(&rb->prb_bdqc.blk_fill_in_prog);
+}
+
+/*
+ * Retire a partly filled block nobody closed within the timeout, and
+ * reopen the block a frozen queue waits on once user space released it.
+ */
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd;
+
+	spin_lock(&po->sk.sk_receive_queue.lock);
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	pbd = prb_curr_block(pkc);
+	if (pkc->reset_pending_on_curr_blk) {
+		if (!prb_block_in_use(pbd)) {
+			prb_open_block(pkc, pbd);
+			goto out;
+		}
+	} else if (pkc->last_kactive_blk_num == pkc->kactive_blk_num &&
+		   pbd->hdr.bh1.num_pkts) {
+		prb_close_block(po, TP_STATUS_BLK_TMO);
+		if (prb_dispatch_next_block(po))
+			goto out;
+	}
+	prb_refresh_timer(pkc);
+out:
+	spin_unlock(&po->sk.sk_receive_queue.lock);
+}
+
+/* Called with the receive queue lock held, before the ring goes live */
+static void init_prb_bdqc(struct packet_sock *po, char **pg_vec,
+			  struct tpacket_req3 *req3)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	unsigned int tov = req3->tp_retire_blk_tov ? : DEFAULT_PRB_RETIRE_TOV;
+
+	memset(pkc, 0, sizeof(*pkc));
+	pkc->pkbdq = pg_vec;
+	pkc->knum_blocks = req3->tp_block_nr;
+	pkc->kblk_size = req3->tp_block_size;
+	pkc->blk_sizeof_priv = req3->tp_sizeof_priv;
+	pkc->feature_req_word = req3->tp_feature_req_word;
+	pkc->knxt_seq_num = 1;
+	pkc->tov_in_jiffies = msecs_to_jiffies(tov) ? : 1;
+	setup_timer(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
+		    (unsigned long)po);
+	po->stats.tp_freeze_q_cnt = 0;
+
+	prb_open_block(pkc, prb_block(pkc, 0));
+}
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
+					  struct sk_buff_head *rb_queue)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+
+	spin_lock_bh(&rb_queue->lock);
+	pkc->delete_blk_timer = 1;
+	spin_unlock_bh(&rb_queue->lock);
+
+	del_timer_sync(&pkc->retire_blk_timer);
+}
+
+/* Whether the block before the one being filled awaits user space */
+static int prb_previous_blk_ready(struct packet_sock *po)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	unsigned int prev = pkc->kactive_blk_num ? : pkc->knum_blocks;
+
+	return prb_block_in_use(prb_block(pkc, prev - 1));
+}
+
 static void packet_sock_destruct(struct sock *sk)
 {
 	skb_queue_purge(&sk->sk_error_queue);
@@ -330,6 +634,316 @@ static void packet_sock_destruct(struct sock *sk)
 }
 
 
+static u32 fanout_hashrnd __read_mostly;
+
+/*
+ * Flow hash for PACKET_FANOUT_HASH, the same for both directions like
+ * the RPS one, which is used when the packet already carries it.  The
+ * skb is shared with the other taps here, so the headers are only read
+ * through skb_header_pointer().
+ */
+static u32 fanout_flow_hash(const struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb);
+	u32 addr1, addr2;
+	u8 ip_proto;
+	int poff;
+	union {
+		u32 v32;
+		u16 v16[2];
+	} ports;
+
+	if (skb->rxhash)
+		return skb->rxhash;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP): {
+		struct iphdr _iph;
+		const struct iphdr *iph;
+
+		iph = skb_header_pointer(skb, nhoff, sizeof(_iph), &_iph);
+		if (!iph || iph->ihl < 5)
+			return 0;
+		addr1 = (__force u32) iph->saddr;
+		addr2 = (__force u32) iph->daddr;
+		ip_proto = iph->frag_off & htons(IP_MF | IP_OFFSET) ?
+			   0 : iph->protocol;
+		poff = nhoff + iph->ihl * 4;
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6): {
+		struct ipv6hdr _ip6h;
+		const struct ipv6hdr *ip6h;
+
+		ip6h = skb_header_pointer(skb, nhoff, sizeof(_ip6h), &_ip6h);
+		if (!ip6h)
+			return 0;
+		addr1 = (__force u32) ip6h->saddr.s6_addr32[3];
+		addr2 = (__force u32) ip6h->daddr.s6_addr32[3];
+		ip_proto = ip6h->nexthdr;
+		poff = nhoff + sizeof(*ip6h);
+		break;
+	}
+	default:
+		return (__force u32) skb->protocol;
+	}
+
+	ports.v32 = 0;
+	switch (ip_proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_DCCP:
+	case IPPROTO_ESP:
+	case IPPROTO_AH:
+	case IPPROTO_SCTP:
+	case IPPROTO_UDPLITE: {
+		u32 _ports;
+		const u32 *pp;
+
+		pp = skb_header_pointer(skb, poff, sizeof(_ports), &_ports);
+		if (pp) {
+			ports.v32 = *pp;
+			if (ports.v16[1] < ports.v16[0])
+				swap(ports.v16[0], ports.v16[1]);
+		}
+		break;
+	}
+	}
+
+	if (addr2 < addr1)
+		swap(addr1, addr2);
+	return jhash_3words(addr1, addr2, ports.v32, fanout_hashrnd);
+}
+
+static struct sock *fanout_demux_hash(struct packet_fanout *f,
+				      struct sk_buff *skb, unsigned int num)
+{
+	return f->arr[((u64)fanout_flow_hash(skb) * num) >> 32];
+}
+
+static struct sock *fanout_demux_lb(struct packet_fanout *f,
+				    struct sk_buff *skb, unsigned int num)
+{
+	return f->arr[(unsigned int)atomic_inc_return(&f->rr_cur) % num];
+}
+
+static struct sock *fanout_demux_cpu(struct packet_fanout *f,
+				     struct sk_buff *skb, unsigned int num)
+{
+	return f->arr[smp_processor_id() % num];
+}
+
+static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
+			     struct packet_type *pt,
+			     struct net_device *orig_dev)
+{
+	struct packet_fanout *f = pt->af_packet_priv;
+	unsigned int num = f->num_members;
+	struct packet_sock *po;
+	struct sock *sk;
+
+	if (!net_eq(dev_net(dev), read_pnet(&f->net)) || !num) {
+		kfree_skb(skb);
+		return 0;
+	}
+	smp_rmb();
+
+	switch (f->type) {
+	case PACKET_FANOUT_HASH:
+	default:
+		sk = fanout_demux_hash(f, skb, num);
+		break;
+	case PACKET_FANOUT_LB:
+		sk = fanout_demux_lb(f, skb, num);
+		break;
+	case PACKET_FANOUT_CPU:
+		sk = fanout_demux_cpu(f, skb, num);
+		break;
+	}
+
+	po = pkt_sk(sk);
+	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
+}
+
+static DEFINE_MUTEX(fanout_mutex);
+static LIST_HEAD(fanout_list);
+
+static void __fanout_link(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+
+	spin_lock(&f->lock);
+	f->arr[f->num_members] = sk;
+	smp_wmb();
+	f->num_members++;
+	spin_unlock(&f->lock);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+	int i;
+
+	spin_lock(&f->lock);
+	for (i = 0; i < f->num_members; i++) {
+		if (f->arr[i] == sk)
+			break;
+	}
+	BUG_ON(i >= f->num_members);
+	f->arr[i] = f->arr[f->num_members - 1];
+	f->num_members--;
+	spin_unlock(&f->lock);
+}
+
+/*
+ * Attach and detach the protocol hook of a socket, or its slot in the
+ * fanout group it belongs to.  Called with po->bind_lock held, or
+ * before the socket is visible (packet_create()).
+ */
+static void register_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (!po->running) {
+		if (po->fanout)
+			__fanout_link(sk, po);
+		else
+			dev_add_pack(&po->prot_hook);
+		sock_hold(sk);
+		po->running = 1;
+	}
+}
+
+/*
+ * With @sync, drops po->bind_lock to wait for receivers still using
+ * the hook.
+ */
+static void __unregister_prot_hook(struct sock *sk, bool sync)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	po->running = 0;
+	if (po->fanout)
+		__fanout_unlink(sk, po);
+	else
+		__dev_remove_pack(&po->prot_hook);
+	__sock_put(sk);
+
+	if (sync) {
+		spin_unlock(&po->bind_lock);
+		synchronize_net();
+		spin_lock(&po->bind_lock);
+	}
+}
+
+static void unregister_prot_hook(struct sock *sk, bool sync)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (po->running)
+		__unregister_prot_hook(sk, sync);
+}
+
+static int fanout_add(struct sock *sk, u16 id, u16 type)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f, *match;
+	int err;
+
+	switch (type) {
+	case PACKET_FANOUT_HASH:
+	case PACKET_FANOUT_LB:
+	case PACKET_FANOUT_CPU:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!po->running)
+		return -EINVAL;
+
+	if (po->fanout)
+		return -EALREADY;
+
+	mutex_lock(&fanout_mutex);
+	match = NULL;
+	list_for_each_entry(f, &fanout_list, list) {
+		if (f->id == id &&
+		    read_pnet(&f->net) == sock_net(sk)) {
+			match = f;
+			break;
+		}
+	}
+	if (!match) {
+		err = -ENOMEM;
+		match = kzalloc(sizeof(*match), GFP_KERNEL);
+		if (!match)
+			goto out;
+		write_pnet(&match->net, sock_net(sk));
+		match->id = id;
+		match->type = type;
+		atomic_set(&match->rr_cur, 0);
+		INIT_LIST_HEAD(&match->list);
+		spin_lock_init(&match->lock);
+		atomic_set(&match->sk_ref, 0);
+		match->prot_hook.type = po->prot_hook.type;
+		match->prot_hook.dev = po->prot_hook.dev;
+		match->prot_hook.func = packet_rcv_fanout;
+		match->prot_hook.af_packet_priv = match;
+		dev_add_pack(&match->prot_hook);
+		list_add(&match->list, &fanout_list);
+	}
+
+	/* members must all see the same traffic */
+	err = -EINVAL;
+	spin_lock(&po->bind_lock);
+	if (po->running &&
+	    match->type == type &&
+	    match->prot_hook.type == po->prot_hook.type &&
+	    match->prot_hook.dev == po->prot_hook.dev) {
+		err = -ENOSPC;
+		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
+			__dev_remove_pack(&po->prot_hook);
+			po->fanout = match;
+			atomic_inc(&match->sk_ref);
+			__fanout_link(sk, po);
+			err = 0;
+		}
+	}
+	spin_unlock(&po->bind_lock);
+
+	if (err && !atomic_read(&match->sk_ref)) {
+		list_del(&match->list);
+		dev_remove_pack(&match->prot_hook);
+		kfree(match);
+	}
+out:
+	mutex_unlock(&fanout_mutex);
+	return err;
+}
+
+/* Called once the socket left the group, by __unregister_prot_hook() */
+static void fanout_release(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f;
+
+	f = po->fanout;
+	if (!f)
+		return;
+
+	po->fanout = NULL;
+
+	mutex_lock(&fanout_mutex);
+	if (atomic_dec_and_test(&f->sk_ref)) {
+		list_del(&f->list);
+		dev_remove_pack(&f->prot_hook);
+		kfree(f);
+	}
+	mutex_unlock(&fanout_mutex);
+}
+
+
 static const struct proto_ops packet_ops;
 
 static const struct proto_ops packet_ops_spkt;
@@ -646,6 +1260,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
@@ -716,10 +1331,19 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
-	if (!h.raw)
-		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
+	if (po->tp_version <= TPACKET_V2) {
+		h.raw = packet_current_frame(po, &po->rx_ring,
+					     TP_STATUS_KERNEL);
+		if (!h.raw)
+			goto ring_is_full;
+		packet_increment_head(&po->rx_ring);
+	} else {
+		h.raw = prb_lookup_frame(po, min_t(unsigned int,
+						   macoff + snaplen,
+						   po->rx_ring.frame_size));
+		if (!h.raw)
+			goto ring_is_full;
+	}
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -759,6 +1383,27 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_vlan_tci = vlan_tx_tag_get(skb);
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* tp_next_offset was set when the room was reserved */
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		if (po->rx_ring.prb_bdqc.feature_req_word &
+		    TP_FT_REQ_FILL_RXHASH)
+			h.h3->hv1.tp_rxhash = skb->rxhash;
+		else
+			h.h3->hv1.tp_rxhash = 0;
+		h.h3->hv1.tp_vlan_tci = vlan_tx_tag_get(skb);
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -774,7 +1419,8 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	__packet_set_status(po, h.raw, status);
+	if (po->tp_version <= TPACKET_V2)
+		__packet_set_status(po, h.raw, status);
 	smp_mb();
 	{
 		struct page *p_start, *p_end;
@@ -788,7 +1434,11 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		}
 	}
 
-	sk->sk_data_ready(sk, 0);
+	/* a V3 block wakes user space once, when it is retired */
+	if (po->tp_version <= TPACKET_V2)
+		sk->sk_data_ready(sk, 0);
+	else
+		prb_clear_blk_fill_status(&po->rx_ring);
 
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
@@ -1264,7 +1914,7 @@ static int packet_release(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct packet_sock *po;
 	struct net *net;
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 
 	if (!sk)
 		return 0;
@@ -1277,27 +1927,25 @@ static int packet_release(struct socket *sock)
 	sock_prot_inuse_add(net, sk->sk_prot, -1);
 	spin_unlock_bh(&net->packet.sklist_lock);
 
+	/*
+	 * Remove from protocol table
+	 */
 	spin_lock(&po->bind_lock);
-	if (po->running) {
-		/*
-		 * Remove from protocol table
-		 */
-		po->running = 0;
-		po->num = 0;
-		__dev_remove_pack(&po->prot_hook);
-		__sock_put(sk);
-	}
+	unregister_prot_hook(sk, false);
+	po->num = 0;
 	spin_unlock(&po->bind_lock);
 
 	packet_flush_mclist(sk);
 
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
+
+	fanout_release(sk);
 
 	synchronize_net();
 	/*
@@ -1322,6 +1970,11 @@ static int packet_release(struct socket *sock)
 static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protocol)
 {
 	struct packet_sock *po = pkt_sk(sk);
+
+	/* the hook of a fanout group is fixed */
+	if (po->fanout)
+		return -EINVAL;
+
 	/*
 	 *	Detach an existing hook if present.
 	 */
@@ -1329,14 +1982,8 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 	lock_sock(sk);
 
 	spin_lock(&po->bind_lock);
-	if (po->running) {
-		__sock_put(sk);
-		po->running = 0;
-		po->num = 0;
-		spin_unlock(&po->bind_lock);
-		dev_remove_pack(&po->prot_hook);
-		spin_lock(&po->bind_lock);
-	}
+	po->num = 0;
+	unregister_prot_hook(sk, true);
 
 	po->num = protocol;
 	po->prot_hook.type = protocol;
@@ -1348,9 +1995,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 		goto out_unlock;
 
 	if (!dev || (dev->flags & IFF_UP)) {
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	} else {
 		sk->sk_err = ENETDOWN;
 		if (!sock_flag(sk, SOCK_DEAD))
@@ -1481,9 +2126,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol,
 
 	if (proto) {
 		po->prot_hook.type = proto;
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	}
 
 	spin_lock_bh(&net->packet.sklist_lock);
@@ -1920,15 +2563,21 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		if (po->tp_version == TPACKET_V3)
+			len = sizeof(req_u.req3);
+		else
+			len = sizeof(req_u.req);
+		if (optlen < len)
 			return -EINVAL;
 		if (pkt_sk(sk)->has_vnet_hdr)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1955,6 +2604,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -2027,6 +2677,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->has_vnet_hdr = !!val;
 		return 0;
 	}
+	case PACKET_FANOUT:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		return fanout_add(sk, val & 0xffff, val >> 16);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2040,7 +2701,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	struct tpacket_stats_v3 st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -2053,7 +2714,10 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+		} else if (len > sizeof(struct tpacket_stats))
 			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
@@ -2102,6 +2766,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -2119,6 +2786,15 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		val = po->tp_loss;
 		data = &val;
 		break;
+	case PACKET_FANOUT:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = (po->fanout ?
+		       ((u32)po->fanout->id |
+			((u32)po->fanout->type << 16)) :
+		       0);
+		data = &val;
+		break;
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2152,9 +2828,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
 				if (po->running) {
-					__dev_remove_pack(&po->prot_hook);
-					__sock_put(sk);
-					po->running = 0;
+					__unregister_prot_hook(sk, false);
 					sk->sk_err = ENETDOWN;
 					if (!sock_flag(sk, SOCK_DEAD))
 						sk->sk_error_report(sk);
@@ -2169,11 +2843,8 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 		case NETDEV_UP:
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
-				if (po->num && !po->running) {
-					dev_add_pack(&po->prot_hook);
-					sock_hold(sk);
-					po->running = 1;
-				}
+				if (po->num)
+					register_prot_hook(sk);
 				spin_unlock(&po->bind_lock);
 			}
 			break;
@@ -2246,7 +2917,9 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
 	if (po->rx_ring.pg_vec) {
-		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
+		if (po->tp_version == TPACKET_V3 ?
+		    prb_previous_blk_ready(po) :
+		    !packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
@@ -2332,9 +3005,10 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
+	struct tpacket_req *req = &req_u->req;
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
@@ -2367,6 +3041,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2387,6 +3064,18 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 					req->tp_frame_nr))
 			goto out;
 
+		if (po->tp_version == TPACKET_V3) {
+			/* no block based transmit */
+			if (unlikely(tx_ring))
+				goto out;
+			/* a block must hold its header and a full frame */
+			if (unlikely(req_u->req3.tp_sizeof_priv >=
+				     req->tp_block_size ||
+				     BLK_PLUS_PRIV(req_u->req3.tp_sizeof_priv) +
+				     req->tp_frame_size > req->tp_block_size))
+				goto out;
+		}
+
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
 		pg_vec = alloc_pg_vec(req, order);
@@ -2407,10 +3096,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	was_running = po->running;
 	num = po->num;
 	if (was_running) {
-		__dev_remove_pack(&po->prot_hook);
 		po->num = 0;
-		po->running = 0;
-		__sock_put(sk);
+		__unregister_prot_hook(sk, false);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -2420,12 +3107,16 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
+		if (po->tp_version == TPACKET_V3 && !tx_ring && rb->pg_vec)
+			prb_shutdown_retire_blk_timer(po, rb_queue);
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 		spin_lock_bh(&rb_queue->lock);
 		pg_vec = XC(rb->pg_vec, pg_vec);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (po->tp_version == TPACKET_V3 && !tx_ring && rb->pg_vec)
+			init_prb_bdqc(po, rb->pg_vec, &req_u->req3);
 		spin_unlock_bh(&rb_queue->lock);
 
 		order = XC(rb->pg_vec_order, order);
@@ -2444,10 +3135,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 
 	spin_lock(&po->bind_lock);
 	if (was_running && !po->running) {
-		sock_hold(sk);
-		po->running = 1;
 		po->num = num;
-		dev_add_pack(&po->prot_hook);
+		register_prot_hook(sk);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -2678,6 +3367,7 @@ static int __init packet_init(void)
 	if (rc != 0)
 		goto out;
 
+	get_random_bytes(&fanout_hashrnd, sizeof(fanout_hashrnd));
 	sock_register(&packet_family_ops);
 	register_pernet_subsys(&packet_net_ops);
 	register_netdevice_notifier(&packet_netdev_notifier);
@@ -206,6 +206,17 @@ void __qdisc_run(struct Qdisc *q)
 	}
 
 	clear_bit(__QDISC_STATE_RUNNING, &q->state);
+
+	/*
+	 * qdisc_restart() stops when the queue looks empty, but packets
+	 * deferred while the lock was dropped in sch_direct_xmit() are not
+	 * counted in it, and their sender saw the qdisc still running.
+	 */
+	if (q->flags & TCQ_F_DEFER_ENQUEUE) {
+		smp_mb__after_clear_bit();
+		if (ACCESS_ONCE(q->defer_list))
+			__netif_schedule(q);
+	}
 }
 
 unsigned long dev_trans_start(struct net_device *dev)
@@ -64,6 +64,10 @@ static int htb_hysteresis __read_mostly = 0; /* whether to use mode hysteresis f
 module_param    (htb_hysteresis, int, 0640);
 MODULE_PARM_DESC(htb_hysteresis, "Hysteresis mode, less CPU load, less accurate");
 
+static int htb_lockless __read_mostly = 0; /* whether new qdiscs enqueue without the root lock */
+module_param_named(lockless, htb_lockless, int, 0640);
+MODULE_PARM_DESC(lockless, "Lock-free enqueue for new root qdiscs, classify at dequeue");
+
 /* used internaly to keep status of single class */
 enum htb_cmode {
 	HTB_CANT_SEND,		/* class can't send and can't borrow */
@@ -581,6 +585,18 @@ static int htb_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 	return NET_XMIT_SUCCESS;
 }
 
+/* move packets queued by qdisc_defer_enqueue() into the classes */
+static void htb_enqueue_deferred(struct Qdisc *sch)
+{
+	struct sk_buff *skb, *next;
+
+	for (skb = qdisc_defer_splice(sch); skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		qdisc_enqueue_root(skb, sch);
+	}
+}
+
 static inline void htb_accnt_tokens(struct htb_class *cl, int bytes, long diff)
 {
 	long toks = diff + cl->tokens;
@@ -853,6 +869,9 @@ static struct sk_buff *htb_dequeue(struct Qdisc *sch)
 	psched_time_t next_event;
 	unsigned long start_at;
 
+	if (sch->flags & TCQ_F_DEFER_ENQUEUE)
+		htb_enqueue_deferred(sch);
+
 	/* try to dequeue direct packets as high prio (!) to minimize cpu work */
 	skb = __skb_dequeue(&q->direct_queue);
 	if (skb != NULL) {
@@ -954,6 +973,7 @@ static void htb_reset(struct Qdisc *sch)
 	}
 	qdisc_watchdog_cancel(&q->watchdog);
 	__skb_queue_purge(&q->direct_queue);
+	qdisc_defer_purge(sch);
 	sch->q.qlen = 0;
 	memset(q->row, 0, sizeof(q->row));
 	memset(q->row_mask, 0, sizeof(q->row_mask));
@@ -1023,6 +1043,11 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt)
 		q->rate2quantum = 1;
 	q->defcls = gopt->defcls;
 
+	/* only the root qdisc sees dev_queue_xmit(), a child HTB is
+	 * enqueued by its parent with the root lock held */
+	if (htb_lockless && sch->parent == TC_H_ROOT)
+		sch->flags |= TCQ_F_DEFER_ENQUEUE;
+
 	return 0;
 }
 
@@ -1230,6 +1255,7 @@ static void htb_destroy(struct Qdisc *sch)
 	}
 	qdisc_class_hash_destroy(&q->clhash);
 	__skb_queue_purge(&q->direct_queue);
+	qdisc_defer_purge(sch);
 }
 
 static int htb_delete(struct Qdisc *sch, unsigned long arg)
@@ -3,6 +3,7 @@
 
 #include <linux/xfrm.h>
 #include <linux/socket.h>
+#include <linux/jhash.h>
 
 static inline unsigned int __xfrm4_addr_hash(xfrm_address_t *addr)
 {
@@ -124,6 +125,39 @@ static inline unsigned int __addr_hash(xfrm_address_t *daddr, xfrm_address_t *sa
 	return h & hmask;
 }
 
+static inline u32 __xfrm_prefix_word(__be32 word, int bits)
+{
+	if (bits <= 0)
+		return 0;
+	if (bits < 32)
+		word &= htonl(~0U << (32 - bits));
+	return (__force u32)word;
+}
+
+/* Hash of the first @prefixlen bits of @daddr, for inexact policies */
+static inline unsigned int __pref_hash(xfrm_address_t *daddr, u8 prefixlen,
+				       unsigned short family, unsigned int hmask)
+{
+	unsigned int h = 0;
+	u32 k[4];
+	int i;
+
+	switch (family) {
+	case AF_INET:
+		h = jhash_1word(__xfrm_prefix_word(daddr->a4, prefixlen),
+				prefixlen);
+		break;
+
+	case AF_INET6:
+		for (i = 0; i < 4; i++)
+			k[i] = __xfrm_prefix_word(daddr->a6[i],
+						  prefixlen - 32 * i);
+		h = jhash2(k, 4, prefixlen);
+		break;
+	}
+	return h & hmask;
+}
+
 extern struct hlist_head *xfrm_hash_alloc(unsigned int sz);
 extern void xfrm_hash_free(struct hlist_head *n, unsigned int sz);
 
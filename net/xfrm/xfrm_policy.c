@@ -60,6 +60,7 @@ static int stale_bundle(struct dst_entry *dst);
 
 static struct xfrm_policy *__xfrm_policy_unlink(struct xfrm_policy *pol,
 						int dir);
+static void xfrm_policy_flush_flows(struct xfrm_policy *pol, int dir);
 #ifdef CONFIG_AS_FASTPATH
 struct asf_ipsec_callbackfn_s	asf_cb_fns = {0};
 
@@ -293,6 +294,7 @@ struct xfrm_policy *xfrm_policy_alloc(struct net *net, gfp_t gfp)
 		INIT_LIST_HEAD(&policy->walk.all);
 		INIT_HLIST_NODE(&policy->bydst);
 		INIT_HLIST_NODE(&policy->byidx);
+		INIT_HLIST_NODE(&policy->byprefix);
 		rwlock_init(&policy->lock);
 		atomic_set(&policy->refcnt, 1);
 		setup_timer(&policy->timer, xfrm_policy_timer,
@@ -358,6 +360,98 @@ static struct hlist_head *policy_hash_direct(struct net *net, xfrm_address_t *da
 	return net->xfrm.policy_bydst[dir].table + hash;
 }
 
+/*
+ * Inexact policies of one direction are also hashed on their destination
+ * prefix, so that a lookup probes one chain per destination prefix length
+ * in use instead of matching the whole policy_inexact list.  Chains are
+ * kept in the order of that list: by priority, then by pos.
+ */
+struct xfrm_policy_prefix {
+	struct hlist_head	*table;
+	unsigned int		hmask;
+	unsigned int		count;
+	u64			pos;
+	unsigned int		users[2][129];
+	unsigned long		plens[2][BITS_TO_LONGS(129)];
+};
+
+static const u8 xfrm_prefix_max[2] = { 32, 128 };
+
+static inline int xfrm_prefix_family(unsigned short family)
+{
+	switch (family) {
+	case AF_INET:
+		return 0;
+	case AF_INET6:
+		return 1;
+	}
+	return -1;
+}
+
+static inline u8 xfrm_prefix_len(struct xfrm_policy *pol, int f)
+{
+	return min(pol->selector.prefixlen_d, xfrm_prefix_max[f]);
+}
+
+/* Does @a come before @b on the policy_inexact list? */
+static inline int xfrm_prefix_before(struct xfrm_policy *a,
+				     struct xfrm_policy *b)
+{
+	return a->priority < b->priority ||
+	       (a->priority == b->priority && a->pos < b->pos);
+}
+
+static void __xfrm_prefix_link(struct hlist_head *table, unsigned int hmask,
+			       struct xfrm_policy *pol, int f)
+{
+	struct hlist_head *chain;
+	struct hlist_node *entry, *prev = NULL;
+	struct xfrm_policy *p;
+
+	chain = table + __pref_hash(&pol->selector.daddr,
+				    xfrm_prefix_len(pol, f), pol->family,
+				    hmask);
+	hlist_for_each_entry(p, entry, chain, byprefix) {
+		if (xfrm_prefix_before(pol, p))
+			break;
+		prev = entry;
+	}
+	if (prev)
+		hlist_add_after(prev, &pol->byprefix);
+	else
+		hlist_add_head(&pol->byprefix, chain);
+}
+
+static void xfrm_prefix_link(struct net *net, struct xfrm_policy *pol, int dir)
+{
+	struct xfrm_policy_prefix *pp = net->xfrm.policy_byprefix[dir];
+	int f = xfrm_prefix_family(pol->family);
+	u8 plen;
+
+	/* Other families never match a flow */
+	if (f < 0)
+		return;
+
+	plen = xfrm_prefix_len(pol, f);
+	__xfrm_prefix_link(pp->table, pp->hmask, pol, f);
+	if (!pp->users[f][plen]++)
+		__set_bit(plen, pp->plens[f]);
+	pp->count++;
+}
+
+static void xfrm_prefix_unlink(struct net *net, struct xfrm_policy *pol,
+			       int dir)
+{
+	struct xfrm_policy_prefix *pp = net->xfrm.policy_byprefix[dir];
+	int f = xfrm_prefix_family(pol->family);
+	u8 plen = xfrm_prefix_len(pol, f);
+
+	hlist_del_init(&pol->byprefix);
+	if (!--pp->users[f][plen])
+		__clear_bit(plen, pp->plens[f]);
+	pp->count--;
+}
+
 static void xfrm_dst_hash_transfer(struct hlist_head *list,
 				   struct hlist_head *ndsttable,
 				   unsigned int nhashmask)
@@ -460,6 +554,37 @@ static void xfrm_byidx_resize(struct net *net, int total)
 	xfrm_hash_free(oidx, (hmask + 1) * sizeof(struct hlist_head));
 }
 
+static void xfrm_byprefix_resize(struct net *net, int dir)
+{
+	struct xfrm_policy_prefix *pp = net->xfrm.policy_byprefix[dir];
+	unsigned int hmask = pp->hmask;
+	unsigned int nhashmask = xfrm_new_hash_mask(hmask);
+	unsigned int nsize = (nhashmask + 1) * sizeof(struct hlist_head);
+	struct hlist_head *opref = pp->table;
+	struct hlist_head *npref = xfrm_hash_alloc(nsize);
+	struct hlist_node *entry, *tmp;
+	struct xfrm_policy *pol;
+	int i;
+
+	if (!npref)
+		return;
+
+	write_lock_bh(&xfrm_policy_lock);
+
+	for (i = hmask; i >= 0; i--) {
+		hlist_for_each_entry_safe(pol, entry, tmp, opref + i, byprefix)
+			__xfrm_prefix_link(npref, nhashmask, pol,
+					   xfrm_prefix_family(pol->family));
+	}
+
+	pp->table = npref;
+	pp->hmask = nhashmask;
+
+	write_unlock_bh(&xfrm_policy_lock);
+
+	xfrm_hash_free(opref, (hmask + 1) * sizeof(struct hlist_head));
+}
+
 static inline int xfrm_bydst_should_resize(struct net *net, int dir, int *total)
 {
 	unsigned int cnt = net->xfrm.policy_count[dir];
@@ -486,6 +611,17 @@ static inline int xfrm_byidx_should_resize(struct net *net, int total)
 	return 0;
 }
 
+static inline int xfrm_byprefix_should_resize(struct net *net, int dir)
+{
+	struct xfrm_policy_prefix *pp = net->xfrm.policy_byprefix[dir];
+
+	if ((pp->hmask + 1) < xfrm_policy_hashmax &&
+	    pp->count > pp->hmask)
+		return 1;
+
+	return 0;
+}
+
 void xfrm_spd_getinfo(struct net *net, struct xfrmk_spdinfo *si)
 {
 	read_lock_bh(&xfrm_policy_lock);
@@ -513,6 +649,9 @@ static void xfrm_hash_resize(struct work_struct *work)
 	for (dir = 0; dir < XFRM_POLICY_MAX * 2; dir++) {
 		if (xfrm_bydst_should_resize(net, dir, &total))
 			xfrm_bydst_resize(net, dir);
+		if (dir < XFRM_POLICY_MAX &&
+		    xfrm_byprefix_should_resize(net, dir))
+			xfrm_byprefix_resize(net, dir);
 	}
 	if (xfrm_byidx_should_resize(net, total))
 		xfrm_byidx_resize(net, total);
@@ -604,8 +743,16 @@ int xfrm_policy_insert(int dir, struct xfrm_policy *policy, int excl)
 		hlist_add_head(&policy->bydst, chain);
 	xfrm_pol_hold(policy);
 	net->xfrm.policy_count[dir]++;
-	atomic_inc(&flow_cache_genid);
-	if (delpol)
+	if (chain == &net->xfrm.policy_inexact[dir]) {
+		/* A replacement keeps its place among equal priorities */
+		if (delpol && delpol->priority == policy->priority)
+			policy->pos = delpol->pos;
+		else
+			policy->pos = ++net->xfrm.policy_byprefix[dir]->pos;
+		if (delpol)
+			__xfrm_policy_unlink(delpol, dir);
+		xfrm_prefix_link(net, policy, dir);
+	} else if (delpol)
 		__xfrm_policy_unlink(delpol, dir);
 	policy->index = delpol ? delpol->index : xfrm_gen_index(net, dir);
 	hlist_add_head(&policy->byidx, net->xfrm.policy_byidx+idx_hash(net, policy->index));
@@ -618,9 +765,12 @@ int xfrm_policy_insert(int dir, struct xfrm_policy *policy, int excl)
 
 	if (delpol)
 		xfrm_policy_kill(delpol);
-	else if (xfrm_bydst_should_resize(net, dir, NULL))
+	else if (xfrm_bydst_should_resize(net, dir, NULL) ||
+		 xfrm_byprefix_should_resize(net, dir))
 		schedule_work(&net->xfrm.policy_hash_work);
 
+	xfrm_policy_flush_flows(policy, dir);
+
 	return 0;
 }
 EXPORT_SYMBOL(xfrm_policy_insert);
@@ -912,6 +1062,48 @@ static int xfrm_policy_match(struct xfrm_policy *pol, struct flowi *fl,
 	return ret;
 }
 
+/*
+ * Find the first policy on the policy_inexact list that applies to this
+ * flow and beats @priority, probing the destination prefix hash once per
+ * prefix length in use.  Called with xfrm_policy_lock held.
+ */
+static struct xfrm_policy *
+xfrm_policy_lookup_inexact(struct net *net, struct flowi *fl, u8 type,
+			   u16 family, u8 dir, xfrm_address_t *daddr,
+			   u32 priority)
+{
+	struct xfrm_policy_prefix *pp = net->xfrm.policy_byprefix[dir];
+	struct xfrm_policy *pol, *best = NULL;
+	struct hlist_node *entry;
+	struct hlist_head *chain;
+	unsigned int plen;
+	int f, err, best_err = 0;
+
+	f = xfrm_prefix_family(family);
+	if (f < 0)
+		return NULL;
+
+	for_each_set_bit(plen, pp->plens[f], xfrm_prefix_max[f] + 1) {
+		chain = pp->table + __pref_hash(daddr, plen, family, pp->hmask);
+		hlist_for_each_entry(pol, entry, chain, byprefix) {
+			if (pol->priority >= priority ||
+			    (best && !xfrm_prefix_before(pol, best)))
+				break;
+			if (xfrm_prefix_len(pol, f) != plen)
+				continue;
+			err = xfrm_policy_match(pol, fl, type, family, dir);
+			if (err == -ESRCH)
+				continue;
+			best = pol;
+			best_err = err;
+			break;
+		}
+	}
+	if (best_err)
+		return ERR_PTR(best_err);
+	return best;
+}
+
 static struct xfrm_policy *xfrm_policy_lookup_bytype(struct net *net, u8 type,
 						     struct flowi *fl,
 						     u16 family, u8 dir)
@@ -946,22 +1138,11 @@ static struct xfrm_policy *xfrm_policy_lookup_bytype(struct net *net, u8 type,
 			break;
 		}
 	}
-	chain = &net->xfrm.policy_inexact[dir];
-	hlist_for_each_entry(pol, entry, chain, bydst) {
-		err = xfrm_policy_match(pol, fl, type, family, dir);
-		if (err) {
-			if (err == -ESRCH)
-				continue;
-			else {
-				ret = ERR_PTR(err);
-				goto fail;
-			}
-		} else if (pol->priority < priority) {
-			ret = pol;
-			break;
-		}
-	}
-	if (ret)
+	pol = xfrm_policy_lookup_inexact(net, fl, type, family, dir, daddr,
+					 priority);
+	if (pol)
+		ret = pol;
+	if (!IS_ERR_OR_NULL(ret))
 		xfrm_pol_hold(ret);
 fail:
 	read_unlock_bh(&xfrm_policy_lock);
@@ -1019,6 +1200,43 @@ static inline int policy_to_flow_dir(int dir)
 	}
 }
 
+struct xfrm_policy_flows {
+	struct xfrm_selector	selector;
+	struct xfrm_mark	mark;
+	u16			family;
+	u8			dir;
+};
+
+static int xfrm_policy_flow_match(struct flowi *fl, u16 family, u8 dir,
+				  void *arg)
+{
+	struct xfrm_policy_flows *flows = arg;
+
+	return dir == flows->dir &&
+	       family == flows->family &&
+	       (fl->mark & flows->mark.m) == flows->mark.v &&
+	       xfrm_selector_match(&flows->selector, fl, family);
+}
+
+/*
+ * A new policy can only change the outcome for the flows its selector
+ * matches; drop those from the flow cache instead of bumping
+ * flow_cache_genid, which would throw away every cached flow and bundle.
+ * Flows resolved to a policy that is deleted or replaced fail
+ * xfrm_policy_flo_check() or stale_bundle() on their own.
+ */
+static void xfrm_policy_flush_flows(struct xfrm_policy *pol, int dir)
+{
+	struct xfrm_policy_flows flows = {
+		.selector	= pol->selector,
+		.mark		= pol->mark,
+		.family		= pol->family,
+		.dir		= policy_to_flow_dir(dir),
+	};
+
+	flow_cache_invalidate(xfrm_policy_flow_match, &flows);
+}
+
 static struct xfrm_policy *xfrm_sk_policy_lookup(struct sock *sk, int dir, struct flowi *fl)
 {
 	struct xfrm_policy *pol;
@@ -1077,6 +1295,8 @@ static struct xfrm_policy *__xfrm_policy_unlink(struct xfrm_policy *pol,
 
 	hlist_del(&pol->bydst);
 	hlist_del(&pol->byidx);
+	if (!hlist_unhashed(&pol->byprefix))
+		xfrm_prefix_unlink(net, pol, dir);
 	list_del(&pol->walk.all);
 	net->xfrm.policy_count[dir]--;
 
@@ -2603,12 +2823,35 @@ static int __net_init xfrm_policy_init(struct net *net)
 		htab->hmask = hmask;
 	}
 
+	for (dir = 0; dir < XFRM_POLICY_MAX; dir++) {
+		struct xfrm_policy_prefix *pp;
+
+		pp = kzalloc(sizeof(*pp), GFP_KERNEL);
+		net->xfrm.policy_byprefix[dir] = pp;
+		if (!pp)
+			goto out_byprefix;
+		pp->table = xfrm_hash_alloc(sz);
+		if (!pp->table)
+			goto out_byprefix;
+		pp->hmask = hmask;
+	}
+
 	INIT_LIST_HEAD(&net->xfrm.policy_all);
 	INIT_WORK(&net->xfrm.policy_hash_work, xfrm_hash_resize);
 	if (net_eq(net, &init_net))
 		register_netdevice_notifier(&xfrm_dev_notifier);
 	return 0;
 
+out_byprefix:
+	for (; dir >= 0; dir--) {
+		struct xfrm_policy_prefix *pp = net->xfrm.policy_byprefix[dir];
+
+		if (pp) {
+			xfrm_hash_free(pp->table, sz);
+			kfree(pp);
+		}
+	}
+	dir = XFRM_POLICY_MAX * 2;
 out_bydst:
 	for (dir--; dir >= 0; dir--) {
 		struct xfrm_policy_hash *htab;
@@ -2652,6 +2895,15 @@ static void xfrm_policy_fini(struct net *net)
 		xfrm_hash_free(htab->table, sz);
 	}
 
+	for (dir = 0; dir < XFRM_POLICY_MAX; dir++) {
+		struct xfrm_policy_prefix *pp = net->xfrm.policy_byprefix[dir];
+
+		WARN_ON(pp->count);
+		xfrm_hash_free(pp->table,
+			       (pp->hmask + 1) * sizeof(struct hlist_head));
+		kfree(pp);
+	}
+
 	sz = (net->xfrm.policy_idx_hmask + 1) * sizeof(struct hlist_head);
 	WARN_ON(!hlist_empty(net->xfrm.policy_byidx));
 	xfrm_hash_free(net->xfrm.policy_byidx, sz);
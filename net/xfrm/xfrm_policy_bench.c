@@ -0,0 +1,218 @@
+/*
+ * xfrm policy lookup microbenchmark.
+ *
+ * Installs a number of outbound IPv4 policies with inexact selectors
+ * (10.x.y.0 with /24, /26 and /28 destination prefixes) in the initial
+ * namespace and times policy lookups through the flow cache, as done
+ * for every packet of a flow:
+ *
+ *	modprobe xfrm_policy_bench policies=5000 lookups=1000000
+ *
+ * "miss" lookups use a new flow every time and so always resolve the
+ * policy from the SPD, "hit" lookups cycle over a small set of flows
+ * that stay in the flow cache.  The hit lookups are then repeated after
+ * adding and deleting one unrelated policy, as a rekey would, to see how
+ * much of the cache survives the update.
+ *
+ * The policies carry a firewall mark of their own, so that traffic
+ * without that mark is not affected while they are installed.  Every
+ * lookup is checked against the policy it should find.  The results go
+ * to the kernel log and loading fails with -EAGAIN, or -EIO if a check
+ * failed, so the module can be loaded again with other parameters.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/in.h>
+#include <net/net_namespace.h>
+#include <net/xfrm.h>
+
+static unsigned int policies = 5000;
+module_param(policies, uint, 0);
+MODULE_PARM_DESC(policies, "Number of policies to install (at most 65536)");
+
+static unsigned int lookups = 1000000;
+module_param(lookups, uint, 0);
+MODULE_PARM_DESC(lookups, "Number of timed lookups per pass");
+
+static unsigned int flows = 1024;
+module_param(flows, uint, 0);
+MODULE_PARM_DESC(flows, "Number of different flows of the hit passes");
+
+static unsigned int mark = 0x7866726d;
+module_param(mark, uint, 0);
+MODULE_PARM_DESC(mark, "Firewall mark of the test policies and flows");
+
+/* Policy @i covers 10.(i >> 8).(i & 255).0 with a /24, /26 or /28 */
+static u8 bench_plen(unsigned int i)
+{
+	return 24 + 2 * (i % 3);
+}
+
+static __be32 bench_daddr(unsigned int i, u32 host)
+{
+	return htonl(0x0a000000 | (i << 8) |
+		     (host & ((1 << (32 - bench_plen(i))) - 1)));
+}
+
+static struct xfrm_policy *bench_policy(unsigned int i, __be32 daddr,
+					u8 plen)
+{
+	struct xfrm_policy *xp;
+	int err;
+
+	xp = xfrm_policy_alloc(&init_net, GFP_KERNEL);
+	if (!xp)
+		return ERR_PTR(-ENOMEM);
+
+	xp->selector.family = AF_INET;
+	xp->selector.daddr.a4 = daddr;
+	xp->selector.prefixlen_d = plen;
+	xp->selector.saddr.a4 = htonl(0xac100000);
+	xp->selector.prefixlen_s = 12;
+	xp->family = AF_INET;
+	xp->mark.v = mark;
+	xp->mark.m = ~0U;
+	xp->priority = i;
+	xp->type = XFRM_POLICY_TYPE_MAIN;
+	xp->action = XFRM_POLICY_ALLOW;
+
+	err = xfrm_policy_insert(XFRM_POLICY_OUT, xp, 1);
+	if (err) {
+		xp->walk.dead = 1;
+		xfrm_policy_destroy(xp);
+		return ERR_PTR(err);
+	}
+	return xp;
+}
+
+static void bench_remove(struct xfrm_policy *xp)
+{
+	xfrm_policy_delete(xp, XFRM_POLICY_OUT);
+	xfrm_pol_put(xp);
+}
+
+static void bench_flow(struct flowi *fl, unsigned int i, u32 seq)
+{
+	memset(fl, 0, sizeof(*fl));
+	fl->mark = mark;
+	fl->fl4_dst = bench_daddr(i, seq);
+	fl->fl4_src = htonl(0xac100000 | (seq & 0xfffff));
+	fl->proto = IPPROTO_UDP;
+	fl->fl_ip_sport = htons(1024 + (seq >> 20));
+	fl->fl_ip_dport = htons(4500);
+}
+
+/* Times one pass of lookups, flow k going to policy @target[k % @nflows] */
+static s64 bench_pass(struct xfrm_policy **xp, u16 *target,
+		      unsigned int nflows, u32 seq, unsigned int *errors)
+{
+	struct xfrm_policy *pol;
+	struct flowi fl;
+	unsigned int i, k;
+	ktime_t start;
+
+	start = ktime_get();
+	for (i = 0; i < lookups; i++) {
+		k = i % nflows;
+		bench_flow(&fl, target[k], seq + k);
+		pol = xfrm_policy_check_flow(&init_net, &fl, AF_INET,
+					     XFRM_POLICY_OUT);
+		if (pol != xp[target[k]])
+			(*errors)++;
+		if (pol)
+			xfrm_pol_put(pol);
+		if (!(i & 0xffff))
+			cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int __init xfrm_policy_bench_init(void)
+{
+	s64 miss_ns, hit_ns, update_ns, after_ns;
+	struct xfrm_policy **xp, *extra;
+	unsigned int i, errors = 0;
+	u16 *target;
+	ktime_t start;
+	int err = 0;
+
+	if (!policies || policies > 65536 || !lookups || !flows)
+		return -EINVAL;
+
+	xp = vmalloc(policies * sizeof(*xp));
+	target = vmalloc(lookups * sizeof(*target));
+	if (!xp || !target) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+	for (i = 0; i < lookups; i++)
+		target[i] = random32() % policies;
+
+	for (i = 0; i < policies; i++) {
+		xp[i] = bench_policy(i, bench_daddr(i, 0), bench_plen(i));
+		if (IS_ERR(xp[i])) {
+			err = PTR_ERR(xp[i]);
+			printk(KERN_ERR "xfrm_policy_bench: cannot add "
+			       "policy %u: %d\n", i, err);
+			goto out_remove;
+		}
+	}
+
+	/* every lookup a new flow */
+	miss_ns = bench_pass(xp, target, lookups, 0, &errors);
+
+	/* warm up, then cycle over the cached flows */
+	bench_pass(xp, target, min(flows, lookups), 1U << 31, &errors);
+	hit_ns = bench_pass(xp, target, min(flows, lookups), 1U << 31,
+			    &errors);
+
+	start = ktime_get();
+	extra = bench_policy(policies, htonl(0x0b000000), 24);
+	if (!IS_ERR(extra))
+		bench_remove(extra);
+	update_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	after_ns = bench_pass(xp, target, min(flows, lookups), 1U << 31,
+			      &errors);
+
+	printk(KERN_INFO "xfrm_policy_bench: %u policies, %u lookups per "
+	       "pass: miss %lld ns/lookup (%lld lookups/s), hit %lld "
+	       "ns/lookup over %u flows, policy update %lld ns, hit after "
+	       "update %lld ns/lookup, %u errors\n",
+	       policies, lookups, div_s64(miss_ns, lookups),
+	       div_s64((s64)lookups * NSEC_PER_SEC, max_t(s64, miss_ns, 1)),
+	       div_s64(hit_ns, lookups), min(flows, lookups), update_ns,
+	       div_s64(after_ns, lookups), errors);
+
+	/* nothing to keep loaded */
+	err = errors ? -EIO : -EAGAIN;
+out_remove:
+	while (i--)
+		bench_remove(xp[i]);
+out_free:
+	vfree(target);
+	vfree(xp);
+	return err;
+}
+
+/*
+ * If an init function is provided, an exit function must also be provided
+ * to allow module unload.
+ */
+static void __exit xfrm_policy_bench_exit(void) { }
+
+module_init(xfrm_policy_bench_init);
+module_exit(xfrm_policy_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("xfrm policy lookup benchmark");